@@ -0,0 +1,23 @@
+# Writes OUTPUT, a header defining COMPILER_BUILD_ID: a hash of every compiler core source listed in
+# SOURCE_LIST. Test results are only reused while it stays the same, so it covers the compiler and nothing
+# else. The header is left alone when the hash has not changed, so only a compiler change recompiles its user.
+#
+#   cmake -DSOURCE_LIST=<file, one path per line> -DOUTPUT=<header> -P compiler_build_id.cmake
+
+file(STRINGS "${SOURCE_LIST}" sources)
+set(hashes "")
+foreach(source IN LISTS sources)
+    file(SHA256 "${source}" hash)
+    string(APPEND hashes "${hash}")
+endforeach()
+string(SHA256 id "${hashes}")
+string(SUBSTRING "${id}" 0 16 id)
+
+set(content "#pragma once\n\n// Generated by cmake/compiler_build_id.cmake, do not edit.\n#define COMPILER_BUILD_ID \"${id}\"\n")
+set(previous "")
+if (EXISTS "${OUTPUT}")
+    file(READ "${OUTPUT}" previous)
+endif()
+if (NOT previous STREQUAL content)
+    file(WRITE "${OUTPUT}" "${content}")
+endif()
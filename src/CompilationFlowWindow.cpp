@@ -1,4 +1,5 @@
 #include <QSplitter>
+#include <QTimer>
 #include <QTextEdit>
 #include <QVBoxLayout>
 #include <QTreeWidget>
@@ -6,10 +7,27 @@
 #include <QPointF>
 #include <QGraphicsScene>
 #include <QGraphicsView>
-#include <QGraphicsRectItem>
-#include <QGraphicsTextItem>
+#include <QGraphicsObject>
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
 #include <QGraphicsSceneMouseEvent>
 #include <QDebug>
+#include <QAbstractTableModel>
+#include <QTableView>
+#include <QAbstractListModel>
+#include <QListView>
+#include <QHeaderView>
+#include <QTextBlock>
+#include <QSignalBlocker>
+#include <QTabWidget>
+#include <QComboBox>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "ast_layout.hpp"
+#include "cfg_layout.hpp"
 
 #include "CompilationFlowWindow.hpp"
 
@@ -19,6 +37,7 @@ public:
     AstScene(QObject *parent = nullptr)
         : QGraphicsScene(parent)
     {
+        setItemIndexMethod(QGraphicsScene::NoIndex); // one item draws the whole tree, see AstTreeItem
     }
 
     void centerViewOnItems(QGraphicsView *view)
@@ -95,9 +114,11 @@ protected:
         // Zoom direction
         double factor = (event->angleDelta().y() > 0) ? zoomInFactor : zoomOutFactor;
 
-        // Prevent too much zooming out
+        // Prevent too much zooming out, but always allow it far enough to see the whole scene
         double currentScale = transform().m11(); // uniform scale
-        if (currentScale < 0.1 && factor < 1.0)
+        QRectF rect = sceneRect();
+        double fitScale = std::min(viewport()->width() / std::max(rect.width(), 1.0), viewport()->height() / std::max(rect.height(), 1.0));
+        if (currentScale < std::min(0.1, fitScale) && factor < 1.0)
             return;
         if (currentScale > 10.0 && factor > 1.0)
             return;
@@ -106,167 +127,943 @@ protected:
     }
 };
 
-class AstNodeRect : public QObject, public QGraphicsRectItem
+static char const *const s_sampleSource =
+    "int counter = 0;\n"
+    "\n"
+    "int fib(int n)\n"
+    "{\n"
+    "    if (n < 2)\n"
+    "        return n;\n"
+    "    return fib(n - 1) + fib(n - 2);\n"
+    "}\n"
+    "\n"
+    "int main(void)\n"
+    "{\n"
+    "    for (int i = 0; i < 10; ++i)\n"
+    "        counter += fib(i);\n"
+    "    return counter;\n"
+    "}\n";
+
+/// Background of whatever corresponds to the selection, in the panes that show text.
+static QColor const s_highlight(255, 245, 160);
+
+QString astNodeLabel(compile_snapshot const &snapshot, u32 node)
+{
+    ast const &tree = snapshot.tree;
+    ast_kind kind = tree.kinds[node];
+    QString label = ast_kind_name(kind);
+
+    if (tree.types[node] != ast_type::none) {
+        label += ' ';
+        label += ast_type_name(tree.types[node]);
+    }
+
+    switch (kind) {
+        case ast_kind::function_decl:
+        case ast_kind::param_decl:
+        case ast_kind::var_decl:
+        case ast_kind::int_literal:
+        case ast_kind::char_literal:
+        case ast_kind::string_literal:
+        case ast_kind::identifier:
+        case ast_kind::call:
+        case ast_kind::unary:
+        case ast_kind::postfix:
+        case ast_kind::binary:
+        case ast_kind::assign: {
+            std::string_view spelling = snapshot.tokens.spelling(snapshot.text, tree.tokens[node]);
+            label += '\n';
+            label += QString::fromUtf8(spelling.data(), int(spelling.size()));
+            break;
+        }
+        default:
+            break;
+    }
+
+    return label;
+}
+
+/// Draws a whole AST as one item, from the `ast_layout` the worker computed along with it. Only what
+/// intersects the exposed rectangle is painted and subtrees too narrow to read at the current zoom are drawn
+/// as summary boxes (see `ast_layout_visible`), so a frame costs about the same for seven nodes as for
+/// hundreds of thousands.
+class AstTreeItem : public QGraphicsObject
 {
     Q_OBJECT
 
 public:
-    AstScene *parentScene = nullptr;
-    QString nodeName;
-
-    AstNodeRect(QString const &nodeName_, QRectF const &rect, AstScene *parentScene_)
-        : QGraphicsRectItem(rect), nodeName(nodeName_), parentScene(parentScene_)
+    AstTreeItem(std::shared_ptr<compile_snapshot const> snapshot_)
+        : snapshot(std::move(snapshot_))
     {
-        setBrush(QBrush(Qt::white));
-        setPen(QPen(Qt::black, 2));
-        setFlag(QGraphicsItem::ItemIsSelectable, true);
+        setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true); // fills in `exposedRect`
         setAcceptHoverEvents(true);
     }
 
+    /// Switches to the next version of the tree. If `next` was diffed against the current one the selection
+    /// follows its node, and the nodes the edit added are tinted until the next switch.
+    void setSnapshot(std::shared_ptr<compile_snapshot const> next)
+    {
+        prepareGeometryChange();
+        bool diffed = next->diff_base == snapshot->generation;
+        selected = diffed && selected != ast_null ? next->diff.new_of_old[selected] : ast_null;
+        snapshot = std::move(next);
+        update();
+    }
+
+    QRectF boundingRect() const override
+    {
+        ast_layout_rect b = snapshot->layout.bounds();
+        return QRectF(QPointF(b.x0, b.y0), QPointF(b.x1, b.y1));
+    }
+
+    QRectF rootRect() const
+    {
+        ast_layout const &layout = snapshot->layout;
+        return layout.root == ast_null ? QRectF() : toQRectF(layout.node_rect(layout.root));
+    }
+
+    QRectF nodeRect(u32 node) const
+    {
+        return toQRectF(snapshot->layout.node_rect(node));
+    }
+
+    QPointF nodeCenter(u32 node) const
+    {
+        return nodeRect(node).center();
+    }
+
+    u32 selectedNode() const
+    {
+        return selected;
+    }
+
+    void setSelectedNode(u32 node)
+    {
+        if (selected != ast_null) {
+            update(nodeRect(selected));
+        }
+        selected = node;
+        if (selected != ast_null) {
+            update(nodeRect(selected));
+        }
+    }
+
+    /// The selected node if it is in `viewRect`, otherwise the node drawn nearest its center, or `ast_null`.
+    /// What to keep in place on screen when the tree changes.
+    u32 anchorNode(QRectF const &viewRect, qreal scale)
+    {
+        ast_layout const &layout = snapshot->layout;
+        visible.clear();
+        ast_layout_visible(layout, { viewRect.left(), viewRect.top(), viewRect.right(), viewRect.bottom() }, scale, s_collapsePx, visible);
+        u32 anchor = ast_null;
+        qreal best = 0;
+        for (ast_layout_visible_node const &v : visible) {
+            QRectF r = toQRectF(layout.node_rect(v.node));
+            if (v.collapsed || !r.intersects(viewRect)) {
+                continue;
+            }
+            if (v.node == selected) {
+                return selected;
+            }
+            QPointF d = r.center() - viewRect.center();
+            qreal distance = d.x() * d.x() + d.y() * d.y();
+            if (anchor == ast_null || distance < best) {
+                anchor = v.node;
+                best = distance;
+            }
+        }
+        return anchor;
+    }
+
+    void paint(QPainter *painter, QStyleOptionGraphicsItem const *option, QWidget *widget) override
+    {
+        Q_UNUSED(widget);
+
+        ast_layout const &layout = snapshot->layout;
+        ast_diff const &diff = snapshot->diff;
+        bool diffed = snapshot->diff_base != 0;
+        qreal scale = option->levelOfDetailFromTransform(painter->worldTransform());
+        QRectF exposed = option->exposedRect;
+        visible.clear();
+        ast_layout_visible(layout, { exposed.left(), exposed.top(), exposed.right(), exposed.bottom() }, scale, s_collapsePx, visible);
+
+        // Zoomed out, hairlines stay visible where 2 unit wide lines would shrink away.
+        QPen pen(Qt::black, scale < 0.5 ? 1 : 2);
+        pen.setCosmetic(scale < 0.5);
+        painter->setPen(pen);
+        bool labels = ast_layout::node_width * scale >= s_labelPx;
+        qreal edgeGap = (ast_layout::row_height - ast_layout::node_height) / 2;
+
+        for (ast_layout_visible_node const &v : visible) {
+            u32 node = v.node;
+            QRectF r = toQRectF(layout.node_rect(node));
+            if (v.collapsed) {
+                r = toQRectF(v.box).adjusted(0, edgeGap, 0, 0);
+            }
+            if (layout.depth[node] > 0) {
+                painter->drawLine(QPointF(r.center().x(), r.top()), QPointF(r.center().x(), r.top() - edgeGap));
+            }
+
+            if (v.collapsed) {
+                painter->setBrush(Qt::lightGray);
+                painter->drawRect(r);
+                if (r.width() * scale >= s_labelPx) {
+                    painter->drawText(r, Qt::AlignCenter, QString("%1 nodes").arg(v.size));
+                }
+                continue;
+            }
+
+            u32 begin = layout.child_begin[node], end = layout.child_begin[node + 1];
+            if (begin != end) {
+                qreal edgeY = layout.edge_y(node);
+                qreal firstX = layout.x[layout.children[begin]] + ast_layout::node_width / 2;
+                qreal lastX = layout.x[layout.children[end - 1]] + ast_layout::node_width / 2;
+                painter->drawLine(QPointF(r.center().x(), r.bottom()), QPointF(r.center().x(), edgeY));
+                painter->drawLine(QPointF(firstX, edgeY), QPointF(lastX, edgeY));
+            }
+
+            if (!r.intersects(exposed)) {
+                continue;
+            }
+            bool added = diffed && diff.old_of_new[node] == ast_null;
+            painter->setBrush(node == selected ? QColor(Qt::yellow) : added ? QColor(190, 225, 255) : QColor(Qt::white));
+            painter->drawRect(r);
+            if (labels) {
+                painter->drawText(r, Qt::AlignCenter, astNodeLabel(*snapshot, node));
+            }
+        }
+    }
+
 signals:
-    void clicked(AstNodeRect *self);  // Emit pointer to self when clicked
+    void nodeClicked(quint32 node);
 
 protected:
-    QVariant itemChange(GraphicsItemChange change, QVariant const &value) override
+    void mousePressEvent(QGraphicsSceneMouseEvent *event) override
     {
-        if (change == QGraphicsItem::ItemSelectedHasChanged) {
-            if (this->isSelected()) {
-                setBrush(Qt::yellow); // selected color
+        u32 node = ast_layout_node_at(snapshot->layout, event->pos().x(), event->pos().y());
+        if (node == ast_null) {
+            event->ignore(); // lets the view drag the scene
+            return;
+        }
+        emit nodeClicked(node); // the window selects it, along with what corresponds to it in the other panes
+        event->accept();
+    }
+
+    void hoverMoveEvent(QGraphicsSceneHoverEvent *event) override
+    {
+        if (ast_layout_node_at(snapshot->layout, event->pos().x(), event->pos().y()) != ast_null) {
+            setCursor(Qt::PointingHandCursor);
+        } else {
+            unsetCursor();
+        }
+        QGraphicsObject::hoverMoveEvent(event);
+    }
+
+private:
+    static QRectF toQRectF(ast_layout_rect const &r)
+    {
+        return QRectF(QPointF(r.x0, r.y0), QPointF(r.x1, r.y1));
+    }
+
+    static constexpr qreal s_collapsePx = 8;    // narrower subtrees become summary boxes
+    static constexpr qreal s_labelPx = 60;      // narrower boxes go without text
+
+    std::shared_ptr<compile_snapshot const> snapshot; // the tree, its layout and what the labels are spelled from
+    u32 selected = ast_null;
+    std::vector<ast_layout_visible_node> visible; // reused by every paint
+};
+
+/// Draws the control-flow graph of one function from the `cfg_layout` the worker computed for it. Only the
+/// blocks and edge segments that intersect the exposed rectangle are painted (see `cfg_layout_visible`), and
+/// zoomed out, blocks go without their text.
+class CfgItem : public QGraphicsObject
+{
+    Q_OBJECT
+
+public:
+    CfgItem()
+    {
+        setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true); // fills in `exposedRect`
+        setAcceptHoverEvents(true);
+        font = QFont("Consolas");
+        font.setStyleHint(QFont::Monospace);
+        font.setPixelSize(int(cfg_layout::line_height) - 3);
+    }
+
+    std::shared_ptr<cfg_layout const> const &layout() const
+    {
+        return current;
+    }
+
+    void setLayout(std::shared_ptr<cfg_layout const> next)
+    {
+        prepareGeometryChange();
+        current = std::move(next);
+        marked.clear();
+        update();
+    }
+
+    /// Instructions to tint, sorted.
+    void setMarked(std::vector<u32> next)
+    {
+        marked = std::move(next);
+        update();
+    }
+
+    QRectF boundingRect() const override
+    {
+        return current == nullptr ? QRectF() : QRectF(0, 0, current->width, current->height);
+    }
+
+    QRectF blockRect(u32 block) const
+    {
+        return toQRectF(current->block_rect(block));
+    }
+
+    QRectF instRect(u32 inst) const
+    {
+        return toQRectF(current->inst_rect(inst));
+    }
+
+    void paint(QPainter *painter, QStyleOptionGraphicsItem const *option, QWidget *widget) override
+    {
+        Q_UNUSED(widget);
+        if (current == nullptr) {
+            return;
+        }
+
+        cfg_layout const &layout = *current;
+        qreal scale = option->levelOfDetailFromTransform(painter->worldTransform());
+        QRectF exposed = option->exposedRect;
+        blocks.clear();
+        segments.clear();
+        cfg_layout_visible(layout, { exposed.left(), exposed.top(), exposed.right(), exposed.bottom() }, blocks, segments);
+
+        // Zoomed out, hairlines stay visible where 2 unit wide lines would shrink away.
+        bool hairlines = scale < 0.5;
+        for (cfg_segment const &segment : segments) {
+            cfg_edge const &e = layout.edges[segment.edge];
+            QPen pen(edgeColor(e.kind), hairlines ? 1 : 2);
+            pen.setCosmetic(hairlines);
+            painter->setPen(pen);
+            QPointF p = toQPointF(layout.points[segment.point]), q = toQPointF(layout.points[segment.point + 1]);
+            painter->drawLine(p, q);
+
+            // Arrowheads where the edge goes into its target: the end of its line, or for an edge drawn
+            // against its direction (a loop's), the start.
+            bool self = e.from == e.to;
+            if (segment.point + 2 == e.end_point && (self || (!e.back && !e.joins))) {
+                drawArrowhead(painter, p, q);
+            } else if (segment.point == e.first_point && e.back && !self) {
+                drawArrowhead(painter, q, p);
+            }
+        }
+
+        QPen pen(Qt::black, hairlines ? 1 : 2);
+        pen.setCosmetic(hairlines);
+        painter->setPen(pen);
+        bool text = cfg_layout::line_height * scale >= s_textPx;
+        painter->setFont(font);
+        for (u32 b : blocks) {
+            QRectF r = blockRect(b);
+            painter->setBrush(text ? QColor(Qt::white) : QColor(Qt::lightGray));
+            painter->drawRect(r);
+            u32 first = layout.block_first_inst[b], end = layout.block_first_inst[b + 1];
+            auto mark = std::lower_bound(marked.begin(), marked.end(), first);
+            if (!text) {
+                if (mark != marked.end() && *mark < end) {
+                    painter->fillRect(r, s_highlight);
+                }
+                continue;
             }
-            else {
-                setBrush(Qt::white); // deselected color
+            qreal left = r.left() + cfg_layout::padding;
+            qreal baseline = r.top() + cfg_layout::padding + cfg_layout::line_height - 4;
+            painter->drawText(QPointF(left, baseline), QString("b%1").arg(b));
+            for (u32 inst = first; inst < end; ++inst) {
+                QRectF line = instRect(inst);
+                if (!line.intersects(exposed)) {
+                    continue;
+                }
+                for (; mark != marked.end() && *mark < inst; ++mark) {
+                }
+                if (mark != marked.end() && *mark == inst) {
+                    painter->fillRect(line.adjusted(1, 0, -1, 0), s_highlight);
+                }
+                painter->drawText(QPointF(left, line.bottom() - 4), QString::fromStdString(layout.lines[inst]));
             }
         }
-        return QGraphicsRectItem::itemChange(change, value);
     }
 
+signals:
+    void instructionClicked(quint32 inst);
+
+protected:
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override
     {
-        for (QGraphicsItem *item : parentScene->selectedItems()) {
-            if (item != this) {
-                item->setSelected(false);
-            }
+        u32 inst = current == nullptr ? u32(-1) : cfg_layout_inst_at(*current, event->pos().x(), event->pos().y());
+        if (inst == u32(-1)) {
+            event->ignore(); // lets the view drag the scene
+            return;
+        }
+        emit instructionClicked(inst); // the window selects the node it was lowered from
+        event->accept();
+    }
+
+    void hoverMoveEvent(QGraphicsSceneHoverEvent *event) override
+    {
+        if (current != nullptr && cfg_layout_inst_at(*current, event->pos().x(), event->pos().y()) != u32(-1)) {
+            setCursor(Qt::PointingHandCursor);
+        } else {
+            unsetCursor();
         }
-        setSelected(!isSelected());
-        event->accept(); // IMPORTANT: tells Qt we handled it
+        QGraphicsObject::hoverMoveEvent(event);
+    }
+
+private:
+    static QRectF toQRectF(cfg_layout_rect const &r)
+    {
+        return QRectF(QPointF(r.x0, r.y0), QPointF(r.x1, r.y1));
     }
 
-    void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override
+    static QPointF toQPointF(cfg_layout_point const &p)
     {
-        event->accept(); // IMPORTANT: prevents Qt from re-selecting the item
+        return QPointF(p.x, p.y);
     }
 
-    void hoverEnterEvent(QGraphicsSceneHoverEvent *event) override
+    static QColor edgeColor(cfg_edge_kind kind)
     {
-        setCursor(Qt::PointingHandCursor);
-        QGraphicsRectItem::hoverEnterEvent(event);
+        switch (kind) {
+            case cfg_edge_kind::taken:     return QColor(0, 140, 0);
+            case cfg_edge_kind::not_taken: return QColor(190, 0, 0);
+            default:                       return QColor(40, 70, 160);
+        }
     }
 
-    void hoverLeaveEvent(QGraphicsSceneHoverEvent *event) override
+    /// A filled arrowhead at `tip`, pointing away from `from`.
+    static void drawArrowhead(QPainter *painter, QPointF from, QPointF tip)
     {
-        unsetCursor();
-        QGraphicsRectItem::hoverLeaveEvent(event);
+        QPointF d = tip - from;
+        qreal length = std::sqrt(d.x() * d.x() + d.y() * d.y());
+        if (length == 0) {
+            return;
+        }
+        d /= length;
+        QPointF n(-d.y(), d.x());
+        QPointF points[3] = { tip, tip - d * 10 + n * 5, tip - d * 10 - n * 5 };
+        painter->setBrush(painter->pen().color());
+        painter->drawPolygon(points, 3);
     }
+
+    static constexpr qreal s_textPx = 6; // shorter lines go without text
+
+    std::shared_ptr<cfg_layout const> current;
+    std::vector<u32> marked;
+    QFont font;
+    std::vector<u32> blocks;            // reused by every paint
+    std::vector<cfg_segment> segments;
 };
 
-AstNodeRect *createNode(AstScene *scene, QString const &name, qreal x, qreal y, CompilationFlowWindow *window)
+/// Lists the tokens of a snapshot straight from its `token_buffer`. Views only ask for the rows they show, and
+/// with fixed row heights they never measure the others, so millions of tokens cost what a screenful does.
+class TokenTableModel : public QAbstractTableModel
 {
-    AstNodeRect *rect = new AstNodeRect(name, QRectF(0, 0, 120, 50), scene);
-    rect->setPos(x, y);
-    scene->addItem(rect);
+public:
+    using QAbstractTableModel::QAbstractTableModel;
 
-    QGraphicsTextItem *label = new QGraphicsTextItem(name, rect);
+    void setSnapshot(std::shared_ptr<compile_snapshot const> next)
+    {
+        beginResetModel();
+        snapshot = std::move(next);
+        highlightBegin = highlightEnd = 0;
+        endResetModel();
+    }
 
-    // Center text
-    QRectF r = rect->rect();
-    QRectF t = label->boundingRect();
-    label->setPos((r.width() - t.width()) / 2,
-                  (r.height() - t.height()) / 2);
+    /// Tints tokens [`begin`, `end`), the ones spanned by what is selected.
+    void setHighlight(u32 begin, u32 end)
+    {
+        std::swap(highlightBegin, begin);
+        std::swap(highlightEnd, end);
+        if (begin < end) {
+            emit dataChanged(index(int(begin), 0), index(int(end - 1), s_columns - 1), { Qt::BackgroundRole });
+        }
+        if (highlightBegin < highlightEnd) {
+            emit dataChanged(index(int(highlightBegin), 0), index(int(highlightEnd - 1), s_columns - 1), { Qt::BackgroundRole });
+        }
+    }
 
-    window->connect(rect, &AstNodeRect::clicked, window, [](AstNodeRect *rect){
-        qDebug() << "Node clicked:" << rect->nodeName;
-    });
+    int rowCount(QModelIndex const &parent = QModelIndex()) const override
+    {
+        return parent.isValid() || snapshot == nullptr ? 0 : int(snapshot->tokens.count);
+    }
 
-    return rect;
-}
+    int columnCount(QModelIndex const &parent = QModelIndex()) const override
+    {
+        return parent.isValid() ? 0 : s_columns;
+    }
 
-QPointF bottomCenter(QGraphicsRectItem *item) {
-    QRectF r = item->rect();
-    return item->mapToScene(r.center().x(), r.bottom());
-}
+    QVariant data(QModelIndex const &index, int role) const override
+    {
+        u32 token = u32(index.row());
+        if (role == Qt::BackgroundRole) {
+            return token >= highlightBegin && token < highlightEnd ? QVariant(s_highlight) : QVariant();
+        }
+        if (role != Qt::DisplayRole) {
+            return QVariant();
+        }
 
-QPointF topCenter(QGraphicsRectItem *item) {
-    QRectF r = item->rect();
-    return item->mapToScene(r.center().x(), r.top());
-}
+        token_buffer const &tokens = snapshot->tokens;
+        switch (index.column()) {
+            case 0:
+                return QString(token_kind_name(tokens.kinds[token]));
+            case 1: {
+                std::string_view spelling = tokens.spelling(snapshot->text, token);
+                return QString::fromUtf8(spelling.data(), int(spelling.size()));
+            }
+            default: {
+                u32 offset = tokens.offsets[token];
+                u32 line = source_index_line_of(snapshot->index, offset);
+                return QString("%1:%2").arg(line + 1).arg(offset - snapshot->index.line_starts[line] + 1);
+            }
+        }
+    }
+
+    QVariant headerData(int section, Qt::Orientation orientation, int role) const override
+    {
+        static char const *const names[s_columns] = { "Kind", "Spelling", "Line:Column" };
+        if (orientation != Qt::Horizontal || role != Qt::DisplayRole || section < 0 || section >= s_columns) {
+            return QVariant();
+        }
+        return QString(names[section]);
+    }
+
+private:
+    static int constexpr s_columns = 3;
+
+    std::shared_ptr<compile_snapshot const> snapshot;
+    u32 highlightBegin = 0;
+    u32 highlightEnd = 0;
+};
 
-void connectNodes(QGraphicsScene *scene, QGraphicsRectItem *parent, QGraphicsRectItem *child)
+/// Lists a snapshot's IR pane line by line: a header, then its errors, or its `ir_listing` cut at
+/// `ir_line_starts`. Like `TokenTableModel`, views only convert the lines they show, so a listing of any length
+/// costs nothing to swap in on the GUI thread.
+class IrListingModel : public QAbstractListModel
 {
-    QPointF p1 = bottomCenter(parent);
-    QPointF p2 = topCenter(child);
+public:
+    using QAbstractListModel::QAbstractListModel;
 
-    QGraphicsLineItem *line = scene->addLine(QLineF(p1, p2), QPen(Qt::black, 2));
-    Q_UNUSED(line);
-}
+    /// Shows `header` alone if `next` is null.
+    void setSnapshot(std::shared_ptr<compile_snapshot const> next, QString nextHeader)
+    {
+        beginResetModel();
+        snapshot = std::move(next);
+        header = std::move(nextHeader);
+        marked.clear();
+        endResetModel();
+    }
 
-CompilationFlowWindow::CompilationFlowWindow(QWidget *parent, QString const &title)
-    : QWidget(nullptr)
+    /// Tints `lines`, sorted.
+    void setMarks(std::vector<u32> lines)
+    {
+        std::swap(marked, lines);
+        for (std::vector<u32> const *changed : { &lines, &marked }) {
+            if (!changed->empty()) {
+                emit dataChanged(index(int(changed->front())), index(int(changed->back())), { Qt::BackgroundRole });
+            }
+        }
+    }
+
+    int rowCount(QModelIndex const &parent = QModelIndex()) const override
+    {
+        if (parent.isValid()) {
+            return 0;
+        }
+        if (snapshot == nullptr) {
+            return 1;
+        }
+        return 1 + int(snapshot->errors.empty() ? snapshot->ir_line_starts.size() : snapshot->errors.size());
+    }
+
+    QVariant data(QModelIndex const &index, int role) const override
+    {
+        u32 line = u32(index.row());
+        if (role == Qt::BackgroundRole) {
+            return std::binary_search(marked.begin(), marked.end(), line) ? QVariant(s_highlight) : QVariant();
+        }
+        if (role != Qt::DisplayRole) {
+            return QVariant();
+        }
+        if (line == 0) {
+            return header;
+        }
+        if (!snapshot->errors.empty()) {
+            return QString::fromStdString(snapshot->errors[line - 1]);
+        }
+        std::vector<u32> const &starts = snapshot->ir_line_starts;
+        u32 begin = starts[line - 1];
+        u32 end = line < starts.size() ? starts[line] - 1 : u32(snapshot->ir_listing.size()); // without the '\n'
+        return QString::fromUtf8(snapshot->ir_listing.data() + begin, int(end - begin));
+    }
+
+private:
+    std::shared_ptr<compile_snapshot const> snapshot;
+    QString header;             // the first line, or the only one without a snapshot
+    std::vector<u32> marked;
+};
+
+CompilationFlowWindow::CompilationFlowWindow(QWidget *parent, QString const &title, QString const &sourcePath)
+    : QWidget(nullptr), sourcePath(sourcePath), worker([this](std::shared_ptr<compile_snapshot const> snapshot) {
+        // On the worker thread: hand the snapshot to the GUI thread, which owns every pane.
+        QMetaObject::invokeMethod(this, [this, snapshot] { showResults(snapshot); }, Qt::QueuedConnection);
+    })
 {
     Q_UNUSED(parent);
 
     setWindowTitle(title);
 
+    QString sourceText;
+    QString loadError;
+    if (sourcePath.isEmpty()) {
+        sourceText = s_sampleSource;
+    }
+    else {
+        compilation loaded;
+        if (compilation_load_file(loaded, sourcePath.toUtf8().constData())) {
+            sourceText = QString::fromStdString(loaded.source_text);
+        } else {
+            loadError = "Cannot read " + sourcePath;
+        }
+    }
+
     QSplitter *splitter = new QSplitter(Qt::Horizontal, this);
 
-    AstScene *scene = new AstScene(this);
-    {
-        // Example binary tree layout
-        // Level spacing
-        const int levelY = 100;
-        const int hSpacing = 150;
+    astScene = new AstScene(this);
+    astView = new ZoomableGraphicsView(astScene);
+    astView->setWindowTitle("AST");
 
-        // Root
-        AstNodeRect *root = createNode(scene, "Root", 400, 0, this);
+    QFont mono("Consolas");
+    mono.setStyleHint(QFont::Monospace);
 
-        // Level 1
-        AstNodeRect *left1 = createNode(scene, "Left1", root->x() - hSpacing, root->y() + levelY, this);
-        AstNodeRect *right1 = createNode(scene, "Right1", root->x() + hSpacing, root->y() + levelY, this);
+    // Create 4 widgets to act as panes
+    sourcePane = new QTextEdit();
+    sourcePane->setPlainText(sourceText);
+    sourcePane->setAcceptRichText(false);
+    tokensModel = new TokenTableModel(this);
+    tokensPane = new QTableView();
+    tokensPane->setModel(tokensModel);
+    tokensPane->setSelectionMode(QAbstractItemView::NoSelection);
+    tokensPane->setWordWrap(false);
+    tokensPane->verticalHeader()->hide();
+    tokensPane->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    tokensPane->verticalHeader()->setDefaultSectionSize(QFontMetrics(mono).height() + 4);
+    tokensPane->horizontalHeader()->setStretchLastSection(true);
+    irModel = new IrListingModel(this);
+    irModel->setSnapshot(nullptr, loadError.isEmpty() ? QString("Compiling...") : loadError);
+    irPane = new QListView();
+    irPane->setModel(irModel);
+    irPane->setSelectionMode(QAbstractItemView::NoSelection);
+    irPane->setUniformItemSizes(true); // the view measures one line, not all of them
+    irPane->setWordWrap(false);
 
-        connectNodes(scene, root, left1);
-        connectNodes(scene, root, right1);
+    sourcePane->setFont(mono);
+    tokensPane->setFont(mono);
+    irPane->setFont(mono);
 
-        // Level 2
-        AstNodeRect *left2 = createNode(scene, "Left2", left1->x() - hSpacing/2, left1->y() + levelY, this);
-        AstNodeRect *right2 = createNode(scene, "Right2", left1->x() + hSpacing/2, left1->y() + levelY, this);
+    // Pane 4 also has the control-flow graph of one function at a time.
+    cfgFunctions = new QComboBox();
+    cfgScene = new QGraphicsScene(this);
+    cfgScene->setItemIndexMethod(QGraphicsScene::NoIndex); // one item draws the whole graph, see CfgItem
+    cfgView = new ZoomableGraphicsView(cfgScene);
+    cfgItem = new CfgItem();
+    cfgScene->addItem(cfgItem);
+    QWidget *cfgPane = new QWidget();
+    QVBoxLayout *cfgLayout = new QVBoxLayout(cfgPane);
+    cfgLayout->setContentsMargins(0, 0, 0, 0);
+    cfgLayout->addWidget(cfgFunctions);
+    cfgLayout->addWidget(cfgView);
+    QTabWidget *irTabs = new QTabWidget();
+    irTabs->addTab(irPane, "Listing");
+    irTabs->addTab(cfgPane, "Control Flow");
 
-        AstNodeRect *left3 = createNode(scene, "Left3", right1->x() - hSpacing/2, right1->y() + levelY, this);
-        AstNodeRect *right3 = createNode(scene, "Right3", right1->x() + hSpacing/2, right1->y() + levelY, this);
+    astView->show();
 
-        connectNodes(scene, left1, left2);
-        connectNodes(scene, left1, right2);
-        connectNodes(scene, right1, left3);
-        connectNodes(scene, right1, right3);
-    }
-    ZoomableGraphicsView *view = new ZoomableGraphicsView(scene);
-    view->setWindowTitle("AST Tree Example");
-    scene->centerViewOnItems(view);
-    view->show();
+    // Every keystroke restarts the timer, the worker only sees the text once typing pauses.
+    debounce = new QTimer(this);
+    debounce->setSingleShot(true);
+    debounce->setInterval(s_debounceMs);
+    connect(debounce, &QTimer::timeout, this, &CompilationFlowWindow::submitSource);
+    // Connected after the initial text is in, every later change is an edit.
+    connect(sourcePane, &QTextEdit::textChanged, debounce, QOverload<>::of(&QTimer::start));
 
-    // Create 4 widgets to act as panes
-    QWidget *pane1 = new QTextEdit("Pane 1");
-    QWidget *pane2 = new QTextEdit("Pane 2");
-    // QWidget *pane3 = new QTextEdit("Pane 3");
-    QWidget *pane4 = new QTextEdit("Pane 4");
+    // Selecting in the source, token, or IR pane, or an instruction in the control-flow graph, selects the
+    // innermost node spanning it (the AST connects its item's clicks as it creates it).
+    connect(sourcePane, &QTextEdit::cursorPositionChanged, this, &CompilationFlowWindow::sourceCursorMoved);
+    connect(irPane, &QListView::clicked, this, [this](QModelIndex const &index) { irLineClicked(index.row()); });
+    connect(tokensPane, &QTableView::clicked, this, [this](QModelIndex const &index) {
+        if (shown != nullptr) {
+            u32 token = u32(index.row());
+            selectNode(source_index_node_spanning(shown->index, token, token), tokensPane, true);
+        }
+    });
+    connect(cfgItem, &CfgItem::instructionClicked, this, [this](quint32 inst) {
+        int function = cfgFunctions->currentIndex();
+        if (shown != nullptr && function >= 0 && u32(function) + 1 < shown->index.function_first_inst.size()) {
+            selectNode(shown->index.inst_node[shown->index.function_first_inst[function] + inst], cfgView, true);
+        }
+    });
+    connect(cfgFunctions, QOverload<int>::of(&QComboBox::currentIndexChanged), this, [this](int function) {
+        cfgFunction = cfgFunctions->itemText(function);
+        showCfg(function);
+        markCfg(false);
+    });
 
     // Add panes to splitter
-    splitter->addWidget(pane1);
-    splitter->addWidget(pane2);
-    splitter->addWidget(view);
-    splitter->addWidget(pane4);
+    splitter->addWidget(sourcePane);
+    splitter->addWidget(tokensPane);
+    splitter->addWidget(astView);
+    splitter->addWidget(irTabs);
 
     // Set splitter as central widget
     QVBoxLayout *layout = new QVBoxLayout(this);
     layout->addWidget(splitter);
+
+    if (loadError.isEmpty()) {
+        submitSource();
+    }
+}
+
+void CompilationFlowWindow::submitSource()
+{
+    // QTextDocument counts positions in UTF-16 code units, let `incremental_update` find the changed bytes.
+    QByteArray source = sourcePane->toPlainText().toUtf8();
+    submittedRevision = sourcePane->document()->revision();
+    worker.submit(sourcePath.toStdString(), std::string(source.constData(), u64(source.size())), ++submitted);
+}
+
+void CompilationFlowWindow::showResults(std::shared_ptr<compile_snapshot const> snapshot)
+{
+    // Results arrive in the order they were submitted, but one queued before a newer one was shown is stale.
+    if (shown != nullptr && snapshot->generation <= shown->generation) {
+        return;
+    }
+    u64 shownBefore = shown != nullptr ? shown->generation : 0;
+    shown = std::move(snapshot);
+    compile_snapshot const &s = *shown;
+
+    // Pane 4: what the front end reused and what the worker took overall, then diagnostics if compilation
+    // failed, otherwise what each optimization pass did, the IR, where native code would keep its registers
+    // and what running it printed (the worker formatted all but this line and found where its lines start).
+    QString irHeader = QString::fromStdString(make_str(
+        "--- %s, AST %llu unchanged/%llu changed/%llu new nodes, layout %lld us (%llu nodes reused), index %lld us, "
+        "CFGs %lld us (%llu of %zu reused), %lld us in total ---",
+        incremental_stats_to_string(s.front_end).c_str(), (unsigned long long)s.diff.unchanged_nodes,
+        (unsigned long long)s.diff.changed_nodes, (unsigned long long)s.diff.new_nodes, (long long)s.layout_us,
+        (unsigned long long)s.layout_reused, (long long)s.index_us, (long long)s.cfg_us,
+        (unsigned long long)s.cfgs_reused, s.cfgs.size(), (long long)s.elapsed_us));
+
+    // All panes switch to the new version in the same repaint.
+    setUpdatesEnabled(false);
+    astView->setUpdatesEnabled(false);
+    if (astTree == nullptr) {
+        astTree = new AstTreeItem(shown);
+        astScene->addItem(astTree);
+        astScene->setSceneRect(astTree->boundingRect().adjusted(-50, -50, 50, 50));
+        connect(astTree, &AstTreeItem::nodeClicked, this, [this](quint32 node) {
+            qDebug() << "Node clicked:" << astNodeLabel(*shown, node);
+            selectNode(node == selection.node ? ast_null : node, astView, true);
+        });
+        astScene->centerViewOnItems(astView);
+        astView->ensureVisible(astTree->rootRect()); // trees wider than the view start at the top
+    } else {
+        // Keep the zoom, and keep the node in sight where it was on screen, if the edit left it in the tree.
+        QRectF viewRect = astView->mapToScene(astView->viewport()->rect()).boundingRect();
+        u32 anchor = astTree->anchorNode(viewRect, astView->transform().m11());
+        QPointF offset = anchor == ast_null ? QPointF() : viewRect.center() - astTree->nodeCenter(anchor);
+        astTree->setSnapshot(shown);
+        astScene->setSceneRect(astTree->boundingRect().adjusted(-50, -50, 50, 50));
+        if (anchor != ast_null && s.diff_base == shownBefore) {
+            u32 moved = s.diff.new_of_old[anchor];
+            if (moved != ast_null) {
+                astView->centerOn(astTree->nodeCenter(moved) + offset);
+            }
+        }
+    }
+    tokensModel->setSnapshot(shown);
+    irModel->setSnapshot(shown, irHeader);
+    if (s.errors.empty()) {
+        // The function picked last if this version has it, otherwise `main`, otherwise the first. After a failed
+        // compile the graph stays as it was.
+        QSignalBlocker blocker(cfgFunctions);
+        cfgFunctions->clear();
+        for (std::shared_ptr<cfg_layout const> const &layout : s.cfgs) {
+            cfgFunctions->addItem(QString::fromStdString(layout->name));
+        }
+        int function = cfgFunctions->findText(cfgFunction);
+        if (function < 0) {
+            function = std::max(cfgFunctions->findText("main"), 0);
+        }
+        cfgFunctions->setCurrentIndex(function);
+        showCfg(function);
+    }
+    // The AST kept its selection through the diff, the other panes follow it without scrolling.
+    selectNode(astTree->selectedNode(), nullptr, false);
+    astView->setUpdatesEnabled(true);
+    setUpdatesEnabled(true);
+}
+
+bool CompilationFlowWindow::sourceIsShown() const
+{
+    return shown != nullptr && shown->direct && shown->generation == submitted
+        && sourcePane->document()->revision() == submittedRevision;
+}
+
+u32 CompilationFlowWindow::sourceOffset(int position) const
+{
+    source_index const &index = shown->index;
+    QTextBlock block = sourcePane->document()->findBlock(position);
+    u32 line = u32(std::max(block.blockNumber(), 0));
+    if (line >= index.line_starts.size()) {
+        return u32(shown->text.size());
+    }
+    return index.line_starts[line] + u32(block.text().left(position - block.position()).toUtf8().size());
+}
+
+int CompilationFlowWindow::sourcePosition(u32 offset) const
+{
+    source_index const &index = shown->index;
+    u32 line = source_index_line_of(index, offset);
+    QTextBlock block = sourcePane->document()->findBlockByNumber(int(line));
+    char const *lineStart = shown->text.data() + index.line_starts[line];
+    return block.position() + QString::fromUtf8(lineStart, int(offset - index.line_starts[line])).size();
+}
+
+int CompilationFlowWindow::irLine(u32 inst) const
+{
+    source_index const &index = shown->index;
+    u32 function = source_index_function_of(index, inst);
+    return 1 + int(shown->ir_function_lines[function] + inst - index.function_first_inst[function]); // after the header
+}
+
+void CompilationFlowWindow::sourceCursorMoved()
+{
+    if (!sourceIsShown()) {
+        return; // edited since, the offsets would be off
+    }
+    QTextCursor cursor = sourcePane->textCursor();
+    u32 first = source_index_token_at(shown->tokens, sourceOffset(cursor.selectionStart()));
+    u32 last = first;
+    if (cursor.hasSelection()) {
+        last = source_index_token_at(shown->tokens, std::max(sourceOffset(cursor.selectionEnd()), u32(1)) - 1);
+    }
+    selectNode(source_index_node_spanning(shown->index, first, std::max(first, last)), sourcePane, true);
+}
+
+void CompilationFlowWindow::irLineClicked(int row)
+{
+    if (shown == nullptr || !shown->errors.empty()) {
+        return;
+    }
+    source_index const &index = shown->index;
+    std::vector<u32> const &lines = shown->ir_function_lines;
+    u32 line = u32(std::max(row - 1, 0)); // after the header
+    auto after = std::upper_bound(lines.begin(), lines.end(), line);
+    if (after == lines.begin()) {
+        return;
+    }
+    u32 function = u32(after - lines.begin() - 1);
+    u32 inst = index.function_first_inst[function] + (line - lines[function]);
+    if (inst < index.function_first_inst[function + 1]) {
+        selectNode(index.inst_node[inst], irPane, true);
+    }
+}
+
+void CompilationFlowWindow::selectNode(u32 node, QWidget const *origin, bool reveal)
+{
+    compile_snapshot const &s = *shown;
+    source_index_select(s.index, s.tokens, node, selection);
+    bool scroll = reveal && node != ast_null;
+
+    tokensModel->setHighlight(selection.first_token, selection.end_token);
+    if (scroll && origin != tokensPane) {
+        tokensPane->scrollTo(tokensModel->index(int(selection.first_token), 0), QAbstractItemView::PositionAtTop);
+    }
+
+    astTree->setSelectedNode(node);
+    if (scroll && origin != astView) {
+        astView->ensureVisible(astTree->nodeRect(node));
+    }
+
+    QList<QTextEdit::ExtraSelection> sourceMarks;
+    if (node != ast_null && sourceIsShown()) {
+        QTextEdit::ExtraSelection mark;
+        mark.format.setBackground(s_highlight);
+        mark.cursor = QTextCursor(sourcePane->document());
+        mark.cursor.setPosition(sourcePosition(selection.begin));
+        mark.cursor.setPosition(sourcePosition(selection.end), QTextCursor::KeepAnchor);
+        sourceMarks.append(mark);
+        if (scroll && origin != sourcePane) {
+            QSignalBlocker blocker(sourcePane);
+            QTextCursor cursor = sourcePane->textCursor();
+            cursor.setPosition(mark.cursor.selectionStart());
+            sourcePane->setTextCursor(cursor);
+            sourcePane->ensureCursorVisible();
+        }
+    }
+    sourcePane->setExtraSelections(sourceMarks);
+
+    // One mark per instruction, so a selection covering a whole program marks only its first ones.
+    std::vector<u32> irMarks;
+    u32 end = std::min(selection.end_inst, selection.first_inst + s_maxMarkedInstructions);
+    for (u32 k = selection.first_inst; k < end; ++k) {
+        irMarks.push_back(u32(irLine(s.index.node_insts[k])));
+    }
+    std::sort(irMarks.begin(), irMarks.end());
+    if (scroll && origin != irPane && !irMarks.empty()) {
+        irPane->scrollTo(irModel->index(int(irMarks.front())), QAbstractItemView::EnsureVisible);
+    }
+    irModel->setMarks(std::move(irMarks));
+
+    markCfg(scroll && origin != cfgView);
+}
+
+void CompilationFlowWindow::showCfg(int function)
+{
+    std::shared_ptr<cfg_layout const> layout;
+    if (shown != nullptr && function >= 0 && u32(function) < shown->cfgs.size()) {
+        layout = shown->cfgs[u32(function)];
+    }
+    if (layout == cfgItem->layout()) {
+        return; // the function did not change, its layout was reused
+    }
+    bool sameFunction = layout != nullptr && cfgItem->layout() != nullptr && layout->name == cfgItem->layout()->name;
+    cfgItem->setLayout(layout);
+    cfgScene->setSceneRect(cfgItem->boundingRect().adjusted(-50, -50, 50, 50));
+    if (!sameFunction && layout != nullptr && layout->block_count() > 0) {
+        cfgView->centerOn(cfgItem->blockRect(0).center());
+        cfgView->ensureVisible(cfgItem->blockRect(0)); // graphs taller than the view start at the top
+    }
+}
+
+void CompilationFlowWindow::markCfg(bool reveal)
+{
+    std::vector<u32> marked;
+    source_index const &index = shown->index;
+    int function = cfgFunctions->currentIndex();
+    if (function >= 0 && u32(function) + 1 < index.function_first_inst.size()) {
+        u32 first = index.function_first_inst[u32(function)], end = index.function_first_inst[u32(function) + 1];
+        u32 last = std::min(selection.end_inst, selection.first_inst + s_maxMarkedInstructions);
+        for (u32 k = selection.first_inst; k < last; ++k) {
+            u32 inst = index.node_insts[k];
+            if (inst >= first && inst < end) {
+                marked.push_back(inst - first);
+            }
+        }
+        std::sort(marked.begin(), marked.end());
+    }
+    if (reveal && !marked.empty()) {
+        cfgView->ensureVisible(cfgItem->instRect(marked.front()));
+    }
+    cfgItem->setMarked(std::move(marked));
 }
 
 #include <CompilationFlowWindow.moc>
@@ -2,10 +2,88 @@
 
 #include <QWidget>
 
+#include <memory>
+
+#include "compile_worker.hpp"
+
+class QTextEdit;
+class QTableView;
+class QListView;
+class QTimer;
+class QGraphicsView;
+class QGraphicsScene;
+class QComboBox;
+class AstScene;
+class AstTreeItem;
+class CfgItem;
+class TokenTableModel;
+class IrListingModel;
+
 class CompilationFlowWindow : public QWidget
 {
     Q_OBJECT
 
 public:
-    explicit CompilationFlowWindow(QWidget *parent = nullptr, QString const &title = "Compilation Flow");
+    /// Compiles `sourcePath` (or a built-in sample program when empty) and shows each phase in its own pane.
+    explicit CompilationFlowWindow(QWidget *parent = nullptr, QString const &title = "Compilation Flow", QString const &sourcePath = QString());
+
+private:
+    /// Hands the source pane's text to the worker, once edits have paused for `s_debounceMs`.
+    void submitSource();
+
+    /// Swaps every pane over to `snapshot` in one go, unless something newer is already shown.
+    void showResults(std::shared_ptr<compile_snapshot const> snapshot);
+
+    /// Selects `node` (none if `ast_null`) in the AST and marks what corresponds to it in the other panes:
+    /// its tokens, its text in the source and the instructions lowered from it. If `reveal`, the panes other
+    /// than `origin`, the one it was picked in, scroll to it.
+    void selectNode(u32 node, QWidget const *origin, bool reveal);
+
+    void sourceCursorMoved();
+    void irLineClicked(int row);
+
+    /// Shows the control-flow graph of `function` (an index into `shown->cfgs`, none if out of range). The view
+    /// stays where it is if it is the same function as before, otherwise it goes to the entry block.
+    void showCfg(int function);
+
+    /// Marks the instructions of the selection that are in the function the control-flow graph shows, and if
+    /// `reveal`, scrolls to the first of them.
+    void markCfg(bool reveal);
+
+    /// Whether the source pane holds the text `shown` was compiled from, so offsets into one are offsets into
+    /// the other. Not after an edit, until its results are in, nor if the source needed the preprocessor.
+    bool sourceIsShown() const;
+
+    /// Byte offset into `shown->text` of a source pane position, which counts UTF-16 code units, and back.
+    u32 sourceOffset(int position) const;
+    int sourcePosition(u32 offset) const;
+
+    /// IR pane row of instruction `inst`, see `source_index::inst_node`.
+    int irLine(u32 inst) const;
+
+    static int constexpr s_debounceMs = 150;
+    static u32 constexpr s_maxMarkedInstructions = 10000;
+
+    QString sourcePath;
+    QTextEdit *sourcePane = nullptr;
+    QTableView *tokensPane = nullptr;
+    TokenTableModel *tokensModel = nullptr;
+    QListView *irPane = nullptr;
+    IrListingModel *irModel = nullptr;
+    QComboBox *cfgFunctions = nullptr; // in `shown->cfgs` order
+    QGraphicsScene *cfgScene = nullptr;
+    QGraphicsView *cfgView = nullptr;
+    CfgItem *cfgItem = nullptr;
+    QString cfgFunction; // the name last picked, shown again whenever a version has it
+    AstScene *astScene = nullptr;
+    QGraphicsView *astView = nullptr;
+    AstTreeItem *astTree = nullptr; // created with the first results, then switched to each next version
+    QTimer *debounce = nullptr;
+
+    u64 submitted = 0;  // generation of the last request
+    int submittedRevision = 0; // of the source pane's document, when it was submitted
+    std::shared_ptr<compile_snapshot const> shown;
+    source_selection selection; // in `shown`
+
+    compile_worker worker; // last, so it is joined before anything its results are posted to goes away
 };
@@ -13,14 +13,102 @@
 #include <QMessageBox>
 #include <QCryptographicHash>
 #include <QMenuBar>
+#include <QRunnable>
+#include <QItemSelectionModel>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QDir>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
 
 #include "util.hpp"
+#include "test_suite.hpp"
 
 #include "populateCommonMenuBar.hpp"
 #include "CompilerTestsWindow.hpp"
 
 using CsvTable = QVector<QVector<QString>>;
 
+struct CompilerTestsWindow::TestRun
+{
+    struct Report
+    {
+        int index;                      // into `rows` and `tests`
+        bool started;                   // else finished, with `result`
+        compiler_test_result result;
+        u64 hash;                       // `compiler_test_hash`
+        s64 elapsed_us;
+    };
+
+    cancel_token cancel;
+    std::string dataDir;
+    std::vector<compiler_test> tests;   // one per row run
+    execution_engine engine = execution_engine::interpreter;
+    bool skipUnchanged = false;
+    compiler_test_results_db lastPassed; // read by the workers, never changed during the run
+    time_point_precise_t start;
+
+    // Appended to by the workers, taken by the GUI thread.
+    std::mutex mutex;
+    std::vector<Report> reports;
+
+    // GUI thread only.
+    QVector<int> rows;
+    int finished = 0;
+    int failed = 0;
+    int skipped = 0;
+    std::string resultsDbPath;
+    compiler_test_results_db results;   // `lastPassed` with what finished so far, saved when the run ends
+
+    void report(Report next)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reports.push_back(std::move(next));
+    }
+};
+
+/// Runs one test of a `TestRun` on the window's thread pool. Holds the run, not the window, so a test still
+/// running when the window goes away or the run is cancelled reports into nothing.
+class TestRunnable : public QRunnable
+{
+public:
+    TestRunnable(std::shared_ptr<CompilerTestsWindow::TestRun> run, int index)
+        : testRun(std::move(run)), index(index)
+    {
+    }
+
+    void run() override
+    {
+        if (testRun->cancel.cancelled())
+            return;
+        compiler_test const &test = testRun->tests[index];
+
+        time_point_precise_t start = get_time_precise();
+        // Hashed either way, so a run that skips nothing still tells the next one what passed.
+        u64 hash = compiler_test_hash(test, testRun->dataDir.c_str(), testRun->engine);
+        if (testRun->skipUnchanged && compiler_test_unchanged(testRun->lastPassed, test, hash)) {
+            compiler_test_result result = {};
+            result.passed = true;
+            result.skipped = true;
+            testRun->report({ index, false, std::move(result), hash, time_diff_us(start, get_time_precise()) });
+            return;
+        }
+        testRun->report({ index, true, {}, hash, 0 });
+
+        compile_cache_stats stats = {};
+        compiler_test_result result = run_compiler_test(test, testRun->dataDir.c_str(), nullptr, stats, &testRun->cancel,
+                                                        testRun->engine);
+        testRun->report({ index, false, std::move(result), hash, time_diff_us(start, get_time_precise()) });
+    }
+
+private:
+    std::shared_ptr<CompilerTestsWindow::TestRun> testRun;
+    int index;
+};
+
 void CompilerTestsWindow::loadCsv(QString const &csvPath)
 {
     QFile file(csvPath);
@@ -51,9 +139,6 @@ void CompilerTestsWindow::loadCsv(QString const &csvPath)
         return;
     }
 
-    int const statusCol = 0;
-    int const compilationFlowCol = 1;
-    int const firstCsvCol = 2; // Table column where actual CSV fields begin
     int const requiredCsvColumnCount = required.size();
     QVector<QStringList> newCsvData;
 
@@ -79,12 +164,15 @@ void CompilerTestsWindow::loadCsv(QString const &csvPath)
         newCsvData.push_back(fields);
     }
 
+    // Results are reported by row, which the new CSV may have moved.
+    cancelTests();
+
     testsTable->clear();
     testsTable->setRowCount(newCsvData.size());
     testsTable->setColumnCount(firstCsvCol + requiredCsvColumnCount);
     {
         QStringList tableHeaders;
-        tableHeaders << "Status" << "Compilation Flow";
+        tableHeaders << "Status" << "Elapsed" << "Compilation Flow";
         tableHeaders.append(required); // Append the CSV columns
         testsTable->setHorizontalHeaderLabels(tableHeaders);
     }
@@ -120,13 +208,19 @@ void CompilerTestsWindow::loadCsv(QString const &csvPath)
             testsTable->setItem(r, statusCol, statusItem);
             // statusItem->setFlags(statusItem->flags() & ~Qt::ItemIsEditable);
         }
+        {
+            QTableWidgetItem *elapsedItem = new QTableWidgetItem();
+            elapsedItem->setFlags(elapsedItem->flags() & ~Qt::ItemIsEditable);
+            testsTable->setItem(r, elapsedCol, elapsedItem);
+        }
         {
             QPushButton *btn = new QPushButton("Open");
             testsTable->setCellWidget(r, compilationFlowCol, btn);
 
             connect(btn, &QPushButton::clicked, this, [this, fields]() {
                 QString title = "Compilation Flow (" + fields[0] + ")";
-                CompilationFlowWindow *w = new CompilationFlowWindow(nullptr, title);
+                QString sourcePath = dataDirectoryPicker->path() + "/" + fields[1];
+                CompilationFlowWindow *w = new CompilationFlowWindow(nullptr, title, sourcePath);
                 w->setAttribute(Qt::WA_DeleteOnClose);
                 w->resize(1600, 900);
                 w->show();
@@ -184,12 +278,178 @@ void CompilerTestsWindow::onTableItemChanged(QTableWidgetItem *item)
 
     qDebug() << "Cell changed: row" << row << "col" << col << "->" << value;
 
-    int statusCol = 0;
     if (col == statusCol) {
         testRows[row].status = value;
     }
 }
 
+void CompilerTestsWindow::runAllTests()
+{
+    QVector<int> rows;
+    for (int r = 0; r < testRows.size(); ++r) {
+        rows.push_back(r);
+    }
+    runTests(rows);
+}
+
+void CompilerTestsWindow::runSelectedTests()
+{
+    QVector<int> rows;
+    for (QModelIndex const &index : testsTable->selectionModel()->selectedIndexes()) {
+        rows.push_back(index.row());
+    }
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+    runTests(rows);
+}
+
+void CompilerTestsWindow::runTests(QVector<int> const &rows)
+{
+    cancelTests();
+    if (rows.isEmpty())
+        return;
+
+    currentRun = std::make_shared<TestRun>();
+    currentRun->dataDir = dataDirectoryPicker->path().toUtf8().constData();
+    currentRun->rows = rows;
+    for (int row : rows) {
+        QStringList const &fields = testRows[row].fields;
+        currentRun->tests.push_back({ fields[0].toStdString(), fields[1].toStdString(), fields[2].toStdString() });
+    }
+
+    // Next to the tests like the compile cache, so every window running the same CSV shares it.
+    currentRun->resultsDbPath = QFileInfo(csvFilePicker->file()).dir().filePath(".cache/test_results.db").toUtf8().constData();
+    currentRun->engine = execution_engine(engineComboBox->currentData().toInt());
+    currentRun->skipUnchanged = skipUnchangedCheckBox->isChecked();
+    std::string error;
+    if (!load_compiler_test_results_db(currentRun->resultsDbPath.c_str(), currentRun->lastPassed, error)) {
+        qDebug() << "Run tests:" << QString::fromStdString(error);
+    }
+    currentRun->results = currentRun->lastPassed;
+    currentRun->start = get_time_precise();
+
+    testsTableIsPopulating = true;
+    testsTable->blockSignals(true);
+    for (int row : rows) {
+        setRowStatus(row, "Queued");
+        testsTable->item(row, elapsedCol)->setText("");
+    }
+    testsTable->blockSignals(false);
+    testsTableIsPopulating = false;
+
+    for (int i = 0; i < rows.size(); ++i) {
+        testPool->start(new TestRunnable(currentRun, i));
+    }
+
+    runAllButton->setEnabled(false);
+    runSelectedButton->setEnabled(false);
+    cancelButton->setEnabled(true);
+    runStatusLabel->setText(QString("Running %1 tests on %2 threads").arg(rows.size()).arg(testPool->maxThreadCount()));
+    flushTimer->start();
+}
+
+void CompilerTestsWindow::cancelTests()
+{
+    if (currentRun == nullptr)
+        return;
+
+    // Queued tests are dropped, running ones stop at their next check and report into the abandoned run.
+    currentRun->cancel.cancel();
+    testPool->clear();
+    flushTestResults();
+    if (currentRun == nullptr)
+        return; // everything had finished
+
+    testsTableIsPopulating = true;
+    testsTable->blockSignals(true);
+    for (int row : currentRun->rows) {
+        QString const &status = testRows[row].status;
+        if (status == "Queued" || status == "Running") {
+            setRowStatus(row, "Cancelled");
+        }
+    }
+    testsTable->blockSignals(false);
+    testsTableIsPopulating = false;
+
+    runStatusLabel->setText(QString("Cancelled after %1 of %2 tests, %3 failed")
+        .arg(currentRun->finished).arg(currentRun->rows.size()).arg(currentRun->failed));
+    saveTestResults();
+    currentRun = nullptr;
+    flushTimer->stop();
+    runAllButton->setEnabled(true);
+    runSelectedButton->setEnabled(true);
+    cancelButton->setEnabled(false);
+}
+
+void CompilerTestsWindow::flushTestResults()
+{
+    if (currentRun == nullptr)
+        return;
+
+    std::vector<TestRun::Report> reports;
+    {
+        std::lock_guard<std::mutex> lock(currentRun->mutex);
+        reports.swap(currentRun->reports);
+    }
+    if (reports.empty())
+        return;
+
+    testsTable->setUpdatesEnabled(false);
+    testsTableIsPopulating = true;
+    testsTable->blockSignals(true);
+    for (TestRun::Report const &report : reports) {
+        int row = currentRun->rows[report.index];
+        if (report.started) {
+            setRowStatus(row, "Running");
+            continue;
+        }
+        compiler_test_result const &result = report.result;
+        setRowStatus(row, result.skipped ? "Passed (unchanged)" : result.passed ? "Passed" : "Failed");
+        testsTable->item(row, statusCol)->setToolTip(QString::fromStdString(result.detail));
+        testsTable->item(row, elapsedCol)->setText(QString("%1 ms").arg(f64(report.elapsed_us) / 1000.0, 0, 'f', 1));
+        ++currentRun->finished;
+        currentRun->failed += !result.passed;
+        currentRun->skipped += result.skipped;
+        if (!result.skipped && result.detail != "cancelled") {
+            compiler_test_results_db_record(currentRun->results, currentRun->tests[report.index], report.hash, result.passed);
+        }
+    }
+    testsTable->blockSignals(false);
+    testsTableIsPopulating = false;
+    testsTable->setUpdatesEnabled(true);
+
+    if (currentRun->finished < currentRun->rows.size()) {
+        runStatusLabel->setText(QString("Running: %1 of %2 done, %3 failed")
+            .arg(currentRun->finished).arg(currentRun->rows.size()).arg(currentRun->failed));
+        return;
+    }
+
+    s64 elapsed_us = time_diff_us(currentRun->start, get_time_precise());
+    runStatusLabel->setText(QString("Done: %1 passed (%2 unchanged), %3 failed in %4 ms")
+        .arg(currentRun->finished - currentRun->failed).arg(currentRun->skipped).arg(currentRun->failed)
+        .arg(f64(elapsed_us) / 1000.0, 0, 'f', 1));
+    saveTestResults();
+    currentRun = nullptr;
+    flushTimer->stop();
+    runAllButton->setEnabled(true);
+    runSelectedButton->setEnabled(true);
+    cancelButton->setEnabled(false);
+}
+
+void CompilerTestsWindow::saveTestResults()
+{
+    std::string error;
+    if (!save_compiler_test_results_db(currentRun->resultsDbPath.c_str(), currentRun->results, error)) {
+        qDebug() << "Run tests:" << QString::fromStdString(error);
+    }
+}
+
+void CompilerTestsWindow::setRowStatus(int row, QString const &status)
+{
+    testsTable->item(row, statusCol)->setText(status);
+    testRows[row].status = status;
+}
+
 CompilerTestsWindow::CompilerTestsWindow(QWidget *parent)
     : QMainWindow(parent)
 {
@@ -217,6 +477,29 @@ CompilerTestsWindow::CompilerTestsWindow(QWidget *parent)
     connect(csvFilePicker, &FilePicker::fileChanged,
             this, &CompilerTestsWindow::onCsvPathChanged);
 
+    skipUnchangedCheckBox = new QCheckBox("Skip unchanged", this);
+    skipUnchangedCheckBox->setToolTip("Skip tests whose source, expected output and compiler build are the same as when they last passed");
+    engineComboBox = new QComboBox(this);
+    engineComboBox->setToolTip("Run the test programs on the interpreter or as x86-64 code from the JIT");
+    engineComboBox->addItem("Interpreter", int(execution_engine::interpreter));
+    if (jit_available())
+        engineComboBox->addItem("JIT", int(execution_engine::jit));
+    runAllButton = new QPushButton("Run All", this);
+    runSelectedButton = new QPushButton("Run Selected", this);
+    cancelButton = new QPushButton("Cancel", this);
+    cancelButton->setEnabled(false);
+    runStatusLabel = new QLabel(this);
+
+    connect(runAllButton, &QPushButton::clicked, this, &CompilerTestsWindow::runAllTests);
+    connect(runSelectedButton, &QPushButton::clicked, this, &CompilerTestsWindow::runSelectedTests);
+    connect(cancelButton, &QPushButton::clicked, this, &CompilerTestsWindow::cancelTests);
+
+    testPool = new QThreadPool(this);
+
+    flushTimer = new QTimer(this);
+    flushTimer->setInterval(50);
+    connect(flushTimer, &QTimer::timeout, this, &CompilerTestsWindow::flushTestResults);
+
     testsTable = new QTableWidget(this);
     loadCsv(csvFilePicker->file());
     testsTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
@@ -225,6 +508,21 @@ CompilerTestsWindow::CompilerTestsWindow(QWidget *parent)
     top_hbox->addWidget(csvFilePicker);
     top_hbox->addWidget(dataDirectoryPicker);
 
+    QHBoxLayout *run_hbox = new QHBoxLayout();
+    run_hbox->addWidget(engineComboBox);
+    run_hbox->addWidget(skipUnchangedCheckBox);
+    run_hbox->addWidget(runAllButton);
+    run_hbox->addWidget(runSelectedButton);
+    run_hbox->addWidget(cancelButton);
+    run_hbox->addWidget(runStatusLabel, 1);
+
     main_vbox->addLayout(top_hbox);
+    main_vbox->addLayout(run_hbox);
     main_vbox->addWidget(testsTable);
 }
+
+CompilerTestsWindow::~CompilerTestsWindow()
+{
+    cancelTests();
+    testPool->waitForDone();
+}
@@ -3,6 +3,14 @@
 #include <QMainWindow>
 #include <QFileSystemWatcher>
 #include <QTableWidget>
+#include <QPushButton>
+#include <QCheckBox>
+#include <QComboBox>
+#include <QLabel>
+#include <QThreadPool>
+#include <QTimer>
+
+#include <memory>
 
 #include "FilePicker.hpp"
 #include "DirectoryPicker.hpp"
@@ -15,6 +23,7 @@ class CompilerTestsWindow : public QMainWindow
 
 public:
     CompilerTestsWindow(QWidget *parent = nullptr);
+    ~CompilerTestsWindow(); // cancels a run in progress, its tests stop at their next call or loop iteration
 
     void loadCsv(QString const &csvPath);
 
@@ -22,8 +31,24 @@ private slots:
     void onCsvPathChanged(QString const &path);
     void onCsvFileModified(QString const &path);
     void onTableItemChanged(QTableWidgetItem *item);
+    void runAllTests();
+    void runSelectedTests();
+    void cancelTests();
+    void flushTestResults();
 
 private:
+    static int constexpr statusCol = 0;
+    static int constexpr elapsedCol = 1;
+    static int constexpr compilationFlowCol = 2;
+    static int constexpr firstCsvCol = 3; // Table column where actual CSV fields begin
+
+    struct TestRun;
+    friend class TestRunnable;
+
+    void runTests(QVector<int> const &rows);
+    void setRowStatus(int row, QString const &status);
+    void saveTestResults(); // of `currentRun`, into its results database
+
     QFileSystemWatcher *watcher;
     FilePicker *csvFilePicker;
     DirectoryPicker *dataDirectoryPicker;
@@ -36,4 +61,17 @@ private:
         QStringList fields;
     };
     QVector<RowState> testRows;
+
+    QCheckBox *skipUnchangedCheckBox;
+    QComboBox *engineComboBox;
+    QPushButton *runAllButton;
+    QPushButton *runSelectedButton;
+    QPushButton *cancelButton;
+    QLabel *runStatusLabel;
+
+    // Tests run on `testPool` and report into `currentRun`, which `flushTimer` drains into the table a batch at
+    // a time, so the event loop sees a few updates a second however fast tests finish.
+    QThreadPool *testPool;
+    QTimer *flushTimer;
+    std::shared_ptr<TestRun> currentRun;
 };
@@ -0,0 +1,109 @@
+#include <QPainter>
+#include <QPaintEvent>
+#include <QKeyEvent>
+#include <QScrollBar>
+#include <QFontMetrics>
+
+#include <algorithm>
+#include <climits>
+
+#include "DocumentViewer.hpp"
+
+DocumentViewer::DocumentViewer(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    QFont mono("Consolas");
+    mono.setStyleHint(QFont::Monospace);
+    setFont(mono);
+    QFontMetrics metrics(mono);
+    lineHeight = metrics.height();
+    charWidth = metrics.horizontalAdvance('0');
+    horizontalScrollBar()->setSingleStep(s_tabWidth);
+    viewport()->setAutoFillBackground(true);
+}
+
+void DocumentViewer::setDocument(std::shared_ptr<text_document const> next)
+{
+    document = std::move(next);
+    u32 lines = document != nullptr ? document->line_count() : 0;
+    gutterWidth = (int(QString::number(lines).size()) + 2) * charWidth;
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    updateScrollBars();
+    viewport()->update();
+}
+
+int DocumentViewer::visibleLines() const
+{
+    return std::max(viewport()->height() / std::max(lineHeight, 1), 1);
+}
+
+int DocumentViewer::visibleColumns() const
+{
+    return std::max((viewport()->width() - gutterWidth) / std::max(charWidth, 1), 1);
+}
+
+void DocumentViewer::updateScrollBars()
+{
+    // Scroll bar values are ints, which is enough: documents are under 4 GiB and so are their lines.
+    int lines = document != nullptr ? int(std::min<u32>(document->line_count(), u32(INT_MAX))) : 0;
+    int columns = document != nullptr ? int(std::min<u32>(document->longest_line, u32(INT_MAX))) : 0;
+    verticalScrollBar()->setPageStep(visibleLines());
+    verticalScrollBar()->setRange(0, std::max(lines - visibleLines(), 0));
+    horizontalScrollBar()->setPageStep(visibleColumns());
+    horizontalScrollBar()->setRange(0, std::max(columns - visibleColumns() + 1, 0));
+}
+
+void DocumentViewer::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBars();
+}
+
+void DocumentViewer::keyPressEvent(QKeyEvent *event)
+{
+    // The scroll area handles the arrows and page keys, the ends of the document are missing.
+    if (event->modifiers() & Qt::ControlModifier && (event->key() == Qt::Key_Home || event->key() == Qt::Key_End)) {
+        verticalScrollBar()->setValue(event->key() == Qt::Key_Home ? 0 : verticalScrollBar()->maximum());
+        return;
+    }
+    QAbstractScrollArea::keyPressEvent(event);
+}
+
+void DocumentViewer::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(viewport());
+    QRect exposed = event->rect();
+    painter.fillRect(QRect(0, exposed.top(), gutterWidth, exposed.height()), QColor(240, 240, 240));
+    if (document == nullptr) {
+        return;
+    }
+
+    u32 first = u32(verticalScrollBar()->value()) + u32(exposed.top() / lineHeight);
+    u32 last = std::min(u32(verticalScrollBar()->value()) + u32(exposed.bottom() / lineHeight) + 1, document->line_count());
+    u32 column = u32(horizontalScrollBar()->value());
+    u32 columns = u32(visibleColumns()) + 1;
+    int baseline = QFontMetrics(font()).ascent();
+
+    for (u32 line = first; line < last; ++line) {
+        int top = int(line - u32(verticalScrollBar()->value())) * lineHeight;
+        painter.setPen(Qt::gray);
+        painter.drawText(QRect(0, top, gutterWidth - charWidth, lineHeight), Qt::AlignRight | Qt::AlignVCenter, QString::number(line + 1));
+
+        // Columns are bytes and tabs are expanded to the next stop, as `text_document_columns` counts them, which
+        // is exact for the ASCII that preprocessed C mostly is. Only the bytes that can be on screen are converted.
+        std::string_view text = document->line(line);
+        QByteArray visible;
+        u32 x = 0;
+        for (u64 i = 0; i < text.size() && x < column + columns; ++i) {
+            u32 width = text[i] == '\t' ? s_tabWidth - x % s_tabWidth : 1;
+            for (u32 w = 0; w < width; ++w, ++x) {
+                if (x >= column && x < column + columns) {
+                    visible += text[i] == '\t' ? ' ' : text[i];
+                }
+            }
+        }
+        painter.setPen(palette().color(QPalette::Text));
+        painter.drawText(gutterWidth, top + baseline, QString::fromUtf8(visible));
+    }
+}
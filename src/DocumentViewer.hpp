@@ -0,0 +1,39 @@
+#pragma once
+
+#include <QAbstractScrollArea>
+
+#include <memory>
+
+#include "text_document.hpp"
+
+/// @brief Read-only view of a `text_document`, with line numbers. Scrolls by line and column and only converts
+/// and paints the part of each line that is on screen, so what it costs does not depend on the size of the
+/// document: a file of tens of megabytes opens as fast as it can be mapped and indexed.
+class DocumentViewer : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    explicit DocumentViewer(QWidget *parent = nullptr);
+
+    /// Shows `document` from its first line. The viewer keeps it mapped for as long as it shows it.
+    void setDocument(std::shared_ptr<text_document const> document);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+
+private:
+    void updateScrollBars();
+
+    int visibleLines() const;
+    int visibleColumns() const;
+
+    static int constexpr s_tabWidth = int(text_document_tab_width); // as `text_document::longest_line` counts
+
+    std::shared_ptr<text_document const> document;
+    int lineHeight = 0;
+    int charWidth = 0;
+    int gutterWidth = 0;    // line numbers, in pixels
+};
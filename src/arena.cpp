@@ -0,0 +1,76 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#include "arena.hpp"
+
+arena::~arena() noexcept
+{
+    release();
+}
+
+void *arena::alloc(u64 size, u64 alignment) noexcept
+{
+    assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+
+    auto aligned_offset = [alignment](block const &b) {
+        u64 base = u64(reinterpret_cast<uintptr_t>(b.data));
+        return ((base + b.used + alignment - 1) & ~(alignment - 1)) - base;
+    };
+
+    for (; current < blocks.size(); ++current) {
+        block &b = blocks[current];
+        u64 offset = aligned_offset(b);
+        if (offset + size <= b.size) {
+            b.used = offset + size;
+            return b.data + offset;
+        }
+    }
+
+    // No room left in any block, add one big enough for this allocation.
+    u64 block_size = std::max(default_block_size, size + alignment);
+    block b = { static_cast<u8 *>(malloc(block_size)), block_size, 0 };
+    assert(b.data != nullptr);
+
+    u64 offset = aligned_offset(b);
+    b.used = offset + size;
+    blocks.push_back(b);
+    current = blocks.size() - 1;
+
+    return b.data + offset;
+}
+
+void arena::reset() noexcept
+{
+    for (block &b : blocks) {
+        b.used = 0;
+    }
+    current = 0;
+}
+
+void arena::release() noexcept
+{
+    for (block &b : blocks) {
+        free(b.data);
+    }
+    blocks.clear();
+    current = 0;
+}
+
+u64 arena::bytes_used() const noexcept
+{
+    u64 total = 0;
+    for (block const &b : blocks) {
+        total += b.used;
+    }
+    return total;
+}
+
+u64 arena::bytes_reserved() const noexcept
+{
+    u64 total = 0;
+    for (block const &b : blocks) {
+        total += b.size;
+    }
+    return total;
+}
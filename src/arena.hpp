@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "primitives.hpp"
+
+/// @brief Bump allocator over a list of large blocks. Allocations are never freed individually;
+/// `reset` rewinds every block at once (keeping the memory for reuse) and `release` returns it to the OS.
+/// Intended for data whose lifetime is one compilation: tokens, AST, IR.
+struct arena
+{
+    struct block
+    {
+        u8 *data;
+        u64 size;
+        u64 used;
+    };
+
+    std::vector<block> blocks;
+    u64 current = 0;                  // index of the block being bumped
+    u64 default_block_size = 1 << 20;
+
+    arena() noexcept = default;
+    arena(arena const &) = delete;
+    arena &operator=(arena const &) = delete;
+    ~arena() noexcept;
+
+    void *alloc(u64 size, u64 alignment) noexcept;
+    void reset() noexcept;
+    void release() noexcept;
+
+    u64 bytes_used() const noexcept;
+    u64 bytes_reserved() const noexcept;
+
+    template <typename Ty>
+    Ty *alloc_array(u64 count) noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<Ty>);
+        return static_cast<Ty *>(alloc(sizeof(Ty) * count, alignof(Ty)));
+    }
+
+    /// Reallocates `old` (holding `old_count` elements) to `new_count` elements. The old storage is abandoned,
+    /// so growing geometrically wastes at most as much as is live.
+    template <typename Ty>
+    Ty *grow_array(Ty *old, u64 old_count, u64 new_count) noexcept
+    {
+        Ty *fresh = alloc_array<Ty>(new_count);
+        if (old_count > 0) {
+            memcpy(fresh, old, sizeof(Ty) * old_count);
+        }
+        return fresh;
+    }
+};
@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <cassert>
+
+#include "util.hpp"
+#include "arena.hpp"
+
+#include "ast.hpp"
+
+char const *ast_kind_name(ast_kind kind) noexcept
+{
+    static char const *const names[] = {
+        "translation_unit",
+        "function_decl",
+        "param_decl",
+        "var_decl",
+        "compound_stmt",
+        "decl_stmt",
+        "expr_stmt",
+        "if_stmt",
+        "while_stmt",
+        "do_stmt",
+        "for_stmt",
+        "return_stmt",
+        "break_stmt",
+        "continue_stmt",
+        "empty",
+        "int_literal",
+        "char_literal",
+        "string_literal",
+        "identifier",
+        "call",
+        "unary",
+        "postfix",
+        "binary",
+        "assign",
+        "ternary",
+    };
+    static_assert(lengthof(names) == u64(ast_kind::count));
+
+    assert(kind < ast_kind::count);
+    return names[u64(kind)];
+}
+
+char const *ast_type_name(ast_type type) noexcept
+{
+    switch (type) {
+        case ast_type::none:   return "";
+        case ast_type::void_:  return "void";
+        case ast_type::char_:  return "char";
+        case ast_type::short_: return "short";
+        case ast_type::int_:   return "int";
+        case ast_type::long_:  return "long";
+    }
+    return "";
+}
+
+void ast::init(arena &memory, u32 initial_capacity) noexcept
+{
+    mem = &memory;
+    count = 0;
+    root = ast_null;
+
+    capacity = std::max(initial_capacity, u32(16));
+    kinds = mem->alloc_array<ast_kind>(capacity);
+    types = mem->alloc_array<ast_type>(capacity);
+    tokens = mem->alloc_array<u32>(capacity);
+    values = mem->alloc_array<u32>(capacity);
+    first_child = mem->alloc_array<u32>(capacity);
+    last_child = mem->alloc_array<u32>(capacity);
+    next_sibling = mem->alloc_array<u32>(capacity);
+}
+
+u32 ast::add_node(ast_kind kind, u32 token) noexcept
+{
+    assert(mem != nullptr && "ast::init not called");
+
+    if (count == capacity) {
+        u32 new_capacity = capacity * 2;
+        kinds = mem->grow_array(kinds, count, new_capacity);
+        types = mem->grow_array(types, count, new_capacity);
+        tokens = mem->grow_array(tokens, count, new_capacity);
+        values = mem->grow_array(values, count, new_capacity);
+        first_child = mem->grow_array(first_child, count, new_capacity);
+        last_child = mem->grow_array(last_child, count, new_capacity);
+        next_sibling = mem->grow_array(next_sibling, count, new_capacity);
+        capacity = new_capacity;
+    }
+
+    u32 id = count++;
+    kinds[id] = kind;
+    types[id] = ast_type::none;
+    tokens[id] = token;
+    values[id] = 0;
+    first_child[id] = ast_null;
+    last_child[id] = ast_null;
+    next_sibling[id] = ast_null;
+    return id;
+}
+
+void ast::add_child(u32 parent, u32 child) noexcept
+{
+    assert(parent < count && child < count);
+    assert(next_sibling[child] == ast_null);
+
+    if (last_child[parent] == ast_null) {
+        first_child[parent] = child;
+    } else {
+        next_sibling[last_child[parent]] = child;
+    }
+    last_child[parent] = child;
+}
+
+u32 ast::child_count(u32 node) const noexcept
+{
+    u32 n = 0;
+    for (u32 c = first_child[node]; c != ast_null; c = next_sibling[c]) {
+        ++n;
+    }
+    return n;
+}
+
+u32 ast::child(u32 node, u32 n) const noexcept
+{
+    u32 c = first_child[node];
+    for (; c != ast_null && n > 0; c = next_sibling[c]) {
+        --n;
+    }
+    return c;
+}
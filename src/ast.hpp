@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string_view>
+
+#include "primitives.hpp"
+
+struct arena;
+
+enum class ast_kind : u8
+{
+    translation_unit,   // children: function_decl | var_decl
+
+    // DECLARATIONS
+
+    function_decl,      // token: name, value: name id, type: return type, children: param_decl..., [compound_stmt]
+    param_decl,         // token: name, value: name id, type
+    var_decl,           // token: name, value: name id, type, children: [initializer expr]
+
+    // STATEMENTS
+
+    compound_stmt,      // children: statements
+    decl_stmt,          // children: var_decl...
+    expr_stmt,          // children: expr
+    if_stmt,            // children: cond, then, [else]
+    while_stmt,         // children: cond, body
+    do_stmt,            // children: body, cond
+    for_stmt,           // children: init, cond, step, body (missing parts are `empty`)
+    return_stmt,        // children: [expr]
+    break_stmt,
+    continue_stmt,
+    empty,              // `;` or an omitted for clause
+
+    // EXPRESSIONS
+
+    int_literal,        // token: the literal
+    char_literal,       // token: the literal
+    string_literal,     // token: first of the adjacent literals, value: how many are concatenated
+    identifier,         // token: the name, value: name id
+    call,               // token: callee name, value: name id, children: args...
+    unary,              // token: operator (- + ! ~ ++ --), children: operand
+    postfix,            // token: operator (++ --), children: operand
+    binary,             // token: operator, children: lhs, rhs
+    assign,             // token: operator (= += ...), children: lhs, rhs
+    ternary,            // children: cond, if_true, if_false
+
+    count
+};
+
+char const *ast_kind_name(ast_kind kind) noexcept;
+
+enum class ast_type : u8
+{
+    none,
+    void_,
+    char_,
+    short_,
+    int_,
+    long_,
+};
+
+char const *ast_type_name(ast_type type) noexcept;
+
+u32 constexpr ast_null = u32(-1);
+
+/// @brief Abstract syntax tree stored as parallel arrays indexed by node id (u32), allocated from an arena.
+/// Children are linked through `first_child`/`next_sibling` indices, so the tree has no pointers and the dense
+/// `kinds` array can be scanned linearly by passes that only care about node kinds. Nodes are appended in
+/// creation order, which for the parser is post-order (children before their parent, root last).
+/// Freeing the tree is resetting its arena.
+struct ast
+{
+    arena *mem = nullptr;
+
+    ast_kind *kinds = nullptr;
+    ast_type *types = nullptr;      // declared type for declarations, `none` otherwise
+    u32 *tokens = nullptr;          // index into the token_buffer the tree was parsed from
+    u32 *values = nullptr;          // kind-specific payload (see `ast_kind`), names are ids into an intern_table
+    u32 *first_child = nullptr;
+    u32 *last_child = nullptr;
+    u32 *next_sibling = nullptr;
+
+    u32 count = 0;
+    u32 capacity = 0;
+    u32 root = ast_null;
+
+    void init(arena &memory, u32 initial_capacity = 1024) noexcept;
+    u32 add_node(ast_kind kind, u32 token) noexcept;
+    void add_child(u32 parent, u32 child) noexcept;
+    u32 child_count(u32 node) const noexcept;
+
+    /// Returns the `n`th child of `node`, or `ast_null`.
+    u32 child(u32 node, u32 n) const noexcept;
+};
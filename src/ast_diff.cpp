@@ -0,0 +1,120 @@
+#include <algorithm>
+#include <utility>
+
+#include "util.hpp"
+
+#include "ast_diff.hpp"
+
+static u64 mix(u64 h, u64 v) noexcept
+{
+    h = (h ^ v) * 0xff51afd7ed558ccdull;
+    return h ^ (h >> 32);
+}
+
+void ast_subtree_hashes(ast const &tree, token_buffer const &tokens, std::string_view text, std::vector<u64> &out) noexcept
+{
+    out.assign(tree.count, 0);
+
+    // Node ids are post-order, so every child is hashed before its parent.
+    for (u32 node = 0; node < tree.count; ++node) {
+        u64 h = fnv1a_hash(tokens.spelling(text, tree.tokens[node]), (u64(tree.kinds[node]) << 8) | u64(tree.types[node]));
+        u64 children = 0;
+        for (u32 c = tree.first_child[node]; c != ast_null; c = tree.next_sibling[c]) {
+            h = mix(h, out[c]);
+            ++children;
+        }
+        out[node] = mix(h, children);
+    }
+}
+
+void ast_diff_trees(ast const &from, std::vector<u64> const &from_hashes, ast const &to, std::vector<u64> const &to_hashes,
+    ast_diff &out) noexcept
+{
+    out.old_of_new.assign(to.count, ast_null);
+    out.new_of_old.assign(from.count, ast_null);
+    out.unchanged.assign(to.count, 0);
+    out.unchanged_nodes = 0;
+    out.changed_nodes = 0;
+    out.new_nodes = 0;
+
+    auto children_of = [](ast const &tree, u32 node, std::vector<u32> &list) {
+        list.clear();
+        for (u32 c = tree.first_child[node]; c != ast_null; c = tree.next_sibling[c]) {
+            list.push_back(c);
+        }
+    };
+
+    std::vector<std::pair<u32, u32>> pairs; // (old, new) still to match
+    std::vector<std::pair<u32, u32>> same;  // (old, new) known to be equal subtrees
+    std::vector<u32> old_children, new_children;
+    if (from.root != ast_null && to.root != ast_null) {
+        pairs.push_back({ from.root, to.root });
+    }
+
+    while (!pairs.empty()) {
+        auto [o, n] = pairs.back();
+        pairs.pop_back();
+        if (from.kinds[o] != to.kinds[n]) {
+            continue;
+        }
+
+        if (from_hashes[o] == to_hashes[n]) {
+            // Equal subtrees: walk them side by side. The child counts only differ on a hash collision.
+            same.push_back({ o, n });
+            while (!same.empty()) {
+                auto [so, sn] = same.back();
+                same.pop_back();
+                out.old_of_new[sn] = so;
+                out.new_of_old[so] = sn;
+                out.unchanged[sn] = 1;
+                ++out.unchanged_nodes;
+                u32 co = from.first_child[so], cn = to.first_child[sn];
+                for (; co != ast_null && cn != ast_null; co = from.next_sibling[co], cn = to.next_sibling[cn]) {
+                    same.push_back({ co, cn });
+                }
+            }
+            continue;
+        }
+
+        out.old_of_new[n] = o;
+        out.new_of_old[o] = n;
+        ++out.changed_nodes;
+
+        children_of(from, o, old_children);
+        children_of(to, n, new_children);
+        u64 old_count = old_children.size(), new_count = new_children.size();
+        u64 prefix = 0, suffix = 0;
+        while (prefix < std::min(old_count, new_count) && from_hashes[old_children[prefix]] == to_hashes[new_children[prefix]]) {
+            ++prefix;
+        }
+        while (suffix < std::min(old_count, new_count) - prefix &&
+            from_hashes[old_children[old_count - 1 - suffix]] == to_hashes[new_children[new_count - 1 - suffix]]) {
+            ++suffix;
+        }
+        for (u64 i = 0; i < prefix; ++i) {
+            pairs.push_back({ old_children[i], new_children[i] });
+        }
+        for (u64 i = 0; i < suffix; ++i) {
+            pairs.push_back({ old_children[old_count - 1 - i], new_children[new_count - 1 - i] });
+        }
+        for (u64 i = prefix; i < std::min(old_count, new_count) - suffix; ++i) {
+            if (from.kinds[old_children[i]] != to.kinds[new_children[i]]) {
+                break;
+            }
+            pairs.push_back({ old_children[i], new_children[i] });
+        }
+    }
+
+    // Whatever is reachable in `to` and did not match is new.
+    if (to.root != ast_null) {
+        std::vector<u32> stack = { to.root };
+        while (!stack.empty()) {
+            u32 node = stack.back();
+            stack.pop_back();
+            out.new_nodes += out.old_of_new[node] == ast_null;
+            for (u32 c = to.first_child[node]; c != ast_null; c = to.next_sibling[c]) {
+                stack.push_back(c);
+            }
+        }
+    }
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+#include "ast.hpp"
+#include "lexer.hpp"
+
+/// Hashes every subtree of `tree` into `out` (indexed by node id): the kinds, types and token spellings of
+/// its nodes and the order of their children. Subtrees that hash the same are the same code, wherever and in
+/// whichever version of the source they are, whatever their node ids and token indices.
+void ast_subtree_hashes(ast const &tree, token_buffer const &tokens, std::string_view text, std::vector<u64> &out) noexcept;
+
+/// @brief How the nodes of one version of an AST correspond to those of the previous one.
+struct ast_diff
+{
+    std::vector<u32> old_of_new;    // per new node: the old node it corresponds to, or `ast_null` if it is new
+    std::vector<u32> new_of_old;    // the other way around, `ast_null` if it is gone
+    std::vector<u8> unchanged;      // per new node: 1 if its whole subtree is the same as its old node's
+    u64 unchanged_nodes;            // in unchanged subtrees
+    u64 changed_nodes;              // matched, but something below them changed
+    u64 new_nodes;
+};
+
+/// Matches `to` against `from` top-down. Subtrees with equal hashes match node for node; two nodes of the same
+/// kind with different hashes match each other, and their children match where their hashes agree from
+/// either end, then pairwise in between while the kinds agree. So an edit inside one function leaves every
+/// other declaration unchanged, and the function's own statements before and after the edit too.
+void ast_diff_trees(ast const &from, std::vector<u64> const &from_hashes, ast const &to, std::vector<u64> const &to_hashes,
+    ast_diff &out) noexcept;
@@ -0,0 +1,514 @@
+#include <algorithm>
+
+#include "util.hpp"
+#include "compiler.hpp"
+
+#include "ast_diff.hpp"
+
+#include "ast_layout.hpp"
+
+ast_layout_rect ast_layout::node_rect(u32 node) const noexcept
+{
+    f64 y = depth[node] * row_height;
+    return { x[node], y, x[node] + node_width, y + node_height };
+}
+
+ast_layout_rect ast_layout::subtree_rect(u32 node) const noexcept
+{
+    f64 edge_gap = (row_height - node_height) / 2;
+    return { min_x[node], depth[node] * row_height - edge_gap, max_x[node], max_depth[node] * row_height + node_height };
+}
+
+f64 ast_layout::edge_y(u32 node) const noexcept
+{
+    return depth[node] * row_height + node_height + (row_height - node_height) / 2;
+}
+
+ast_layout_rect ast_layout::bounds() const noexcept
+{
+    if (root == ast_null) {
+        return { 0, 0, 0, 0 };
+    }
+    return subtree_rect(root);
+}
+
+static bool intersects(ast_layout_rect const &a, ast_layout_rect const &b) noexcept
+{
+    return a.x0 <= b.x1 && b.x0 <= a.x1 && a.y0 <= b.y1 && b.y0 <= a.y1;
+}
+
+/// @brief State of Walker's algorithm. `prelim` is a node's x before the `mod`s of its ancestors are added;
+/// `thread` links a contour node with no children of its own to the next node of the contour; `shift` and
+/// `change` spread the move of a subtree over the siblings it moved past, applied once per parent by
+/// `execute_shifts`, which keeps apportioning linear; `ancestor` tells which sibling of the subtree being placed
+/// a conflicting contour node belongs to.
+struct tidy_tree
+{
+    ast_layout &layout;
+    std::vector<u32> parent;
+    std::vector<u32> slot;          // index into `layout.children`
+    std::vector<f64> prelim;
+    std::vector<f64> mod;
+    std::vector<f64> shift;
+    std::vector<f64> change;
+    std::vector<u32> thread;
+    std::vector<u32> ancestor;
+
+    static constexpr f64 distance = ast_layout::leaf_spacing;
+
+    explicit tidy_tree(ast_layout &layout) noexcept
+        : layout(layout)
+    {
+    }
+
+    bool leaf(u32 v) const noexcept
+    {
+        return layout.child_begin[v] == layout.child_begin[v + 1];
+    }
+
+    u32 next_left(u32 v) const noexcept
+    {
+        return leaf(v) ? thread[v] : layout.children[layout.child_begin[v]];
+    }
+
+    u32 next_right(u32 v) const noexcept
+    {
+        return leaf(v) ? thread[v] : layout.children[layout.child_begin[v + 1] - 1];
+    }
+
+    f64 midpoint(u32 v) const noexcept
+    {
+        return leaf(v) ? 0 : (prelim[next_left(v)] + prelim[next_right(v)]) / 2;
+    }
+
+    void move_subtree(u32 wl, u32 wr, f64 amount) noexcept
+    {
+        f64 per_subtree = amount / f64(slot[wr] - slot[wl]);
+        change[wr] -= per_subtree;
+        shift[wr] += amount;
+        change[wl] += per_subtree;
+        prelim[wr] += amount;
+        mod[wr] += amount;
+    }
+
+    void execute_shifts(u32 v) noexcept
+    {
+        f64 total = 0, rate = 0;
+        for (u32 k = layout.child_begin[v + 1]; k-- > layout.child_begin[v]; ) {
+            u32 w = layout.children[k];
+            prelim[w] += total;
+            mod[w] += total;
+            rate += change[w];
+            total += shift[w] + rate;
+        }
+    }
+
+    /// Pushes the subtree of `v` right until its left contour clears the right contours of its left siblings,
+    /// and threads the shorter contour onto the longer one.
+    u32 apportion(u32 v, u32 default_ancestor) noexcept
+    {
+        u32 first = layout.child_begin[parent[v]];
+        if (slot[v] == first) {
+            return default_ancestor;
+        }
+        u32 vir = v, vor = v, vil = layout.children[slot[v] - 1], vol = layout.children[first];
+        f64 sir = mod[vir], sor = mod[vor], sil = mod[vil], sol = mod[vol];
+        while (next_right(vil) != ast_null && next_left(vir) != ast_null) {
+            vil = next_right(vil);
+            vir = next_left(vir);
+            vol = next_left(vol);
+            vor = next_right(vor);
+            ancestor[vor] = v;
+            f64 gap = (prelim[vil] + sil) - (prelim[vir] + sir) + distance;
+            if (gap > 0) {
+                u32 a = parent[ancestor[vil]] == parent[v] ? ancestor[vil] : default_ancestor;
+                move_subtree(a, v, gap);
+                sir += gap;
+                sor += gap;
+            }
+            sil += mod[vil];
+            sir += mod[vir];
+            sol += mod[vol];
+            sor += mod[vor];
+        }
+        if (next_right(vil) != ast_null && next_right(vor) == ast_null) {
+            thread[vor] = next_right(vil);
+            mod[vor] += sil - sor;
+        }
+        if (next_left(vir) != ast_null && next_left(vol) == ast_null) {
+            thread[vol] = next_left(vir);
+            mod[vol] += sir - sol;
+            default_ancestor = v;
+        }
+        return default_ancestor;
+    }
+
+    /// First walk for `node`: places its children left to right, apportioning each against those before it.
+    /// A node's own place depends on its left siblings, so it is settled when its parent's turn comes.
+    void place_children(u32 node) noexcept
+    {
+        u32 begin = layout.child_begin[node], end = layout.child_begin[node + 1];
+        if (begin == end) {
+            return;
+        }
+        u32 default_ancestor = layout.children[begin];
+        for (u32 k = begin; k < end; ++k) {
+            u32 w = layout.children[k];
+            f64 w_midpoint = midpoint(w);
+            if (k > begin) {
+                prelim[w] = prelim[layout.children[k - 1]] + distance;
+                if (!leaf(w)) {
+                    mod[w] = prelim[w] - w_midpoint;
+                }
+            } else {
+                prelim[w] = w_midpoint;
+            }
+            default_ancestor = apportion(w, default_ancestor);
+        }
+        execute_shifts(node);
+    }
+
+    /// `place_children` for the reachable nodes in `[first, end)`, bottom-up (node ids are post-order).
+    void first_walk(u32 first, u32 end) noexcept
+    {
+        for (u32 node = first; node < end; ++node) {
+            if (layout.depth[node] >= 0) {
+                place_children(node);
+            }
+        }
+    }
+};
+
+/// Builds the children lists, depths and Walker state of `tree` in `out` and `t`, up to the first walk.
+static void prepare(ast const &tree, ast_layout &out, tidy_tree &t) noexcept
+{
+    u32 n = tree.count;
+    out.root = tree.root;
+    out.x.assign(n, 0);
+    out.depth.assign(n, -1);
+    out.min_x.assign(n, 0);
+    out.max_x.assign(n, 0);
+    out.max_depth.assign(n, -1);
+    out.size.assign(n, 0);
+    out.child_begin.assign(n + 1, 0);
+    out.children.clear();
+    out.children.reserve(n);
+
+    t.parent.assign(n, ast_null);
+    t.slot.assign(n, ast_null);
+    for (u32 node = 0; node < n; ++node) {
+        out.child_begin[node] = u32(out.children.size());
+        for (u32 c = tree.first_child[node]; c != ast_null; c = tree.next_sibling[c]) {
+            t.parent[c] = node;
+            t.slot[c] = u32(out.children.size());
+            out.children.push_back(c);
+        }
+    }
+    out.child_begin[n] = u32(out.children.size());
+    out.reach_right.assign(out.children.size(), 0);
+    out.reach_left.assign(out.children.size(), 0);
+
+    // Node ids are post-order with the root last, so going down through them sees every parent before its
+    // children and going up sees every child before its parent.
+    if (tree.root != ast_null) {
+        out.depth[tree.root] = 0;
+    }
+    for (u32 node = n; node-- > 0; ) {
+        if (out.depth[node] >= 0) {
+            for (u32 k = out.child_begin[node]; k < out.child_begin[node + 1]; ++k) {
+                out.depth[out.children[k]] = out.depth[node] + 1;
+            }
+        }
+    }
+
+    t.prelim.assign(n, 0);
+    t.mod.assign(n, 0);
+    t.shift.assign(n, 0);
+    t.change.assign(n, 0);
+    t.thread.assign(n, ast_null);
+    t.ancestor.resize(n);
+    for (u32 node = 0; node < n; ++node) {
+        t.ancestor[node] = node;
+    }
+}
+
+/// Places the root's children next to each other, keeping what the first walk left below them for
+/// `ast_layout_update`, then computes every position and bound.
+static void finish(ast_layout &out, tidy_tree &t) noexcept
+{
+    out.walk_prelim = t.prelim;
+    out.walk_mod = t.mod;
+    out.walk_thread = t.thread;
+
+    u32 root = out.root;
+    t.place_children(root);
+    t.prelim[root] = t.midpoint(root);
+
+    // Second walk, top-down, adding up the `mod`s of the ancestors (in `shift`, which is done with).
+    std::vector<f64> &sum = t.shift;
+    sum[root] = 0;
+    f64 left = 0;
+    for (u32 node = u32(out.x.size()); node-- > 0; ) {
+        if (out.depth[node] < 0) {
+            continue;
+        }
+        out.x[node] = t.prelim[node] + sum[node];
+        left = std::min(left, out.x[node]);
+        for (u32 k = out.child_begin[node]; k < out.child_begin[node + 1]; ++k) {
+            sum[out.children[k]] = sum[node] + t.mod[node];
+        }
+    }
+
+    // Bounds, bottom-up, with the tree moved to start at x = 0.
+    for (u32 node = 0; node < out.x.size(); ++node) {
+        if (out.depth[node] < 0) {
+            continue;
+        }
+        out.x[node] -= left;
+        out.min_x[node] = out.x[node];
+        out.max_x[node] = out.x[node] + ast_layout::node_width;
+        out.max_depth[node] = out.depth[node];
+        out.size[node] = 1;
+        u32 begin = out.child_begin[node], end = out.child_begin[node + 1];
+        for (u32 k = begin; k < end; ++k) {
+            u32 c = out.children[k];
+            out.min_x[node] = std::min(out.min_x[node], out.min_x[c]);
+            out.max_x[node] = std::max(out.max_x[node], out.max_x[c]);
+            out.max_depth[node] = std::max(out.max_depth[node], out.max_depth[c]);
+            out.size[node] += out.size[c];
+            out.reach_right[k] = k > begin ? std::max(out.reach_right[k - 1], out.max_x[c]) : out.max_x[c];
+        }
+        for (u32 k = end; k-- > begin; ) {
+            u32 c = out.children[k];
+            out.reach_left[k] = k + 1 < end ? std::min(out.reach_left[k + 1], out.min_x[c]) : out.min_x[c];
+        }
+    }
+}
+
+void ast_layout_build(ast const &tree, ast_layout &out) noexcept
+{
+    tidy_tree t(out);
+    prepare(tree, out, t);
+    if (tree.root == ast_null) {
+        return;
+    }
+    t.first_walk(0, tree.root);
+    finish(out, t);
+}
+
+/// Lowest node id in the subtree of `node`: its leftmost leaf, nodes are numbered in post-order.
+static u32 first_id(ast_layout const &layout, u32 node) noexcept
+{
+    while (layout.child_begin[node] != layout.child_begin[node + 1]) {
+        node = layout.children[layout.child_begin[node]];
+    }
+    return node;
+}
+
+u64 ast_layout_update(ast const &tree, ast_layout const &previous, ast_diff const &diff, ast_layout &out) noexcept
+{
+    tidy_tree t(out);
+    prepare(tree, out, t);
+    if (tree.root == ast_null) {
+        return 0;
+    }
+
+    bool have_previous = previous.root != ast_null && previous.walk_prelim.size() == previous.x.size() &&
+        diff.old_of_new.size() == tree.count;
+    u64 reused = 0;
+    for (u32 k = out.child_begin[tree.root]; k < out.child_begin[tree.root + 1]; ++k) {
+        u32 decl = out.children[k];
+        u32 first = first_id(out, decl);
+        u32 old_decl = have_previous ? diff.old_of_new[decl] : ast_null;
+
+        // An unchanged declaration is copied if its node ids are all the same distance from the old ones.
+        bool copy = old_decl != ast_null && diff.unchanged[decl] && previous.depth[old_decl] == 1 &&
+            decl - first == old_decl - first_id(previous, old_decl);
+        s64 delta = s64(old_decl) - s64(decl);
+        for (u32 node = first; copy && node <= decl; ++node) {
+            copy = out.depth[node] < 0 || s64(diff.old_of_new[node]) - s64(node) == delta;
+        }
+        if (!copy) {
+            t.first_walk(first, decl + 1);
+            continue;
+        }
+        for (u32 node = first; node <= decl; ++node) {
+            u32 old = u32(s64(node) + delta);
+            t.prelim[node] = previous.walk_prelim[old];
+            t.mod[node] = previous.walk_mod[old];
+            u32 thread = previous.walk_thread[old];
+            t.thread[node] = thread == ast_null ? ast_null : u32(s64(thread) - delta);
+        }
+        reused += decl + 1 - first;
+    }
+
+    finish(out, t);
+    return reused;
+}
+
+/// Index into `layout.children` of the first child of `node` that it or a sibling left of it reaches `x` or
+/// further right, i.e. the first one whose subtree could reach `x`.
+static u32 first_child_reaching(ast_layout const &layout, u32 node, f64 x) noexcept
+{
+    auto begin = layout.reach_right.begin() + layout.child_begin[node];
+    auto end = layout.reach_right.begin() + layout.child_begin[node + 1];
+    return u32(std::partition_point(begin, end, [&](f64 reach) { return reach < x; }) - layout.reach_right.begin());
+}
+
+void ast_layout_visible(ast_layout const &layout, ast_layout_rect view, f64 scale, f64 collapse_px,
+    std::vector<ast_layout_visible_node> &out) noexcept
+{
+    if (layout.root == ast_null || !intersects(layout.subtree_rect(layout.root), view)) {
+        return;
+    }
+
+    auto narrow = [&](f64 x0, f64 x1) { return (x1 - x0) * scale < collapse_px; };
+
+    // Adds the summary box of the siblings `children[first, end)`.
+    auto collapse = [&](u32 first, u32 end) {
+        u32 node = layout.children[first];
+        ast_layout_visible_node v = { node, end - first, layout.subtree_rect(node), 0 };
+        for (u32 k = first; k < end; ++k) {
+            ast_layout_rect r = layout.subtree_rect(layout.children[k]);
+            v.box.x0 = std::min(v.box.x0, r.x0);
+            v.box.x1 = std::max(v.box.x1, r.x1);
+            v.box.y1 = std::max(v.box.y1, r.y1);
+            v.size += layout.size[layout.children[k]];
+        }
+        out.push_back(v);
+    };
+
+    std::vector<u32> stack = { layout.root };
+    std::vector<u32> pushed;
+    while (!stack.empty()) {
+        u32 node = stack.back();
+        stack.pop_back();
+        out.push_back({ node, 0, {}, 1 });
+
+        // The children that can reach into the view are a run. Narrow neighbours in it are gathered until
+        // together they would be wide enough to tell apart.
+        u32 end = layout.child_begin[node + 1];
+        u32 run = 0, run_end = 0;
+        f64 run_x0 = 0, run_x1 = 0;
+        pushed.clear();
+        for (u32 k = first_child_reaching(layout, node, view.x0); k < end && layout.reach_left[k] <= view.x1; ++k) {
+            u32 c = layout.children[k];
+            bool visible = intersects(layout.subtree_rect(c), view);
+            bool fits = visible && narrow(layout.min_x[c], layout.max_x[c]);
+            if (run != run_end && (!fits || !narrow(std::min(run_x0, layout.min_x[c]), std::max(run_x1, layout.max_x[c])))) {
+                collapse(run, run_end);
+                run = run_end;
+            }
+            if (fits) {
+                if (run == run_end) {
+                    run = k;
+                    run_x0 = layout.min_x[c];
+                    run_x1 = layout.max_x[c];
+                }
+                run_end = k + 1;
+                run_x0 = std::min(run_x0, layout.min_x[c]);
+                run_x1 = std::max(run_x1, layout.max_x[c]);
+            } else if (visible) {
+                pushed.push_back(c);
+            }
+        }
+        if (run != run_end) {
+            collapse(run, run_end);
+        }
+        stack.insert(stack.end(), pushed.rbegin(), pushed.rend());
+    }
+}
+
+u32 ast_layout_node_at(ast_layout const &layout, f64 x, f64 y) noexcept
+{
+    if (layout.root == ast_null) {
+        return ast_null;
+    }
+
+    // Boxes never overlap, but subtrees do, so more than one child may have to be looked into.
+    ast_layout_rect point = { x, y, x, y };
+    std::vector<u32> stack = { layout.root };
+    while (!stack.empty()) {
+        u32 node = stack.back();
+        stack.pop_back();
+        if (!intersects(layout.subtree_rect(node), point)) {
+            continue;
+        }
+        if (intersects(layout.node_rect(node), point)) {
+            return node;
+        }
+        u32 end = layout.child_begin[node + 1];
+        for (u32 k = first_child_reaching(layout, node, x); k < end && layout.reach_left[k] <= x; ++k) {
+            stack.push_back(layout.children[k]);
+        }
+    }
+    return ast_null;
+}
+
+/// Pairs of neighbouring boxes on a row that are closer than `leaf_spacing`.
+static u64 count_overlaps(ast_layout const &layout) noexcept
+{
+    std::vector<std::pair<s32, f64>> boxes; // row, x
+    for (u32 node = 0; node < layout.x.size(); ++node) {
+        if (layout.depth[node] >= 0) {
+            boxes.push_back({ layout.depth[node], layout.x[node] });
+        }
+    }
+    std::sort(boxes.begin(), boxes.end());
+    u64 overlaps = 0;
+    for (u64 i = 1; i < boxes.size(); ++i) {
+        if (boxes[i].first == boxes[i - 1].first && boxes[i].second - boxes[i - 1].second < ast_layout::leaf_spacing - 1e-6) {
+            ++overlaps;
+        }
+    }
+    return overlaps;
+}
+
+ast_layout_benchmark_result ast_layout_benchmark(u64 nodes, u64 frames) noexcept
+{
+    ast_layout_benchmark_result result = {};
+    result.frames = frames;
+
+    compilation comp;
+    comp.source_text = generate_benchmark_program(std::max(nodes / 63, u64(1)), false); // each function is 63 nodes
+    compile_front_end(comp);
+    result.nodes = comp.tree.count;
+
+    ast_layout layout;
+    time_point_precise_t t0 = get_time_precise();
+    ast_layout_build(comp.tree, layout);
+    result.build_us = time_diff_us(t0, get_time_precise());
+    result.overlaps = count_overlaps(layout);
+
+    f64 const view_w = 1600, view_h = 1000, collapse_px = 8;
+    ast_layout_rect bounds = layout.bounds();
+    std::vector<ast_layout_visible_node> visible;
+    u64 seed = 0x9e3779b97f4a7c15ull;
+
+    for (u64 f = 0; f < frames; ++f) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        f64 cx = bounds.x0 + f64(seed >> 11) / f64(1ull << 53) * (bounds.x1 - bounds.x0);
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        f64 cy = bounds.y0 + f64(seed >> 11) / f64(1ull << 53) * (bounds.y1 - bounds.y0);
+
+        visible.clear();
+        time_point_precise_t t1 = get_time_precise();
+        ast_layout_visible(layout, { cx - view_w / 2, cy - view_h / 2, cx + view_w / 2, cy + view_h / 2 }, 1, collapse_px, visible);
+        result.zoomed_in_frame_us += time_diff_us(t1, get_time_precise());
+        result.zoomed_in_visible += visible.size();
+
+        f64 fit = std::min(view_w / std::max(bounds.x1 - bounds.x0, 1.0), view_h / std::max(bounds.y1 - bounds.y0, 1.0));
+        visible.clear();
+        time_point_precise_t t2 = get_time_precise();
+        ast_layout_visible(layout, bounds, fit, collapse_px, visible);
+        result.zoomed_out_frame_us += time_diff_us(t2, get_time_precise());
+        result.zoomed_out_visible += visible.size();
+    }
+
+    u64 divisor = std::max(frames, u64(1));
+    result.zoomed_in_frame_us /= s64(divisor);
+    result.zoomed_out_frame_us /= s64(divisor);
+    result.zoomed_in_visible /= divisor;
+    result.zoomed_out_visible /= divisor;
+    return result;
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+
+#include "primitives.hpp"
+#include "ast.hpp"
+
+struct ast_diff;
+
+struct ast_layout_rect
+{
+    f64 x0, y0, x1, y1;
+};
+
+/// @brief Where every node of an AST is drawn, in flat arrays indexed by node id, plus the per-subtree bounds
+/// that make it its own spatial index. A subtree lies entirely inside its bounding box, so finding what
+/// intersects a rectangle only descends into subtrees whose boxes intersect it. Sibling subtrees are in order
+/// left to right, but their boxes can overlap (a shallow subtree tucks in above a deeper neighbour), so each
+/// child slot also records how far its left siblings reach right and its right siblings reach left: both only
+/// grow along the children, and binary-searching them finds the siblings that can reach a given x.
+/// Nodes are `node_width` x `node_height` boxes, row `depth` is at y = depth * `row_height`.
+struct ast_layout
+{
+    static constexpr f64 node_width = 120;
+    static constexpr f64 node_height = 50;
+    static constexpr f64 row_height = 100;
+    static constexpr f64 leaf_spacing = 150;
+
+    u32 root = ast_null;
+
+    std::vector<f64> x;             // left edge
+    std::vector<s32> depth;         // -1: not reachable from the root (left over from a parse error)
+    std::vector<f64> min_x;         // subtree bounds, the right edge is `max_x`
+    std::vector<f64> max_x;
+    std::vector<s32> max_depth;     // deepest row of the subtree
+    std::vector<u32> size;          // nodes in the subtree
+    std::vector<u32> child_begin;   // `children[child_begin[n]..child_begin[n + 1]]`, left to right
+    std::vector<u32> children;
+    std::vector<f64> reach_right;   // per child slot: max `max_x` of the siblings up to and including it
+    std::vector<f64> reach_left;    // per child slot: min `min_x` of the siblings from it on
+
+    // Walker state of the root's children's subtrees before they were placed next to each other, which only
+    // depends on each subtree itself, for `ast_layout_update` to reuse.
+    std::vector<f64> walk_prelim;
+    std::vector<f64> walk_mod;
+    std::vector<u32> walk_thread;
+
+    ast_layout_rect node_rect(u32 node) const noexcept;
+    ast_layout_rect subtree_rect(u32 node) const noexcept; // from the edge above `node` to its deepest row
+    f64 edge_y(u32 node) const noexcept;    // of the horizontal edge joining `node` to its children
+    ast_layout_rect bounds() const noexcept; // of the whole tree, all zeros if it is empty
+};
+
+/// Lays `tree` out as a tidy tree (Walker's algorithm, in the linear-time form of Buchheim, Juenger and
+/// Leipert): parents centered over their children, subtrees pushed as close as their contours allow with
+/// neighbouring boxes at least `leaf_spacing` apart on every row, small subtrees between large ones spaced
+/// out evenly, and a subtree drawn the same wherever it appears. No recursion, so any depth of nesting is
+/// fine.
+void ast_layout_build(ast const &tree, ast_layout &out) noexcept;
+
+/// `ast_layout_build` for a new version of the tree `previous` was built for, with `diff` from that tree to
+/// `tree`. Top-level declarations that did not change take their first walk from `previous` instead of
+/// redoing it, so the layout work grows with what the edit changed; the rest is linear passes. Gives exactly
+/// what `ast_layout_build` would. Returns how many nodes were reused.
+u64 ast_layout_update(ast const &tree, ast_layout const &previous, ast_diff const &diff, ast_layout &out) noexcept;
+
+struct ast_layout_visible_node
+{
+    u32 node;
+    u32 collapsed;                  // 0, or how many siblings from `node` on are drawn as one summary box instead
+    ast_layout_rect box;            // the summary box, when `collapsed`
+    u32 size;                       // nodes under the summary box
+};
+
+/// Appends to `out`, parents before children, the nodes whose `subtree_rect` intersects `view`: everything
+/// such a node draws (its box, the edge up to its parent's and the edges down to its children's) lies inside
+/// it. At `scale` pixels per layout unit, siblings whose subtrees together are narrower than `collapse_px`
+/// pixels are reported once, as a summary box, and nothing below them is visited, so the work is bounded by
+/// what fits on screen rather than by the size of the tree.
+void ast_layout_visible(ast_layout const &layout, ast_layout_rect view, f64 scale, f64 collapse_px,
+    std::vector<ast_layout_visible_node> &out) noexcept;
+
+/// The node whose box contains (`x`, `y`), or `ast_null`.
+u32 ast_layout_node_at(ast_layout const &layout, f64 x, f64 y) noexcept;
+
+struct ast_layout_benchmark_result
+{
+    u64 nodes;
+    s64 build_us;
+    u64 overlaps;                   // neighbouring boxes on a row closer than `leaf_spacing`, should be 0
+    u64 frames;                     // viewports queried per zoom level
+    s64 zoomed_in_frame_us;         // average `ast_layout_visible` for a window-sized view at 1:1
+    s64 zoomed_out_frame_us;        // ... showing the whole tree
+    u64 zoomed_in_visible;          // average nodes reported per frame
+    u64 zoomed_out_visible;
+};
+
+/// Lays out the AST of a generated source of about `nodes` nodes, checks that no boxes overlap, and times what
+/// a renderer does per frame:
+/// `ast_layout_visible` over a 1600x1000 pixel viewport panned to random places at 1:1, and fitting the
+/// whole tree.
+ast_layout_benchmark_result ast_layout_benchmark(u64 nodes = 500000, u64 frames = 200) noexcept;
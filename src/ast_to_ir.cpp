@@ -0,0 +1,893 @@
+#include <cassert>
+#include <limits>
+#include <unordered_map>
+#include <utility>
+
+#include "util.hpp"
+#include "lexer.hpp"
+#include "ast.hpp"
+#include "intern.hpp"
+#include "parser.hpp"
+#include "ir.hpp"
+
+#include "ast_to_ir.hpp"
+
+/// Bits kept when a value is stored to a variable of `type`, 0 if no truncation is needed.
+static s32 type_bits(ast_type type) noexcept
+{
+    switch (type) {
+        case ast_type::char_:  return 8;
+        case ast_type::short_: return 16;
+        case ast_type::int_:   return 32;
+        default:               return 0;
+    }
+}
+
+class ir_lowering
+{
+public:
+    ir_lowering(std::string_view text, token_buffer const &tokens, ast const &tree, intern_table const &names,
+                ir_module &out, std::vector<std::string> &errors, cancel_token const *cancel) noexcept
+        : m_text(text), m_tokens(tokens), m_tree(tree), m_names(names), m_module(out), m_errors(errors), m_cancel(cancel)
+    {
+    }
+
+    void lower_translation_unit() noexcept;
+
+private:
+    struct function_info
+    {
+        u32 index;          // into m_module.functions, `ir_null` until defined
+        u32 param_count;
+        ast_type return_type;
+        u32 node;           // the definition, or the first declaration
+    };
+
+    struct global_info
+    {
+        u32 index;
+        ast_type type;
+    };
+
+    struct local_info
+    {
+        u32 name;
+        u32 slot;
+        ast_type type;
+    };
+
+    struct loop_info
+    {
+        std::vector<u32> breaks;     // jumps to patch to the loop exit
+        std::vector<u32> continues;  // jumps to patch to the continue target
+    };
+
+    static u32 constexpr ir_null = u32(-1);
+
+    std::string_view m_text;
+    token_buffer const &m_tokens;
+    ast const &m_tree;
+    intern_table const &m_names;
+    ir_module &m_module;
+    std::vector<std::string> &m_errors;
+    cancel_token const *m_cancel;
+
+    std::unordered_map<u32, function_info> m_functions;   // by name id
+    std::unordered_map<u32, global_info> m_globals;       // by name id
+    std::unordered_map<std::string, u32> m_string_ids;
+
+    // Per function state.
+    ir_function *m_fn = nullptr;
+    ast_type m_return_type = ast_type::none;
+    std::vector<local_info> m_locals;     // innermost scope last
+    std::vector<u64> m_scope_starts;
+    std::vector<loop_info> m_loops;
+    u32 m_next_reg = 0;
+    u32 m_first_temp = 0;
+    u32 m_node = ast_null;                // innermost statement or expression being lowered, see `ir_function::nodes`
+
+    void error(u32 node, std::string const &what) noexcept
+    {
+        u32 tok = m_tree.tokens[node];
+        m_errors.push_back(source_location_str(m_text, m_tokens.offsets[tok]) + ": " + what);
+    }
+
+    token_kind op_kind(u32 node) const noexcept
+    {
+        return m_tokens.kinds[m_tree.tokens[node]];
+    }
+
+    std::string_view spelling(u32 node) const noexcept
+    {
+        return m_tokens.spelling(m_text, m_tree.tokens[node]);
+    }
+
+    std::string name_str(u32 node) const noexcept
+    {
+        return std::string(m_names.str(m_tree.values[node]));
+    }
+
+    u32 emit(ir_op op, u32 a = 0, u32 b = 0, u32 c = 0, s32 imm = 0) noexcept
+    {
+        m_fn->code.push_back({ op, 0, u16(a), u16(b), u16(c), imm });
+        m_fn->nodes.push_back(m_node);
+        return u32(m_fn->code.size() - 1);
+    }
+
+    u32 here() const noexcept
+    {
+        return u32(m_fn->code.size());
+    }
+
+    void patch(u32 jump_idx, u32 target) noexcept
+    {
+        m_fn->code[jump_idx].imm = s32(target);
+    }
+
+    u32 new_reg() noexcept
+    {
+        u32 r = m_next_reg++;
+        if (m_next_reg > m_fn->register_count) {
+            m_fn->register_count = m_next_reg;
+        }
+        return r;
+    }
+
+    /// Temporaries are scoped to a statement, registers are recycled once it is lowered.
+    void end_statement() noexcept
+    {
+        m_next_reg = m_first_temp;
+    }
+
+    void convert(u32 reg, ast_type type) noexcept
+    {
+        if (s32 bits = type_bits(type); bits != 0) {
+            emit(ir_op::sext, reg, reg, 0, bits);
+        }
+    }
+
+    void push_scope() noexcept
+    {
+        m_scope_starts.push_back(m_locals.size());
+    }
+
+    void pop_scope() noexcept
+    {
+        m_locals.resize(m_scope_starts.back());
+        m_scope_starts.pop_back();
+    }
+
+    local_info const *find_local(u32 name) const noexcept
+    {
+        for (u64 i = m_locals.size(); i-- > 0;) {
+            if (m_locals[i].name == name) {
+                return &m_locals[i];
+            }
+        }
+        return nullptr;
+    }
+
+    bool eval_constant(u32 node, s64 &out) noexcept;
+    void declare_global(u32 node) noexcept;
+    void declare_function(u32 node) noexcept;
+    void lower_function(u32 node) noexcept;
+
+    void lower_statement(u32 node) noexcept;
+    void lower_local_decl(u32 node) noexcept;
+    void lower_loop_body(u32 body, loop_info &loop) noexcept;
+    void lower_condition_jump(u32 cond, std::vector<u32> &false_jumps) noexcept;
+
+    u32 lower_expr(u32 node) noexcept;
+    u32 lower_literal(u32 node) noexcept;
+    u32 lower_string(u32 node) noexcept;
+    u32 lower_load(u32 ident) noexcept;
+    void lower_store(u32 ident, u32 reg) noexcept;
+    u32 lower_call(u32 node) noexcept;
+    u32 lower_binary(u32 node) noexcept;
+    u32 lower_logical(u32 node, bool is_and) noexcept;
+    u32 lower_assign(u32 node) noexcept;
+    u32 lower_increment(u32 node, bool postfix) noexcept;
+};
+
+static ir_op binary_op_for(token_kind kind) noexcept
+{
+    switch (kind) {
+        case token_kind::plus:                  case token_kind::plus_equal:            return ir_op::add;
+        case token_kind::minus:                 case token_kind::minus_equal:           return ir_op::sub;
+        case token_kind::star:                  case token_kind::star_equal:            return ir_op::mul;
+        case token_kind::slash:                 case token_kind::slash_equal:           return ir_op::div;
+        case token_kind::percent:               case token_kind::percent_equal:         return ir_op::mod;
+        case token_kind::ampersand:             case token_kind::ampersand_equal:       return ir_op::bit_and;
+        case token_kind::pipe:                  case token_kind::pipe_equal:            return ir_op::bit_or;
+        case token_kind::caret:                 case token_kind::caret_equal:           return ir_op::bit_xor;
+        case token_kind::less_less:             case token_kind::less_less_equal:       return ir_op::shl;
+        case token_kind::greater_greater:       case token_kind::greater_greater_equal: return ir_op::shr;
+        case token_kind::equal_equal:   return ir_op::eq;
+        case token_kind::exclaim_equal: return ir_op::ne;
+        case token_kind::less:          return ir_op::lt;
+        case token_kind::less_equal:    return ir_op::le;
+        case token_kind::greater:       return ir_op::gt;
+        case token_kind::greater_equal: return ir_op::ge;
+        default:                        return ir_op::nop;
+    }
+}
+
+// DECLARATIONS
+
+/// Folds the integer constant expressions allowed in global initializers.
+bool ir_lowering::eval_constant(u32 node, s64 &out) noexcept
+{
+    switch (m_tree.kinds[node]) {
+        case ast_kind::int_literal: {
+            u64 value = 0;
+            parse_integer_literal(spelling(node), value);
+            out = s64(value);
+            return true;
+        }
+        case ast_kind::char_literal:
+            return parse_char_literal(spelling(node), out);
+        case ast_kind::unary: {
+            s64 v;
+            if (!eval_constant(m_tree.first_child[node], v)) return false;
+            switch (op_kind(node)) {
+                case token_kind::minus:   out = s64(0ull - u64(v)); return true;
+                case token_kind::plus:    out = v; return true;
+                case token_kind::tilde:   out = ~v; return true;
+                case token_kind::exclaim: out = !v; return true;
+                default:                  return false;
+            }
+        }
+        case ast_kind::binary: {
+            s64 l, r;
+            if (!eval_constant(m_tree.child(node, 0), l) || !eval_constant(m_tree.child(node, 1), r)) return false;
+            switch (op_kind(node)) {
+                case token_kind::plus:                out = s64(u64(l) + u64(r)); return true;
+                case token_kind::minus:               out = s64(u64(l) - u64(r)); return true;
+                case token_kind::star:                out = s64(u64(l) * u64(r)); return true;
+                case token_kind::slash:               if (r == 0 || (r == -1 && l == std::numeric_limits<s64>::min())) return false; out = l / r; return true;
+                case token_kind::percent:             if (r == 0 || (r == -1 && l == std::numeric_limits<s64>::min())) return false; out = l % r; return true;
+                case token_kind::ampersand:           out = l & r; return true;
+                case token_kind::pipe:                out = l | r; return true;
+                case token_kind::caret:               out = l ^ r; return true;
+                case token_kind::less_less:           out = s64(u64(l) << (r & 63)); return true;
+                case token_kind::greater_greater:     out = l >> (r & 63); return true;
+                case token_kind::equal_equal:         out = l == r; return true;
+                case token_kind::exclaim_equal:       out = l != r; return true;
+                case token_kind::less:                out = l < r; return true;
+                case token_kind::less_equal:          out = l <= r; return true;
+                case token_kind::greater:             out = l > r; return true;
+                case token_kind::greater_equal:       out = l >= r; return true;
+                case token_kind::ampersand_ampersand: out = l && r; return true;
+                case token_kind::pipe_pipe:           out = l || r; return true;
+                default:                              return false;
+            }
+        }
+        case ast_kind::ternary: {
+            s64 c, t, f;
+            if (!eval_constant(m_tree.child(node, 0), c) || !eval_constant(m_tree.child(node, 1), t) || !eval_constant(m_tree.child(node, 2), f)) return false;
+            out = c ? t : f;
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+void ir_lowering::declare_global(u32 node) noexcept
+{
+    u32 name = m_tree.values[node];
+    u32 init = m_tree.first_child[node];
+
+    s64 value = 0;
+    if (init != ast_null && !eval_constant(init, value)) {
+        error(init, "initializer of '" + name_str(node) + "' is not a constant expression");
+        return;
+    }
+    if (s32 bits = type_bits(m_tree.types[node]); bits != 0) {
+        u32 shift = u32(64 - bits);
+        value = s64(u64(value) << shift) >> shift;
+    }
+
+    if (m_functions.contains(name)) {
+        error(node, "'" + name_str(node) + "' redeclared as a different kind of symbol");
+        return;
+    }
+
+    auto it = m_globals.find(name);
+    if (it == m_globals.end()) {
+        m_globals[name] = { u32(m_module.globals.size()), m_tree.types[node] };
+        m_module.globals.push_back({ name_str(node), value });
+    }
+    else if (init != ast_null) {
+        // Tentative definitions (`int x; int x = 1;`) are fine, the initialized one wins.
+        m_module.globals[it->second.index].initial_value = value;
+    }
+}
+
+void ir_lowering::declare_function(u32 node) noexcept
+{
+    u32 name = m_tree.values[node];
+    u32 param_count = 0;
+    bool has_body = false;
+    for (u32 c = m_tree.first_child[node]; c != ast_null; c = m_tree.next_sibling[c]) {
+        if (m_tree.kinds[c] == ast_kind::param_decl) {
+            ++param_count;
+        } else {
+            has_body = true;
+        }
+    }
+
+    if (m_globals.contains(name)) {
+        error(node, "'" + name_str(node) + "' redeclared as a different kind of symbol");
+        return;
+    }
+
+    auto it = m_functions.find(name);
+    if (it == m_functions.end()) {
+        it = m_functions.emplace(name, function_info{ ir_null, param_count, m_tree.types[node], node }).first;
+    }
+    else if (it->second.param_count != param_count) {
+        error(node, "conflicting declarations of '" + name_str(node) + "'");
+        return;
+    }
+
+    if (has_body) {
+        if (it->second.index != ir_null) {
+            error(node, "redefinition of '" + name_str(node) + "'");
+            return;
+        }
+        it->second.index = u32(m_module.functions.size());
+        it->second.node = node;
+        m_module.functions.emplace_back();
+        m_module.functions.back().name = name_str(node);
+        m_module.functions.back().param_count = param_count;
+    }
+}
+
+void ir_lowering::lower_translation_unit() noexcept
+{
+    u32 root = m_tree.root;
+    if (root == ast_null) {
+        return;
+    }
+
+    // Declare everything first so functions can call ones defined later in the file.
+    for (u32 decl = m_tree.first_child[root]; decl != ast_null; decl = m_tree.next_sibling[decl]) {
+        if (m_tree.kinds[decl] == ast_kind::function_decl) {
+            declare_function(decl);
+        } else {
+            declare_global(decl);
+        }
+    }
+
+    for (u32 decl = m_tree.first_child[root]; decl != ast_null; decl = m_tree.next_sibling[decl]) {
+        if (m_tree.kinds[decl] != ast_kind::function_decl) {
+            continue;
+        }
+        if (cancelled(m_cancel)) {
+            return;
+        }
+        auto it = m_functions.find(m_tree.values[decl]);
+        if (it != m_functions.end() && it->second.index != ir_null && it->second.node == decl) {
+            lower_function(decl);
+        }
+    }
+
+    auto main_it = m_functions.find(m_names.find("main"));
+    if (main_it != m_functions.end() && main_it->second.index != ir_null) {
+        m_module.main_index = main_it->second.index;
+    }
+}
+
+void ir_lowering::lower_function(u32 node) noexcept
+{
+    function_info const &info = m_functions[m_tree.values[node]];
+    m_fn = &m_module.functions[info.index];
+    m_node = node;
+    m_return_type = info.return_type;
+    m_locals.clear();
+    m_scope_starts.clear();
+    m_loops.clear();
+
+    m_fn->register_count = info.param_count;
+    m_next_reg = m_first_temp = info.param_count;
+
+    push_scope();
+
+    u32 param_reg = 0;
+    u32 body = ast_null;
+    for (u32 c = m_tree.first_child[node]; c != ast_null; c = m_tree.next_sibling[c]) {
+        if (m_tree.kinds[c] != ast_kind::param_decl) {
+            body = c;
+            continue;
+        }
+        // Parameters are spilled to slots like any other local, mem2reg puts them back in registers.
+        u32 slot = m_fn->slot_count++;
+        convert(param_reg, m_tree.types[c]);
+        emit(ir_op::store_local, param_reg, 0, 0, s32(slot));
+        m_locals.push_back({ m_tree.values[c], slot, m_tree.types[c] });
+        ++param_reg;
+    }
+
+    lower_statement(body);
+
+    // Falling off the end returns 0, which is what C99 specifies for main.
+    u32 zero = new_reg();
+    emit(ir_op::mov_imm, zero, 0, 0, 0);
+    emit(ir_op::ret, zero);
+
+    pop_scope();
+    m_fn = nullptr;
+    m_node = ast_null;
+}
+
+// STATEMENTS
+
+void ir_lowering::lower_local_decl(u32 node) noexcept
+{
+    u32 outer = std::exchange(m_node, node);
+
+    u32 slot = m_fn->slot_count++;
+    u32 init = m_tree.first_child[node];
+
+    u32 value;
+    if (init != ast_null) {
+        value = lower_expr(init);
+        convert(value, m_tree.types[node]);
+    } else {
+        // Uninitialized locals read as 0 so every execution engine agrees on what such a program prints.
+        value = new_reg();
+        emit(ir_op::mov_imm, value, 0, 0, 0);
+    }
+    emit(ir_op::store_local, value, 0, 0, s32(slot));
+
+    // In scope only after its own initializer, as in C.
+    m_locals.push_back({ m_tree.values[node], slot, m_tree.types[node] });
+    m_node = outer;
+}
+
+/// Emits the jumps taken when `cond` is false, to be patched by the caller.
+void ir_lowering::lower_condition_jump(u32 cond, std::vector<u32> &false_jumps) noexcept
+{
+    u32 r = lower_expr(cond);
+    false_jumps.push_back(emit(ir_op::jump_if_not, r));
+    end_statement();
+}
+
+void ir_lowering::lower_loop_body(u32 body, loop_info &loop) noexcept
+{
+    m_loops.emplace_back();
+    lower_statement(body);
+    loop = std::move(m_loops.back());
+    m_loops.pop_back();
+}
+
+void ir_lowering::lower_statement(u32 node) noexcept
+{
+    u32 outer = std::exchange(m_node, node);
+
+    switch (m_tree.kinds[node]) {
+        case ast_kind::compound_stmt:
+            push_scope();
+            for (u32 c = m_tree.first_child[node]; c != ast_null; c = m_tree.next_sibling[c]) {
+                lower_statement(c);
+            }
+            pop_scope();
+            break;
+
+        case ast_kind::decl_stmt:
+            for (u32 c = m_tree.first_child[node]; c != ast_null; c = m_tree.next_sibling[c]) {
+                lower_local_decl(c);
+                end_statement();
+            }
+            break;
+
+        case ast_kind::expr_stmt:
+            lower_expr(m_tree.first_child[node]);
+            end_statement();
+            break;
+
+        case ast_kind::empty:
+            break;
+
+        case ast_kind::if_stmt: {
+            std::vector<u32> to_else;
+            lower_condition_jump(m_tree.child(node, 0), to_else);
+            lower_statement(m_tree.child(node, 1));
+
+            u32 otherwise = m_tree.child(node, 2);
+            if (otherwise == ast_null) {
+                for (u32 j : to_else) patch(j, here());
+                break;
+            }
+            u32 to_end = emit(ir_op::jump);
+            for (u32 j : to_else) patch(j, here());
+            lower_statement(otherwise);
+            patch(to_end, here());
+            break;
+        }
+
+        case ast_kind::while_stmt: {
+            u32 top = here();
+            std::vector<u32> to_exit;
+            lower_condition_jump(m_tree.child(node, 0), to_exit);
+
+            loop_info loop;
+            lower_loop_body(m_tree.child(node, 1), loop);
+            patch(emit(ir_op::jump), top);
+
+            for (u32 j : loop.continues) patch(j, top);
+            for (u32 j : loop.breaks) patch(j, here());
+            for (u32 j : to_exit) patch(j, here());
+            break;
+        }
+
+        case ast_kind::do_stmt: {
+            u32 top = here();
+            loop_info loop;
+            lower_loop_body(m_tree.child(node, 0), loop);
+
+            u32 cond_start = here();
+            u32 r = lower_expr(m_tree.child(node, 1));
+            patch(emit(ir_op::jump_if, r), top);
+            end_statement();
+
+            for (u32 j : loop.continues) patch(j, cond_start);
+            for (u32 j : loop.breaks) patch(j, here());
+            break;
+        }
+
+        case ast_kind::for_stmt: {
+            push_scope();
+            lower_statement(m_tree.child(node, 0));
+
+            u32 top = here();
+            std::vector<u32> to_exit;
+            u32 cond = m_tree.child(node, 1);
+            if (m_tree.kinds[cond] != ast_kind::empty) {
+                lower_condition_jump(cond, to_exit);
+            }
+
+            loop_info loop;
+            lower_loop_body(m_tree.child(node, 3), loop);
+
+            u32 step_start = here();
+            u32 step = m_tree.child(node, 2);
+            if (m_tree.kinds[step] != ast_kind::empty) {
+                lower_expr(step);
+                end_statement();
+            }
+            patch(emit(ir_op::jump), top);
+
+            for (u32 j : loop.continues) patch(j, step_start);
+            for (u32 j : loop.breaks) patch(j, here());
+            for (u32 j : to_exit) patch(j, here());
+            pop_scope();
+            break;
+        }
+
+        case ast_kind::return_stmt: {
+            u32 value = m_tree.first_child[node];
+            u32 r;
+            if (value != ast_null) {
+                if (m_return_type == ast_type::void_) {
+                    error(node, "void function should not return a value");
+                }
+                r = lower_expr(value);
+                convert(r, m_return_type);
+            } else {
+                r = new_reg();
+                emit(ir_op::mov_imm, r, 0, 0, 0);
+            }
+            emit(ir_op::ret, r);
+            end_statement();
+            break;
+        }
+
+        case ast_kind::break_stmt:
+        case ast_kind::continue_stmt:
+            if (m_loops.empty()) {
+                error(node, std::string(spelling(node)) + " statement not within a loop");
+                break;
+            }
+            if (m_tree.kinds[node] == ast_kind::break_stmt) {
+                m_loops.back().breaks.push_back(emit(ir_op::jump));
+            } else {
+                m_loops.back().continues.push_back(emit(ir_op::jump));
+            }
+            break;
+
+        default:
+            error(node, make_str("unexpected %s in statement position", ast_kind_name(m_tree.kinds[node])));
+            break;
+    }
+
+    m_node = outer;
+}
+
+// EXPRESSIONS
+
+u32 ir_lowering::lower_literal(u32 node) noexcept
+{
+    s64 value = 0;
+    if (m_tree.kinds[node] == ast_kind::char_literal) {
+        parse_char_literal(spelling(node), value);
+    } else {
+        u64 v = 0;
+        parse_integer_literal(spelling(node), v);
+        value = s64(v);
+    }
+
+    u32 r = new_reg();
+    if (value >= std::numeric_limits<s32>::min() && value <= std::numeric_limits<s32>::max()) {
+        emit(ir_op::mov_imm, r, 0, 0, s32(value));
+    } else {
+        emit(ir_op::mov_wide, r, 0, 0, s32(m_module.constants.size()));
+        m_module.constants.push_back(value);
+    }
+    return r;
+}
+
+u32 ir_lowering::lower_string(u32 node) noexcept
+{
+    std::string bytes;
+    u32 first_tok = m_tree.tokens[node];
+    for (u32 i = 0; i < m_tree.values[node]; ++i) {
+        std::string piece;
+        if (!decode_string_literal(m_tokens.spelling(m_text, first_tok + i), piece)) {
+            error(node, "malformed string literal");
+        }
+        bytes += piece;
+    }
+
+    auto [it, inserted] = m_string_ids.try_emplace(bytes, u32(m_module.strings.size()));
+    if (inserted) {
+        m_module.strings.push_back(std::move(bytes));
+    }
+
+    u32 r = new_reg();
+    emit(ir_op::load_string, r, 0, 0, s32(it->second));
+    return r;
+}
+
+u32 ir_lowering::lower_load(u32 ident) noexcept
+{
+    u32 name = m_tree.values[ident];
+    u32 r = new_reg();
+
+    if (local_info const *local = find_local(name)) {
+        emit(ir_op::load_local, r, 0, 0, s32(local->slot));
+    }
+    else if (auto it = m_globals.find(name); it != m_globals.end()) {
+        emit(ir_op::load_global, r, 0, 0, s32(it->second.index));
+    }
+    else {
+        error(ident, m_functions.contains(name) ? "function '" + name_str(ident) + "' used as a value"
+                                                : "use of undeclared identifier '" + name_str(ident) + "'");
+    }
+    return r;
+}
+
+/// Converts `reg` to the variable's type in place and stores it.
+void ir_lowering::lower_store(u32 ident, u32 reg) noexcept
+{
+    u32 name = m_tree.values[ident];
+
+    if (local_info const *local = find_local(name)) {
+        convert(reg, local->type);
+        emit(ir_op::store_local, reg, 0, 0, s32(local->slot));
+    }
+    else if (auto it = m_globals.find(name); it != m_globals.end()) {
+        convert(reg, it->second.type);
+        emit(ir_op::store_global, reg, 0, 0, s32(it->second.index));
+    }
+    else {
+        error(ident, "use of undeclared identifier '" + name_str(ident) + "'");
+    }
+}
+
+u32 ir_lowering::lower_call(u32 node) noexcept
+{
+    u32 argc = m_tree.child_count(node);
+
+    // Arguments are evaluated into their own temporaries then copied into a consecutive block.
+    u32 base = m_next_reg;
+    for (u32 i = 0; i < argc; ++i) {
+        new_reg();
+    }
+    u32 i = 0;
+    for (u32 arg = m_tree.first_child[node]; arg != ast_null; arg = m_tree.next_sibling[arg], ++i) {
+        u32 r = lower_expr(arg);
+        emit(ir_op::mov, base + i, r);
+    }
+
+    u32 dest = argc > 0 ? base : new_reg();
+    std::string_view name = m_names.str(m_tree.values[node]);
+
+    auto it = m_functions.find(m_tree.values[node]);
+    if (it != m_functions.end() && it->second.index != ir_null) {
+        if (it->second.param_count != argc) {
+            error(node, make_str("'%s' expects %u arguments, %u given", name_str(node).c_str(), it->second.param_count, argc));
+        }
+        emit(ir_op::call, dest, base, argc, s32(it->second.index));
+    }
+    else if (name == "putchar" || name == "printf") {
+        ir_builtin builtin = name == "putchar" ? ir_builtin::putchar_ : ir_builtin::printf_;
+        emit(ir_op::call_builtin, dest, base, argc, s32(builtin));
+    }
+    else {
+        error(node, it != m_functions.end() ? "function '" + name_str(node) + "' is declared but never defined"
+                                            : "call to undeclared function '" + name_str(node) + "'");
+    }
+    return dest;
+}
+
+u32 ir_lowering::lower_logical(u32 node, bool is_and) noexcept
+{
+    u32 result = new_reg();
+    u32 lhs = lower_expr(m_tree.child(node, 0));
+
+    // && yields 0 as soon as lhs is false, || yields 1 as soon as lhs is true.
+    emit(ir_op::mov_imm, result, 0, 0, is_and ? 0 : 1);
+    u32 short_circuit = emit(is_and ? ir_op::jump_if_not : ir_op::jump_if, lhs);
+
+    u32 rhs = lower_expr(m_tree.child(node, 1));
+    u32 tmp = new_reg();
+    emit(ir_op::log_not, tmp, rhs);
+    emit(ir_op::log_not, result, tmp);
+
+    patch(short_circuit, here());
+    return result;
+}
+
+u32 ir_lowering::lower_binary(u32 node) noexcept
+{
+    token_kind kind = op_kind(node);
+    if (kind == token_kind::ampersand_ampersand || kind == token_kind::pipe_pipe) {
+        return lower_logical(node, kind == token_kind::ampersand_ampersand);
+    }
+
+    u32 lhs = lower_expr(m_tree.child(node, 0));
+
+    // `x + 5` and `x - 5` are common enough to get an immediate form.
+    u32 rhs_node = m_tree.child(node, 1);
+    s64 constant;
+    if ((kind == token_kind::plus || kind == token_kind::minus) && eval_constant(rhs_node, constant) && constant > std::numeric_limits<s32>::min() && constant <= std::numeric_limits<s32>::max()) {
+        u32 r = new_reg();
+        emit(ir_op::add_imm, r, lhs, 0, s32(kind == token_kind::plus ? constant : -constant));
+        return r;
+    }
+
+    u32 rhs = lower_expr(rhs_node);
+    u32 r = new_reg();
+    emit(binary_op_for(kind), r, lhs, rhs);
+    return r;
+}
+
+u32 ir_lowering::lower_assign(u32 node) noexcept
+{
+    u32 target = m_tree.child(node, 0);
+    token_kind kind = op_kind(node);
+
+    u32 value;
+    if (kind == token_kind::equal) {
+        value = lower_expr(m_tree.child(node, 1));
+    } else {
+        u32 current = lower_load(target);
+        u32 rhs = lower_expr(m_tree.child(node, 1));
+        value = new_reg();
+        emit(binary_op_for(kind), value, current, rhs);
+    }
+    lower_store(target, value);
+    return value;
+}
+
+u32 ir_lowering::lower_increment(u32 node, bool postfix) noexcept
+{
+    u32 target = m_tree.first_child[node];
+    s32 delta = op_kind(node) == token_kind::plus_plus ? 1 : -1;
+
+    u32 old_value = lower_load(target);
+    u32 new_value = new_reg();
+    emit(ir_op::add_imm, new_value, old_value, 0, delta);
+    lower_store(target, new_value);
+    return postfix ? old_value : new_value;
+}
+
+u32 ir_lowering::lower_expr(u32 node) noexcept
+{
+    // Restored by hand rather than on scope exit, this recursion is as deep as the expressions are nested.
+    u32 outer = std::exchange(m_node, node);
+    u32 result;
+
+    switch (m_tree.kinds[node]) {
+        case ast_kind::int_literal:
+        case ast_kind::char_literal:
+            result = lower_literal(node);
+            break;
+
+        case ast_kind::string_literal:
+            result = lower_string(node);
+            break;
+
+        case ast_kind::identifier:
+            result = lower_load(node);
+            break;
+
+        case ast_kind::call:
+            result = lower_call(node);
+            break;
+
+        case ast_kind::unary: {
+            token_kind kind = op_kind(node);
+            if (kind == token_kind::plus_plus || kind == token_kind::minus_minus) {
+                result = lower_increment(node, false);
+                break;
+            }
+            u32 operand = lower_expr(m_tree.first_child[node]);
+            if (kind == token_kind::plus) {
+                result = operand;
+                break;
+            }
+            result = new_reg();
+            ir_op op = kind == token_kind::minus ? ir_op::neg : kind == token_kind::tilde ? ir_op::bit_not : ir_op::log_not;
+            emit(op, result, operand);
+            break;
+        }
+
+        case ast_kind::postfix:
+            result = lower_increment(node, true);
+            break;
+
+        case ast_kind::binary:
+            result = lower_binary(node);
+            break;
+
+        case ast_kind::assign:
+            result = lower_assign(node);
+            break;
+
+        case ast_kind::ternary: {
+            result = new_reg();
+            u32 cond = lower_expr(m_tree.child(node, 0));
+            u32 to_false = emit(ir_op::jump_if_not, cond);
+
+            emit(ir_op::mov, result, lower_expr(m_tree.child(node, 1)));
+            u32 to_end = emit(ir_op::jump);
+
+            patch(to_false, here());
+            emit(ir_op::mov, result, lower_expr(m_tree.child(node, 2)));
+            patch(to_end, here());
+            break;
+        }
+
+        default:
+            error(node, make_str("unexpected %s in expression", ast_kind_name(m_tree.kinds[node])));
+            result = new_reg();
+            break;
+    }
+
+    m_node = outer;
+    return result;
+}
+
+bool ast_to_ir(std::string_view text, token_buffer const &tokens, ast const &tree, intern_table const &names,
+               ir_module &out, std::vector<std::string> &errors, cancel_token const *cancel) noexcept
+{
+    out = {};
+    u64 errors_before = errors.size();
+
+    ir_lowering lowering(text, tokens, tree, names, out, errors, cancel);
+    lowering.lower_translation_unit();
+    if (cancelled(cancel)) {
+        return false;
+    }
+
+    for (ir_function const &fn : out.functions) {
+        if (fn.register_count > ir_max_registers) {
+            errors.push_back(make_str("function '%s' needs %u registers, more than the IR can encode", fn.name.c_str(), fn.register_count));
+        }
+    }
+
+    return errors.size() == errors_before;
+}
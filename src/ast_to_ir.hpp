@@ -0,0 +1,20 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct ast;
+struct token_buffer;
+struct intern_table;
+struct ir_module;
+struct cancel_token;
+
+/// Lowers the AST parsed from `tokens` (lexed from `text`) to the custom IR, replacing `out`.
+/// The output is deliberately naive: every local variable lives in a frame slot and every expression
+/// evaluates into a fresh temporary register, leaving cleanup to the optimization passes.
+/// `putchar` and `printf` resolve to runtime builtins unless the program defines them.
+/// Errors are appended to `errors` as "line:col: message", returns false if there were any.
+/// `cancel` is polled before each function, a cancelled lowering stops there and returns false.
+bool ast_to_ir(std::string_view text, token_buffer const &tokens, ast const &tree, intern_table const &names,
+               ir_module &out, std::vector<std::string> &errors, cancel_token const *cancel = nullptr) noexcept;
@@ -0,0 +1,855 @@
+#include <algorithm>
+#include <unordered_map>
+
+#include "util.hpp"
+#include "compiler.hpp"
+
+#include "cfg_layout.hpp"
+
+static u32 constexpr none = u32(-1);
+
+/// The lines of the listing of `fn` (see `ir_function_to_string`) below its header.
+static void listing_lines(ir_module const &module, ir_function const &fn, std::vector<std::string> &out) noexcept
+{
+    out.resize(fn.code.size());
+    for (u64 i = 0; i < fn.code.size(); ++i) {
+        out[i] = make_str("%4zu  ", i) + ir_inst_to_string(module, fn.code[i]);
+    }
+}
+
+static u64 lines_hash(std::string const &name, std::vector<std::string> const &lines) noexcept
+{
+    u64 h = fnv1a_hash(name);
+    for (std::string const &line : lines) {
+        h = fnv1a_hash(line, fnv1a_hash("\n", h));
+    }
+    return h;
+}
+
+u64 cfg_layout_hash(ir_module const &module, ir_function const &fn) noexcept
+{
+    std::vector<std::string> lines;
+    listing_lines(module, fn, lines);
+    return lines_hash(fn.name, lines);
+}
+
+cfg_layout_rect cfg_layout::block_rect(u32 block) const noexcept
+{
+    return { block_x[block], block_y[block], block_x[block] + block_width[block], block_y[block] + block_height[block] };
+}
+
+u32 cfg_layout::block_of(u32 inst) const noexcept
+{
+    auto after = std::upper_bound(block_first_inst.begin(), block_first_inst.end(), inst);
+    return u32(after - block_first_inst.begin() - 1);
+}
+
+cfg_layout_rect cfg_layout::inst_rect(u32 inst) const noexcept
+{
+    u32 block = block_of(inst);
+    f64 y = block_y[block] + padding + f64(1 + inst - block_first_inst[block]) * line_height; // below the header
+    return { block_x[block], y, block_x[block] + block_width[block], y + line_height };
+}
+
+/// Working state of `cfg_layout_build`. Nodes are the blocks followed by the dummy nodes, edges between
+/// nodes (`links`) only ever join neighbouring layers.
+struct sugiyama
+{
+    cfg_layout &layout;
+    u32 blocks = 0;
+
+    std::vector<u32> layer;         // per node
+    std::vector<f64> width;
+    std::vector<u32> up_begin;      // `up[up_begin[n]..up_begin[n + 1]]`: neighbours in the layer above
+    std::vector<u32> up;
+    std::vector<u32> down_begin;    // ... below
+    std::vector<u32> down;
+    std::vector<u32> order_begin;   // per layer, and one past the last: its range of `order`
+    std::vector<u32> order;         // the nodes of each layer, left to right
+    std::vector<u32> pos;           // per node: where it is in its layer
+    std::vector<f64> x;             // per node: center
+    std::vector<u32> size;          // per node: nodes in its subtree, taking each node's first neighbour above as its parent
+
+    // Per `layout.edges`: the dummy nodes it got `[own_first, own_end)` top to bottom, then the node it ends
+    // at, its lower block or, where it joins the dummy nodes of an edge to the same block, the first of those.
+    std::vector<u32> own_first;
+    std::vector<u32> own_end;
+    std::vector<u32> end_node;
+
+    // Scratch.
+    std::vector<std::pair<f64, u32>> keyed;
+    std::vector<u32> fenwick;
+    std::vector<u32> lower;
+
+    explicit sugiyama(cfg_layout &out) noexcept : layout(out) {}
+
+    bool dummy(u32 node) const noexcept { return node >= blocks; }
+    u32 upper_block(cfg_edge const &e) const noexcept { return e.back ? e.to : e.from; }
+    u32 lower_block(cfg_edge const &e) const noexcept { return e.back ? e.from : e.to; }
+
+    /// Splits the code into blocks at jump targets and after jumps and returns, and connects them.
+    void split(ir_function const &fn) noexcept
+    {
+        u32 n = u32(fn.code.size());
+        std::vector<u8> leader(n + 1, 0);
+        leader[0] = 1;
+        for (u32 i = 0; i < n; ++i) {
+            ir_inst const &inst = fn.code[i];
+            if (ir_op_is_jump(inst.op)) {
+                if (u32(inst.imm) < n) {
+                    leader[inst.imm] = 1;
+                }
+                leader[i + 1] = 1;
+            } else if (inst.op == ir_op::ret) {
+                leader[i + 1] = 1;
+            }
+        }
+        layout.block_first_inst.clear();
+        for (u32 i = 0; i < n; ++i) {
+            if (leader[i]) {
+                layout.block_first_inst.push_back(i);
+            }
+        }
+        layout.block_first_inst.push_back(n);
+        blocks = layout.block_count();
+
+        layout.edges.clear();
+        for (u32 b = 0; b < blocks; ++b) {
+            ir_inst const &last = fn.code[layout.block_first_inst[b + 1] - 1];
+            u32 next = b + 1 < blocks ? b + 1 : none;
+            u32 target = ir_op_is_jump(last.op) && u32(last.imm) < n ? layout.block_of(u32(last.imm)) : none;
+            auto add = [&](u32 to, cfg_edge_kind kind) {
+                if (to != none) {
+                    layout.edges.push_back({ b, to, kind, false, false, 0, 0 });
+                }
+            };
+            if (last.op == ir_op::jump) {
+                add(target, cfg_edge_kind::unconditional);
+            } else if (ir_op_is_jump(last.op)) {
+                if (target == next) {
+                    add(next, cfg_edge_kind::unconditional);
+                } else {
+                    add(target, cfg_edge_kind::taken);
+                    add(next, cfg_edge_kind::not_taken);
+                }
+            } else if (last.op != ir_op::ret) {
+                add(next, cfg_edge_kind::unconditional);
+            }
+        }
+    }
+
+    /// Marks the edges a depth-first search from the entry (then from the blocks it did not reach) finds
+    /// closing a cycle as `back`, which leaves the others acyclic. Iterative, a function can have any number
+    /// of blocks.
+    void break_cycles() noexcept
+    {
+        std::vector<u32> out_begin(blocks + 1, 0);
+        for (cfg_edge const &e : layout.edges) {
+            ++out_begin[e.from + 1];
+        }
+        for (u32 b = 0; b < blocks; ++b) {
+            out_begin[b + 1] += out_begin[b];
+        }
+
+        std::vector<u8> state(blocks, 0); // 0: not seen, 1: on the stack, 2: done
+        std::vector<std::pair<u32, u32>> stack; // block and its next edge
+        for (u32 root = 0; root < blocks; ++root) {
+            if (state[root] != 0) {
+                continue;
+            }
+            state[root] = 1;
+            stack.push_back({ root, out_begin[root] });
+            while (!stack.empty()) {
+                u32 b = stack.back().first;
+                u32 k = stack.back().second;
+                if (k == out_begin[b + 1]) {
+                    state[b] = 2;
+                    stack.pop_back();
+                    continue;
+                }
+                ++stack.back().second;
+                cfg_edge &e = layout.edges[k];
+                if (state[e.to] == 1) {
+                    e.back = true;
+                } else if (state[e.to] == 0) {
+                    state[e.to] = 1;
+                    stack.push_back({ e.to, out_begin[e.to] });
+                }
+            }
+        }
+    }
+
+    /// Longest path from the top, then blocks nothing leads to (besides the entry) moved down to just above
+    /// their first successor, so they do not sit at the top with long edges hanging off them.
+    void assign_layers() noexcept
+    {
+        std::vector<u32> succ_begin(blocks + 1, 0), succ, indegree(blocks, 0);
+        for (cfg_edge const &e : layout.edges) {
+            if (e.from != e.to) {
+                ++succ_begin[upper_block(e) + 1];
+                ++indegree[lower_block(e)];
+            }
+        }
+        for (u32 b = 0; b < blocks; ++b) {
+            succ_begin[b + 1] += succ_begin[b];
+        }
+        succ.resize(succ_begin[blocks]);
+        std::vector<u32> cursor(succ_begin.begin(), succ_begin.end() - 1);
+        for (cfg_edge const &e : layout.edges) {
+            if (e.from != e.to) {
+                succ[cursor[upper_block(e)]++] = lower_block(e);
+            }
+        }
+
+        std::vector<u32> topo, remaining = indegree;
+        for (u32 b = 0; b < blocks; ++b) {
+            if (remaining[b] == 0) {
+                topo.push_back(b);
+            }
+        }
+        layer.assign(blocks, 0);
+        for (u64 i = 0; i < topo.size(); ++i) {
+            u32 b = topo[i];
+            for (u32 k = succ_begin[b]; k < succ_begin[b + 1]; ++k) {
+                layer[succ[k]] = std::max(layer[succ[k]], layer[b] + 1);
+                if (--remaining[succ[k]] == 0) {
+                    topo.push_back(succ[k]);
+                }
+            }
+        }
+        for (u64 i = topo.size(); i-- > 0; ) {
+            u32 b = topo[i];
+            if (b == 0 || indegree[b] != 0 || succ_begin[b] == succ_begin[b + 1]) {
+                continue;
+            }
+            u32 lowest = none;
+            for (u32 k = succ_begin[b]; k < succ_begin[b + 1]; ++k) {
+                lowest = std::min(lowest, layer[succ[k]]);
+            }
+            layer[b] = std::max(layer[b], lowest - 1);
+        }
+    }
+
+    /// Gives every edge spanning several layers a dummy node in each layer in between. Edges to the same block
+    /// (in the same direction) share their dummy nodes from where they meet down, so the many edges of a chain
+    /// of `if`s to the code after it run as one line instead of one per `if`.
+    void add_dummies() noexcept
+    {
+        width.resize(blocks);
+        std::vector<std::pair<u32, u32>> links;
+        std::unordered_map<u64, u32> shared; // lower block, layer and direction to the dummy node there
+        u32 count = u32(layer.size());
+        own_first.assign(layout.edges.size(), 0);
+        own_end.assign(layout.edges.size(), 0);
+        end_node.assign(layout.edges.size(), none);
+        for (u64 i = 0; i < layout.edges.size(); ++i) {
+            cfg_edge &e = layout.edges[i];
+            own_first[i] = own_end[i] = count;
+            if (e.from == e.to) {
+                continue;
+            }
+            u32 u = upper_block(e), v = lower_block(e);
+            u32 previous = u;
+            end_node[i] = v;
+            for (u32 m = layer[u] + 1; m < layer[v]; ++m) {
+                u64 key = (u64(v) << 33) | (u64(m) << 1) | u64(e.back);
+                auto [it, inserted] = shared.try_emplace(key, count);
+                links.push_back({ previous, it->second });
+                if (!inserted) {
+                    end_node[i] = it->second;
+                    e.joins = true;
+                    break;
+                }
+                layer.push_back(m);
+                width.push_back(cfg_layout::dummy_width);
+                previous = count++;
+            }
+            own_end[i] = count;
+            if (!e.joins) {
+                links.push_back({ previous, v });
+            }
+        }
+        layout.dummies = count - blocks;
+
+        up_begin.assign(count + 1, 0);
+        down_begin.assign(count + 1, 0);
+        for (auto [a, b] : links) {
+            ++down_begin[a + 1];
+            ++up_begin[b + 1];
+        }
+        for (u32 n = 0; n < count; ++n) {
+            down_begin[n + 1] += down_begin[n];
+            up_begin[n + 1] += up_begin[n];
+        }
+        up.resize(links.size());
+        down.resize(links.size());
+        std::vector<u32> up_cursor(up_begin.begin(), up_begin.end() - 1), down_cursor(down_begin.begin(), down_begin.end() - 1);
+        for (auto [a, b] : links) {
+            down[down_cursor[a]++] = b;
+            up[up_cursor[b]++] = a;
+        }
+    }
+
+    void order_by_id(u32 layers) noexcept
+    {
+        u32 count = u32(layer.size());
+        order_begin.assign(layers + 1, 0);
+        for (u32 n = 0; n < count; ++n) {
+            ++order_begin[layer[n] + 1];
+        }
+        for (u32 l = 0; l < layers; ++l) {
+            order_begin[l + 1] += order_begin[l];
+        }
+        order.resize(count);
+        pos.resize(count);
+        std::vector<u32> cursor(order_begin.begin(), order_begin.end() - 1);
+        for (u32 n = 0; n < count; ++n) {
+            pos[n] = cursor[layer[n]] - order_begin[layer[n]];
+            order[cursor[layer[n]]++] = n;
+        }
+    }
+
+    /// Reorders every layer after the first in the sweep's direction by the average position of each node's
+    /// neighbours in the layer before it. Nodes without any keep their place as well as the others allow.
+    void order_sweep(bool downward) noexcept
+    {
+        u32 layers = u32(order_begin.size() - 1);
+        std::vector<u32> const &adjacent_begin = downward ? up_begin : down_begin;
+        std::vector<u32> const &adjacent = downward ? up : down;
+        for (u32 i = 1; i < layers; ++i) {
+            u32 l = downward ? i : layers - 1 - i;
+            keyed.clear();
+            for (u32 k = order_begin[l]; k < order_begin[l + 1]; ++k) {
+                u32 n = order[k];
+                u32 begin = adjacent_begin[n], end = adjacent_begin[n + 1];
+                f64 key = pos[n];
+                if (begin != end) {
+                    f64 sum = 0;
+                    for (u32 j = begin; j < end; ++j) {
+                        sum += pos[adjacent[j]];
+                    }
+                    key = sum / f64(end - begin);
+                }
+                keyed.push_back({ key, n });
+            }
+            std::stable_sort(keyed.begin(), keyed.end(), [](auto const &a, auto const &b) { return a.first < b.first; });
+            for (u32 k = 0; k < keyed.size(); ++k) {
+                order[order_begin[l] + k] = keyed[k].second;
+                pos[keyed[k].second] = k;
+            }
+        }
+    }
+
+    /// Crossings between every pair of neighbouring layers: the inversions of the lower ends of their edges
+    /// taken in order of the upper ends, counted with a Fenwick tree.
+    u64 count_crossings() noexcept
+    {
+        u64 crossings = 0;
+        u32 layers = u32(order_begin.size() - 1);
+        for (u32 l = 0; l + 1 < layers; ++l) {
+            u32 size = order_begin[l + 2] - order_begin[l + 1];
+            fenwick.assign(size + 1, 0);
+            u32 inserted = 0;
+            for (u32 k = order_begin[l]; k < order_begin[l + 1]; ++k) {
+                u32 n = order[k];
+                lower.clear();
+                for (u32 j = down_begin[n]; j < down_begin[n + 1]; ++j) {
+                    lower.push_back(pos[down[j]]);
+                }
+                std::sort(lower.begin(), lower.end());
+                for (u32 q : lower) {
+                    u32 not_after = 0;
+                    for (u32 i = q + 1; i > 0; i -= i & (0 - i)) {
+                        not_after += fenwick[i];
+                    }
+                    crossings += inserted - not_after;
+                    for (u32 i = q + 1; i <= size; i += i & (0 - i)) {
+                        ++fenwick[i];
+                    }
+                    ++inserted;
+                }
+            }
+        }
+        return crossings;
+    }
+
+    void order_layers(u32 layers) noexcept
+    {
+        order_by_id(layers);
+        std::vector<u32> best = order;
+        u64 best_crossings = count_crossings();
+        for (int iteration = 0; iteration < 6 && best_crossings > 0; ++iteration) {
+            order_sweep(true);
+            order_sweep(false);
+            u64 crossings = count_crossings();
+            if (crossings < best_crossings) {
+                best = order;
+                best_crossings = crossings;
+            }
+        }
+        order = std::move(best);
+        for (u32 l = 0; l < layers; ++l) {
+            for (u32 k = order_begin[l]; k < order_begin[l + 1]; ++k) {
+                pos[order[k]] = k - order_begin[l];
+            }
+        }
+        layout.crossings = best_crossings;
+    }
+
+    f64 spacing(u32 a, u32 b) const noexcept
+    {
+        return dummy(a) || dummy(b) ? cfg_layout::block_spacing / 4 : cfg_layout::block_spacing;
+    }
+
+    /// Moves every layer after the first in the sweep's direction as close to the average x of each node's
+    /// neighbours in the layer before it as the order and spacing allow, in the least-squares sense, both
+    /// weighted by `size` so the larger parts of the graph run straight and the smaller ones move aside. With
+    /// `c` the least distance of each node from the first, the positions minus `c` must not decrease, which
+    /// makes this an isotonic regression: pool adjacent violators, linear in the layer.
+    void place_sweep(bool downward) noexcept
+    {
+        u32 layers = u32(order_begin.size() - 1);
+        std::vector<u32> const &adjacent_begin = downward ? up_begin : down_begin;
+        std::vector<u32> const &adjacent = downward ? up : down;
+        struct pool { f64 weight, sum; u32 count; };
+        std::vector<pool> pools;
+        std::vector<f64> offset;
+        for (u32 i = 1; i < layers; ++i) {
+            u32 l = downward ? i : layers - 1 - i;
+            pools.clear();
+            offset.clear();
+            f64 c = 0;
+            for (u32 k = order_begin[l]; k < order_begin[l + 1]; ++k) {
+                u32 n = order[k];
+                if (k > order_begin[l]) {
+                    u32 left = order[k - 1];
+                    c += (width[left] + width[n]) / 2 + spacing(left, n);
+                }
+                offset.push_back(c);
+                u32 begin = adjacent_begin[n], end = adjacent_begin[n + 1];
+                f64 target = x[n], weight = 0.01;
+                if (begin != end) {
+                    f64 sum = 0, total = 0;
+                    for (u32 j = begin; j < end; ++j) {
+                        sum += x[adjacent[j]] * f64(size[adjacent[j]]);
+                        total += f64(size[adjacent[j]]);
+                    }
+                    target = sum / total;
+                    weight = f64(size[n]);
+                }
+                pools.push_back({ weight, weight * (target - c), 1 });
+                while (pools.size() > 1 && pools[pools.size() - 2].sum / pools[pools.size() - 2].weight > pools.back().sum / pools.back().weight) {
+                    pool top = pools.back();
+                    pools.pop_back();
+                    pools.back().weight += top.weight;
+                    pools.back().sum += top.sum;
+                    pools.back().count += top.count;
+                }
+            }
+            u32 k = order_begin[l];
+            for (pool const &p : pools) {
+                f64 value = p.sum / p.weight;
+                for (u32 j = 0; j < p.count; ++j, ++k) {
+                    x[order[k]] = value + offset[k - order_begin[l]];
+                }
+            }
+        }
+    }
+
+    void place(u32 layers) noexcept
+    {
+        // Subtree sizes, bottom-up. An edge's own dummy nodes come before the ones it joins, so a shared line
+        // belongs to the edge that started it and the rest hang off it.
+        size.assign(layer.size(), 1);
+        for (u32 k = u32(order.size()); k-- > 0; ) {
+            u32 n = order[k];
+            if (up_begin[n] != up_begin[n + 1]) {
+                size[up[up_begin[n]]] += size[n];
+            }
+        }
+
+        x.assign(layer.size(), 0);
+        for (u32 l = 0; l < layers; ++l) {
+            f64 c = 0;
+            for (u32 k = order_begin[l]; k < order_begin[l + 1]; ++k) {
+                u32 n = order[k];
+                if (k > order_begin[l]) {
+                    u32 left = order[k - 1];
+                    c += (width[left] + width[n]) / 2 + spacing(left, n);
+                }
+                x[n] = c;
+            }
+        }
+        for (int iteration = 0; iteration < 4; ++iteration) {
+            place_sweep(true);
+            place_sweep(false);
+        }
+        place_sweep(true);
+
+        f64 left = 0;
+        for (u32 n = 0; n < layer.size(); ++n) {
+            left = std::min(left, x[n] - width[n] / 2);
+        }
+        for (f64 &v : x) {
+            v -= left;
+        }
+    }
+};
+
+/// Where edge `e` (`i` in `layout.edges`) leaves or enters `block`: spread along its bottom or top in the order of
+/// where the edges come from or go to, so they do not cross at the block.
+static void assign_ports(sugiyama const &s, std::vector<std::pair<f64, u32>> &ends, u32 block, std::vector<f64> &port) noexcept
+{
+    std::sort(ends.begin(), ends.end());
+    cfg_layout const &layout = s.layout;
+    for (u64 k = 0; k < ends.size(); ++k) {
+        port[ends[k].second] = layout.block_x[block] + layout.block_width[block] * f64(k + 1) / f64(ends.size() + 1);
+    }
+}
+
+void cfg_layout_build(ir_module const &module, ir_function const &fn, cfg_layout &out) noexcept
+{
+    out.name = fn.name;
+    listing_lines(module, fn, out.lines);
+    out.hash = lines_hash(fn.name, out.lines);
+    out.layer_y.clear();
+    out.layer_height.clear();
+    out.layer_begin.assign(1, 0);
+    out.layer_blocks.clear();
+    out.points.clear();
+    out.band_y.clear();
+    out.band_begin.assign(1, 0);
+    out.band_segments.clear();
+    out.width = out.height = 0;
+    out.dummies = 0;
+    out.crossings = 0;
+    out.edges.clear();
+    if (fn.code.empty()) {
+        out.block_first_inst.assign(1, 0);
+        out.block_layer.clear();
+        out.block_x.clear();
+        out.block_y.clear();
+        out.block_width.clear();
+        out.block_height.clear();
+        return;
+    }
+
+    sugiyama s(out);
+    s.split(fn);
+    s.break_cycles();
+    s.assign_layers();
+    u32 blocks = s.blocks;
+    u32 layers = *std::max_element(s.layer.begin(), s.layer.end()) + 1;
+
+    // Block sizes, before the dummy nodes are added after them.
+    out.block_width.resize(blocks);
+    out.block_height.resize(blocks);
+    s.width.resize(blocks);
+    for (u32 b = 0; b < blocks; ++b) {
+        u64 chars = make_str("b%u", b).size();
+        for (u32 i = out.block_first_inst[b]; i < out.block_first_inst[b + 1]; ++i) {
+            chars = std::max(chars, u64(out.lines[i].size()));
+        }
+        out.block_width[b] = s.width[b] = f64(chars) * cfg_layout::char_width + 2 * cfg_layout::padding;
+        out.block_height[b] = f64(1 + out.block_first_inst[b + 1] - out.block_first_inst[b]) * cfg_layout::line_height
+            + 2 * cfg_layout::padding;
+    }
+
+    s.add_dummies();
+    s.order_layers(layers);
+    s.place(layers);
+
+    // Layers and blocks.
+    out.layer_height.assign(layers, 0);
+    for (u32 b = 0; b < blocks; ++b) {
+        out.layer_height[s.layer[b]] = std::max(out.layer_height[s.layer[b]], out.block_height[b]);
+    }
+    out.layer_y.resize(layers);
+    f64 y = 0;
+    for (u32 l = 0; l < layers; ++l) {
+        out.layer_y[l] = y;
+        y += out.layer_height[l] + cfg_layout::layer_spacing;
+        for (u32 k = s.order_begin[l]; k < s.order_begin[l + 1]; ++k) {
+            if (!s.dummy(s.order[k])) {
+                out.layer_blocks.push_back(s.order[k]);
+            }
+        }
+        out.layer_begin.push_back(u32(out.layer_blocks.size()));
+    }
+    out.block_layer.assign(s.layer.begin(), s.layer.begin() + blocks);
+    out.block_x.resize(blocks);
+    out.block_y.resize(blocks);
+    for (u32 b = 0; b < blocks; ++b) {
+        out.block_x[b] = s.x[b] - out.block_width[b] / 2;
+        out.block_y[b] = out.layer_y[s.layer[b]];
+        out.width = std::max(out.width, out.block_x[b] + out.block_width[b] + cfg_layout::block_spacing / 2); // room for a self loop
+    }
+    for (u32 n = blocks; n < s.layer.size(); ++n) {
+        out.width = std::max(out.width, s.x[n] + s.width[n] / 2);
+    }
+    out.height = out.layer_y.back() + out.layer_height.back();
+
+    // Ports, the edges leaving each block's bottom and entering its top in the order of the nodes at their
+    // other ends.
+    u64 edge_count = out.edges.size();
+    std::vector<f64> out_port(edge_count, 0), in_port(edge_count, 0);
+    {
+        std::vector<u32> leaving_begin(blocks + 1, 0), entering_begin(blocks + 1, 0);
+        for (u64 i = 0; i < edge_count; ++i) {
+            cfg_edge const &e = out.edges[i];
+            if (e.from != e.to) {
+                ++leaving_begin[s.upper_block(e) + 1];
+                if (!e.joins) {
+                    ++entering_begin[s.lower_block(e) + 1];
+                }
+            }
+        }
+        for (u32 b = 0; b < blocks; ++b) {
+            leaving_begin[b + 1] += leaving_begin[b];
+            entering_begin[b + 1] += entering_begin[b];
+        }
+        std::vector<std::pair<f64, u32>> leaving(leaving_begin[blocks]), entering(entering_begin[blocks]);
+        std::vector<u32> leaving_cursor(leaving_begin.begin(), leaving_begin.end() - 1);
+        std::vector<u32> entering_cursor(entering_begin.begin(), entering_begin.end() - 1);
+        for (u64 i = 0; i < edge_count; ++i) {
+            cfg_edge const &e = out.edges[i];
+            if (e.from == e.to) {
+                continue;
+            }
+            u32 next = s.own_first[i] < s.own_end[i] ? s.own_first[i] : s.end_node[i];
+            leaving[leaving_cursor[s.upper_block(e)]++] = { s.x[next], u32(i) };
+            if (!e.joins) {
+                u32 previous = s.own_first[i] < s.own_end[i] ? s.own_end[i] - 1 : s.upper_block(e);
+                entering[entering_cursor[s.lower_block(e)]++] = { s.x[previous], u32(i) };
+            }
+        }
+        std::vector<std::pair<f64, u32>> ends;
+        for (u32 b = 0; b < blocks; ++b) {
+            ends.assign(leaving.begin() + leaving_begin[b], leaving.begin() + leaving_begin[b + 1]);
+            assign_ports(s, ends, b, out_port);
+            ends.assign(entering.begin() + entering_begin[b], entering.begin() + entering_begin[b + 1]);
+            assign_ports(s, ends, b, in_port);
+        }
+    }
+
+    // Polylines, top to bottom: down from the port to the bottom of the layer, through the dummy nodes and
+    // into the top of the lower block or the shared dummy node it joins.
+    for (u64 i = 0; i < edge_count; ++i) {
+        cfg_edge &e = out.edges[i];
+        e.first_point = u32(out.points.size());
+        if (e.from == e.to) {
+            cfg_layout_rect r = out.block_rect(e.from);
+            f64 loop_x = r.x1 + cfg_layout::block_spacing / 2 - 4;
+            f64 h = r.y1 - r.y0;
+            out.points.push_back({ r.x1, r.y0 + h * 2 / 3 });
+            out.points.push_back({ loop_x, r.y0 + h * 2 / 3 });
+            out.points.push_back({ loop_x, r.y0 + h / 3 });
+            out.points.push_back({ r.x1, r.y0 + h / 3 });
+            e.end_point = u32(out.points.size());
+            continue;
+        }
+        u32 u = s.upper_block(e), v = s.lower_block(e);
+        u32 lu = s.layer[u];
+        out.points.push_back({ out_port[i], out.block_y[u] + out.block_height[u] });
+        out.points.push_back({ out_port[i], out.layer_y[lu] + out.layer_height[lu] });
+        for (u32 d = s.own_first[i]; d < s.own_end[i]; ++d) {
+            u32 m = s.layer[d];
+            out.points.push_back({ s.x[d], out.layer_y[m] });
+            out.points.push_back({ s.x[d], out.layer_y[m] + out.layer_height[m] });
+        }
+        if (e.joins) {
+            u32 d = s.end_node[i];
+            out.points.push_back({ s.x[d], out.layer_y[s.layer[d]] });
+        } else {
+            out.points.push_back({ in_port[i], out.layer_y[s.layer[v]] });
+        }
+        e.end_point = u32(out.points.size());
+    }
+
+    // Bands, and the segments in each.
+    for (u32 l = 0; l < layers; ++l) {
+        out.band_y.push_back(out.layer_y[l]);
+        out.band_y.push_back(out.layer_y[l] + out.layer_height[l]);
+    }
+    u32 bands = u32(out.band_y.size() - 1);
+    auto band_of = [&out, bands](f64 y) {
+        u32 band = u32(std::upper_bound(out.band_y.begin(), out.band_y.end(), y) - out.band_y.begin());
+        return std::min(band == 0 ? 0 : band - 1, bands - 1);
+    };
+    std::vector<u32> segment_band;
+    out.band_begin.assign(bands + 1, 0);
+    for (cfg_edge const &e : out.edges) {
+        for (u32 p = e.first_point; p + 1 < e.end_point; ++p) {
+            segment_band.push_back(band_of((out.points[p].y + out.points[p + 1].y) / 2));
+            ++out.band_begin[segment_band.back() + 1];
+        }
+    }
+    for (u32 b = 0; b < bands; ++b) {
+        out.band_begin[b + 1] += out.band_begin[b];
+    }
+    out.band_segments.resize(segment_band.size());
+    std::vector<u32> cursor(out.band_begin.begin(), out.band_begin.end() - 1);
+    u32 k = 0;
+    for (u32 i = 0; i < edge_count; ++i) {
+        cfg_edge const &e = out.edges[i];
+        for (u32 p = e.first_point; p + 1 < e.end_point; ++p) {
+            out.band_segments[cursor[segment_band[k++]]++] = { i, p };
+        }
+    }
+}
+
+/// Band (see `cfg_layout::band_y`) `y` is in, the first or last one if it is outside all of them.
+static u32 band_at(cfg_layout const &layout, f64 y) noexcept
+{
+    u32 bands = u32(layout.band_y.size() - 1);
+    u32 band = u32(std::upper_bound(layout.band_y.begin(), layout.band_y.end(), y) - layout.band_y.begin());
+    return std::min(band == 0 ? 0 : band - 1, bands - 1);
+}
+
+/// The first block of `layer` whose right edge is at or right of `x`.
+static u32 first_block_from(cfg_layout const &layout, u32 layer, f64 x) noexcept
+{
+    auto begin = layout.layer_blocks.begin() + layout.layer_begin[layer];
+    auto end = layout.layer_blocks.begin() + layout.layer_begin[layer + 1];
+    return u32(std::partition_point(begin, end, [&layout, x](u32 b) { return layout.block_x[b] + layout.block_width[b] < x; })
+        - layout.layer_blocks.begin());
+}
+
+void cfg_layout_visible(cfg_layout const &layout, cfg_layout_rect view, std::vector<u32> &blocks,
+    std::vector<cfg_segment> &segments) noexcept
+{
+    if (layout.layer_y.empty() || view.y1 < 0 || view.y0 > layout.height) {
+        return;
+    }
+    u32 first = band_at(layout, view.y0), last = band_at(layout, view.y1);
+    for (u32 band = first; band <= last; ++band) {
+        for (u32 k = layout.band_begin[band]; k < layout.band_begin[band + 1]; ++k) {
+            cfg_segment s = layout.band_segments[k];
+            cfg_layout_point p = layout.points[s.point], q = layout.points[s.point + 1];
+            if (std::max(p.x, q.x) >= view.x0 && std::min(p.x, q.x) <= view.x1 && std::max(p.y, q.y) >= view.y0 &&
+                std::min(p.y, q.y) <= view.y1) {
+                segments.push_back(s);
+            }
+        }
+        if (band % 2 != 0) {
+            continue;
+        }
+        u32 layer = band / 2;
+        for (u32 k = first_block_from(layout, layer, view.x0); k < layout.layer_begin[layer + 1]; ++k) {
+            u32 b = layout.layer_blocks[k];
+            if (layout.block_x[b] > view.x1) {
+                break;
+            }
+            if (layout.block_y[b] <= view.y1 && layout.block_y[b] + layout.block_height[b] >= view.y0) {
+                blocks.push_back(b);
+            }
+        }
+    }
+}
+
+u32 cfg_layout_inst_at(cfg_layout const &layout, f64 x, f64 y) noexcept
+{
+    if (layout.layer_y.empty()) {
+        return none;
+    }
+    u32 band = band_at(layout, y);
+    if (band % 2 != 0) {
+        return none;
+    }
+    u32 layer = band / 2;
+    u32 k = first_block_from(layout, layer, x);
+    if (k == layout.layer_begin[layer + 1]) {
+        return none;
+    }
+    u32 b = layout.layer_blocks[k];
+    cfg_layout_rect r = layout.block_rect(b);
+    if (x < r.x0 || y < r.y0 || y >= r.y1) {
+        return none;
+    }
+    f64 line = (y - r.y0 - cfg_layout::padding) / cfg_layout::line_height - 1; // below the header
+    u32 count = layout.block_first_inst[b + 1] - layout.block_first_inst[b];
+    return line >= 0 && line < f64(count) ? layout.block_first_inst[b] + u32(line) : none;
+}
+
+// BENCHMARK
+
+static std::string generated_source(u64 cases) noexcept
+{
+    std::string source =
+        "long run(long n)\n"
+        "{\n"
+        "    long acc = 1;\n"
+        "    for (long pc = 0; pc < n; pc++) {\n"
+        "        long op = (pc * 7 + acc) % " + std::to_string(std::max(cases, u64(1))) + ";\n"
+        "        if (op < 0) op = -op;\n";
+    for (u64 i = 0; i < cases; ++i) {
+        source += make_str(
+            "        if (op == %llu) {\n"
+            "            acc = acc * 3 + %llu;\n"
+            "            if (acc > 1000000) acc -= 1000000;\n"
+            "            continue;\n"
+            "        }\n",
+            (unsigned long long)i, (unsigned long long)i);
+    }
+    source +=
+        "        acc = 0;\n"
+        "    }\n"
+        "    return acc;\n"
+        "}\n"
+        "\n"
+        "int main(void)\n"
+        "{\n"
+        "    return run(100) & 255;\n"
+        "}\n";
+    return source;
+}
+
+cfg_layout_benchmark_result cfg_layout_benchmark(u64 cases, u64 frames) noexcept
+{
+    cfg_layout_benchmark_result result = {};
+    result.frames = frames;
+
+    compilation comp;
+    comp.source_text = generated_source(cases);
+    compile_to_ir(comp);
+    ir_function const *run = nullptr;
+    for (ir_function const &fn : comp.ir.functions) {
+        if (fn.name == "run") {
+            run = &fn;
+        }
+    }
+    if (run == nullptr) {
+        return result;
+    }
+
+    cfg_layout layout;
+    time_point_precise_t t0 = get_time_precise();
+    cfg_layout_build(comp.ir, *run, layout);
+    result.build_us = time_diff_us(t0, get_time_precise());
+    result.instructions = run->code.size();
+    result.blocks = layout.block_count();
+    result.edges = layout.edges.size();
+    result.dummies = layout.dummies;
+    result.layers = layout.layer_y.size();
+    result.crossings = layout.crossings;
+
+    u64 seed = 0x9e3779b97f4a7c15ull;
+    auto next = [&seed](f64 bound) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return f64(seed >> 11) / f64(u64(1) << 53) * std::max(bound, 0.0);
+    };
+    std::vector<u32> blocks;
+    std::vector<cfg_segment> segments;
+    u64 visible = 0;
+    time_point_precise_t t1 = get_time_precise();
+    for (u64 i = 0; i < frames; ++i) {
+        f64 x = next(layout.width - 1600), y = next(layout.height - 1000);
+        blocks.clear();
+        segments.clear();
+        cfg_layout_visible(layout, { x, y, x + 1600, y + 1000 }, blocks, segments);
+        visible += blocks.size() + segments.size();
+    }
+    result.frame_us = time_diff_us(t1, get_time_precise()) / s64(std::max(frames, u64(1)));
+    result.frame_visible = visible / std::max(frames, u64(1));
+    return result;
+}
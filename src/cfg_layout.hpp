@@ -0,0 +1,129 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "ir.hpp"
+
+struct cfg_layout_rect
+{
+    f64 x0, y0, x1, y1;
+};
+
+struct cfg_layout_point
+{
+    f64 x, y;
+};
+
+enum class cfg_edge_kind : u8
+{
+    unconditional,  // a `jump`, or falling through to the next block
+    taken,          // a conditional jump to its target
+    not_taken,      // a conditional jump falling through
+};
+
+struct cfg_edge
+{
+    u32 from;               // blocks
+    u32 to;
+    cfg_edge_kind kind;
+    bool back;              // goes up, against the layering: drawn from `to` down to `from`
+    bool joins;             // ends where it meets an edge to the same block, which goes on for both of them
+    u32 first_point;        // its polyline is `points[first_point..end_point)`, top to bottom unless a self loop
+    u32 end_point;
+};
+
+/// @brief A piece of an edge's polyline: from `points[point]` to `points[point + 1]`.
+struct cfg_segment
+{
+    u32 edge;
+    u32 point;
+};
+
+/// @brief The control-flow graph of one IR function, laid out in layers (Sugiyama style): blocks with their
+/// instruction text, edges as polylines. Rows of blocks (layers) and the gaps between them make horizontal
+/// bands, and every edge segment lies within one band, so the layout is its own spatial index: a rectangle
+/// binary-searches the bands it spans, then the blocks of each layer, which are in order left to right.
+/// A block is a header line plus a line per instruction, `line_height` apart and `char_width` per character.
+struct cfg_layout
+{
+    static constexpr f64 char_width = 8;
+    static constexpr f64 line_height = 16;
+    static constexpr f64 padding = 6;           // around a block's text
+    static constexpr f64 block_spacing = 40;    // between neighbours in a layer
+    static constexpr f64 layer_spacing = 60;    // between layers
+    static constexpr f64 dummy_width = 12;      // room for an edge passing through a layer
+
+    u64 hash = 0;                   // of the function's listing, see `cfg_layout_hash`
+    std::string name;
+    std::vector<std::string> lines; // per instruction, as in the listing
+
+    std::vector<u32> block_first_inst;  // per block, and one past the last: its instructions
+    std::vector<u32> block_layer;
+    std::vector<f64> block_x;           // left edge
+    std::vector<f64> block_y;           // top edge, the top of its layer
+    std::vector<f64> block_width;
+    std::vector<f64> block_height;
+
+    std::vector<f64> layer_y;           // top of every layer
+    std::vector<f64> layer_height;      // of its tallest block
+    std::vector<u32> layer_begin;       // `layer_blocks[layer_begin[l]..layer_begin[l + 1]]`, left to right
+    std::vector<u32> layer_blocks;
+
+    std::vector<cfg_edge> edges;
+    std::vector<cfg_layout_point> points;
+    std::vector<f64> band_y;            // top of every band (layer l is band 2l, the gap below it 2l + 1), and the bottom
+    std::vector<u32> band_begin;        // `band_segments[band_begin[b]..band_begin[b + 1]]`
+    std::vector<cfg_segment> band_segments;
+
+    f64 width = 0;
+    f64 height = 0;
+    u32 dummies = 0;                    // nodes edges spanning several layers pass through
+    u64 crossings = 0;                  // of edges between neighbouring layers, after ordering
+
+    u32 block_count() const noexcept { return u32(block_first_inst.size() - 1); }
+    cfg_layout_rect block_rect(u32 block) const noexcept;
+    u32 block_of(u32 inst) const noexcept;
+    cfg_layout_rect inst_rect(u32 inst) const noexcept; // its line in its block
+};
+
+/// Identifies the layout of `fn`: a hash of its name and listing, everything the layout depends on.
+u64 cfg_layout_hash(ir_module const &module, ir_function const &fn) noexcept;
+
+/// Splits `fn` into basic blocks and lays them out top to bottom:
+/// - a depth-first search from the entry reverses the edges that close cycles;
+/// - each block goes one layer below its lowest predecessor, then as close above its successors as that allows;
+/// - edges spanning several layers pass through a dummy node in each, shared from where they meet by edges to
+///   the same block;
+/// - sweeps down and up order every layer by the barycenter of its neighbours in the previous one, keeping the
+///   order with the fewest crossings;
+/// - sweeps down and up place every layer as close to its neighbours above or below as its order and spacing
+///   allow (an isotonic regression per layer), with dummy nodes pulling hardest so long edges run straight.
+/// Each step takes about linear time in the blocks, edges and dummy nodes, none of them recurses.
+void cfg_layout_build(ir_module const &module, ir_function const &fn, cfg_layout &out) noexcept;
+
+/// Appends to `blocks` the blocks and to `segments` the edge segments that intersect `view`.
+void cfg_layout_visible(cfg_layout const &layout, cfg_layout_rect view, std::vector<u32> &blocks,
+    std::vector<cfg_segment> &segments) noexcept;
+
+/// The instruction whose line contains (`x`, `y`), or `u32(-1)`.
+u32 cfg_layout_inst_at(cfg_layout const &layout, f64 x, f64 y) noexcept;
+
+struct cfg_layout_benchmark_result
+{
+    u64 instructions;
+    u64 blocks;
+    u64 edges;
+    u64 dummies;
+    u64 layers;
+    u64 crossings;
+    s64 build_us;
+    u64 frames;
+    s64 frame_us;                   // average `cfg_layout_visible` for a window-sized view
+    u64 frame_visible;              // average blocks and segments reported per frame
+};
+
+/// Lays out a generated interpreter loop dispatching over `cases` opcodes with a chain of `if`s, the shape of
+/// a large `switch`, and times `cfg_layout_visible` over `frames` 1600x1000 views panned to random places.
+cfg_layout_benchmark_result cfg_layout_benchmark(u64 cases = 1000, u64 frames = 200) noexcept;
@@ -0,0 +1,478 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <thread>
+#include <type_traits>
+
+#include "util.hpp"
+#include "mapped_file.hpp"
+#include "compiler.hpp"
+#include "parser.hpp"
+#include "ast_to_ir.hpp"
+
+#include "compile_cache.hpp"
+
+namespace fs = std::filesystem;
+
+char const *cache_artifact_name(cache_artifact artifact) noexcept
+{
+    switch (artifact) {
+        case cache_artifact::tokens: return "tokens";
+        case cache_artifact::ast:    return "ast";
+        case cache_artifact::ir:     return "ir";
+        case cache_artifact::count:  break;
+    }
+    return "";
+}
+
+void compile_cache_stats_add(compile_cache_stats &total, compile_cache_stats const &s) noexcept
+{
+    for (u64 i = 0; i < u64(cache_artifact::count); ++i) {
+        total.hits[i] += s.hits[i];
+        total.misses[i] += s.misses[i];
+    }
+    total.bytes_read += s.bytes_read;
+    total.bytes_written += s.bytes_written;
+    total.saved_us += s.saved_us;
+}
+
+std::string compile_cache_stats_to_string(compile_cache_stats const &stats) noexcept
+{
+    std::string text;
+    for (u64 i = 0; i < u64(cache_artifact::count); ++i) {
+        text += make_str("%s %llu hit %llu miss | ", cache_artifact_name(cache_artifact(i)),
+                         (unsigned long long)stats.hits[i], (unsigned long long)stats.misses[i]);
+    }
+    text += make_str("read %llu B, wrote %llu B | saved %lld us",
+                     (unsigned long long)stats.bytes_read, (unsigned long long)stats.bytes_written, (long long)stats.saved_us);
+    return text;
+}
+
+// KEYS
+
+struct cache_key
+{
+    u64 lo;
+    u64 hi;
+};
+
+/// Word-at-a-time multiply-rotate hash with a splitmix64 finalizer, independent of FNV-1a so the two halves of
+/// a key do not collide together.
+static u64 mix_hash(std::string_view s, u64 seed) noexcept
+{
+    u64 h = seed ^ (u64(s.size()) * 0x9E3779B97F4A7C15ull);
+    u64 i = 0;
+    for (; i + 8 <= s.size(); i += 8) {
+        u64 word;
+        std::memcpy(&word, s.data() + i, 8);
+        h = std::rotl(h ^ (word * 0xBF58476D1CE4E5B9ull), 31) * 0x94D049BB133111EBull;
+    }
+    u64 tail = 0;
+    std::memcpy(&tail, s.data() + i, s.size() - i);
+    h ^= tail * 0xBF58476D1CE4E5B9ull;
+
+    h ^= h >> 30;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 27;
+    h *= 0x94D049BB133111EBull;
+    h ^= h >> 31;
+    return h;
+}
+
+/// A compiler built from different sources may turn the same text into different tokens, AST or IR, so its
+/// build id is part of the key: no entry outlives the compiler that wrote it.
+static cache_key text_key(std::string_view text) noexcept
+{
+    u64 version = compile_cache_version;
+    u64 build = fnv1a_hash(compiler_build_id(), fnv1a_hash(std::string_view(reinterpret_cast<char const *>(&version), sizeof(version))));
+    return { fnv1a_hash(text, build), mix_hash(text, version ^ build) };
+}
+
+/// Key of one artifact of the text with key `base`, `variant` telling apart artifacts built with different options.
+static cache_key artifact_key(cache_key base, cache_artifact artifact, std::string_view variant = {}) noexcept
+{
+    std::string tag = std::string(cache_artifact_name(artifact)) + ':' + std::string(variant);
+    return { fnv1a_hash(tag, base.lo), mix_hash(tag, base.hi) };
+}
+
+// FILES
+
+struct cache_header
+{
+    char magic[4];
+    u32 version;
+    u32 artifact;
+    u32 reserved;
+    cache_key key;
+    u64 text_size;      // of the preprocessed text, one more check against collisions
+    s64 produce_us;     // what running the phase took
+    u64 payload_size;
+};
+
+static char const s_magic[4] = { 'M', 'C', 'C', 'A' };
+
+static std::string entry_path(char const *dir, cache_key key, cache_artifact artifact) noexcept
+{
+    return make_str("%s/%016llx%016llx.%s", dir, (unsigned long long)key.lo, (unsigned long long)key.hi, cache_artifact_name(artifact));
+}
+
+struct cache_writer
+{
+    std::vector<u8> bytes;
+
+    void raw(void const *data, u64 size) noexcept
+    {
+        u8 const *p = static_cast<u8 const *>(data);
+        bytes.insert(bytes.end(), p, p + size);
+    }
+
+    template <typename Ty>
+    void pod(Ty const &value) noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<Ty>);
+        raw(&value, sizeof(value));
+    }
+
+    template <typename Ty>
+    void array(Ty const *data, u64 count) noexcept
+    {
+        static_assert(std::is_trivially_copyable_v<Ty>);
+        pod(count);
+        raw(data, sizeof(Ty) * count);
+    }
+
+    void str(std::string_view s) noexcept { array(s.data(), s.size()); }
+};
+
+/// Reads what `cache_writer` wrote. Every read past the end fails and leaves `ok` false, so callers check once.
+struct cache_reader
+{
+    u8 const *pos;
+    u8 const *end;
+    bool ok = true;
+
+    bool raw(void *out, u64 size) noexcept
+    {
+        if (!ok || u64(end - pos) < size) {
+            ok = false;
+            return false;
+        }
+        if (size != 0) {
+            std::memcpy(out, pos, size);
+        }
+        pos += size;
+        return true;
+    }
+
+    template <typename Ty>
+    Ty pod() noexcept
+    {
+        Ty value = {};
+        raw(&value, sizeof(value));
+        return value;
+    }
+
+    /// Element count of the array that follows, 0 (and not ok) if it would not fit in what is left.
+    template <typename Ty>
+    u64 count() noexcept
+    {
+        u64 n = pod<u64>();
+        if (ok && n > u64(end - pos) / sizeof(Ty)) {
+            ok = false;
+        }
+        return ok ? n : 0;
+    }
+
+    template <typename Ty>
+    void vec(std::vector<Ty> &out) noexcept
+    {
+        out.resize(count<Ty>());
+        raw(out.data(), sizeof(Ty) * out.size());
+    }
+
+    std::string str() noexcept
+    {
+        std::string s(count<char>(), '\0');
+        raw(s.data(), s.size());
+        return s;
+    }
+};
+
+static bool store(char const *dir, cache_key key, cache_artifact artifact, u64 text_size, s64 produce_us,
+                  cache_writer const &payload, compile_cache_stats &stats) noexcept
+{
+    cache_header header = {};
+    std::memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.version = compile_cache_version;
+    header.artifact = u32(artifact);
+    header.key = key;
+    header.text_size = text_size;
+    header.produce_us = produce_us;
+    header.payload_size = payload.bytes.size();
+
+    // A private temporary then a rename, so readers never see half an entry.
+    static std::atomic<u64> s_temp_counter = 0;
+    std::string path = entry_path(dir, key, artifact);
+    std::string temp = make_str("%s.%llx-%llx.tmp", path.c_str(), (unsigned long long)std::hash<std::thread::id>()(std::this_thread::get_id()),
+                                (unsigned long long)s_temp_counter++);
+
+    FILE *file = fopen(temp.c_str(), "wb");
+    if (file == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+           && (payload.bytes.empty() || fwrite(payload.bytes.data(), payload.bytes.size(), 1, file) == 1);
+    ok &= fclose(file) == 0;
+
+    std::error_code ec;
+    if (ok) {
+        fs::rename(temp, path, ec);
+        ok = !ec;
+    }
+    if (!ok) {
+        fs::remove(temp, ec);
+        return false;
+    }
+    stats.bytes_written += sizeof(header) + payload.bytes.size();
+    return true;
+}
+
+/// Maps the entry and checks its header. On success `reader` covers the payload (valid while `file` is open).
+static bool load(char const *dir, cache_key key, cache_artifact artifact, u64 text_size, mapped_file &file,
+                 cache_reader &reader, s64 &produce_us) noexcept
+{
+    if (!file.open(entry_path(dir, key, artifact).c_str()) || file.size < sizeof(cache_header)) {
+        return false;
+    }
+    cache_header header;
+    std::memcpy(&header, file.data, sizeof(header));
+    if (std::memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.version != compile_cache_version
+        || header.artifact != u32(artifact) || header.key.lo != key.lo || header.key.hi != key.hi
+        || header.text_size != text_size || header.payload_size != file.size - sizeof(header)) {
+        return false;
+    }
+    u8 const *payload = reinterpret_cast<u8 const *>(file.data) + sizeof(header);
+    reader = { payload, payload + header.payload_size };
+    produce_us = header.produce_us;
+    return true;
+}
+
+// ARTIFACTS
+
+static void write_tokens(cache_writer &w, token_buffer const &tokens) noexcept
+{
+    w.array(tokens.kinds.data(), tokens.count);
+    w.array(tokens.offsets.data(), tokens.count);
+    w.array(tokens.lengths.data(), tokens.count);
+    w.array(tokens.flags.data(), tokens.count);
+}
+
+static bool read_tokens(cache_reader &r, token_buffer &tokens) noexcept
+{
+    r.vec(tokens.kinds);
+    r.vec(tokens.offsets);
+    r.vec(tokens.lengths);
+    r.vec(tokens.flags);
+    tokens.count = tokens.kinds.size();
+    return r.ok && r.pos == r.end && tokens.offsets.size() == tokens.count
+        && tokens.lengths.size() == tokens.count && tokens.flags.size() == tokens.count;
+}
+
+static void write_ast(cache_writer &w, ast const &tree, intern_table const &names) noexcept
+{
+    w.pod(tree.root);
+    w.array(tree.kinds, tree.count);
+    w.array(tree.types, tree.count);
+    w.array(tree.tokens, tree.count);
+    w.array(tree.values, tree.count);
+    w.array(tree.first_child, tree.count);
+    w.array(tree.last_child, tree.count);
+    w.array(tree.next_sibling, tree.count);
+
+    w.pod(names.count);
+    for (u32 id = 0; id < names.count; ++id) {
+        w.str(names.str(id));
+    }
+}
+
+static bool read_ast(cache_reader &r, arena &mem, ast &tree, intern_table &names) noexcept
+{
+    u32 root = r.pod<u32>();
+    u64 count = r.count<ast_kind>();
+    if (!r.ok || count > u64(ast_null)) {
+        return false;
+    }
+    tree.init(mem, std::max(u32(count), u32(16)));
+    r.raw(tree.kinds, sizeof(ast_kind) * count);
+    auto column = [&](auto *dst) {
+        using Ty = std::remove_pointer_t<decltype(dst)>;
+        if (r.count<Ty>() != count) {
+            r.ok = false;
+        }
+        r.raw(dst, sizeof(Ty) * count);
+    };
+    column(tree.types);
+    column(tree.tokens);
+    column(tree.values);
+    column(tree.first_child);
+    column(tree.last_child);
+    column(tree.next_sibling);
+    tree.count = u32(count);
+    tree.root = root;
+
+    // Ids are handed out in first-seen order, so interning in id order gives every name its old id back.
+    u32 name_count = r.pod<u32>();
+    names.init(mem, std::max(name_count, u32(16)));
+    for (u32 id = 0; id < name_count && r.ok; ++id) {
+        std::string s = r.str();
+        if (r.ok && names.intern(s) != id) {
+            r.ok = false;
+        }
+    }
+    return r.ok && r.pos == r.end;
+}
+
+static void write_ir(cache_writer &w, ir_module const &module, ir_optimization_stats const &stats) noexcept
+{
+    w.pod(u64(module.functions.size()));
+    for (ir_function const &fn : module.functions) {
+        w.str(fn.name);
+        w.pod(fn.param_count);
+        w.pod(fn.register_count);
+        w.pod(fn.slot_count);
+        w.array(fn.code.data(), fn.code.size());
+        w.array(fn.nodes.data(), fn.nodes.size());
+    }
+    w.pod(u64(module.globals.size()));
+    for (ir_global const &g : module.globals) {
+        w.str(g.name);
+        w.pod(g.initial_value);
+    }
+    w.pod(u64(module.strings.size()));
+    for (std::string const &s : module.strings) {
+        w.str(s);
+    }
+    w.array(module.constants.data(), module.constants.size());
+    w.pod(module.main_index);
+    w.pod(stats);
+}
+
+static bool read_ir(cache_reader &r, ir_module &module, ir_optimization_stats &stats) noexcept
+{
+    module = {};
+    // Each function, global and string takes at least 8 bytes, which bounds the counts before allocating.
+    module.functions.resize(r.count<u64>());
+    for (ir_function &fn : module.functions) {
+        fn.name = r.str();
+        fn.param_count = r.pod<u32>();
+        fn.register_count = r.pod<u32>();
+        fn.slot_count = r.pod<u32>();
+        r.vec(fn.code);
+        r.vec(fn.nodes);
+    }
+    module.globals.resize(r.count<u64>());
+    for (ir_global &g : module.globals) {
+        g.name = r.str();
+        g.initial_value = r.pod<s64>();
+    }
+    module.strings.resize(r.count<u64>());
+    for (std::string &s : module.strings) {
+        s = r.str();
+    }
+    r.vec(module.constants);
+    module.main_index = r.pod<u32>();
+    stats = r.pod<ir_optimization_stats>();
+    return r.ok && r.pos == r.end;
+}
+
+// COMPILATION
+
+bool compile_to_ir_cached(compilation &c, char const *cache_dir, compile_cache_stats &stats) noexcept
+{
+    c.reset();
+    std::error_code ec;
+    fs::create_directories(cache_dir, ec);
+
+    time_point_precise_t t0 = get_time_precise();
+    bool ok = preprocess_text(c.source_text, c.source_path.empty() ? "<source>" : c.source_path.c_str(), c.pp_options, c.preprocessed);
+    c.preprocess_us = time_diff_us(t0, get_time_precise());
+    if (!ok) {
+        c.errors.insert(c.errors.end(), c.preprocessed.errors.begin(), c.preprocessed.errors.end());
+        return false;
+    }
+
+    std::string_view text = c.preprocessed.text;
+    cache_key base = text_key(text);
+
+    // Loads one artifact with `read`, or runs its phase with `produce` and stores what `write` makes of it.
+    auto phase = [&](cache_artifact artifact, cache_key key, s64 &phase_us, auto &&read, auto &&produce, auto &&write) {
+        u64 i = u64(artifact);
+        time_point_precise_t start = get_time_precise();
+        {
+            mapped_file file;
+            cache_reader reader = { nullptr, nullptr };
+            s64 produce_us = 0;
+            if (load(cache_dir, key, artifact, text.size(), file, reader, produce_us) && read(reader)) {
+                phase_us = time_diff_us(start, get_time_precise());
+                ++stats.hits[i];
+                stats.bytes_read += file.size;
+                stats.saved_us += produce_us - phase_us;
+                return true;
+            }
+        }
+        ++stats.misses[i];
+        start = get_time_precise();
+        bool produced = produce();
+        phase_us = time_diff_us(start, get_time_precise());
+        if (produced) {
+            cache_writer writer;
+            write(writer);
+            store(cache_dir, key, artifact, text.size(), phase_us, writer, stats);
+        }
+        return produced;
+    };
+
+    phase(cache_artifact::tokens, artifact_key(base, cache_artifact::tokens), c.lex_us,
+        [&](cache_reader &r) { return read_tokens(r, c.tokens); },
+        [&] { lex(text, c.tokens); return true; },
+        [&](cache_writer &w) { write_tokens(w, c.tokens); });
+
+    ok = phase(cache_artifact::ast, artifact_key(base, cache_artifact::ast), c.parse_us,
+        [&](cache_reader &r) {
+            c.mem.reset();
+            return read_ast(r, c.mem, c.tree, c.names);
+        },
+        [&] {
+            // A rejected cache entry may have left partial nodes behind.
+            c.mem.reset();
+            c.tree = {};
+            c.names = {};
+            c.tree.init(c.mem, u32(std::max(c.tokens.count, u64(16))));
+            c.names.init(c.mem);
+            bool parsed = parse_tokens(text, c.tokens, c.tree, c.names, c.errors);
+            preprocess_map_error_locations(c.preprocessed, c.errors);
+            return parsed;
+        },
+        [&](cache_writer &w) { write_ast(w, c.tree, c.names); });
+    if (!ok) {
+        return false;
+    }
+
+    return phase(cache_artifact::ir, artifact_key(base, cache_artifact::ir, c.optimize ? "O1" : "O0"), c.ir_us,
+        [&](cache_reader &r) { return read_ir(r, c.ir, c.ir_stats); },
+        [&] {
+            c.ir = {};
+            c.ir_stats = {};
+            bool lowered = ast_to_ir(text, c.tokens, c.tree, c.names, c.ir, c.errors);
+            preprocess_map_error_locations(c.preprocessed, c.errors);
+            if (lowered && c.optimize) {
+                ir_optimize(c.ir, &c.ir_stats);
+            }
+            return lowered;
+        },
+        [&](cache_writer &w) { write_ir(w, c.ir, c.ir_stats); });
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <string>
+
+#include "primitives.hpp"
+
+struct compilation;
+
+/// Part of every cache key and entry header. Bump it whenever the layout of entries on disk changes; what the
+/// compiler produces changing is covered by `compiler_build_id`, also part of every key.
+u32 constexpr compile_cache_version = 2;
+
+enum class cache_artifact : u8
+{
+    tokens,
+    ast,        // with the intern table its names refer to
+    ir,         // optimized or not, keyed separately
+
+    count
+};
+
+char const *cache_artifact_name(cache_artifact artifact) noexcept;
+
+struct compile_cache_stats
+{
+    u64 hits[u64(cache_artifact::count)];
+    u64 misses[u64(cache_artifact::count)];
+    u64 bytes_read;
+    u64 bytes_written;
+    s64 saved_us;       // what the skipped phases took when their artifacts were stored, minus loading them
+};
+
+void compile_cache_stats_add(compile_cache_stats &total, compile_cache_stats const &s) noexcept;
+
+/// One line: hits and misses per artifact, bytes read and written, time saved.
+std::string compile_cache_stats_to_string(compile_cache_stats const &stats) noexcept;
+
+/// `compile_to_ir` backed by a content-addressed cache in `cache_dir` (created if missing). The source is
+/// always preprocessed, its expanded text is what gets hashed (so header edits invalidate entries too); every
+/// later phase whose artifact is in the cache is loaded instead of run, and every phase that runs successfully
+/// is stored. Entries are files named by a 128-bit hash of the text, `compile_cache_version`,
+/// `compiler_build_id` and, for IR, `c.optimize`; they are written to a temporary name and renamed, so
+/// concurrent compilations of the same input are safe, and a truncated or mismatched entry is treated as a
+/// miss. Cache I/O failures only cost the hit. Hits and misses are added to `stats`.
+bool compile_to_ir_cached(compilation &c, char const *cache_dir, compile_cache_stats &stats) noexcept;
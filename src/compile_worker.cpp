@@ -0,0 +1,180 @@
+#include <algorithm>
+#include <cstring>
+
+#include "util.hpp"
+#include "interpreter.hpp"
+#include "x64.hpp"
+
+#include "compile_worker.hpp"
+
+compile_worker::compile_worker(result_callback on_result) noexcept
+    : m_on_result(std::move(on_result)), m_thread(&compile_worker::worker_main, this)
+{
+}
+
+compile_worker::~compile_worker() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+        m_cancel.cancel();
+    }
+    m_wake.notify_one();
+    m_thread.join();
+}
+
+void compile_worker::submit(std::string path, std::string source, u64 generation) noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending = std::make_unique<request>(request{ std::move(path), std::move(source), generation });
+        m_cancel.cancel(); // reset by the worker when it takes the request, so this only ever stops older ones
+    }
+    m_wake.notify_one();
+}
+
+void compile_worker::worker_main() noexcept
+{
+    for (;;) {
+        std::unique_ptr<request> req;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return m_stop || m_pending != nullptr; });
+            if (m_stop) {
+                return;
+            }
+            req = std::move(m_pending);
+            m_cancel.reset();
+        }
+
+        std::unique_ptr<compile_snapshot> snapshot = compile(*req);
+        if (snapshot != nullptr) {
+            m_previous = std::move(snapshot);
+            m_on_result(m_previous);
+        }
+    }
+}
+
+static void copy_tree(ast const &from, ast &to, arena &mem) noexcept
+{
+    to.init(mem, std::max(from.count, u32(1)));
+    memcpy(to.kinds, from.kinds, sizeof(ast_kind) * from.count);
+    memcpy(to.types, from.types, sizeof(ast_type) * from.count);
+    memcpy(to.tokens, from.tokens, sizeof(u32) * from.count);
+    memcpy(to.values, from.values, sizeof(u32) * from.count);
+    memcpy(to.first_child, from.first_child, sizeof(u32) * from.count);
+    memcpy(to.last_child, from.last_child, sizeof(u32) * from.count);
+    memcpy(to.next_sibling, from.next_sibling, sizeof(u32) * from.count);
+    to.count = from.count;
+    to.root = from.root;
+}
+
+/// Front end (incrementally), back end, AST diff and layout, source index, control-flow graph layouts, code generation
+/// for the register allocation report, then a run of the program, polling `m_cancel` throughout. Returns null if it
+/// was cancelled.
+std::unique_ptr<compile_snapshot> compile_worker::compile(request const &req) noexcept
+{
+    time_point_precise_t t0 = get_time_precise();
+    auto snapshot = std::make_unique<compile_snapshot>();
+    snapshot->generation = req.generation;
+
+    compilation &c = m_unit.comp;
+    c.cancel = &m_cancel;
+    bool ok;
+    if (c.source_path != req.path) {
+        c.source_path = req.path;
+        c.source_text = req.source;
+        ok = incremental_build(m_unit, snapshot->front_end);
+    } else {
+        ok = incremental_update(m_unit, req.source, snapshot->front_end);
+    }
+    ok = ok && compile_back_end(c);
+    if (m_cancel.cancelled()) {
+        return nullptr;
+    }
+
+    // COPY what the panes show, `m_unit` changes with the next request.
+    snapshot->text = c.preprocessed.text;
+    snapshot->tokens = c.tokens;
+    snapshot->errors = c.errors;
+    copy_tree(c.tree, snapshot->tree, snapshot->mem);
+
+    // Diff against what the GUI shows, so it can keep its selection, and lay out only what changed.
+    time_point_precise_t layout_start = get_time_precise();
+    ast_subtree_hashes(snapshot->tree, snapshot->tokens, snapshot->text, snapshot->hashes);
+    if (m_previous != nullptr) {
+        snapshot->diff_base = m_previous->generation;
+        ast_diff_trees(m_previous->tree, m_previous->hashes, snapshot->tree, snapshot->hashes, snapshot->diff);
+        snapshot->layout_reused = ast_layout_update(snapshot->tree, m_previous->layout, snapshot->diff, snapshot->layout);
+    } else {
+        ast_layout_build(snapshot->tree, snapshot->layout);
+    }
+    snapshot->layout_us = time_diff_us(layout_start, get_time_precise());
+
+    // Only IR lowered from this tree is linked, after a failed compile `c.ir` may be an older one.
+    time_point_precise_t index_start = get_time_precise();
+    snapshot->direct = m_unit.direct;
+    source_index_build(snapshot->text, snapshot->tokens, snapshot->tree, ok ? c.ir : ir_module{}, snapshot->index);
+    snapshot->index_us = time_diff_us(index_start, get_time_precise());
+
+    if (ok) {
+        std::string &ir = snapshot->ir_listing;
+        ir = ir_optimization_stats_to_string(c.ir_stats) + '\n';
+        u32 first_line = u32(std::count(ir.begin(), ir.end(), '\n'));
+        ir += ir_module_to_string(c.ir, &snapshot->ir_function_lines);
+        for (u32 &line : snapshot->ir_function_lines) {
+            line += first_line;
+        }
+
+        // Only functions whose listing changed are laid out again, the cache keeps what this compile used.
+        time_point_precise_t cfg_start = get_time_precise();
+        std::unordered_map<u64, std::shared_ptr<cfg_layout const>> cache;
+        for (ir_function const &fn : c.ir.functions) {
+            if (m_cancel.cancelled()) {
+                m_cfg_cache.merge(cache); // what was laid out so far is likely still wanted by the next request
+                return nullptr;
+            }
+            u64 hash = cfg_layout_hash(c.ir, fn);
+            auto cached = m_cfg_cache.find(hash);
+            std::shared_ptr<cfg_layout const> layout;
+            if (cached != m_cfg_cache.end() && cached->second->name == fn.name) {
+                layout = cached->second;
+                ++snapshot->cfgs_reused;
+            } else {
+                auto built = std::make_shared<cfg_layout>();
+                cfg_layout_build(c.ir, fn, *built);
+                layout = std::move(built);
+            }
+            cache.emplace(hash, layout);
+            snapshot->cfgs.push_back(std::move(layout));
+        }
+        m_cfg_cache = std::move(cache);
+        snapshot->cfg_us = time_diff_us(cfg_start, get_time_precise());
+
+        x64_options options;
+        options.cancel = &m_cancel;
+        x64_module_code code;
+        std::string codegen_error;
+        if (x64_compile(c.ir, code, codegen_error, options)) {
+            ir += "\n--- register allocation ---\n" + regalloc_stats_to_string(code.regalloc);
+        }
+
+        interpreter_options run_options;
+        run_options.cancel = &m_cancel;
+        execution_result run;
+        execute_ir(c.ir, run, run_options);
+        if (m_cancel.cancelled()) {
+            return nullptr;
+        }
+        ir += make_str("--- exit code %lld, %lld us ---\n", (long long)run.exit_code, (long long)run.elapsed_us);
+        ir += run.output;
+        if (!run.error.empty()) {
+            ir += "\nruntime error: " + run.error + '\n';
+        }
+    }
+
+    index_lines(snapshot->ir_listing, snapshot->ir_line_starts);
+
+    snapshot->elapsed_us = time_diff_us(t0, get_time_precise());
+    return snapshot;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "primitives.hpp"
+#include "util.hpp"
+#include "incremental.hpp"
+#include "ast_diff.hpp"
+#include "ast_layout.hpp"
+#include "source_index.hpp"
+#include "cfg_layout.hpp"
+#include "text_document.hpp"
+
+/// @brief What the compilation flow panes show for one version of the source, built on the worker thread so
+/// the GUI only has to display it. Owns copies of the text, tokens and AST, the worker moves on without it.
+struct compile_snapshot
+{
+    u64 generation = 0;             // of the request it answers
+    incremental_stats front_end = {};
+    std::string text;               // what `tokens` index into
+    token_buffer tokens;
+    arena mem;                      // holds `tree`
+    ast tree;
+    std::vector<u64> hashes;        // of `tree`'s subtrees
+    u64 diff_base = 0;              // generation `diff` is against, 0 if there was none to diff against
+    ast_diff diff = {};             // from the previous snapshot's tree to `tree`
+    ast_layout layout;              // of `tree`, so the GUI only draws it
+    u64 layout_reused = 0;          // nodes whose layout was carried over from the previous snapshot
+    s64 layout_us = 0;
+    bool direct = false;            // `text` is the submitted source as-is, so offsets into one are offsets into both
+    source_index index;             // of `text`, `tokens`, `tree` and the IR in `ir_listing`
+    s64 index_us = 0;
+    std::vector<std::string> errors;
+    std::string ir_listing;         // optimization statistics, IR, register allocation and what running it printed
+    std::vector<u32> ir_function_lines; // line (from 0) of every function's first instruction in `ir_listing`
+    std::vector<u32> ir_line_starts;    // of `ir_listing`, so a view can show any line without splitting it
+    std::vector<std::shared_ptr<cfg_layout const>> cfgs; // per function of that IR, shared with older snapshots
+    u64 cfgs_reused = 0;            // layouts whose function's listing had not changed
+    s64 cfg_us = 0;
+    s64 elapsed_us = 0;             // everything the worker did for it
+};
+
+/// @brief Compiles the latest submitted source on a thread of its own. Submitting cancels the compilation in
+/// progress (it stops at the next phase, function, or loop iteration of the program it runs) and replaces any
+/// request still waiting, so the worker only ever catches up with the newest source. Sources are compiled
+/// through one `incremental_unit`, so consecutive versions share their unchanged tokens and declarations.
+struct compile_worker
+{
+    /// Called on the worker thread with every snapshot that was neither superseded nor cancelled. The worker
+    /// keeps the last one to diff the next against, so snapshots are shared and never change once posted.
+    using result_callback = std::function<void(std::shared_ptr<compile_snapshot const>)>;
+
+    explicit compile_worker(result_callback on_result) noexcept;
+    compile_worker(compile_worker const &) = delete;
+    compile_worker &operator=(compile_worker const &) = delete;
+    ~compile_worker() noexcept; // cancels what is running and joins
+
+    /// `path` only names the source in diagnostics.
+    void submit(std::string path, std::string source, u64 generation) noexcept;
+
+private:
+    struct request
+    {
+        std::string path;
+        std::string source;
+        u64 generation;
+    };
+
+    void worker_main() noexcept;
+    std::unique_ptr<compile_snapshot> compile(request const &req) noexcept;
+
+    result_callback m_on_result;
+    incremental_unit m_unit;        // only touched by the worker thread
+    std::shared_ptr<compile_snapshot const> m_previous; // the last snapshot posted
+    std::unordered_map<u64, std::shared_ptr<cfg_layout const>> m_cfg_cache; // by hash, of the last compile's functions
+    cancel_token m_cancel;          // of the request being compiled
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::unique_ptr<request> m_pending;
+    bool m_stop = false;
+
+    std::thread m_thread;           // last, so it starts after everything it uses
+};
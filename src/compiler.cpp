@@ -0,0 +1,122 @@
+#include <algorithm>
+
+#include "util.hpp"
+#include "mapped_file.hpp"
+#include "parser.hpp"
+#include "ast_to_ir.hpp"
+#include "compiler_build_id.hpp"
+
+#include "compiler.hpp"
+
+void compilation::reset() noexcept
+{
+    preprocessed = {};
+    tokens.clear();
+    mem.reset();
+    names = {};
+    tree = {};
+    ir = {};
+    ir_stats = {};
+    errors.clear();
+    preprocess_us = 0;
+    lex_us = 0;
+    parse_us = 0;
+    ir_us = 0;
+}
+
+char const *compiler_build_id() noexcept
+{
+    return COMPILER_BUILD_ID;
+}
+
+bool compilation_load_file(compilation &c, char const *path) noexcept
+{
+    mapped_file file;
+    if (!file.open(path)) {
+        return false;
+    }
+    c.source_path = path;
+    c.source_text.assign(file.view());
+    return true;
+}
+
+bool compile_front_end(compilation &c) noexcept
+{
+    c.reset();
+
+    time_point_precise_t t0 = get_time_precise();
+    bool ok = preprocess_text(c.source_text, c.source_path.empty() ? "<source>" : c.source_path.c_str(), c.pp_options, c.preprocessed);
+    time_point_precise_t t1 = get_time_precise();
+    c.preprocess_us = time_diff_us(t0, t1);
+
+    if (!ok) {
+        c.errors.insert(c.errors.end(), c.preprocessed.errors.begin(), c.preprocessed.errors.end());
+        return false;
+    }
+    if (cancelled(c.cancel)) {
+        return false;
+    }
+
+    lex(c.preprocessed.text, c.tokens);
+    time_point_precise_t t2 = get_time_precise();
+    c.lex_us = time_diff_us(t1, t2);
+    if (cancelled(c.cancel)) {
+        return false;
+    }
+
+    // Parsed C averages under one node per token, start there to avoid most regrowth.
+    c.tree.init(c.mem, u32(std::max(c.tokens.count, u64(16))));
+    c.names.init(c.mem);
+    ok = parse_tokens(c.preprocessed.text, c.tokens, c.tree, c.names, c.errors);
+    preprocess_map_error_locations(c.preprocessed, c.errors);
+    c.parse_us = time_diff_us(t2, get_time_precise());
+
+    return ok;
+}
+
+bool compile_back_end(compilation &c) noexcept
+{
+    c.ir = {};
+    c.ir_stats = {};
+
+    time_point_precise_t t0 = get_time_precise();
+    u64 first_error = c.errors.size();
+    bool ok = ast_to_ir(c.preprocessed.text, c.tokens, c.tree, c.names, c.ir, c.errors, c.cancel);
+    preprocess_map_error_locations(c.preprocessed, c.errors, first_error);
+    if (ok && c.optimize) {
+        ir_optimize(c.ir, &c.ir_stats, c.cancel);
+    }
+    c.ir_us = time_diff_us(t0, get_time_precise());
+
+    return ok && !cancelled(c.cancel);
+}
+
+bool compile_to_ir(compilation &c) noexcept
+{
+    return compile_front_end(c) && compile_back_end(c);
+}
+
+std::string generate_benchmark_program(u64 functions, bool with_main, char const *prefix) noexcept
+{
+    std::string source = make_str("long %stotal;\n", prefix);
+    for (u64 i = 0; i < functions; ++i) {
+        source += make_str(
+            "long %sf%llu(long a, long b)\n"
+            "{\n"
+            "    long s = 0;\n"
+            "    for (long i = 0; i < a; i++) {\n"
+            "        if (i %% 3 == 0) s += i * b; else s -= i / (b + 1);\n"
+            "        s = s ^ (s << 2);\n"
+            "    }\n"
+            "    %stotal += s;\n"
+            "    %s\n"
+            "    return s + a * b;\n"
+            "}\n",
+            prefix, (unsigned long long)i, prefix,
+            i == 0 ? "" : make_str("printf(\"f%llu %%ld\\n\", %sf%llu(a - 1, b));", (unsigned long long)i, prefix, (unsigned long long)(i - 1)).c_str());
+    }
+    if (with_main && functions > 0) {
+        source += make_str("int main(void) { return %sf%llu(3, 4) & 255; }\n", prefix, (unsigned long long)(functions - 1));
+    }
+    return source;
+}
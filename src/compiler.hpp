@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "arena.hpp"
+#include "lexer.hpp"
+#include "preprocessor.hpp"
+#include "ast.hpp"
+#include "intern.hpp"
+#include "ir.hpp"
+#include "optimizer.hpp"
+
+struct cancel_token;
+
+/// @brief Everything produced by compiling one translation unit. Phase outputs that are not owned by
+/// standard containers live in `mem`, so starting over is `reset` (a single arena rewind).
+struct compilation
+{
+    std::string source_path;
+    std::string source_text;
+
+    preprocessor_options pp_options;
+    bool optimize = true; // run `ir_optimize` after AST_to_IR
+    cancel_token const *cancel = nullptr; // polled between phases and per function, see `compile_to_ir`
+    preprocess_result preprocessed;
+    token_buffer tokens; // of `preprocessed.text`
+
+    arena mem;
+    intern_table names; // identifiers of `tree`
+    ast tree;
+    ir_module ir;
+    ir_optimization_stats ir_stats;
+
+    std::vector<std::string> errors;
+
+    s64 preprocess_us = 0;
+    s64 lex_us = 0;
+    s64 parse_us = 0;
+    s64 ir_us = 0;
+
+    void reset() noexcept;
+};
+
+/// Identifies the compiler: a hash of every compiler core source, generated by the build. The Qt front end is
+/// not part of it, so changing only the GUI keeps test results and cached artifacts valid.
+char const *compiler_build_id() noexcept;
+
+/// Reads `path` into `c.source_text` (and sets `c.source_path`). Returns false if the file cannot be read.
+bool compilation_load_file(compilation &c, char const *path) noexcept;
+
+/// Runs preprocess_text -> preprocessed_text_to_tokens -> tokens_to_AST on `c.source_text`.
+/// Returns false if any phase reported errors (see `c.errors`), later phases are skipped in that case.
+bool compile_front_end(compilation &c) noexcept;
+
+/// AST_to_IR of the front end's results in `c` into `c.ir`, optimized unless `c.optimize` is off.
+bool compile_back_end(compilation &c) noexcept;
+
+/// `compile_front_end` followed by `compile_back_end`. If `c.cancel` gets cancelled they stop at the next
+/// phase or function and return false, leaving `c` partly built.
+bool compile_to_ir(compilation &c) noexcept;
+
+/// The program the benchmarks compile, growing with `functions`: a global `<prefix>total`, then functions
+/// `<prefix>f0`, `<prefix>f1`, ... of a loop, a branch and arithmetic each, every one but the first also printing
+/// a call to the one before. With `with_main`, a `main` calls the last, making a whole program.
+std::string generate_benchmark_program(u64 functions, bool with_main, char const *prefix = "") noexcept;
@@ -0,0 +1,350 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+
+#include "util.hpp"
+#include "mapped_file.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "elf.hpp"
+
+#include "differential.hpp"
+
+namespace fs = std::filesystem;
+
+#if defined(_WIN32)
+static char const s_null_device[] = "NUL";
+static char const s_exe_suffix[] = ".exe";
+#else
+static char const s_null_device[] = "/dev/null";
+static char const s_exe_suffix[] = "";
+#endif
+
+static bool run_command(std::string const &command) noexcept
+{
+#if defined(_WIN32)
+    // cmd strips the outer quotes of a command line that starts with one.
+    std::string line = "\"" + command + "\"";
+#else
+    std::string const &line = command;
+#endif
+    return std::system(line.c_str()) == 0;
+}
+
+static std::string quoted(fs::path const &path) noexcept
+{
+    return "\"" + path.string() + "\"";
+}
+
+/// Best time of `iterations` runs of `command`, or -1 if `must_succeed` and it failed.
+static s64 best_command_us(std::string const &command, u64 iterations, bool must_succeed) noexcept
+{
+    s64 best = std::numeric_limits<s64>::max();
+    for (u64 i = 0; i < iterations; ++i) {
+        time_point_precise_t t0 = get_time_precise();
+        bool ok = run_command(command);
+        best = std::min(best, time_diff_us(t0, get_time_precise()));
+        if (must_succeed && !ok) {
+            return -1;
+        }
+    }
+    return best;
+}
+
+static bool file_equals(fs::path const &path, std::string_view text) noexcept
+{
+    mapped_file file;
+    return file.open(path.string().c_str()) && file.view() == text;
+}
+
+namespace
+{
+    struct native_config
+    {
+        std::string compiler;
+        char const *level;
+        std::string name;
+        s64 empty_compile_us = 0; // of an empty `main` to an object file, the compiler's own startup
+        s64 startup_us = 0;     // of an empty `main` built the same way
+        std::string error;
+    };
+
+    struct program
+    {
+        std::string name;
+        fs::path path;          // the source, as the system compilers see it
+        std::string text;       // as ours does
+    };
+}
+
+/// Compiles `source` to `object` the way every config compiles the programs.
+static std::string native_compile_command(native_config const &config, fs::path const &source, fs::path const &object) noexcept
+{
+    return config.name + " -w -include stdio.h -c " + quoted(source) + " -o " + quoted(object);
+}
+
+/// Source to object file, ours over theirs: both sides produce machine code.
+static f64 compile_ratio(differential_test_result const &t, differential_native_result const &n) noexcept
+{
+    return f64(std::max(t.compile_us + t.object_compile_us, s64(1))) / f64(std::max(n.compile_us, s64(1)));
+}
+
+differential_benchmark_result differential_benchmark(std::vector<compiler_test> const &tests, char const *data_dir,
+                                                     u64 iterations) noexcept
+{
+    differential_benchmark_result result = {};
+    iterations = std::max(iterations, u64(1));
+
+    std::error_code ec;
+    fs::path dir = fs::temp_directory_path(ec) / make_str("differential-%llx", (unsigned long long)get_time_precise().time_since_epoch().count());
+    fs::create_directories(dir, ec);
+    if (ec) {
+        result.errors.push_back("cannot create " + dir.string());
+        return result;
+    }
+    std::string const quiet = make_str(" >%s 2>%s", s_null_device, s_null_device);
+
+    // SYSTEM COMPILERS, each with the time it takes to start a program it built.
+    std::vector<native_config> configs;
+    for (char const *compiler : { "gcc", "clang" }) {
+        if (!run_command(std::string(compiler) + " --version" + quiet)) {
+            continue;
+        }
+        for (char const *level : { "-O0", "-O2" }) {
+            configs.push_back({ compiler, level, std::string(compiler) + " " + level, 0, 0, {} });
+        }
+    }
+    if (configs.empty()) {
+        result.errors.push_back("neither gcc nor clang was found on the PATH");
+    }
+
+    fs::path empty_source = dir / "empty.c";
+    if (FILE *file = fopen(empty_source.string().c_str(), "wb")) {
+        fputs("int main(void) { return 0; }\n", file);
+        fclose(file);
+    }
+    for (u64 c = 0; c < configs.size(); ++c) {
+        native_config &config = configs[c];
+        fs::path exe = dir / make_str("empty-%llu%s", (unsigned long long)c, s_exe_suffix);
+        if (!run_command(config.name + " " + quoted(empty_source) + " -o " + quoted(exe) + quiet)) {
+            config.error = "cannot build an empty program";
+            result.errors.push_back(config.name + ": " + config.error);
+            continue;
+        }
+        config.startup_us = best_command_us(quoted(exe) + quiet, iterations, false);
+        fs::path empty_object = dir / make_str("empty-%llu.o", (unsigned long long)c);
+        config.empty_compile_us = std::max(best_command_us(native_compile_command(config, empty_source, empty_object) + quiet, iterations, false), s64(0));
+        result.configs.push_back(config.name);
+    }
+
+    // PROGRAMS: the tests, then one that runs long enough to measure more than process startup.
+    std::vector<program> programs;
+    for (compiler_test const &test : tests) {
+        program p = { test.name, fs::path(data_dir) / test.source_file, {} };
+        compilation comp;
+        if (!compilation_load_file(comp, p.path.string().c_str())) {
+            result.errors.push_back(test.name + ": cannot read " + p.path.string());
+            continue;
+        }
+        p.text = std::move(comp.source_text);
+        programs.push_back(std::move(p));
+    }
+    {
+        program p = { "interpreter_benchmark", dir / "interpreter_benchmark.c", interpreter_benchmark_source() };
+        if (FILE *file = fopen(p.path.string().c_str(), "wb")) {
+            fwrite(p.text.data(), 1, p.text.size(), file);
+            fclose(file);
+        }
+        programs.push_back(std::move(p));
+    }
+
+    for (u64 i = 0; i < programs.size(); ++i) {
+        program const &p = programs[i];
+        differential_test_result &t = result.tests.emplace_back();
+        t.name = p.name;
+
+        // OURS
+        compilation comp;
+        bool compiled = false;
+        t.compile_us = best_time_us(iterations, [&] {
+            comp.reset();
+            comp.source_path = p.path.string();
+            comp.source_text = p.text;
+            compiled = compile_to_ir(comp);
+        });
+        if (!compiled) {
+            t.error = comp.errors.empty() ? "compilation failed" : comp.errors.front();
+            result.errors.push_back(p.name + ": " + t.error);
+            continue;
+        }
+        bool has_main = comp.ir.main_index != u32(-1);
+
+        // A program that traps here (overflows the stack, divides by zero) is undefined behaviour in C: a native
+        // build may crash or, its recursion made a loop, never stop. Such programs are compiled, never run.
+        execution_result reference;
+        execute_ir(comp.ir, reference);
+        if (has_main && !reference.error.empty()) {
+            result.errors.push_back(p.name + ": traps (" + reference.error + "), compile times only");
+            has_main = false;
+        }
+        if (has_main) {
+            execution_result run;
+            t.interpreter_us = best_time_us(iterations, [&] { execute_ir(comp.ir, run); });
+        }
+
+        if (jit_available()) {
+            jit_module jit;
+            std::string error;
+            bool jitted = false;
+            t.jit_compile_us = best_time_us(iterations, [&] { jitted = jit_compile(comp.ir, jit, error); });
+            if (!jitted) {
+                result.errors.push_back(p.name + ": JIT: " + error);
+            } else if (has_main) {
+                ir_runtime rt;
+                t.jit_us = best_time_us(iterations, [&] {
+                    ir_runtime_init(rt, comp.ir);
+                    s64 exit_code = 0;
+                    jit_call(jit, comp.ir.main_index, nullptr, 0, rt, exit_code);
+                });
+                t.jit_output_matches = rt.output == reference.output && rt.error.empty();
+                if (!t.jit_output_matches) {
+                    result.errors.push_back(p.name + ": the JIT printed something else than the interpreter");
+                }
+            }
+        }
+
+        fs::path object = dir / make_str("ours-%llu.o", (unsigned long long)i);
+        std::string error;
+        bool written = false;
+        t.object_compile_us = best_time_us(iterations, [&] { written = elf_write_object_file(comp.ir, object.string().c_str(), error); });
+        if (!written) {
+            result.errors.push_back(p.name + ": object file: " + error);
+        } else if (has_main && !configs.empty() && configs[0].error.empty()) {
+            // Linked and started by the first system compiler, so its startup time is the one to subtract.
+            fs::path exe = dir / make_str("ours-%llu%s", (unsigned long long)i, s_exe_suffix);
+            fs::path out = dir / make_str("ours-%llu.txt", (unsigned long long)i);
+            if (!run_command(configs[0].compiler + " " + quoted(object) + " -o " + quoted(exe) + quiet)) {
+                result.errors.push_back(p.name + ": cannot link our object file");
+            } else {
+                s64 us = best_command_us(quoted(exe) + " >" + quoted(out) + " 2>" + s_null_device, iterations, false);
+                t.object_us = std::max(us - configs[0].startup_us, s64(1));
+                t.object_output_matches = file_equals(out, reference.output);
+                if (!t.object_output_matches) {
+                    result.errors.push_back(p.name + ": our object file printed something else than the interpreter");
+                }
+            }
+        }
+
+        // THEIRS
+        for (u64 c = 0; c < configs.size(); ++c) {
+            native_config const &config = configs[c];
+            if (!config.error.empty()) {
+                continue;
+            }
+            differential_native_result &n = t.native.emplace_back();
+            n.config = config.name;
+            fs::path native_object = dir / make_str("native-%llu-%llu.o", (unsigned long long)i, (unsigned long long)c);
+            n.compile_us = best_command_us(native_compile_command(config, p.path, native_object) + quiet, iterations, true);
+            if (n.compile_us < 0) {
+                n.error = "does not compile";
+                n.compile_us = 0;
+                continue;
+            }
+            n.compile_us = std::max(n.compile_us - config.empty_compile_us, s64(0));
+            if (!has_main) {
+                continue;
+            }
+            fs::path exe = dir / make_str("native-%llu-%llu%s", (unsigned long long)i, (unsigned long long)c, s_exe_suffix);
+            fs::path out = dir / make_str("native-%llu-%llu.txt", (unsigned long long)i, (unsigned long long)c);
+            if (!run_command(config.compiler + " " + quoted(native_object) + " -o " + quoted(exe) + quiet)) {
+                n.error = "does not link";
+                continue;
+            }
+            s64 us = best_command_us(quoted(exe) + " >" + quoted(out) + " 2>" + s_null_device, iterations, false);
+            n.run_us = std::max(us - config.startup_us, s64(1));
+            n.output_matches = file_equals(out, reference.output);
+        }
+    }
+    fs::remove_all(dir, ec);
+
+    // RATIOS, over the programs both sides built and ran alike.
+    for (std::string const &config : result.configs) {
+        differential_ratio &r = result.ratios.emplace_back();
+        r.config = config;
+        f64 log_compile = 0, log_interpreter = 0, log_jit = 0, log_object = 0;
+        u64 compiled = 0, jit_runs = 0, object_runs = 0;
+        for (differential_test_result const &t : result.tests) {
+            auto n = std::find_if(t.native.begin(), t.native.end(), [&](differential_native_result const &n) { return n.config == config; });
+            if (!t.error.empty() || n == t.native.end() || !n->error.empty()) {
+                continue;
+            }
+            if (n->compile_us != 0) {
+                log_compile += std::log(compile_ratio(t, *n));
+                ++compiled;
+            }
+            if (n->run_us == 0 || !n->output_matches) {
+                continue;
+            }
+            log_interpreter += std::log(f64(t.interpreter_us) / f64(n->run_us));
+            ++r.programs;
+            if (t.jit_us != 0 && t.jit_output_matches) {
+                log_jit += std::log(f64(t.jit_us) / f64(n->run_us));
+                ++jit_runs;
+            }
+            if (t.object_us != 0 && t.object_output_matches) {
+                log_object += std::log(f64(t.object_us) / f64(n->run_us));
+                ++object_runs;
+            }
+        }
+        r.compile = compiled != 0 ? std::exp(log_compile / f64(compiled)) : 0;
+        r.interpreter = r.programs != 0 ? std::exp(log_interpreter / f64(r.programs)) : 0;
+        r.jit = jit_runs != 0 ? std::exp(log_jit / f64(jit_runs)) : 0;
+        r.object = object_runs != 0 ? std::exp(log_object / f64(object_runs)) : 0;
+    }
+    return result;
+}
+
+std::string differential_benchmark_to_string(differential_benchmark_result const &result) noexcept
+{
+    std::string s;
+    for (differential_test_result const &t : result.tests) {
+        if (!t.error.empty()) {
+            s += make_str("%s: %s\n", t.name.c_str(), t.error.c_str());
+            continue;
+        }
+        s += make_str("%s: ours compile %lld us (JIT +%lld, object +%lld) | run: interpreter %lld us, JIT %lld us%s, object %lld us%s\n",
+                      t.name.c_str(), (long long)t.compile_us, (long long)t.jit_compile_us, (long long)t.object_compile_us,
+                      (long long)t.interpreter_us, (long long)t.jit_us, t.jit_us != 0 && !t.jit_output_matches ? " (different output)" : "",
+                      (long long)t.object_us, t.object_us != 0 && !t.object_output_matches ? " (different output)" : "");
+        for (differential_native_result const &n : t.native) {
+            if (!n.error.empty()) {
+                s += make_str("    %-10s %s\n", n.config.c_str(), n.error.c_str());
+                continue;
+            }
+            if (n.compile_us != 0) {
+                s += make_str("    %-10s compile %lld us (ours to an object file %.3fx)", n.config.c_str(), (long long)n.compile_us,
+                              compile_ratio(t, n));
+            } else {
+                s += make_str("    %-10s compile within noise of an empty program", n.config.c_str());
+            }
+            if (n.run_us != 0) {
+                s += make_str(" | run %lld us%s: interpreter %.2fx, JIT %.2fx, object %.2fx", (long long)n.run_us,
+                              n.output_matches ? "" : " (different output)", f64(t.interpreter_us) / f64(n.run_us),
+                              f64(t.jit_us) / f64(n.run_us), f64(t.object_us) / f64(n.run_us));
+            }
+            s += '\n';
+        }
+    }
+    s += "geometric mean, our time over theirs (compile: source to object file, their empty program's compile subtracted):\n";
+    for (differential_ratio const &r : result.ratios) {
+        s += make_str("    %-10s compile %.3fx | run over %llu programs: interpreter %.2fx, JIT %.2fx, object %.2fx\n",
+                      r.config.c_str(), r.compile, (unsigned long long)r.programs, r.interpreter, r.jit, r.object);
+    }
+    for (std::string const &e : result.errors) {
+        s += "error: " + e + "\n";
+    }
+    return s;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "test_suite.hpp"
+
+/// @brief One program built by a system C compiler at one optimization level.
+struct differential_native_result
+{
+    std::string config;             // e.g. "gcc -O2"
+    std::string error;              // why it could not be compiled, linked or run, empty if it was
+    s64 compile_us;                 // to an object file, best of the iterations, less the config's compile of an empty
+                                    // `main`; 0 if it was no slower than that, within noise of it
+    s64 run_us;                     // best of the iterations, the config's process startup time subtracted; 0 without `main` or trapping
+    bool output_matches;            // printed the same as our interpreter
+};
+
+/// @brief One program built by our compiler and run on every engine available, then by every system config.
+struct differential_test_result
+{
+    std::string name;
+    std::string error;              // why our compiler could not build it, empty if it could
+    s64 compile_us;                 // source to IR, best of the iterations
+    s64 jit_compile_us;             // IR to machine code
+    s64 object_compile_us;          // IR to an object file, linking excluded
+    s64 interpreter_us;             // runs, best of the iterations; 0 where unavailable, without `main` or trapping
+    s64 jit_us;
+    s64 object_us;                  // a process like the native ones, its startup time subtracted the same way
+    bool jit_output_matches;        // printed the same as our interpreter, else its time is left out of the ratios
+    bool object_output_matches;
+    std::vector<differential_native_result> native;     // by config
+};
+
+/// @brief How many times slower than a system config, as a geometric mean over the programs both ran.
+struct differential_ratio
+{
+    std::string config;
+    f64 compile;                    // our source to object file time (`compile_us` + `object_compile_us`) over theirs
+    f64 interpreter;                // our run time over theirs
+    f64 jit;
+    f64 object;
+    u64 programs;                   // that both ran with the same output
+};
+
+struct differential_benchmark_result
+{
+    std::vector<std::string> configs;               // "<compiler> -O0" and "<compiler> -O2" per compiler found
+    std::vector<differential_test_result> tests;    // the CSV's, then the interpreter benchmark program
+    std::vector<differential_ratio> ratios;         // by config
+    std::vector<std::string> errors;
+};
+
+/// Builds every test program (and the interpreter benchmark program) with our compiler and with each of gcc and
+/// clang found on the PATH at -O0 and -O2, runs each build `iterations` times and compares compile and run
+/// times. System compilers and the programs they build run as processes started through the shell, so each
+/// config's time to compile an empty `main` is subtracted from its compile times, and its startup time (that
+/// empty `main` run the same way, also used for our object files) from its runs. Sources are
+/// compiled with `-include stdio.h`, the way our compiler provides `printf` without a declaration. Programs
+/// that trap in our interpreter are undefined behaviour in C, so only their compile times are compared.
+differential_benchmark_result differential_benchmark(std::vector<compiler_test> const &tests, char const *data_dir,
+                                                     u64 iterations = 5) noexcept;
+
+/// A table of the per-program times and ratios, then the geometric means.
+std::string differential_benchmark_to_string(differential_benchmark_result const &result) noexcept;
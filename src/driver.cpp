@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <limits>
+#include <thread>
+
+#include "util.hpp"
+#include "thread_pool.hpp"
+
+#include "driver.hpp"
+
+static u64 unit_fingerprint(driver_unit const &unit) noexcept
+{
+    u64 hash = fnv1a_hash(ir_module_to_string(unit.comp.ir));
+    for (std::string const &e : unit.comp.errors) {
+        hash = fnv1a_hash(e, hash);
+    }
+    return hash;
+}
+
+driver_result driver_compile(std::vector<driver_input> const &inputs, thread_pool &pool, bool optimize) noexcept
+{
+    driver_result result = {};
+    for (u64 i = 0; i < inputs.size(); ++i) {
+        result.units.push_back(std::make_unique<driver_unit>());
+    }
+    std::vector<u64> fingerprints(inputs.size());
+
+    time_point_precise_t t0 = get_time_precise();
+    pool.parallel_for(inputs.size(), [&](u64 i, u32 worker) {
+        time_point_precise_t start = get_time_precise();
+        driver_input const &input = inputs[i];
+        driver_unit &unit = *result.units[i];
+        unit.worker = worker;
+        unit.comp.optimize = optimize;
+        if (input.in_memory) {
+            unit.comp.source_path = input.path;
+            unit.comp.source_text = input.text;
+            unit.ok = compile_to_ir(unit.comp);
+        } else if (compilation_load_file(unit.comp, input.path.c_str())) {
+            unit.ok = compile_to_ir(unit.comp);
+        } else {
+            unit.comp.errors.push_back("cannot read file");
+        }
+        fingerprints[i] = unit_fingerprint(unit);
+        unit.elapsed_us = time_diff_us(start, get_time_precise());
+    });
+
+    // MERGE, in input order whatever order the units finished in.
+    result.fingerprint = fnv1a_hash("");
+    for (u64 i = 0; i < inputs.size(); ++i) {
+        driver_unit const &unit = *result.units[i];
+        for (std::string const &e : unit.comp.errors) {
+            result.errors.push_back(inputs[i].path + ": " + e);
+        }
+        result.failed += !unit.ok;
+        result.tokens += unit.comp.tokens.count;
+        result.ast_nodes += unit.comp.tree.count;
+        result.functions += unit.comp.ir.functions.size();
+        result.ir_instructions += unit.comp.ir.instruction_count();
+        result.fingerprint = fnv1a_hash(std::string_view(reinterpret_cast<char const *>(&fingerprints[i]), sizeof(u64)), result.fingerprint);
+    }
+    result.steals = pool.steals();
+    result.wall_us = time_diff_us(t0, get_time_precise());
+
+    return result;
+}
+
+// BENCHMARK
+
+// Translation units of uneven size, a few large ones among many small ones as in a real C project,
+// so the last units to be picked up would leave workers idle without stealing.
+static std::vector<driver_input> generated_inputs() noexcept
+{
+    std::vector<driver_input> inputs;
+    for (u64 unit = 0; unit < 35; ++unit) {
+        u64 functions = unit % 7 == 0 ? 400 : 40 + unit * 3;
+        std::string source = generate_benchmark_program(functions, false, make_str("u%llu_", (unsigned long long)unit).c_str());
+        inputs.push_back({ make_str("unit%llu.c", (unsigned long long)unit), std::move(source), true });
+    }
+    return inputs;
+}
+
+driver_benchmark_result driver_benchmark(std::vector<std::string> const &paths, u64 iterations) noexcept
+{
+    driver_benchmark_result result = {};
+
+    std::vector<driver_input> inputs;
+    if (paths.empty()) {
+        inputs = generated_inputs();
+    } else {
+        for (std::string const &path : paths) {
+            inputs.push_back({ path, {}, false });
+        }
+    }
+    result.units = inputs.size();
+
+    std::vector<u32> thread_counts;
+    u32 hardware = std::max(std::thread::hardware_concurrency(), 1u);
+    for (u32 n = 1; n < hardware; n *= 2) {
+        thread_counts.push_back(n);
+    }
+    thread_counts.push_back(hardware);
+
+    u64 reference = 0;
+    for (u32 threads : thread_counts) {
+        thread_pool pool(threads);
+        driver_scaling_point point = { threads, std::numeric_limits<s64>::max(), 0.0, 0, true };
+        for (u64 i = 0; i < iterations; ++i) {
+            driver_result run = driver_compile(inputs, pool);
+            if (threads == 1 && i == 0) {
+                reference = run.fingerprint;
+                result.ir_instructions = run.ir_instructions;
+                for (auto const &unit : run.units) {
+                    result.source_bytes += unit->comp.source_text.size();
+                }
+                result.errors = std::move(run.errors);
+            }
+            point.identical &= run.fingerprint == reference;
+            if (run.wall_us < point.best_us) {
+                point.best_us = run.wall_us;
+                point.steals = run.steals;
+            }
+        }
+        point.speedup = result.points.empty() ? 1.0 : f64(result.points.front().best_us) / f64(std::max(point.best_us, s64(1)));
+        result.points.push_back(point);
+    }
+
+    return result;
+}
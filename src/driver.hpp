@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "compiler.hpp"
+
+struct thread_pool;
+
+/// One translation unit to compile: the file at `path`, or `text` when `in_memory` (`path` then only names it).
+struct driver_input
+{
+    std::string path;
+    std::string text;
+    bool in_memory = false;
+};
+
+/// @brief A compiled translation unit. Its `compilation` owns the unit's arena and intern table, and only the
+/// worker compiling it ever touches them, so workers share nothing while compiling and ids are assigned in the
+/// unit's own first-seen order whichever thread runs it.
+struct driver_unit
+{
+    compilation comp;
+    bool ok = false;
+    u32 worker = 0;         // the only thing that depends on scheduling
+    s64 elapsed_us = 0;     // load plus every phase
+};
+
+struct driver_result
+{
+    std::vector<std::unique_ptr<driver_unit>> units;  // input order
+    std::vector<std::string> errors;                  // every unit's diagnostics prefixed with its path, input order
+    u64 failed = 0;
+    u64 tokens = 0;
+    u64 ast_nodes = 0;
+    u64 functions = 0;
+    u64 ir_instructions = 0;
+    u64 fingerprint = 0;    // of every unit's IR listing and diagnostics in input order
+    u64 steals = 0;
+    s64 wall_us = 0;
+};
+
+/// Compiles every input to IR (`compile_to_ir`, optimized if `optimize`) concurrently on `pool`, then merges
+/// the per-unit results in input order, so everything but `worker`, timings and `steals` is the same for
+/// any number of threads.
+driver_result driver_compile(std::vector<driver_input> const &inputs, thread_pool &pool, bool optimize = true) noexcept;
+
+struct driver_scaling_point
+{
+    u32 threads;
+    s64 best_us;            // best of `iterations` compiles of the whole set
+    f64 speedup;            // over 1 thread
+    u64 steals;             // in the best run
+    bool identical;         // fingerprint equal to the 1-thread run's
+};
+
+struct driver_benchmark_result
+{
+    u64 units;
+    u64 source_bytes;
+    u64 ir_instructions;
+    std::vector<driver_scaling_point> points;   // 1, 2, 4, ... threads, then the hardware thread count
+    std::vector<std::string> errors;
+};
+
+/// Compiles the C files at `paths` (or, if empty, a generated set of 35 translation units of uneven size,
+/// about the shape of Lua) with 1 to N threads and reports the scaling and whether the merged output stayed
+/// identical.
+driver_benchmark_result driver_benchmark(std::vector<std::string> const &paths, u64 iterations = 3) noexcept;
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include "util.hpp"
+#include "ir.hpp"
+#include "x64.hpp"
+#include "compiler.hpp"
+
+#include "elf.hpp"
+
+// ELF64 STRUCTURES
+// Spelled out rather than taken from <elf.h> so objects can be written on any host.
+
+struct elf64_ehdr
+{
+    u8 ident[16];
+    u16 type;
+    u16 machine;
+    u32 version;
+    u64 entry;
+    u64 phoff;
+    u64 shoff;
+    u32 flags;
+    u16 ehsize;
+    u16 phentsize;
+    u16 phnum;
+    u16 shentsize;
+    u16 shnum;
+    u16 shstrndx;
+};
+static_assert(sizeof(elf64_ehdr) == 64);
+
+struct elf64_shdr
+{
+    u32 name;
+    u32 type;
+    u64 flags;
+    u64 addr;
+    u64 offset;
+    u64 size;
+    u32 link;
+    u32 info;
+    u64 addralign;
+    u64 entsize;
+};
+static_assert(sizeof(elf64_shdr) == 64);
+
+struct elf64_sym
+{
+    u32 name;
+    u8 info;
+    u8 other;
+    u16 shndx;
+    u64 value;
+    u64 size;
+};
+static_assert(sizeof(elf64_sym) == 24);
+
+struct elf64_rela
+{
+    u64 offset;
+    u64 info;
+    s64 addend;
+};
+static_assert(sizeof(elf64_rela) == 24);
+
+enum : u32
+{
+    sht_progbits = 1,
+    sht_symtab = 2,
+    sht_strtab = 3,
+    sht_rela = 4,
+    sht_nobits = 8,
+
+    shf_write = 0x1,
+    shf_alloc = 0x2,
+    shf_execinstr = 0x4,
+    shf_info_link = 0x40,
+
+    stb_local = 0,
+    stb_global = 1,
+    stt_notype = 0,
+    stt_object = 1,
+    stt_func = 2,
+    stt_section = 3,
+
+    r_x86_64_pc32 = 2,
+    r_x86_64_plt32 = 4,
+};
+
+// Section header indices, in file order.
+enum : u16
+{
+    sec_null,
+    sec_text,
+    sec_rodata,
+    sec_data,
+    sec_note_gnu_stack,
+    sec_symtab,
+    sec_strtab,
+    sec_rela_text,
+    sec_shstrtab,
+
+    sec_count
+};
+
+static u8 symbol_info(u32 binding, u32 type) noexcept
+{
+    return u8((binding << 4) | type);
+}
+
+/// Appends NUL-terminated names, returning each one's offset. Offset 0 is the empty name.
+struct string_table
+{
+    std::vector<u8> bytes = { 0 };
+
+    u32 add(std::string_view name) noexcept
+    {
+        u32 offset = u32(bytes.size());
+        bytes.insert(bytes.end(), name.begin(), name.end());
+        bytes.push_back(0);
+        return offset;
+    }
+};
+
+template <typename Ty>
+static void append(std::vector<u8> &out, Ty const &value) noexcept
+{
+    u8 const *bytes = reinterpret_cast<u8 const *>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(Ty));
+}
+
+static void align_to(std::vector<u8> &out, u64 alignment) noexcept
+{
+    out.resize((out.size() + alignment - 1) / alignment * alignment, 0);
+}
+
+// WRITER
+
+bool elf_write_object(ir_module const &module, std::vector<u8> &out, std::string &error, elf_object_stats *stats) noexcept
+{
+    out.clear();
+
+    time_point_precise_t t0 = get_time_precise();
+    x64_options options;
+    options.target = x64_target::object;
+    x64_module_code code;
+    if (!x64_compile(module, code, error, options)) {
+        return false;
+    }
+    time_point_precise_t t1 = get_time_precise();
+
+    // SYMBOLS: locals (section symbols, then function bodies), then globals (entry points, globals, externs).
+
+    std::vector<elf64_sym> symbols;
+    string_table strtab;
+    symbols.push_back({});
+    for (u16 section : { sec_text, sec_rodata, sec_data }) {
+        symbols.push_back({ 0, symbol_info(stb_local, stt_section), 0, section, 0, 0 });
+    }
+    u32 const section_symbol[] = { 0, 1, 2, 3 }; // by section index
+
+    for (u64 i = 0; i < module.functions.size(); ++i) {
+        u32 name = strtab.add(module.functions[i].name + ".ir");
+        symbols.push_back({ name, symbol_info(stb_local, stt_func), 0, sec_text, code.function_offsets[i], code.function_sizes[i] });
+    }
+    u32 const first_global = u32(symbols.size());
+
+    for (u64 i = 0; i < module.functions.size(); ++i) {
+        if (code.entry_points[i] != u32(-1)) {
+            u32 name = strtab.add(module.functions[i].name);
+            symbols.push_back({ name, symbol_info(stb_global, stt_func), 0, sec_text, code.entry_points[i], code.entry_sizes[i] });
+        }
+    }
+    for (u64 i = 0; i < module.globals.size(); ++i) {
+        u32 name = strtab.add(module.globals[i].name);
+        symbols.push_back({ name, symbol_info(stb_global, stt_object), 0, sec_data, 8 * i, 8 });
+    }
+
+    u32 extern_symbol[u64(x64_extern::count)] = {};
+    for (x64_reloc const &reloc : code.relocs) {
+        if (reloc.what == x64_reloc::kind::call_extern && extern_symbol[reloc.index] == 0) {
+            extern_symbol[reloc.index] = u32(symbols.size());
+            u32 name = strtab.add(x64_extern_name(x64_extern(reloc.index)));
+            symbols.push_back({ name, symbol_info(stb_global, stt_notype), 0, 0, 0, 0 });
+        }
+    }
+
+    // RELOCATIONS: every displacement is relative to the end of its own 4 bytes, hence the -4 addends.
+
+    std::vector<elf64_rela> relas;
+    relas.reserve(code.relocs.size());
+    for (x64_reloc const &reloc : code.relocs) {
+        u64 symbol;
+        u32 type;
+        s64 addend = s64(reloc.index) - 4;
+        switch (reloc.what) {
+            case x64_reloc::kind::rodata:
+                symbol = section_symbol[sec_rodata];
+                type = r_x86_64_pc32;
+                break;
+            case x64_reloc::kind::data:
+                symbol = section_symbol[sec_data];
+                type = r_x86_64_pc32;
+                break;
+            case x64_reloc::kind::call_extern:
+                symbol = extern_symbol[reloc.index];
+                type = r_x86_64_plt32;
+                addend = -4;
+                break;
+            default:
+                error = "JIT relocation in object code";
+                return false;
+        }
+        relas.push_back({ reloc.offset, (symbol << 32) | type, addend });
+    }
+
+    // SECTIONS
+
+    string_table shstrtab;
+    elf64_shdr sections[sec_count] = {};
+    auto place = [&](u16 index, u32 name, u32 type, u64 flags, u64 alignment, void const *data, u64 size) {
+        align_to(out, alignment);
+        sections[index].name = name;
+        sections[index].type = type;
+        sections[index].flags = flags;
+        sections[index].offset = out.size();
+        sections[index].size = size;
+        sections[index].addralign = alignment;
+        if (type != sht_nobits && size != 0) {
+            u8 const *bytes = static_cast<u8 const *>(data);
+            out.insert(out.end(), bytes, bytes + size);
+        }
+    };
+
+    out.resize(sizeof(elf64_ehdr));
+
+    std::vector<u8> data;
+    data.reserve(8 * module.globals.size());
+    for (ir_global const &global : module.globals) {
+        append(data, global.initial_value);
+    }
+
+    place(sec_text, shstrtab.add(".text"), sht_progbits, shf_alloc | shf_execinstr, 16, code.code.data(), code.code.size());
+    place(sec_rodata, shstrtab.add(".rodata"), sht_progbits, shf_alloc, 1, code.rodata.data(), code.rodata.size());
+    place(sec_data, shstrtab.add(".data"), sht_progbits, shf_alloc | shf_write, 8, data.data(), data.size());
+    // Marks the stack non-executable, without it GNU ld warns and makes the whole program's stack executable.
+    place(sec_note_gnu_stack, shstrtab.add(".note.GNU-stack"), sht_progbits, 0, 1, nullptr, 0);
+
+    place(sec_symtab, shstrtab.add(".symtab"), sht_symtab, 0, 8, symbols.data(), symbols.size() * sizeof(elf64_sym));
+    sections[sec_symtab].link = sec_strtab;
+    sections[sec_symtab].info = first_global;
+    sections[sec_symtab].entsize = sizeof(elf64_sym);
+
+    place(sec_strtab, shstrtab.add(".strtab"), sht_strtab, 0, 1, strtab.bytes.data(), strtab.bytes.size());
+
+    place(sec_rela_text, shstrtab.add(".rela.text"), sht_rela, shf_info_link, 8, relas.data(), relas.size() * sizeof(elf64_rela));
+    sections[sec_rela_text].link = sec_symtab;
+    sections[sec_rela_text].info = sec_text;
+    sections[sec_rela_text].entsize = sizeof(elf64_rela);
+
+    // Its own name has to be in the table before the table is copied.
+    u32 shstrtab_name = shstrtab.add(".shstrtab");
+    place(sec_shstrtab, shstrtab_name, sht_strtab, 0, 1, shstrtab.bytes.data(), shstrtab.bytes.size());
+
+    align_to(out, 8);
+    u64 section_headers = out.size();
+    for (elf64_shdr const &section : sections) {
+        append(out, section);
+    }
+
+    elf64_ehdr header = {};
+    u8 const ident[] = { 0x7F, 'E', 'L', 'F', 2 /* 64-bit */, 1 /* little endian */, 1 /* version */, 0 /* System V ABI */ };
+    std::memcpy(header.ident, ident, sizeof(ident));
+    header.type = 1;        // ET_REL
+    header.machine = 62;    // EM_X86_64
+    header.version = 1;
+    header.shoff = section_headers;
+    header.ehsize = sizeof(elf64_ehdr);
+    header.shentsize = sizeof(elf64_shdr);
+    header.shnum = sec_count;
+    header.shstrndx = sec_shstrtab;
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    if (stats != nullptr) {
+        stats->code_bytes = code.code.size();
+        stats->object_bytes = out.size();
+        stats->codegen_ns = time_diff_ns(t0, t1);
+        stats->write_ns = time_diff_ns(t1, get_time_precise());
+    }
+    return true;
+}
+
+bool elf_write_object_file(ir_module const &module, char const *path, std::string &error) noexcept
+{
+    std::vector<u8> bytes;
+    if (!elf_write_object(module, bytes, error)) {
+        return false;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        error = make_str("cannot open %s for writing", path);
+        return false;
+    }
+    bool ok = fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+    ok &= fclose(file) == 0;
+    if (!ok) {
+        error = make_str("cannot write %s", path);
+    }
+    return ok;
+}
+
+// BENCHMARK
+
+elf_benchmark_result elf_benchmark(char const *path, u64 iterations) noexcept
+{
+    elf_benchmark_result result = {};
+
+    compilation comp;
+    if (path == nullptr) {
+        comp.source_text = generate_benchmark_program(4000, true);
+    } else if (!compilation_load_file(comp, path)) {
+        result.errors.push_back(make_str("cannot read %s", path));
+        return result;
+    }
+    if (!compile_to_ir(comp)) {
+        result.errors.push_back(comp.errors.empty() ? "compilation failed" : comp.errors.front());
+        return result;
+    }
+    result.source_bytes = comp.source_text.size();
+    result.functions = comp.ir.functions.size();
+
+    result.codegen_best_us = std::numeric_limits<s64>::max();
+    result.write_best_us = std::numeric_limits<s64>::max();
+    s64 best_total_ns = std::numeric_limits<s64>::max();
+    std::vector<u8> object;
+    for (u64 i = 0; i < iterations; ++i) {
+        elf_object_stats stats;
+        std::string error;
+        if (!elf_write_object(comp.ir, object, error, &stats)) {
+            result.errors.push_back(error);
+            return result;
+        }
+        result.code_bytes = stats.code_bytes;
+        result.object_bytes = stats.object_bytes;
+        result.codegen_best_us = std::min(result.codegen_best_us, stats.codegen_ns / 1000);
+        result.write_best_us = std::min(result.write_best_us, stats.write_ns / 1000);
+        best_total_ns = std::min(best_total_ns, stats.codegen_ns + stats.write_ns);
+    }
+    result.code_mb_per_sec = f64(result.code_bytes) / (f64(std::max(best_total_ns, s64(1))) / 1e9) / (1024.0 * 1024.0);
+    return result;
+}
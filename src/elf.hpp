@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+
+struct ir_module;
+
+struct elf_object_stats
+{
+    u64 code_bytes;     // .text
+    u64 object_bytes;   // the whole file
+    s64 codegen_ns;     // x64_compile
+    s64 write_ns;       // laying out sections, symbols and relocations
+};
+
+/// Writes `module` (unfused IR) as an ELF64 x86-64 relocatable object into `out`, no assembler involved:
+/// .text, .rodata (string literals), .data (globals), a symbol table and .rela.text. Every function with at
+/// most 6 parameters is a global System V function under its own name, so the object links with the system
+/// linker and C code can call into it, `main` included. Builtins call the C library. Returns false with
+/// `error` set if the module cannot be compiled.
+bool elf_write_object(ir_module const &module, std::vector<u8> &out, std::string &error, elf_object_stats *stats = nullptr) noexcept;
+
+/// `elf_write_object` to the file at `path`.
+bool elf_write_object_file(ir_module const &module, char const *path, std::string &error) noexcept;
+
+struct elf_benchmark_result
+{
+    u64 source_bytes;
+    u64 functions;
+    u64 code_bytes;
+    u64 object_bytes;
+    s64 codegen_best_us;            // best of `iterations`
+    s64 write_best_us;
+    f64 code_mb_per_sec;            // machine code bytes over codegen + write time
+    std::vector<std::string> errors;
+};
+
+/// Compiles the C file at `path` (or, if null, a generated translation unit of a few thousand functions)
+/// to IR once, then measures how fast it is turned into an object file.
+elf_benchmark_result elf_benchmark(char const *path, u64 iterations = 5) noexcept;
@@ -0,0 +1,597 @@
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+
+#include "util.hpp"
+#include "output_compare.hpp"
+#include "parser.hpp"
+
+#include "incremental.hpp"
+
+/// Whether the preprocessor could turn `text` into anything but the same tokens: directives, predefined macros
+/// (every one is a `__` name) and line splices. Without them the source is lexed as it is.
+static bool needs_preprocessor(std::string_view text) noexcept
+{
+    if (text.find('#') != std::string_view::npos || text.find("__") != std::string_view::npos) {
+        return true;
+    }
+    for (u64 i = text.find('\\'); i != std::string_view::npos; i = text.find('\\', i + 1)) {
+        if (i + 1 < text.size() && (text[i + 1] == '\n' || text[i + 1] == '\r')) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static u32 parse_chunk(compilation &c, u32 first, std::vector<incremental_chunk> &chunks, std::vector<u32> &decls) noexcept
+{
+    incremental_chunk chunk = {};
+    chunk.first_token = first;
+    chunk.first_node = c.tree.count;
+    chunk.first_decl = u32(decls.size());
+    chunk.end_token = parse_top_level_declaration(c.preprocessed.text, c.tokens, first, c.tree, c.names, decls, chunk.errors);
+    chunk.end_node = c.tree.count;
+    chunk.decl_count = u32(decls.size()) - chunk.first_decl;
+    chunks.push_back(std::move(chunk));
+    return chunks.back().end_token;
+}
+
+/// The lengths of the longest common prefix and, in what is left, suffix of `a` and `b`: an edit turning one
+/// into the other replaced the bytes between them. Compares blocks of bytes, as both scans can cover whole files.
+static void common_affixes(std::string_view a, std::string_view b, u64 &prefix, u64 &suffix) noexcept
+{
+    u64 limit = std::min(a.size(), b.size());
+    prefix = first_mismatch(a.data(), b.data(), limit);
+    suffix = 0;
+    u64 const block = 64;
+    while (suffix + block <= limit - prefix && memcmp(a.data() + a.size() - suffix - block, b.data() + b.size() - suffix - block, block) == 0) {
+        suffix += block;
+    }
+    while (suffix < limit - prefix && a[a.size() - 1 - suffix] == b[b.size() - 1 - suffix]) {
+        ++suffix;
+    }
+}
+
+/// Links `u.decls[from - 1, to)` (the declarations that changed and the one before them) to the declaration after
+/// each, adds the translation_unit node over all of them and gathers the chunks' errors, as `parse_tokens` ends.
+static bool finish_parse(incremental_unit &u, u64 from, u64 to) noexcept
+{
+    ast &tree = u.comp.tree;
+    std::vector<u32> const &decls = u.decls;
+    for (u64 i = from > 0 ? from - 1 : 0; i < to; ++i) {
+        tree.next_sibling[decls[i]] = i + 1 < decls.size() ? decls[i + 1] : ast_null;
+    }
+    tree.root = tree.add_node(ast_kind::translation_unit, 0);
+    tree.first_child[tree.root] = decls.empty() ? ast_null : decls.front();
+    tree.last_child[tree.root] = decls.empty() ? ast_null : decls.back();
+
+    u.comp.errors.clear();
+    if (u.chunks_with_errors > 0) {
+        for (incremental_chunk const &chunk : u.chunks) {
+            u.comp.errors.insert(u.comp.errors.end(), chunk.errors.begin(), chunk.errors.end());
+        }
+        preprocess_map_error_locations(u.comp.preprocessed, u.comp.errors);
+    }
+    return u.comp.errors.empty();
+}
+
+bool incremental_build(incremental_unit &u, incremental_stats &stats) noexcept
+{
+    compilation &c = u.comp;
+    c.reset();
+    u.chunks.clear();
+    u.decls.clear();
+    u.chunks_with_errors = 0;
+    u.direct = c.pp_options.defines.empty() && !needs_preprocessor(c.source_text);
+    stats = {};
+    stats.full = true;
+    stats.edit_bytes = c.source_text.size();
+
+    time_point_precise_t t0 = get_time_precise();
+    if (u.direct) {
+        c.preprocessed.text = c.source_text;
+    } else if (!preprocess_text(c.source_text, c.source_path.empty() ? "<source>" : c.source_path.c_str(), c.pp_options, c.preprocessed)) {
+        c.preprocess_us = stats.preprocess_us = time_diff_us(t0, get_time_precise());
+        c.errors.insert(c.errors.end(), c.preprocessed.errors.begin(), c.preprocessed.errors.end());
+        return false;
+    }
+    time_point_precise_t t1 = get_time_precise();
+    c.preprocess_us = stats.preprocess_us = time_diff_us(t0, t1);
+    if (cancelled(c.cancel)) {
+        return false;
+    }
+
+    lex(c.preprocessed.text, c.tokens);
+    time_point_precise_t t2 = get_time_precise();
+    c.lex_us = stats.lex_us = time_diff_us(t1, t2);
+    stats.tokens_relexed = c.tokens.count;
+    if (cancelled(c.cancel)) {
+        return false;
+    }
+
+    c.tree.init(c.mem, u32(std::max(c.tokens.count, u64(16))));
+    c.names.init(c.mem);
+    for (u32 next = 0; c.tokens.kinds[next] != token_kind::end_of_input;) {
+        if (cancelled(c.cancel)) {
+            u.chunks.clear(); // the next edit builds again
+            return false;
+        }
+        next = parse_chunk(c, next, u.chunks, u.decls);
+        u.chunks_with_errors += !u.chunks.back().errors.empty();
+    }
+    bool ok = finish_parse(u, 0, u.decls.size());
+    c.parse_us = stats.parse_us = time_diff_us(t2, get_time_precise());
+    stats.chunks_reparsed = u.chunks.size();
+
+    return ok;
+}
+
+// RELEX
+
+template <typename Ty>
+static void move_tail(std::vector<Ty> &v, u64 from, u64 to, u64 count) noexcept
+{
+    if (count > 0 && from != to) {
+        memmove(v.data() + to, v.data() + from, sizeof(Ty) * count);
+    }
+}
+
+/// Moves `count` values from `array + from` to `array + to` (the ranges may overlap) and maps each with `fn`,
+/// in one pass.
+template <typename Fn>
+static void move_mapped(u32 *array, u64 from, u64 to, u64 count, Fn &&fn) noexcept
+{
+    if (to <= from) {
+        for (u64 i = 0; i < count; ++i) {
+            array[to + i] = fn(array[from + i]);
+        }
+    } else {
+        for (u64 i = count; i-- > 0;) {
+            array[to + i] = fn(array[from + i]);
+        }
+    }
+}
+
+/// Re-lexes `text` around the edit of [`offset`, `offset` + `removed`) into `added` bytes and patches
+/// `tokens` (which were lexed from the text before it). Sets the relexed range of new token indices and the
+/// shift of the indices of the tokens after it.
+static void relex(std::string_view text, token_buffer &tokens, u64 offset, u64 removed, u64 added,
+                  u32 &relexed_first, u32 &relexed_count, u32 &reused_from, incremental_stats &stats) noexcept
+{
+    s64 delta = s64(added) - s64(removed);
+    u64 edit_end = offset + added;
+
+    // First token ending at or after the edit, at worst end_of_input.
+    u32 lo = 0;
+    u32 hi = u32(tokens.count - 1);
+    while (lo < hi) {
+        u32 mid = lo + (hi - lo) / 2;
+        if (tokens.offsets[mid] + tokens.lengths[mid] < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    // Restart at the token before it: text typed right after a token can extend it (`-` into `-=`, `..` into
+    // `...`), and a token start is never inside a comment, so the lexer's state there is known. Nothing before
+    // that token changed, so neither did its flags.
+    u32 restart_tok = lo > 0 ? lo - 1 : 0;
+    u64 restart = lo > 0 ? tokens.offsets[restart_tok] : 0;
+
+    // Lex growing windows until a token past the edit lines up with an old one (same kind, length and flags
+    // at the same shifted offset), from there on the old tokens are still right. The last few tokens of a
+    // window are not trusted, the lexer may have stopped short of their real end (or of a longer punctuator).
+    token_buffer fresh;
+    u64 count = 0;
+    u32 resume = u32(tokens.count);
+    for (u64 window = 2 * added + 256; ; window *= 2) {
+        bool to_end = restart + window >= text.size();
+        u64 size = to_end ? text.size() - restart : window;
+        lex(text.substr(restart, size), fresh);
+        if (lo > 0) {
+            fresh.flags[0] = tokens.flags[restart_tok];
+        }
+
+        bool synced = false;
+        u32 old = lo;
+        for (u64 i = 0; i < fresh.count; ++i) {
+            u64 at = restart + fresh.offsets[i];
+            if (!to_end && at + fresh.lengths[i] + 4 > restart + size) {
+                break;
+            }
+            if (at < edit_end) {
+                continue;
+            }
+            u64 was = u64(s64(at) - delta);
+            while (old < tokens.count && tokens.offsets[old] < was) {
+                ++old;
+            }
+            if (old == tokens.count) {
+                break;
+            }
+            if (tokens.offsets[old] == was && tokens.kinds[old] == fresh.kinds[i] && tokens.lengths[old] == fresh.lengths[i] &&
+                tokens.flags[old] == fresh.flags[i]) {
+                count = i;
+                resume = old;
+                synced = true;
+                break;
+            }
+        }
+        if (synced) {
+            break;
+        }
+        if (to_end) {
+            count = fresh.count; // including end_of_input
+            resume = u32(tokens.count);
+            break;
+        }
+    }
+
+    // SPLICE: [restart_tok, resume) of the old tokens becomes fresh [0, count).
+    u64 tail = tokens.count - resume;
+    u64 new_count = restart_tok + count + tail;
+    tokens.reserve(new_count);
+    move_tail(tokens.kinds, resume, restart_tok + count, tail);
+    move_tail(tokens.lengths, resume, restart_tok + count, tail);
+    move_tail(tokens.flags, resume, restart_tok + count, tail);
+    if (delta != 0 || resume != restart_tok + count) {
+        // The one pass over the rest of the file: what follows the edit moved by `delta` bytes.
+        move_mapped(tokens.offsets.data(), resume, restart_tok + count, tail, [delta](u32 offset) { return u32(s64(offset) + delta); });
+        stats.tokens_shifted = tail;
+    }
+    for (u64 i = 0; i < count; ++i) {
+        tokens.kinds[restart_tok + i] = fresh.kinds[i];
+        tokens.offsets[restart_tok + i] = u32(restart + fresh.offsets[i]);
+        tokens.lengths[restart_tok + i] = fresh.lengths[i];
+        tokens.flags[restart_tok + i] = fresh.flags[i];
+    }
+    tokens.count = new_count;
+
+    relexed_first = restart_tok;
+    relexed_count = u32(count);
+    reused_from = resume;
+    stats.tokens_relexed = count;
+    stats.tokens_reused = new_count - count;
+}
+
+// REPARSE
+
+/// Nodes copied out of an `ast`.
+struct node_stash
+{
+    std::vector<ast_kind> kinds;
+    std::vector<ast_type> types;
+    std::vector<u32> tokens;
+    std::vector<u32> values;
+    std::vector<u32> first_child;
+    std::vector<u32> last_child;
+    std::vector<u32> next_sibling;
+
+    void take(ast const &tree, u32 from, u32 to) noexcept
+    {
+        kinds.assign(tree.kinds + from, tree.kinds + to);
+        types.assign(tree.types + from, tree.types + to);
+        tokens.assign(tree.tokens + from, tree.tokens + to);
+        values.assign(tree.values + from, tree.values + to);
+        first_child.assign(tree.first_child + from, tree.first_child + to);
+        last_child.assign(tree.last_child + from, tree.last_child + to);
+        next_sibling.assign(tree.next_sibling + from, tree.next_sibling + to);
+    }
+};
+
+template <typename Ty>
+static void move_nodes(Ty *array, u32 from, u32 to, u32 count) noexcept
+{
+    if (count > 0 && from != to) {
+        memmove(array + to, array + from, sizeof(Ty) * count);
+    }
+}
+
+static u32 relocate(u32 node, s64 shift) noexcept
+{
+    return node == ast_null ? ast_null : u32(s64(node) + shift);
+}
+
+/// Replaces `v[from, to)` with `with`, moving the elements after them only if the length changed.
+template <typename Ty>
+static void splice(std::vector<Ty> &v, u64 from, u64 to, std::vector<Ty> &with) noexcept
+{
+    u64 common = std::min(to - from, u64(with.size()));
+    std::move(with.begin(), with.begin() + common, v.begin() + from);
+    if (with.size() > common) {
+        v.insert(v.begin() + to, std::make_move_iterator(with.begin() + common), std::make_move_iterator(with.end()));
+    } else {
+        v.erase(v.begin() + from + common, v.begin() + to);
+    }
+}
+
+/// Re-parses the chunks from the first one that may have seen a relexed token up to the first one after the
+/// edit that starts where the re-parse ended, and slides the nodes of the rest into place behind them. Old
+/// token `t` is `t` + `token_shift` now if `t` >= `reused_from`, and unchanged if `t` < `relexed_first`.
+static void reparse(incremental_unit &u, u32 relexed_first, u32 reused_from, s64 token_shift, u64 &decls_from, u64 &decls_to,
+                    incremental_stats &stats) noexcept
+{
+    compilation &c = u.comp;
+    ast &tree = c.tree;
+    u64 old_chunks = u.chunks.size();
+    u32 old_count = tree.count; // the old root is the last node
+
+    // A chunk ending before `relexed_first` never looked at a relexed token, not even as lookahead.
+    u64 a = u64(std::partition_point(u.chunks.begin(), u.chunks.end(),
+                                     [&](incremental_chunk const &chunk) { return chunk.end_token < relexed_first; }) - u.chunks.begin());
+    // Only chunks starting at or after `reused_from` consist of old tokens.
+    u64 b = u64(std::partition_point(u.chunks.begin() + a, u.chunks.end(),
+                                     [&](incremental_chunk const &chunk) { return chunk.first_token < reused_from; }) - u.chunks.begin());
+
+    // Parse behind the old root, until a chunk of old tokens starts right where parsing got to.
+    std::vector<incremental_chunk> middle;
+    std::vector<u32> middle_decls;
+    u32 next = a < old_chunks ? u.chunks[a].first_token : (old_chunks > 0 ? u.chunks.back().end_token : 0);
+    for (;;) {
+        if (c.tokens.kinds[next] == token_kind::end_of_input) {
+            b = old_chunks;
+            break;
+        }
+        while (b < old_chunks && s64(u.chunks[b].first_token) + token_shift < s64(next)) {
+            ++b;
+        }
+        if (b < old_chunks && s64(u.chunks[b].first_token) + token_shift == s64(next)) {
+            break;
+        }
+        next = parse_chunk(c, next, middle, middle_decls);
+    }
+    stats.chunks_reparsed = middle.size();
+    stats.chunks_reused = old_chunks - (b - a);
+
+    // PLACE: [keep, suffix_first) held the old middle, [suffix_first, suffix_end) the chunks kept after it.
+    u32 keep = a < old_chunks ? u.chunks[a].first_node : (old_chunks > 0 ? u.chunks.back().end_node : 0);
+    u32 suffix_first = b < old_chunks ? u.chunks[b].first_node : old_count - 1;
+    u32 suffix_end = old_count - 1;
+    u32 middle_count = tree.count - old_count;
+    s64 node_shift = s64(middle_count) - s64(suffix_first - keep);
+    s64 middle_shift = s64(keep) - s64(old_count);
+
+    node_stash stash;
+    stash.take(tree, old_count, tree.count);
+    u32 suffix_to = keep + middle_count;
+    u32 suffix_count = suffix_end - suffix_first;
+    move_nodes(tree.kinds, suffix_first, suffix_to, suffix_count);
+    move_nodes(tree.types, suffix_first, suffix_to, suffix_count);
+    move_nodes(tree.values, suffix_first, suffix_to, suffix_count);
+    if (node_shift != 0 || token_shift != 0) {
+        // The one pass over the nodes after the edit: their ids and tokens moved.
+        move_mapped(tree.tokens, suffix_first, suffix_to, suffix_count, [token_shift](u32 t) { return u32(s64(t) + token_shift); });
+        stats.nodes_shifted = suffix_count;
+    }
+    if (node_shift != 0) {
+        auto moved = [node_shift](u32 node) { return relocate(node, node_shift); };
+        move_mapped(tree.first_child, suffix_first, suffix_to, suffix_count, moved);
+        move_mapped(tree.last_child, suffix_first, suffix_to, suffix_count, moved);
+        move_mapped(tree.next_sibling, suffix_first, suffix_to, suffix_count, moved);
+    }
+    for (u32 i = 0; i < middle_count; ++i) {
+        u32 n = keep + i;
+        tree.kinds[n] = stash.kinds[i];
+        tree.types[n] = stash.types[i];
+        tree.tokens[n] = stash.tokens[i];
+        tree.values[n] = stash.values[i];
+        tree.first_child[n] = relocate(stash.first_child[i], middle_shift);
+        tree.last_child[n] = relocate(stash.last_child[i], middle_shift);
+        tree.next_sibling[n] = relocate(stash.next_sibling[i], middle_shift);
+    }
+    tree.count = suffix_to + suffix_count;
+    tree.root = ast_null;
+
+    // CHUNKS and DECLS: the old middle's are replaced by the new ones, those after it are rebased.
+    u32 old_decls_from = a < old_chunks ? u.chunks[a].first_decl : u32(u.decls.size());
+    u32 old_decls_to = b < old_chunks ? u.chunks[b].first_decl : u32(u.decls.size());
+    s64 decl_shift = s64(middle_decls.size()) - s64(old_decls_to - old_decls_from);
+    for (u64 i = a; i < b; ++i) {
+        u.chunks_with_errors -= !u.chunks[i].errors.empty();
+    }
+    if (token_shift != 0 || node_shift != 0 || decl_shift != 0 || u.chunks_with_errors > 0) {
+        for (u64 i = b; i < old_chunks; ++i) {
+            incremental_chunk &chunk = u.chunks[i];
+            for (u32 d = 0; d < chunk.decl_count; ++d) {
+                u.decls[chunk.first_decl + d] = relocate(u.decls[chunk.first_decl + d], node_shift);
+            }
+            chunk.first_token = u32(s64(chunk.first_token) + token_shift);
+            chunk.end_token = u32(s64(chunk.end_token) + token_shift);
+            chunk.first_node = u32(s64(chunk.first_node) + node_shift);
+            chunk.end_node = u32(s64(chunk.end_node) + node_shift);
+            chunk.first_decl = u32(s64(chunk.first_decl) + decl_shift);
+            if (!chunk.errors.empty()) {
+                // Same tokens, same nodes, but the messages' line numbers may have moved: parse it again for those.
+                arena scratch;
+                ast discarded;
+                discarded.init(scratch, 16);
+                std::vector<u32> discarded_decls;
+                chunk.errors.clear();
+                parse_top_level_declaration(c.preprocessed.text, c.tokens, chunk.first_token, discarded, c.names, discarded_decls, chunk.errors);
+            }
+        }
+    }
+    for (incremental_chunk &chunk : middle) {
+        chunk.first_node = u32(s64(chunk.first_node) + middle_shift);
+        chunk.end_node = u32(s64(chunk.end_node) + middle_shift);
+        chunk.first_decl += old_decls_from;
+        u.chunks_with_errors += !chunk.errors.empty();
+    }
+    for (u32 &decl : middle_decls) {
+        decl = relocate(decl, middle_shift);
+    }
+    decls_from = old_decls_from;
+    decls_to = old_decls_from + middle_decls.size();
+    splice(u.decls, old_decls_from, old_decls_to, middle_decls);
+    splice(u.chunks, a, b, middle);
+}
+
+bool incremental_edit(incremental_unit &u, u64 offset, u64 removed, std::string_view inserted, incremental_stats &stats) noexcept
+{
+    compilation &c = u.comp;
+    offset = std::min(offset, u64(c.source_text.size()));
+    removed = std::min(removed, c.source_text.size() - offset);
+    c.source_text.replace(offset, removed, inserted);
+
+    if (u.chunks.empty()) {
+        return incremental_build(u, stats);
+    }
+
+    stats = {};
+    u64 added = inserted.size();
+    time_point_precise_t t0 = get_time_precise();
+    if (u.direct) {
+        // Only the edit and the characters either side of it can have made a `#`, `__` or line splice.
+        u64 from = offset > 0 ? offset - 1 : 0;
+        if (needs_preprocessor(std::string_view(c.source_text).substr(from, offset + added + 1 - from))) {
+            return incremental_build(u, stats);
+        }
+        c.preprocessed.text.replace(offset, removed, inserted);
+    } else {
+        if (c.pp_options.defines.empty() && !needs_preprocessor(c.source_text)) {
+            return incremental_build(u, stats);
+        }
+        preprocess_result pp;
+        if (!preprocess_text(c.source_text, c.source_path.empty() ? "<source>" : c.source_path.c_str(), c.pp_options, pp)) {
+            return incremental_build(u, stats);
+        }
+
+        // The expanded text changed somewhere between its longest common prefix and suffix with the old one.
+        std::string_view before = c.preprocessed.text;
+        std::string_view after = pp.text;
+        u64 prefix, suffix;
+        common_affixes(before, after, prefix, suffix);
+        offset = prefix;
+        removed = before.size() - prefix - suffix;
+        added = after.size() - prefix - suffix;
+        c.preprocessed = std::move(pp);
+    }
+    time_point_precise_t t1 = get_time_precise();
+    c.preprocess_us = stats.preprocess_us = time_diff_us(t0, t1);
+    stats.edit_bytes = removed + added;
+
+    u32 relexed_first = 0;
+    u32 relexed_count = 0;
+    u32 reused_from = 0;
+    relex(c.preprocessed.text, c.tokens, offset, removed, added, relexed_first, relexed_count, reused_from, stats);
+    time_point_precise_t t2 = get_time_precise();
+    c.lex_us = stats.lex_us = time_diff_us(t1, t2);
+
+    u64 decls_from = 0;
+    u64 decls_to = 0;
+    reparse(u, relexed_first, reused_from, s64(relexed_first) + relexed_count - reused_from, decls_from, decls_to, stats);
+    bool ok = finish_parse(u, decls_from, decls_to);
+    c.parse_us = stats.parse_us = time_diff_us(t2, get_time_precise());
+
+    c.ir = {};
+    c.ir_stats = {};
+    c.ir_us = 0;
+
+    return ok;
+}
+
+bool incremental_update(incremental_unit &u, std::string_view source, incremental_stats &stats) noexcept
+{
+    std::string_view current = u.comp.source_text;
+    u64 prefix, suffix;
+    common_affixes(current, source, prefix, suffix);
+    std::string inserted(source.substr(prefix, source.size() - prefix - suffix));
+    return incremental_edit(u, prefix, current.size() - prefix - suffix, inserted, stats);
+}
+
+std::string incremental_stats_to_string(incremental_stats const &stats) noexcept
+{
+    return make_str("%s%llu bytes edited: relexed %llu tokens (%llu reused), reparsed %llu declarations (%llu reused), "
+                    "shifted %llu tokens and %llu nodes after the edit, preprocess %lld us, lex %lld us, parse %lld us",
+                    stats.full ? "full build, " : "",
+                    (unsigned long long)stats.edit_bytes,
+                    (unsigned long long)stats.tokens_relexed, (unsigned long long)stats.tokens_reused,
+                    (unsigned long long)stats.chunks_reparsed, (unsigned long long)stats.chunks_reused,
+                    (unsigned long long)stats.tokens_shifted, (unsigned long long)stats.nodes_shifted,
+                    (long long)stats.preprocess_us, (long long)stats.lex_us, (long long)stats.parse_us);
+}
+
+// BENCHMARK
+
+static bool is_named(ast_kind kind) noexcept
+{
+    return one_of(kind, { ast_kind::function_decl, ast_kind::param_decl, ast_kind::var_decl, ast_kind::identifier, ast_kind::call });
+}
+
+/// Same token kinds and spellings, and the same AST node for node with names compared as strings (their ids and
+/// the token offsets differ when one side was lexed from preprocessed text).
+static bool same_front_end(compilation const &a, compilation const &b) noexcept
+{
+    if (a.tokens.count != b.tokens.count || a.tree.count != b.tree.count || a.tree.root != b.tree.root || a.errors != b.errors) {
+        return false;
+    }
+    for (u64 i = 0; i < a.tokens.count; ++i) {
+        if (a.tokens.kinds[i] != b.tokens.kinds[i] || a.tokens.spelling(a.preprocessed.text, i) != b.tokens.spelling(b.preprocessed.text, i)) {
+            return false;
+        }
+    }
+    ast const &x = a.tree;
+    ast const &y = b.tree;
+    for (u32 n = 0; n < x.count; ++n) {
+        bool values_match = is_named(x.kinds[n]) ? a.names.str(x.values[n]) == b.names.str(y.values[n]) : x.values[n] == y.values[n];
+        if (x.kinds[n] != y.kinds[n] || x.types[n] != y.types[n] || x.tokens[n] != y.tokens[n] || !values_match ||
+            x.first_child[n] != y.first_child[n] || x.last_child[n] != y.last_child[n] || x.next_sibling[n] != y.next_sibling[n]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+incremental_benchmark_result incremental_benchmark(u64 edits) noexcept
+{
+    incremental_benchmark_result result = {};
+    result.edits = edits;
+    f64 first_ns = 0;
+    f64 last_ns = 0;
+
+    for (u64 functions : { 10, 100, 1000, 4000 }) {
+        incremental_unit unit;
+        unit.comp.source_text = generate_benchmark_program(functions, false);
+        incremental_stats stats;
+        incremental_build(unit, stats);
+
+        incremental_benchmark_point point = { unit.comp.source_text.size(), 0, 0, true };
+        u64 seed = 0x9e3779b97f4a7c15ull;
+        u64 offset = 0;
+        s64 incremental_ns = 0;
+        for (u64 e = 0; e < edits; ++e) {
+            // Odd edits type a digit into `long s = 0;` of some function, even ones delete it again.
+            if (e % 2 == 0) {
+                seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+                u64 target = (seed >> 33) % functions;
+                offset = unit.comp.source_text.find(make_str("f%llu(", (unsigned long long)target));
+                offset = unit.comp.source_text.find("= 0;", offset) + 2;
+            }
+            time_point_precise_t t0 = get_time_precise();
+            if (e % 2 == 0) {
+                incremental_edit(unit, offset, 0, "1", stats);
+            } else {
+                incremental_edit(unit, offset, 1, "", stats);
+            }
+            incremental_ns += time_diff_ns(t0, get_time_precise());
+
+            compilation full;
+            full.source_text = unit.comp.source_text;
+            time_point_precise_t t1 = get_time_precise();
+            compile_front_end(full);
+            point.full_us += time_diff_us(t1, get_time_precise());
+            point.identical &= same_front_end(unit.comp, full);
+        }
+        point.full_us /= s64(std::max(edits, u64(1)));
+        f64 average_ns = f64(incremental_ns) / f64(std::max(edits, u64(1)));
+        point.incremental_us = s64(average_ns / 1000);
+        first_ns = result.points.empty() ? average_ns : first_ns;
+        last_ns = average_ns;
+        result.points.push_back(point);
+    }
+    u64 growth = result.points.back().source_bytes - result.points.front().source_bytes;
+    result.incremental_ns_per_kb = growth > 0 ? (last_ns - first_ns) * 1024 / f64(growth) : 0;
+
+    return result;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+#include "compiler.hpp"
+
+/// Tokens, nodes and declarations of one external declaration (a function, or a declaration of one or more
+/// globals), the unit that gets re-parsed.
+struct incremental_chunk
+{
+    u32 first_token;
+    u32 end_token;      // the next chunk's `first_token`
+    u32 first_node;
+    u32 end_node;
+    u32 first_decl;     // into `incremental_unit::decls`
+    u32 decl_count;
+    std::vector<std::string> errors;
+};
+
+/// @brief A `compilation` whose front end follows edits of its source instead of being rerun. After an edit
+/// the lexer restarts at the token before it and stops as soon as its tokens line up with the old ones again,
+/// and only the external declarations whose tokens changed are parsed again; the other declarations' nodes
+/// are kept (before the edit) or moved with their ids and token indices shifted (after it). Sources without
+/// directives, `__` names or line splices are lexed as they are, with no preprocessor run at all. Lexing and
+/// parsing then cost about the edit's size, but token offsets and node ids are absolute, so everything after
+/// the edit still takes one plain pass: its token offsets are shifted, and its nodes are moved and relocated
+/// when the edit changed the number of tokens or nodes (see `tokens_shifted` and `nodes_shifted`). That pass
+/// is a few nanoseconds per token, the term `incremental_benchmark` reports as `incremental_ns_per_kb`.
+/// Other sources are preprocessed again and the edit is found by diffing the expanded text, which still saves
+/// lexing and parsing.
+/// `comp` is always what `compile_front_end` would have produced for `comp.source_text`, except that name
+/// ids are in the order names were first seen over all edits.
+struct incremental_unit
+{
+    compilation comp;
+    bool direct = false;                    // `comp.preprocessed.text` is the source as-is
+    std::vector<incremental_chunk> chunks;  // empty if the last build failed before parsing
+    std::vector<u32> decls;                 // the root's children, chunk by chunk
+    u64 chunks_with_errors = 0;             // chunks whose `errors` are not empty
+};
+
+struct incremental_stats
+{
+    bool full;              // nothing was reused: the first build, or the preprocessor was switched on or off
+    u64 edit_bytes;         // removed plus inserted, in the lexed text
+    u64 tokens_relexed;
+    u64 tokens_reused;
+    u64 chunks_reparsed;
+    u64 chunks_reused;
+    u64 tokens_shifted;     // tokens after the edit whose offsets were rewritten
+    u64 nodes_shifted;      // nodes after the edit that were moved or had their tokens rewritten
+    s64 preprocess_us;
+    s64 lex_us;             // including patching the token arrays
+    s64 parse_us;           // including moving the reused nodes
+};
+
+/// Runs the whole front end on `u.comp.source_text`. Returns false if there were errors (see `u.comp.errors`)
+/// or `u.comp.cancel` was cancelled, which is polled between phases and declarations.
+bool incremental_build(incremental_unit &u, incremental_stats &stats) noexcept;
+
+/// Replaces `removed` bytes of `u.comp.source_text` at `offset` with `inserted` and brings the front end up to
+/// date. Returns false if there were errors.
+bool incremental_edit(incremental_unit &u, u64 offset, u64 removed, std::string_view inserted, incremental_stats &stats) noexcept;
+
+/// `incremental_edit` with whatever single edit turns the current source into `source` (for editors that only
+/// report the new text, or report it in other units than bytes).
+bool incremental_update(incremental_unit &u, std::string_view source, incremental_stats &stats) noexcept;
+
+std::string incremental_stats_to_string(incremental_stats const &stats) noexcept;
+
+struct incremental_benchmark_point
+{
+    u64 source_bytes;
+    s64 full_us;            // average `compile_front_end` after an edit
+    s64 incremental_us;     // average `incremental_edit`
+    bool identical;         // every edit's tokens and AST matched a full compile's
+};
+
+struct incremental_benchmark_result
+{
+    u64 edits;
+    std::vector<incremental_benchmark_point> points; // growing sources
+    f64 incremental_ns_per_kb;  // growth of `incremental_us` with the source size, first to last point
+};
+
+/// Types `edits` single characters into and deletes them from generated sources of growing size, comparing
+/// the latency of `incremental_edit` with that of a full `compile_front_end` and checking their results agree.
+incremental_benchmark_result incremental_benchmark(u64 edits = 100) noexcept;
@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include "util.hpp"
+#include "arena.hpp"
+
+#include "intern.hpp"
+
+void intern_table::init(arena &memory, u32 initial_capacity) noexcept
+{
+    mem = &memory;
+    count = 0;
+    capacity = std::max(initial_capacity, u32(16));
+    strings = mem->alloc_array<std::string_view>(capacity);
+
+    slot_count = 32;
+    while (slot_count < capacity * 2) {
+        slot_count *= 2;
+    }
+    slot_hashes = mem->alloc_array<u64>(slot_count);
+    slot_ids = mem->alloc_array<u32>(slot_count);
+    std::fill_n(slot_ids, slot_count, intern_null);
+}
+
+/// Slot holding `s`, or the empty slot where it would be inserted.
+u64 intern_table::probe(std::string_view s, u64 hash) const noexcept
+{
+    u64 mask = slot_count - 1;
+    for (u64 slot = hash & mask;; slot = (slot + 1) & mask) {
+        u32 id = slot_ids[slot];
+        if (id == intern_null || (slot_hashes[slot] == hash && strings[id] == s)) {
+            return slot;
+        }
+    }
+}
+
+void intern_table::grow_slots() noexcept
+{
+    u64 *old_hashes = slot_hashes;
+    u32 *old_ids = slot_ids;
+    u32 old_slot_count = slot_count;
+
+    // The old slots are abandoned in the arena, same as `arena::grow_array`.
+    slot_count *= 2;
+    slot_hashes = mem->alloc_array<u64>(slot_count);
+    slot_ids = mem->alloc_array<u32>(slot_count);
+    std::fill_n(slot_ids, slot_count, intern_null);
+
+    u64 mask = slot_count - 1;
+    for (u32 i = 0; i < old_slot_count; ++i) {
+        if (old_ids[i] == intern_null) {
+            continue;
+        }
+        u64 slot = old_hashes[i] & mask;
+        while (slot_ids[slot] != intern_null) {
+            slot = (slot + 1) & mask;
+        }
+        slot_hashes[slot] = old_hashes[i];
+        slot_ids[slot] = old_ids[i];
+    }
+}
+
+u32 intern_table::intern(std::string_view s) noexcept
+{
+    assert(mem != nullptr && "intern_table::init not called");
+
+    u64 hash = fnv1a_hash(s);
+    u64 slot = probe(s, hash);
+    if (slot_ids[slot] != intern_null) {
+        return slot_ids[slot];
+    }
+
+    if (count == capacity) {
+        u32 new_capacity = capacity * 2;
+        strings = mem->grow_array(strings, count, new_capacity);
+        capacity = new_capacity;
+    }
+
+    char *copy = mem->alloc_array<char>(std::max(s.size(), size_t(1)));
+    if (!s.empty()) {
+        memcpy(copy, s.data(), s.size());
+    }
+
+    u32 id = count++;
+    strings[id] = std::string_view(copy, s.size());
+    slot_hashes[slot] = hash;
+    slot_ids[slot] = id;
+
+    if (u64(count) * 2 > slot_count) {
+        grow_slots();
+    }
+    return id;
+}
+
+u32 intern_table::find(std::string_view s) const noexcept
+{
+    if (mem == nullptr) {
+        return intern_null;
+    }
+    return slot_ids[probe(s, fnv1a_hash(s))];
+}
+
+std::string_view intern_table::str(u32 id) const noexcept
+{
+    assert(id < count);
+    return strings[id];
+}
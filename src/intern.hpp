@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string_view>
+
+#include "primitives.hpp"
+
+struct arena;
+
+u32 constexpr intern_null = u32(-1);
+
+/// @brief Maps each distinct string to a dense u32 id, so later phases compare and hash names as integers.
+/// Open addressing with linear probing over (hash, id) slots kept at most half full; the string bytes and
+/// every array live in the arena, so like the AST it is freed by resetting that arena.
+/// Ids are assigned in first-seen order starting at 0, `str(id)` stays valid until the arena is reset.
+struct intern_table
+{
+    arena *mem = nullptr;
+
+    u64 *slot_hashes = nullptr;
+    u32 *slot_ids = nullptr;            // `intern_null` for an empty slot
+    u32 slot_count = 0;                 // power of 2
+
+    std::string_view *strings = nullptr; // by id
+    u32 count = 0;
+    u32 capacity = 0;
+
+    void init(arena &memory, u32 initial_capacity = 256) noexcept;
+
+    /// Id of `s`, adding a copy of it to the table if it is new.
+    u32 intern(std::string_view s) noexcept;
+
+    /// Id of `s`, or `intern_null` if it was never interned.
+    u32 find(std::string_view s) const noexcept;
+
+    std::string_view str(u32 id) const noexcept;
+
+private:
+    u64 probe(std::string_view s, u64 hash) const noexcept;
+    void grow_slots() noexcept;
+};
@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "util.hpp"
+#include "ir.hpp"
+#include "compiler.hpp"
+
+#include "interpreter.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#   define IR_THREADED_DISPATCH 1
+#else
+#   define IR_THREADED_DISPATCH 0
+#endif
+
+bool ir_threaded_dispatch_available() noexcept
+{
+    return IR_THREADED_DISPATCH;
+}
+
+// DISPATCH LOOP
+
+// Every handler ends in VM_NEXT. With threaded dispatch that is an indirect jump straight to the next handler,
+// giving the branch predictor one site per opcode to learn from. The switch loop funnels every opcode through
+// the same jump at `dispatch`. Both strategies share the handlers, so they cannot drift apart.
+#if IR_THREADED_DISPATCH
+#   define VM_CASE(name) case ir_op::name: op_##name:
+#   define VM_NEXT()                                            \
+        do {                                                    \
+            if constexpr (Count) VM_COUNT();                    \
+            if constexpr (Threaded) goto *s_labels[u8(pc->op)]; \
+            else goto dispatch;                                 \
+        } while (0)
+#else
+#   define VM_CASE(name) case ir_op::name:
+#   define VM_NEXT()                                            \
+        do {                                                    \
+            if constexpr (Count) VM_COUNT();                    \
+            goto dispatch;                                      \
+        } while (0)
+#endif
+
+#define VM_COUNT()                                          \
+    do {                                                    \
+        ++executed;                                         \
+        if (profile != nullptr) {                           \
+            ++profile->pairs[prev_op][u8(pc->op)];          \
+            prev_op = u8(pc->op);                           \
+        }                                                   \
+    } while (0)
+
+#define VM_TRAP(message)    \
+    do {                    \
+        rt.error = message; \
+        goto trap;          \
+    } while (0)
+
+// A long-running program spends its time in loops and calls, so a cancellable run polls its token on calls
+// and on taken branches back to an earlier instruction, and nowhere else.
+#define VM_POLL()                                                                       \
+    do {                                                                                \
+        if constexpr (Cancellable) {                                                    \
+            if (cancel->cancelled()) VM_TRAP("cancelled");                              \
+        }                                                                               \
+    } while (0)
+
+#define VM_POLL_BRANCH(taken)                                                           \
+    do {                                                                                \
+        if constexpr (Cancellable) {                                                    \
+            if ((taken) && pc->imm <= s64(pc - fn->code.data()) && cancel->cancelled()) \
+                VM_TRAP("cancelled");                                                   \
+        }                                                                               \
+    } while (0)
+
+template <bool Threaded, bool Count, bool Cancellable>
+static bool interpret(ir_module const &module, u32 fn_index, s64 const *args, u32 argc, ir_runtime &rt,
+                      s64 &result, s64 *stack, u64 stack_words, u64 &instructions, ir_pair_profile *profile,
+                      cancel_token const *cancel) noexcept
+{
+#if IR_THREADED_DISPATCH
+    static void *const s_labels[] = {
+        &&op_nop,
+        &&op_mov_imm,
+        &&op_mov_wide,
+        &&op_mov,
+        &&op_load_local,
+        &&op_store_local,
+        &&op_load_global,
+        &&op_store_global,
+        &&op_load_string,
+        &&op_add,
+        &&op_sub,
+        &&op_mul,
+        &&op_div,
+        &&op_mod,
+        &&op_bit_and,
+        &&op_bit_or,
+        &&op_bit_xor,
+        &&op_shl,
+        &&op_shr,
+        &&op_add_imm,
+        &&op_neg,
+        &&op_bit_not,
+        &&op_log_not,
+        &&op_sext,
+        &&op_eq,
+        &&op_ne,
+        &&op_lt,
+        &&op_le,
+        &&op_gt,
+        &&op_ge,
+        &&op_jump,
+        &&op_jump_if,
+        &&op_jump_if_not,
+        &&op_call,
+        &&op_call_builtin,
+        &&op_ret,
+        &&op_load_local_pair,
+        &&op_load_local_mov_imm,
+        &&op_load_local_add_imm,
+        &&op_local_add_imm,
+        &&op_local_add_imm_sext32,
+        &&op_mov_imm_store_local,
+        &&op_sext_store_local,
+        &&op_eq_jump_if_not,
+        &&op_ne_jump_if_not,
+        &&op_lt_jump_if_not,
+        &&op_le_jump_if_not,
+        &&op_gt_jump_if_not,
+        &&op_ge_jump_if_not,
+    };
+    static_assert(lengthof(s_labels) == u64(ir_op::count));
+#endif
+
+    struct frame
+    {
+        ir_function const *fn;
+        ir_inst const *return_pc;
+        s64 *base;
+        u16 dest;
+    };
+    std::vector<frame> frames;
+    frames.reserve(64);
+
+    s64 *const stack_end = stack + stack_words;
+    s64 *const globals = rt.globals.data();
+    u64 executed = 0;
+    u8 prev_op = u8(ir_op::nop); // the profile attributes the first dispatch to a `nop` pair
+
+    ir_function const *fn = &module.functions[fn_index];
+    if (fn->register_count + fn->slot_count > stack_words || argc != fn->param_count) {
+        rt.error = argc != fn->param_count ? "wrong number of arguments" : "stack overflow";
+        return false;
+    }
+
+    // Registers then slots, frames are stacked back to back.
+    s64 *base = stack;
+    s64 *r = base;
+    s64 *slots = base + fn->register_count;
+    ir_inst const *pc = fn->code.data();
+    std::copy(args, args + argc, r);
+
+    if constexpr (Count) VM_COUNT();
+    goto dispatch; // the first instruction is dispatched through the switch in both modes
+
+dispatch:
+    switch (pc->op) {
+        VM_CASE(nop)
+            ++pc;
+            VM_NEXT();
+
+        // DATA MOVEMENT
+
+        VM_CASE(mov_imm)
+            r[pc->a] = pc->imm;
+            ++pc;
+            VM_NEXT();
+        VM_CASE(mov_wide)
+            r[pc->a] = module.constants[pc->imm];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(mov)
+            r[pc->a] = r[pc->b];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(load_local)
+            r[pc->a] = slots[pc->imm];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(store_local)
+            slots[pc->imm] = r[pc->a];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(load_global)
+            r[pc->a] = globals[pc->imm];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(store_global)
+            globals[pc->imm] = r[pc->a];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(load_string)
+            r[pc->a] = s64(reinterpret_cast<intptr_t>(module.strings[pc->imm].c_str()));
+            ++pc;
+            VM_NEXT();
+
+        // ARITHMETIC (wrapping, done on u64 to keep overflow defined)
+
+        VM_CASE(add)
+            r[pc->a] = s64(u64(r[pc->b]) + u64(r[pc->c]));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(sub)
+            r[pc->a] = s64(u64(r[pc->b]) - u64(r[pc->c]));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(mul)
+            r[pc->a] = s64(u64(r[pc->b]) * u64(r[pc->c]));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(div)
+            if (r[pc->c] == 0) VM_TRAP("division by zero");
+            if (r[pc->c] == -1 && r[pc->b] == std::numeric_limits<s64>::min()) VM_TRAP("division overflow");
+            r[pc->a] = r[pc->b] / r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(mod)
+            if (r[pc->c] == 0) VM_TRAP("division by zero");
+            if (r[pc->c] == -1 && r[pc->b] == std::numeric_limits<s64>::min()) VM_TRAP("division overflow");
+            r[pc->a] = r[pc->b] % r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(bit_and)
+            r[pc->a] = r[pc->b] & r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(bit_or)
+            r[pc->a] = r[pc->b] | r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(bit_xor)
+            r[pc->a] = r[pc->b] ^ r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(shl)
+            r[pc->a] = s64(u64(r[pc->b]) << (r[pc->c] & 63));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(shr)
+            r[pc->a] = r[pc->b] >> (r[pc->c] & 63);
+            ++pc;
+            VM_NEXT();
+        VM_CASE(add_imm)
+            r[pc->a] = s64(u64(r[pc->b]) + u64(s64(pc->imm)));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(neg)
+            r[pc->a] = s64(0 - u64(r[pc->b]));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(bit_not)
+            r[pc->a] = ~r[pc->b];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(log_not)
+            r[pc->a] = !r[pc->b];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(sext) {
+            u32 shift = u32(64 - pc->imm);
+            r[pc->a] = s64(u64(r[pc->b]) << shift) >> shift;
+            ++pc;
+            VM_NEXT();
+        }
+
+        // COMPARISONS
+
+        VM_CASE(eq)
+            r[pc->a] = r[pc->b] == r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(ne)
+            r[pc->a] = r[pc->b] != r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(lt)
+            r[pc->a] = r[pc->b] < r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(le)
+            r[pc->a] = r[pc->b] <= r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(gt)
+            r[pc->a] = r[pc->b] > r[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(ge)
+            r[pc->a] = r[pc->b] >= r[pc->c];
+            ++pc;
+            VM_NEXT();
+
+        // CONTROL FLOW
+
+        VM_CASE(jump)
+            VM_POLL_BRANCH(true);
+            pc = fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(jump_if)
+            VM_POLL_BRANCH(r[pc->a]);
+            pc = r[pc->a] ? fn->code.data() + pc->imm : pc + 1;
+            VM_NEXT();
+        VM_CASE(jump_if_not)
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(call) {
+            VM_POLL();
+            ir_function const *callee = &module.functions[pc->imm];
+            s64 *callee_base = slots + fn->slot_count;
+            if (callee_base + callee->register_count + callee->slot_count > stack_end) {
+                VM_TRAP("stack overflow");
+            }
+            std::copy(r + pc->b, r + pc->b + pc->c, callee_base);
+            frames.push_back({ fn, pc + 1, base, pc->a });
+
+            fn = callee;
+            base = r = callee_base;
+            slots = base + fn->register_count;
+            pc = fn->code.data();
+            VM_NEXT();
+        }
+        VM_CASE(call_builtin)
+            r[pc->a] = ir_call_builtin(rt, ir_builtin(pc->imm), r + pc->b, pc->c);
+            if (!rt.error.empty()) goto trap;
+            ++pc;
+            VM_NEXT();
+        VM_CASE(ret) {
+            s64 value = r[pc->a];
+            if (frames.empty()) {
+                result = value;
+                instructions += executed;
+                return true;
+            }
+            frame const &caller = frames.back();
+            fn = caller.fn;
+            base = r = caller.base;
+            slots = base + fn->register_count;
+            pc = caller.return_pc;
+            r[caller.dest] = value;
+            frames.pop_back();
+            VM_NEXT();
+        }
+
+        // SUPERINSTRUCTIONS
+
+        VM_CASE(load_local_pair)
+            r[pc->a] = slots[pc->imm];
+            r[pc->b] = slots[pc->c];
+            ++pc;
+            VM_NEXT();
+        VM_CASE(load_local_mov_imm)
+            r[pc->a] = slots[pc->c];
+            r[pc->b] = pc->imm;
+            ++pc;
+            VM_NEXT();
+        VM_CASE(load_local_add_imm)
+            r[pc->b] = slots[pc->c];
+            r[pc->a] = s64(u64(r[pc->b]) + u64(s64(pc->imm)));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(local_add_imm)
+            r[pc->b] = slots[pc->c];
+            slots[pc->c] = r[pc->a] = s64(u64(r[pc->b]) + u64(s64(pc->imm)));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(local_add_imm_sext32)
+            r[pc->b] = slots[pc->c];
+            slots[pc->c] = r[pc->a] = s64(s32(u32(u64(r[pc->b]) + u64(s64(pc->imm)))));
+            ++pc;
+            VM_NEXT();
+        VM_CASE(mov_imm_store_local)
+            slots[pc->c] = r[pc->a] = pc->imm;
+            ++pc;
+            VM_NEXT();
+        VM_CASE(sext_store_local) {
+            u32 shift = u32(64 - pc->c);
+            slots[pc->imm] = r[pc->a] = s64(u64(r[pc->b]) << shift) >> shift;
+            ++pc;
+            VM_NEXT();
+        }
+        VM_CASE(eq_jump_if_not)
+            r[pc->a] = r[pc->b] == r[pc->c];
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(ne_jump_if_not)
+            r[pc->a] = r[pc->b] != r[pc->c];
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(lt_jump_if_not)
+            r[pc->a] = r[pc->b] < r[pc->c];
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(le_jump_if_not)
+            r[pc->a] = r[pc->b] <= r[pc->c];
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(gt_jump_if_not)
+            r[pc->a] = r[pc->b] > r[pc->c];
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+        VM_CASE(ge_jump_if_not)
+            r[pc->a] = r[pc->b] >= r[pc->c];
+            VM_POLL_BRANCH(!r[pc->a]);
+            pc = r[pc->a] ? pc + 1 : fn->code.data() + pc->imm;
+            VM_NEXT();
+
+        case ir_op::count:
+            break;
+    }
+    rt.error = "invalid opcode";
+
+trap:
+    instructions += executed;
+    return false;
+}
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_COUNT
+#undef VM_TRAP
+#undef VM_POLL
+#undef VM_POLL_BRANCH
+
+/// Picks the `interpret` instantiation for the dispatch strategy and what `options` ask for.
+template <bool Threaded>
+static bool interpret_with(ir_module const &module, u32 fn_index, s64 const *args, u32 argc, ir_runtime &rt,
+                           s64 &result, s64 *stack, u64 &executed, interpreter_options const &options) noexcept
+{
+    if (options.cancel != nullptr) {
+        return options.count_instructions
+            ? interpret<Threaded, true, true>(module, fn_index, args, argc, rt, result, stack, options.stack_words, executed, options.profile, options.cancel)
+            : interpret<Threaded, false, true>(module, fn_index, args, argc, rt, result, stack, options.stack_words, executed, options.profile, options.cancel);
+    }
+    return options.count_instructions
+        ? interpret<Threaded, true, false>(module, fn_index, args, argc, rt, result, stack, options.stack_words, executed, options.profile, nullptr)
+        : interpret<Threaded, false, false>(module, fn_index, args, argc, rt, result, stack, options.stack_words, executed, options.profile, nullptr);
+}
+
+bool ir_interpret_call(ir_module const &module, u32 fn_index, s64 const *args, u32 argc, ir_runtime &rt,
+                       s64 &result, interpreter_options const &options, u64 *instructions) noexcept
+{
+    // Deliberately not value-initialized, the lowering never reads a register or slot before writing it.
+    std::unique_ptr<s64[]> stack(new s64[options.stack_words]);
+    u64 executed = 0;
+    bool ok;
+
+#if IR_THREADED_DISPATCH
+    if (options.dispatch == ir_dispatch::threaded) {
+        ok = interpret_with<true>(module, fn_index, args, argc, rt, result, stack.get(), executed, options);
+    } else
+#endif
+    {
+        ok = interpret_with<false>(module, fn_index, args, argc, rt, result, stack.get(), executed, options);
+    }
+
+    if (instructions != nullptr) {
+        *instructions = executed;
+    }
+    if (options.profile != nullptr) {
+        options.profile->dispatches += executed;
+    }
+    return ok;
+}
+
+bool execute_ir(ir_module const &module, execution_result &out, interpreter_options const &options) noexcept
+{
+    out = {};
+
+    ir_runtime rt;
+    ir_runtime_init(rt, module);
+    rt.output_sink = options.output_sink;
+
+    time_point_precise_t t0 = get_time_precise();
+    bool ok = true;
+    if (module.main_index != u32(-1)) {
+        ok = ir_interpret_call(module, module.main_index, nullptr, 0, rt, out.exit_code, options, &out.instructions);
+    }
+    ir_runtime_flush_output(rt);
+    ok = ok && rt.error.empty();
+    out.elapsed_us = time_diff_us(t0, get_time_precise());
+
+    out.output = std::move(rt.output);
+    out.error = std::move(rt.error);
+    return ok;
+}
+
+// BENCHMARK
+
+static char const s_benchmark_source[] = R"(
+int fib(int n)
+{
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+long mix(int iterations)
+{
+    long sum = 0;
+    int i;
+    for (i = 0; i < iterations; ++i) {
+        sum += (i ^ (i >> 3)) % 7;
+        if (sum > 1000000)
+            sum -= 999983;
+    }
+    return sum;
+}
+
+int main()
+{
+    printf("%ld %d\n", mix(2000000), fib(24));
+    return 0;
+}
+)";
+
+char const *interpreter_benchmark_source() noexcept
+{
+    return s_benchmark_source;
+}
+
+static s32 native_fib(s32 n) noexcept
+{
+    return n < 2 ? n : native_fib(n - 1) + native_fib(n - 2);
+}
+
+static s64 native_mix(s32 iterations) noexcept
+{
+    s64 sum = 0;
+    for (s32 i = 0; i < iterations; ++i) {
+        sum += (i ^ (i >> 3)) % 7;
+        if (sum > 1000000)
+            sum -= 999983;
+    }
+    return sum;
+}
+
+interpreter_benchmark_result interpreter_benchmark(u64 iterations) noexcept
+{
+    interpreter_benchmark_result result = {};
+
+    compilation comp;
+    comp.source_text = s_benchmark_source;
+    if (!compile_to_ir(comp)) {
+        return result;
+    }
+
+    interpreter_options options;
+    options.count_instructions = true;
+    execution_result run;
+    execute_ir(comp.ir, run, options);
+    result.instructions = run.instructions;
+    options.count_instructions = false;
+
+    options.dispatch = ir_dispatch::switch_loop;
+    result.switch_best_us = best_time_us(iterations, [&] { execute_ir(comp.ir, run, options); });
+
+    if (ir_threaded_dispatch_available()) {
+        options.dispatch = ir_dispatch::threaded;
+        result.threaded_best_us = best_time_us(iterations, [&] { execute_ir(comp.ir, run, options); });
+    }
+
+    // `volatile` keeps the compiler from folding the native run into a constant.
+    volatile s32 mix_iterations = 2000000;
+    volatile s32 fib_n = 24;
+    volatile s64 sink = 0;
+    result.native_best_us = best_time_us(iterations, [&] { sink = native_mix(mix_iterations) + native_fib(fib_n); });
+    (void)sink;
+
+    f64 instructions = f64(std::max(result.instructions, u64(1)));
+    result.switch_ns_per_inst = f64(result.switch_best_us) * 1000.0 / instructions;
+    result.threaded_ns_per_inst = f64(result.threaded_best_us) * 1000.0 / instructions;
+    result.switch_vs_native = f64(result.switch_best_us) / f64(result.native_best_us);
+    result.threaded_vs_native = f64(result.threaded_best_us) / f64(result.native_best_us);
+    return result;
+}
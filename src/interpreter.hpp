@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+
+#include "primitives.hpp"
+#include "ir.hpp"
+
+struct cancel_token;
+
+enum class ir_dispatch : u8
+{
+    switch_loop,    // one indirect branch shared by every opcode (portable)
+    threaded,       // computed goto, one indirect branch per handler (GCC and Clang only)
+};
+
+/// Whether this build supports `ir_dispatch::threaded`, which is also the default when it does.
+bool ir_threaded_dispatch_available() noexcept;
+
+/// Dynamic opcode pair counts: `pairs[x][y]` is how often `y` was dispatched right after `x`.
+/// Accumulates across runs, so one profile can cover a whole test corpus.
+struct ir_pair_profile
+{
+    u64 pairs[u64(ir_op::count)][u64(ir_op::count)] = {};
+    u64 dispatches = 0;
+};
+
+struct interpreter_options
+{
+    ir_dispatch dispatch = ir_threaded_dispatch_available() ? ir_dispatch::threaded : ir_dispatch::switch_loop;
+    bool count_instructions = false;   // fills `execution_result::instructions`, slows dispatch slightly
+    ir_pair_profile *profile = nullptr; // if set (requires `count_instructions`), records opcode pairs into it
+    u64 stack_words = 1 << 20;         // registers + slots of all active frames, 8 MiB by default
+    cancel_token const *cancel = nullptr; // if set, polled on calls and backward branches, a cancelled run traps
+    std::function<bool(std::string_view)> output_sink; // `execute_ir` streams output through it, see `ir_runtime`
+};
+
+struct execution_result
+{
+    s64 exit_code;
+    std::string output;     // what the program printed, empty if it went to an `output_sink`
+    std::string error;      // why it trapped, empty if it ran to completion
+    u64 instructions;       // executed, only counted with `interpreter_options::count_instructions`
+    s64 elapsed_us;
+};
+
+/// Calls `module.functions[fn_index]` with `argc` arguments, the entry point shared by every execution engine:
+/// program state lives in `rt` and the return value is written to `result`.
+/// Returns false if the program trapped (`rt.error` says why).
+bool ir_interpret_call(ir_module const &module, u32 fn_index, s64 const *args, u32 argc, ir_runtime &rt,
+                       s64 &result, interpreter_options const &options = {}, u64 *instructions = nullptr) noexcept;
+
+/// Runs the module's `main` from a fresh runtime. A module without `main` runs nothing and succeeds with
+/// empty output, which is what test programs that only declare things expect.
+bool execute_ir(ir_module const &module, execution_result &out, interpreter_options const &options = {}) noexcept;
+
+struct interpreter_benchmark_result
+{
+    u64 instructions;           // executed per run
+    s64 switch_best_us;
+    s64 threaded_best_us;       // 0 when threaded dispatch is not available
+    s64 native_best_us;         // the same program compiled into this binary
+    f64 switch_ns_per_inst;
+    f64 threaded_ns_per_inst;
+    f64 switch_vs_native;       // slowdown factors
+    f64 threaded_vs_native;
+};
+
+/// Source of the program `interpreter_benchmark` runs.
+char const *interpreter_benchmark_source() noexcept;
+
+/// Compiles a loop- and call-heavy program with the front end, runs it with each dispatch strategy and
+/// reports best-of-`iterations` time per executed instruction next to the native equivalent.
+interpreter_benchmark_result interpreter_benchmark(u64 iterations = 5) noexcept;
@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+#include "util.hpp"
+
+#include "ir.hpp"
+
+char const *ir_op_name(ir_op op) noexcept
+{
+    static char const *const names[] = {
+        "nop",
+        "mov_imm",
+        "mov_wide",
+        "mov",
+        "load_local",
+        "store_local",
+        "load_global",
+        "store_global",
+        "load_string",
+        "add",
+        "sub",
+        "mul",
+        "div",
+        "mod",
+        "bit_and",
+        "bit_or",
+        "bit_xor",
+        "shl",
+        "shr",
+        "add_imm",
+        "neg",
+        "bit_not",
+        "log_not",
+        "sext",
+        "eq",
+        "ne",
+        "lt",
+        "le",
+        "gt",
+        "ge",
+        "jump",
+        "jump_if",
+        "jump_if_not",
+        "call",
+        "call_builtin",
+        "ret",
+        "load_local_pair",
+        "load_local_mov_imm",
+        "load_local_add_imm",
+        "local_add_imm",
+        "local_add_imm_sext32",
+        "mov_imm_store_local",
+        "sext_store_local",
+        "eq_jump_if_not",
+        "ne_jump_if_not",
+        "lt_jump_if_not",
+        "le_jump_if_not",
+        "gt_jump_if_not",
+        "ge_jump_if_not",
+    };
+    static_assert(lengthof(names) == u64(ir_op::count));
+
+    assert(op < ir_op::count);
+    return names[u64(op)];
+}
+
+bool ir_op_is_superinstruction(ir_op op) noexcept
+{
+    return op >= ir_op::load_local_pair && op < ir_op::count;
+}
+
+bool ir_op_is_jump(ir_op op) noexcept
+{
+    return one_of(op, { ir_op::jump, ir_op::jump_if, ir_op::jump_if_not })
+        || (op >= ir_op::eq_jump_if_not && op <= ir_op::ge_jump_if_not);
+}
+
+char const *ir_builtin_name(ir_builtin builtin) noexcept
+{
+    switch (builtin) {
+        case ir_builtin::putchar_: return "putchar";
+        case ir_builtin::printf_:  return "printf";
+        case ir_builtin::count:    break;
+    }
+    return "";
+}
+
+bool ir_op_is_pure(ir_op op) noexcept
+{
+    return (op >= ir_op::mov_imm && op <= ir_op::mov) || op == ir_op::load_string || (op >= ir_op::add && op <= ir_op::ge);
+}
+
+bool ir_fold(ir_op op, s64 b, s64 c, s32 imm, s64 &out) noexcept
+{
+    switch (op) {
+        case ir_op::mov_imm: out = imm; return true;
+        case ir_op::mov:     out = b; return true;
+        case ir_op::add:     out = s64(u64(b) + u64(c)); return true;
+        case ir_op::sub:     out = s64(u64(b) - u64(c)); return true;
+        case ir_op::mul:     out = s64(u64(b) * u64(c)); return true;
+        case ir_op::div:     if (c == 0 || (c == -1 && b == std::numeric_limits<s64>::min())) return false; out = b / c; return true;
+        case ir_op::mod:     if (c == 0 || (c == -1 && b == std::numeric_limits<s64>::min())) return false; out = b % c; return true;
+        case ir_op::bit_and: out = b & c; return true;
+        case ir_op::bit_or:  out = b | c; return true;
+        case ir_op::bit_xor: out = b ^ c; return true;
+        case ir_op::shl:     out = s64(u64(b) << (c & 63)); return true;
+        case ir_op::shr:     out = b >> (c & 63); return true;
+        case ir_op::add_imm: out = s64(u64(b) + u64(s64(imm))); return true;
+        case ir_op::neg:     out = s64(0 - u64(b)); return true;
+        case ir_op::bit_not: out = ~b; return true;
+        case ir_op::log_not: out = !b; return true;
+        case ir_op::sext: {
+            u32 shift = u32(64 - imm);
+            out = s64(u64(b) << shift) >> shift;
+            return true;
+        }
+        case ir_op::eq:      out = b == c; return true;
+        case ir_op::ne:      out = b != c; return true;
+        case ir_op::lt:      out = b < c; return true;
+        case ir_op::le:      out = b <= c; return true;
+        case ir_op::gt:      out = b > c; return true;
+        case ir_op::ge:      out = b >= c; return true;
+        default:             return false;
+    }
+}
+
+u64 ir_module::instruction_count() const noexcept
+{
+    u64 n = 0;
+    for (ir_function const &fn : functions) {
+        n += fn.code.size();
+    }
+    return n;
+}
+
+std::string ir_inst_to_string(ir_module const &module, ir_inst const &inst) noexcept
+{
+    std::string s = ir_op_name(inst.op);
+    s.resize(std::max(s.size() + 1, size_t(14)), ' ');
+
+    switch (inst.op) {
+        case ir_op::nop:
+            break;
+        case ir_op::mov_imm:
+            s += make_str("r%u, %d", inst.a, inst.imm);
+            break;
+        case ir_op::mov_wide:
+            s += make_str("r%u, %lld", inst.a, (long long)module.constants[inst.imm]);
+            break;
+        case ir_op::mov:
+        case ir_op::neg:
+        case ir_op::bit_not:
+        case ir_op::log_not:
+            s += make_str("r%u, r%u", inst.a, inst.b);
+            break;
+        case ir_op::sext:
+            s += make_str("r%u, r%u, %d", inst.a, inst.b, inst.imm);
+            break;
+        case ir_op::load_local:
+            s += make_str("r%u, slot%d", inst.a, inst.imm);
+            break;
+        case ir_op::store_local:
+            s += make_str("slot%d, r%u", inst.imm, inst.a);
+            break;
+        case ir_op::load_global:
+            s += make_str("r%u, @%s", inst.a, module.globals[inst.imm].name.c_str());
+            break;
+        case ir_op::store_global:
+            s += make_str("@%s, r%u", module.globals[inst.imm].name.c_str(), inst.a);
+            break;
+        case ir_op::load_string:
+            s += make_str("r%u, str%d", inst.a, inst.imm);
+            break;
+        case ir_op::add_imm:
+            s += make_str("r%u, r%u, %d", inst.a, inst.b, inst.imm);
+            break;
+        case ir_op::jump:
+            s += make_str("%d", inst.imm);
+            break;
+        case ir_op::jump_if:
+        case ir_op::jump_if_not:
+            s += make_str("r%u, %d", inst.a, inst.imm);
+            break;
+        case ir_op::call:
+            s += make_str("r%u, %s(r%u..+%u)", inst.a, module.functions[inst.imm].name.c_str(), inst.b, inst.c);
+            break;
+        case ir_op::call_builtin:
+            s += make_str("r%u, %s(r%u..+%u)", inst.a, ir_builtin_name(ir_builtin(inst.imm)), inst.b, inst.c);
+            break;
+        case ir_op::ret:
+            s += make_str("r%u", inst.a);
+            break;
+        case ir_op::load_local_pair:
+            s += make_str("r%u, slot%d, r%u, slot%u", inst.a, inst.imm, inst.b, inst.c);
+            break;
+        case ir_op::load_local_mov_imm:
+            s += make_str("r%u, slot%u, r%u, %d", inst.a, inst.c, inst.b, inst.imm);
+            break;
+        case ir_op::load_local_add_imm:
+        case ir_op::local_add_imm:
+        case ir_op::local_add_imm_sext32:
+            s += make_str("r%u, r%u, slot%u, %d", inst.a, inst.b, inst.c, inst.imm);
+            break;
+        case ir_op::mov_imm_store_local:
+            s += make_str("slot%u, r%u, %d", inst.c, inst.a, inst.imm);
+            break;
+        case ir_op::sext_store_local:
+            s += make_str("slot%d, r%u, r%u, %u", inst.imm, inst.a, inst.b, inst.c);
+            break;
+        case ir_op::eq_jump_if_not:
+        case ir_op::ne_jump_if_not:
+        case ir_op::lt_jump_if_not:
+        case ir_op::le_jump_if_not:
+        case ir_op::gt_jump_if_not:
+        case ir_op::ge_jump_if_not:
+            s += make_str("r%u, r%u, r%u, %d", inst.a, inst.b, inst.c, inst.imm);
+            break;
+        default: // three register arithmetic and comparisons
+            s += make_str("r%u, r%u, r%u", inst.a, inst.b, inst.c);
+            break;
+    }
+    return s;
+}
+
+std::string ir_function_to_string(ir_module const &module, ir_function const &fn) noexcept
+{
+    std::string s = make_str("%s(%u params, %u registers, %u slots):\n", fn.name.c_str(), fn.param_count, fn.register_count, fn.slot_count);
+    for (u64 i = 0; i < fn.code.size(); ++i) {
+        s += make_str("%4zu  ", i);
+        s += ir_inst_to_string(module, fn.code[i]);
+        s += '\n';
+    }
+    return s;
+}
+
+std::string ir_module_to_string(ir_module const &module, std::vector<u32> *function_lines) noexcept
+{
+    std::string s;
+    for (ir_global const &g : module.globals) {
+        s += make_str("@%s = %lld\n", g.name.c_str(), (long long)g.initial_value);
+    }
+    for (u64 i = 0; i < module.strings.size(); ++i) {
+        s += make_str("str%zu = \"%s\"\n", i, module.strings[i].c_str());
+    }
+    if (!module.globals.empty() || !module.strings.empty()) {
+        s += '\n';
+    }
+    if (function_lines != nullptr) {
+        function_lines->clear();
+    }
+    u32 line = u32(std::count(s.begin(), s.end(), '\n')); // string literals may hold newlines
+    for (ir_function const &fn : module.functions) {
+        if (function_lines != nullptr) {
+            function_lines->push_back(line + 1); // after the header
+        }
+        s += ir_function_to_string(module, fn);
+        s += '\n';
+        line += u32(fn.code.size()) + 2;
+    }
+    return s;
+}
+
+void ir_runtime_init(ir_runtime &rt, ir_module const &module) noexcept
+{
+    rt.globals.resize(module.globals.size());
+    for (u64 i = 0; i < module.globals.size(); ++i) {
+        rt.globals[i] = module.globals[i].initial_value;
+    }
+    rt.output.clear();
+    rt.error.clear();
+    rt.strings.assign(module.strings.begin(), module.strings.end());
+    std::sort(rt.strings.begin(), rt.strings.end(), [](std::string_view a, std::string_view b) {
+        return std::less<char const *>()(a.data(), b.data());
+    });
+}
+
+/// The string literal `arg` points into (at most up to its NUL), or null if it points into none of them.
+static char const *runtime_string(ir_runtime const &rt, s64 arg) noexcept
+{
+    char const *p = reinterpret_cast<char const *>(arg);
+    auto it = std::upper_bound(rt.strings.begin(), rt.strings.end(), p, [](char const *q, std::string_view s) {
+        return std::less<char const *>()(q, s.data());
+    });
+    if (it == rt.strings.begin()) {
+        return nullptr;
+    }
+    --it;
+    return std::less_equal<char const *>()(p, it->data() + it->size()) ? p : nullptr;
+}
+
+void ir_runtime_flush_output(ir_runtime &rt) noexcept
+{
+    if (!rt.output_sink || rt.output.empty()) {
+        return;
+    }
+    bool accepted = rt.output_sink(rt.output);
+    rt.output.clear();
+    if (!accepted && rt.error.empty()) {
+        rt.error = "output rejected";
+    }
+}
+
+/// Formats one printf conversion. `spec` is the conversion without its length modifier (e.g. "%-5" + 'd'),
+/// `is_long` tells whether one was given (l, ll, z, j), which decides between the 32 and 64-bit C types. For
+/// 's', `arg` must already have been checked with `runtime_string` (or be 0).
+static void format_conversion(std::string &out, std::string spec, char conv, bool is_long, s64 arg) noexcept
+{
+    // Measured first, then written in place: a field width can make a conversion any length.
+    auto append = [&](auto value) {
+        s32 len = snprintf(nullptr, 0, spec.c_str(), value);
+        if (len > 0) {
+            u64 old_size = out.size();
+            out.resize(old_size + u64(len) + 1);
+            snprintf(out.data() + old_size, u64(len) + 1, spec.c_str(), value);
+            out.resize(old_size + u64(len));
+        }
+    };
+
+    switch (conv) {
+        case 'd':
+        case 'i':
+            spec += is_long ? "lld" : "d";
+            if (is_long) {
+                append((long long)arg);
+            } else {
+                append(s32(arg));
+            }
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec += is_long ? "ll" : "";
+            spec += conv;
+            if (is_long) {
+                append((unsigned long long)arg);
+            } else {
+                append(u32(arg));
+            }
+            break;
+        case 'c':
+            spec += 'c';
+            append(s32(u8(arg)));
+            break;
+        case 's': {
+            char const *str = reinterpret_cast<char const *>(arg);
+            spec += 's';
+            append(str ? str : "(null)");
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+static s64 builtin_printf(ir_runtime &rt, s64 const *args, u32 argc) noexcept
+{
+    if (argc == 0 || args[0] == 0) {
+        rt.error = "printf: null format string";
+        return -1;
+    }
+    char const *fmt = runtime_string(rt, args[0]);
+    if (fmt == nullptr) {
+        rt.error = make_str("printf: format string is %lld, not a string", (long long)args[0]);
+        return -1;
+    }
+
+    u64 size_before = rt.output.size();
+    u32 next_arg = 1;
+
+    for (char const *p = fmt; *p != '\0'; ++p) {
+        if (*p != '%') {
+            rt.output += *p;
+            continue;
+        }
+        if (p[1] == '%') {
+            rt.output += '%';
+            ++p;
+            continue;
+        }
+
+        std::string spec = "%";
+        ++p;
+        while (*p != '\0' && strchr("-+ #0", *p)) spec += *p++;
+        while (*p >= '0' && *p <= '9') spec += *p++;
+        if (*p == '.') {
+            spec += *p++;
+            while (*p >= '0' && *p <= '9') spec += *p++;
+        }
+        bool is_long = false;
+        while (*p != '\0' && strchr("hlzj", *p)) {
+            is_long |= *p != 'h';
+            ++p;
+        }
+        if (*p == '\0' || !strchr("diuxXocs", *p)) {
+            rt.error = make_str("printf: unsupported conversion in \"%s\"", fmt);
+            return -1;
+        }
+        if (next_arg >= argc) {
+            rt.error = make_str("printf: too few arguments for \"%s\"", fmt);
+            return -1;
+        }
+        s64 arg = args[next_arg++];
+        if (*p == 's' && arg != 0 && runtime_string(rt, arg) == nullptr) {
+            rt.error = make_str("printf: argument for %%s in \"%s\" is %lld, not a string", fmt, (long long)arg);
+            return -1;
+        }
+        format_conversion(rt.output, std::move(spec), *p, is_long, arg);
+    }
+
+    return s64(rt.output.size() - size_before);
+}
+
+static s64 call_builtin(ir_runtime &rt, ir_builtin builtin, s64 const *args, u32 argc) noexcept
+{
+    switch (builtin) {
+        case ir_builtin::putchar_:
+            if (argc != 1) {
+                rt.error = "putchar: expects 1 argument";
+                return -1;
+            }
+            rt.output += char(u8(args[0]));
+            return s64(u8(args[0]));
+        case ir_builtin::printf_:
+            return builtin_printf(rt, args, argc);
+        case ir_builtin::count:
+            break;
+    }
+    rt.error = "unknown builtin";
+    return -1;
+}
+
+s64 ir_call_builtin(ir_runtime &rt, ir_builtin builtin, s64 const *args, u32 argc) noexcept
+{
+    s64 result = call_builtin(rt, builtin, args, argc);
+    if (rt.output.size() >= ir_output_flush_bytes) {
+        ir_runtime_flush_output(rt);
+    }
+    return result;
+}
@@ -0,0 +1,191 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+
+/// Opcodes of the custom IR. Registers and local slots hold s64, comparisons produce 0 or 1.
+/// Operand fields are `a`, `b`, `c` (registers unless noted) and `imm`.
+enum class ir_op : u8
+{
+    nop,
+
+    // DATA MOVEMENT
+
+    mov_imm,        // a = imm
+    mov_wide,       // a = module.constants[imm], for literals that do not fit in imm
+    mov,            // a = b
+    load_local,     // a = slot[imm]
+    store_local,    // slot[imm] = a
+    load_global,    // a = globals[imm]
+    store_global,   // globals[imm] = a
+    load_string,    // a = address of module.strings[imm] (NUL terminated)
+
+    // ARITHMETIC
+
+    add,            // a = b + c
+    sub,
+    mul,
+    div,            // traps on division by zero and on INT64_MIN / -1
+    mod,            // same traps as div
+    bit_and,
+    bit_or,
+    bit_xor,
+    shl,            // shift count is masked to 0..63
+    shr,            // arithmetic, count masked to 0..63
+    add_imm,        // a = b + imm
+    neg,            // a = -b
+    bit_not,        // a = ~b
+    log_not,        // a = !b
+    sext,           // a = b truncated to its low imm bits (8, 16 or 32) and sign-extended back
+
+    // COMPARISONS
+
+    eq,             // a = b == c
+    ne,
+    lt,
+    le,
+    gt,
+    ge,
+
+    // CONTROL FLOW
+
+    jump,           // pc = imm
+    jump_if,        // if (a) pc = imm
+    jump_if_not,    // if (!a) pc = imm
+    call,           // a = functions[imm](b, b + 1, ..., b + c - 1)
+    call_builtin,   // a = builtin imm (b, ..., b + c - 1)
+    ret,            // return a
+
+    // SUPERINSTRUCTIONS
+    // Fused pairs produced by `fuse_superinstructions`, only the interpreter executes these.
+
+    load_local_pair,        // a = slot[imm], b = slot[c]
+    load_local_mov_imm,     // a = slot[c], b = imm
+    load_local_add_imm,     // b = slot[c], a = b + imm
+    local_add_imm,          // b = slot[c], a = b + imm, slot[c] = a
+    local_add_imm_sext32,   // b = slot[c], a = (b + imm) truncated to 32 bits and sign-extended, slot[c] = a
+    mov_imm_store_local,    // a = imm, slot[c] = a
+    sext_store_local,       // a = b truncated to its low c bits and sign-extended, slot[imm] = a
+    eq_jump_if_not,         // a = b == c, if (!a) pc = imm
+    ne_jump_if_not,
+    lt_jump_if_not,
+    le_jump_if_not,
+    gt_jump_if_not,
+    ge_jump_if_not,
+
+    count
+};
+
+char const *ir_op_name(ir_op op) noexcept;
+
+bool ir_op_is_superinstruction(ir_op op) noexcept;
+
+/// Whether `op` (possibly conditionally) jumps to the instruction index in `imm`.
+bool ir_op_is_jump(ir_op op) noexcept;
+
+/// @brief Fixed-width (12 byte) instruction, see `ir_op` for what the fields mean per opcode.
+struct ir_inst
+{
+    ir_op op;
+    u8 unused;
+    u16 a;
+    u16 b;
+    u16 c;
+    s32 imm;
+};
+static_assert(sizeof(ir_inst) == 12);
+
+/// Functions provided by the runtime rather than compiled from source, called with `call_builtin`.
+enum class ir_builtin : u8
+{
+    putchar_,   // putchar(int c)
+    printf_,    // printf(char const *fmt, ...): %d %i %u %x %X %o %c %s and %%, with flags, width, precision
+                // (not `*`) and length modifiers h l ll z j
+
+    count
+};
+
+char const *ir_builtin_name(ir_builtin builtin) noexcept;
+
+u32 constexpr ir_max_registers = 1 << 16;
+
+/// Arguments arrive in registers 0..param_count-1, locals live in `slot_count` frame slots.
+struct ir_function
+{
+    std::string name;
+    u32 param_count = 0;
+    u32 register_count = 0;
+    u32 slot_count = 0;
+    std::vector<ir_inst> code; // branch targets are indices into this
+    std::vector<u32> nodes;    // per instruction: the AST node it was lowered from (`ast_null` if none), or empty
+};
+
+struct ir_global
+{
+    std::string name;
+    s64 initial_value;
+};
+
+struct ir_module
+{
+    std::vector<ir_function> functions;
+    std::vector<ir_global> globals;
+    std::vector<std::string> strings;   // string literal bytes, `load_string` yields `strings[i].c_str()`
+    std::vector<s64> constants;         // for `mov_wide`
+    u32 main_index = u32(-1);           // index of `main` in `functions`, if defined
+
+    u64 instruction_count() const noexcept;
+};
+
+/// Whether `op` computes its result from registers and `imm` alone, without side effects other than
+/// possibly trapping (div and mod). Such instructions can be folded, deduplicated and removed when unused.
+bool ir_op_is_pure(ir_op op) noexcept;
+
+/// Evaluates pure arithmetic and comparison `op` on operand values `b` and `c` exactly as the interpreter
+/// does. Returns false if the instruction would trap or `op` is not foldable.
+bool ir_fold(ir_op op, s64 b, s64 c, s32 imm, s64 &out) noexcept;
+
+/// One instruction as the listings spell it, without its index.
+std::string ir_inst_to_string(ir_module const &module, ir_inst const &inst) noexcept;
+
+/// Textual listing of `fn`, one instruction per line prefixed with its index.
+std::string ir_function_to_string(ir_module const &module, ir_function const &fn) noexcept;
+
+/// Globals, strings, then every function's listing. `function_lines`, if given, receives the line (from 0) of
+/// each function's first instruction.
+std::string ir_module_to_string(ir_module const &module, std::vector<u32> *function_lines = nullptr) noexcept;
+
+/// Output a runtime with an `output_sink` holds before passing it on.
+u64 constexpr ir_output_flush_bytes = 64 * 1024;
+
+/// @brief Mutable state of a running program: its globals and what it printed.
+/// Shared by every execution engine so they behave identically.
+struct ir_runtime
+{
+    std::vector<s64> globals;
+    std::string output;
+    std::string error;   // set when the program traps, execution stops at that point
+
+    /// The module's string literals, ordered by address. Strings are host pointers, so builtins check every
+    /// argument used as one against these and trap on anything else rather than dereferencing an integer.
+    std::vector<std::string_view> strings;
+
+    /// If set, `output` is passed to it and cleared whenever it reaches `ir_output_flush_bytes` (and by
+    /// `ir_runtime_flush_output`), so a program can print any amount in bounded memory. Returning false stops
+    /// the program: it traps as soon as the builtin that printed returns.
+    std::function<bool(std::string_view)> output_sink;
+};
+
+void ir_runtime_init(ir_runtime &rt, ir_module const &module) noexcept;
+
+/// Passes what is left in `rt.output` to `rt.output_sink`, if there is one. For engines to call when the
+/// program ends.
+void ir_runtime_flush_output(ir_runtime &rt) noexcept;
+
+/// Executes `builtin` with `argc` arguments, appending anything printed to `rt.output`.
+/// Returns what the C function would (e.g. the number of bytes printf wrote).
+s64 ir_call_builtin(ir_runtime &rt, ir_builtin builtin, s64 const *args, u32 argc) noexcept;
@@ -0,0 +1,344 @@
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) && defined(__linux__)
+#   define JIT_AVAILABLE 1
+#   include <sys/mman.h>
+#   include <unistd.h>
+#else
+#   define JIT_AVAILABLE 0
+#endif
+
+#include "util.hpp"
+#include "ir.hpp"
+#include "x64.hpp"
+#include "interpreter.hpp"
+#include "compiler.hpp"
+#include "mapped_file.hpp"
+#include "test_suite.hpp"
+
+#include "jit.hpp"
+
+bool jit_available() noexcept
+{
+    return JIT_AVAILABLE;
+}
+
+jit_module::jit_module(jit_module &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+jit_module &jit_module::operator=(jit_module &&other) noexcept
+{
+    if (this != &other) {
+        release();
+        code = std::exchange(other.code, nullptr);
+        mapped_size = std::exchange(other.mapped_size, 0);
+        code_size = std::exchange(other.code_size, 0);
+        entry_offset = other.entry_offset;
+        stack_bytes_per_word = other.stack_bytes_per_word;
+        function_offsets = std::move(other.function_offsets);
+        param_counts = std::move(other.param_counts);
+    }
+    return *this;
+}
+
+jit_module::~jit_module() noexcept
+{
+    release();
+}
+
+void jit_module::release() noexcept
+{
+#if JIT_AVAILABLE
+    if (code != nullptr) {
+        munmap(code, mapped_size);
+    }
+#endif
+    code = nullptr;
+    mapped_size = 0;
+    code_size = 0;
+    function_offsets.clear();
+    param_counts.clear();
+}
+
+#if JIT_AVAILABLE
+
+// Called by generated code for `call_builtin`, on the JIT stack.
+static s64 jit_builtin(x64_context *ctx, u32 builtin, s64 const *args, u32 argc) noexcept
+{
+    s64 value = ir_call_builtin(*ctx->rt, ir_builtin(builtin), args, argc);
+    ctx->trapped = !ctx->rt->error.empty();
+    return value;
+}
+
+static u64 page_size() noexcept
+{
+    static u64 const size = u64(sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+static u64 round_up(u64 n, u64 multiple) noexcept
+{
+    return (n + multiple - 1) / multiple * multiple;
+}
+
+bool jit_compile(ir_module const &module, jit_module &out, std::string &error, x64_options const &options) noexcept
+{
+    out.release();
+
+    x64_options jit_options = options;
+    jit_options.target = x64_target::jit;
+    x64_module_code generated;
+    if (!x64_compile(module, generated, error, jit_options)) {
+        return false;
+    }
+
+    for (x64_reloc const &reloc : generated.relocs) {
+        u64 address = 0;
+        switch (reloc.what) {
+            case x64_reloc::kind::string:
+                address = u64(reinterpret_cast<uintptr_t>(module.strings[reloc.index].c_str()));
+                break;
+            case x64_reloc::kind::builtin_helper:
+                address = u64(reinterpret_cast<uintptr_t>(&jit_builtin));
+                break;
+            default:
+                error = "object relocation in JIT code";
+                return false;
+        }
+        std::memcpy(generated.code.data() + reloc.offset, &address, sizeof(address));
+    }
+
+    // Never writable and executable at the same time.
+    u64 size = round_up(std::max(generated.code.size(), size_t(1)), page_size());
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        error = "cannot map memory for JIT code";
+        return false;
+    }
+    std::memcpy(memory, generated.code.data(), generated.code.size());
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        error = "cannot make JIT code executable";
+        return false;
+    }
+
+    out.code = static_cast<u8 *>(memory);
+    out.mapped_size = size;
+    out.code_size = generated.code.size();
+    out.entry_offset = generated.entry_offset;
+    out.stack_bytes_per_word = generated.stack_bytes_per_word;
+    out.function_offsets = std::move(generated.function_offsets);
+    for (ir_function const &fn : module.functions) {
+        out.param_counts.push_back(fn.param_count);
+    }
+    return true;
+}
+
+bool jit_call(jit_module const &jit, u32 fn_index, s64 const *args, u32 argc, ir_runtime &rt, s64 &result,
+              u64 stack_words, cancel_token const *cancel) noexcept
+{
+    static cancel_token const never_cancelled;
+
+    if (argc != jit.param_counts[fn_index]) {
+        rt.error = "wrong number of arguments";
+        return false;
+    }
+
+    // No frame takes more than `stack_bytes_per_word` bytes per word it counts, so the word limit is always
+    // reached first. The headroom is for the C++ builtins, and the guard page below turns anything missed into
+    // a crash rather than corruption.
+    u64 const headroom = 256 * 1024;
+    u64 guard = page_size();
+    u64 size = guard + round_up(u64(jit.stack_bytes_per_word) * stack_words + headroom, page_size());
+    void *stack = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (stack == MAP_FAILED) {
+        rt.error = "cannot map memory for the JIT stack";
+        return false;
+    }
+    mprotect(stack, guard, PROT_NONE);
+
+    x64_context ctx = {};
+    ctx.rt = &rt;
+    ctx.globals = rt.globals.data();
+    ctx.stack_words = stack_words;
+    ctx.stack_top = static_cast<u8 *>(stack) + size;
+    ctx.cancel = cancel != nullptr ? cancel : &never_cancelled;
+
+    using entry_fn = u64 (*)(x64_context *, s64 const *, s64 *, void const *);
+    auto entry = reinterpret_cast<entry_fn>(jit.code + jit.entry_offset);
+    bool ok = entry(&ctx, args, &result, jit.code + jit.function_offsets[fn_index]) != 0;
+
+    munmap(stack, size);
+
+    if (!ok && ctx.trap != x64_trap::builtin) {
+        rt.error = x64_trap_message(ctx.trap);
+    }
+    return ok;
+}
+
+#else
+
+bool jit_compile(ir_module const &, jit_module &out, std::string &error, x64_options const &) noexcept
+{
+    out.release();
+    error = "the JIT requires Linux on x86-64";
+    return false;
+}
+
+bool jit_call(jit_module const &, u32, s64 const *, u32, ir_runtime &rt, s64 &, u64, cancel_token const *) noexcept
+{
+    rt.error = "the JIT requires Linux on x86-64";
+    return false;
+}
+
+#endif
+
+bool execute_jit(ir_module const &module, execution_result &out, interpreter_options const &options) noexcept
+{
+    out = {};
+
+    ir_runtime rt;
+    ir_runtime_init(rt, module);
+    rt.output_sink = options.output_sink;
+
+    time_point_precise_t t0 = get_time_precise();
+    bool ok = true;
+    if (module.main_index != u32(-1)) {
+        jit_module jit;
+        x64_options jit_options;
+        jit_options.cancel = options.cancel;
+        jit_options.poll_cancel = options.cancel != nullptr;
+        ok = jit_compile(module, jit, rt.error, jit_options)
+            && jit_call(jit, module.main_index, nullptr, 0, rt, out.exit_code, options.stack_words, options.cancel);
+    }
+    ir_runtime_flush_output(rt);
+    ok = ok && rt.error.empty();
+    out.elapsed_us = time_diff_us(t0, get_time_precise());
+
+    out.output = std::move(rt.output);
+    out.error = std::move(rt.error);
+    return ok;
+}
+
+char const *execution_engine_name(execution_engine engine) noexcept
+{
+    switch (engine) {
+        case execution_engine::interpreter: return "interpreter";
+        case execution_engine::jit:         return "jit";
+    }
+    return "";
+}
+
+bool execute_program(ir_module const &module, execution_engine engine, execution_result &out,
+                     interpreter_options const &options) noexcept
+{
+    return engine == execution_engine::jit ? execute_jit(module, out, options) : execute_ir(module, out, options);
+}
+
+// BENCHMARK
+
+jit_benchmark_result jit_benchmark(char const *csv_path, char const *data_dir, u64 iterations) noexcept
+{
+    jit_benchmark_result result = {};
+
+    std::vector<compiler_test> tests;
+    std::string error;
+    if (!load_compiler_tests(csv_path, tests, error)) {
+        result.errors.push_back(error);
+    }
+
+    struct program
+    {
+        std::string name;
+        ir_module ir;
+        jit_module jit;
+        std::string expected_path; // empty for the benchmark program
+    };
+    std::vector<program> programs;
+
+    auto add_program = [&](std::string name, compilation &comp, std::string expected_path) {
+        if (!compile_to_ir(comp)) {
+            result.errors.push_back(name + ": " + (comp.errors.empty() ? "compilation failed" : comp.errors.front()));
+            return;
+        }
+        programs.push_back({ std::move(name), std::move(comp.ir), {}, std::move(expected_path) });
+    };
+
+    for (compiler_test const &test : tests) {
+        compilation comp;
+        std::string path = std::string(data_dir) + "/" + test.source_file;
+        if (!compilation_load_file(comp, path.c_str())) {
+            result.errors.push_back(test.name + ": cannot read " + path);
+            continue;
+        }
+        add_program(test.name, comp, std::string(data_dir) + "/" + test.expected_output_file);
+    }
+    {
+        compilation comp;
+        comp.source_text = interpreter_benchmark_source();
+        add_program("interpreter_benchmark", comp, {});
+    }
+
+    time_point_precise_t t0 = get_time_precise();
+    for (program &p : programs) {
+        if (jit_compile(p.ir, p.jit, error)) {
+            result.code_bytes += p.jit.code_size;
+            ++result.programs;
+        } else {
+            result.errors.push_back(p.name + ": " + error);
+        }
+    }
+    result.compile_us = time_diff_us(t0, get_time_precise());
+
+    auto run_jit = [](program const &p, execution_result &out) {
+        out = {};
+        ir_runtime rt;
+        ir_runtime_init(rt, p.ir);
+        if (p.ir.main_index != u32(-1)) {
+            jit_call(p.jit, p.ir.main_index, nullptr, 0, rt, out.exit_code);
+        }
+        out.output = std::move(rt.output);
+        out.error = std::move(rt.error);
+    };
+
+    // Programs that failed to compile stay in place: moving a module would move the strings compiled code points into.
+    for (program const &p : programs) {
+        if (p.jit.code == nullptr) {
+            continue;
+        }
+        execution_result interpreted, jitted;
+        execute_ir(p.ir, interpreted);
+        run_jit(p, jitted);
+        if (jitted.output != interpreted.output || jitted.exit_code != interpreted.exit_code || jitted.error != interpreted.error) {
+            result.errors.push_back(p.name + ": JIT and interpreter disagree");
+        }
+        if (!p.expected_path.empty()) {
+            mapped_file expected;
+            if (!expected.open(p.expected_path.c_str())) {
+                result.errors.push_back(p.name + ": cannot read " + p.expected_path);
+            } else if (jitted.output != expected.view()) {
+                result.errors.push_back(p.name + ": JIT output differs from " + p.expected_path);
+            }
+        }
+    }
+
+    auto best_of = [&](auto &&run_one) {
+        return best_time_us(iterations, [&] {
+            for (program const &p : programs) {
+                if (p.jit.code != nullptr) {
+                    execution_result run;
+                    run_one(p, run);
+                }
+            }
+        });
+    };
+    result.interpreter_best_us = best_of([](program const &p, execution_result &run) { execute_ir(p.ir, run); });
+    result.jit_best_us = best_of(run_jit);
+    result.speedup = f64(result.interpreter_best_us) / f64(result.jit_best_us);
+
+    return result;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "ir.hpp"
+#include "x64.hpp"
+#include "interpreter.hpp"
+
+/// Whether this build can JIT-compile: Linux on x86-64. Elsewhere `jit_compile` fails with an error.
+bool jit_available() noexcept;
+
+/// @brief Machine code for an `ir_module` in executable memory, unmapped on destruction.
+/// The module must outlive it and stay in place, `load_string` addresses point into its strings.
+struct jit_module
+{
+    u8 *code = nullptr;
+    u64 mapped_size = 0;
+    u64 code_size = 0;
+    u32 entry_offset = 0;
+    u32 stack_bytes_per_word = 0;
+    std::vector<u32> function_offsets;
+    std::vector<u32> param_counts;
+
+    jit_module() noexcept = default;
+    jit_module(jit_module &&other) noexcept;
+    jit_module &operator=(jit_module &&other) noexcept;
+    jit_module(jit_module const &) = delete;
+    jit_module &operator=(jit_module const &) = delete;
+    ~jit_module() noexcept;
+
+    void release() noexcept;
+};
+
+/// Translates every function of `module` (unfused IR) to x86-64 with `x64_compile`, maps it read-write,
+/// patches string and runtime addresses, then flips the mapping to read-execute. `options.target` is ignored.
+/// Returns false with `error` set on unsupported platforms, superinstructions or mmap failure.
+bool jit_compile(ir_module const &module, jit_module &out, std::string &error, x64_options const &options = {}) noexcept;
+
+/// Calls function `fn_index` of a compiled module: the same contract as `ir_interpret_call`, with program state
+/// in `rt`, the return value in `result` and the interpreter's trap messages in `rt.error` on failure.
+/// Frames count against `stack_words` as they do in the interpreter, so recursion overflows at the same depth.
+/// Code compiled with `x64_options::poll_cancel` traps with "cancelled" once `cancel` is, if there is one.
+bool jit_call(jit_module const &jit, u32 fn_index, s64 const *args, u32 argc, ir_runtime &rt, s64 &result,
+              u64 stack_words = 1 << 20, cancel_token const *cancel = nullptr) noexcept;
+
+/// `execute_ir` for the JIT: compiles `module` and runs its `main` from a fresh runtime. `elapsed_us` includes
+/// compilation, `instructions` is always 0 (machine code is not instrumented). Of `options`, only `stack_words`,
+/// `output_sink` and `cancel` apply; with a `cancel` token the code polls it on calls and backward jumps, as the
+/// interpreter does. A module that cannot be compiled fails with the reason in `out.error`.
+bool execute_jit(ir_module const &module, execution_result &out, interpreter_options const &options = {}) noexcept;
+
+enum class execution_engine : u8
+{
+    interpreter,
+    jit,
+};
+
+char const *execution_engine_name(execution_engine engine) noexcept;
+
+/// Runs the module's `main` with the chosen engine, so callers can switch per run.
+bool execute_program(ir_module const &module, execution_engine engine, execution_result &out,
+                     interpreter_options const &options = {}) noexcept;
+
+struct jit_benchmark_result
+{
+    u64 programs;                       // corpus programs that compiled, plus the interpreter benchmark program
+    u64 code_bytes;                     // machine code generated for all of them
+    s64 compile_us;                     // x64_compile and mapping, all programs
+    s64 interpreter_best_us;            // best-of-iterations time to run every program once
+    s64 jit_best_us;                    // same, code already compiled
+    f64 speedup;                        // interpreter_best_us / jit_best_us
+    std::vector<std::string> errors;    // unreadable corpus, failed compiles, output differing from either engine or the expected file
+};
+
+/// Runs the programs of the tests CSV at `csv_path` (sources and expected outputs in `data_dir`) and the
+/// interpreter benchmark program under both engines, checks that output, exit code and errors match exactly
+/// and that corpus output matches its expected-output file, and compares run times.
+jit_benchmark_result jit_benchmark(char const *csv_path, char const *data_dir, u64 iterations = 5) noexcept;
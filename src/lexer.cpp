@@ -0,0 +1,694 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <string>
+
+#include "util.hpp"
+#include "simd.hpp"
+#include "mapped_file.hpp"
+
+#include "lexer.hpp"
+
+char const *token_kind_name(token_kind kind) noexcept
+{
+    static char const *const names[] = {
+        "end_of_input",
+        "unknown",
+        "identifier",
+        "number",
+        "char_literal",
+        "string_literal",
+        "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else", "enum", "extern",
+        "float", "for", "goto", "if", "inline", "int", "long", "register", "restrict", "return", "short", "signed",
+        "sizeof", "static", "struct", "switch", "typedef", "union", "unsigned", "void", "volatile", "while",
+        "_Alignas", "_Alignof", "_Atomic", "_Bool", "_Complex", "_Generic", "_Imaginary", "_Noreturn",
+        "_Static_assert", "_Thread_local",
+        "[", "]", "(", ")", "{", "}", ".", "->", "++", "--", "&", "*", "+", "-", "~", "!",
+        "/", "%", "<<", ">>", "<", ">", "<=", ">=", "==", "!=", "^", "|", "&&", "||", "?", ":",
+        ";", "...", "=", "*=", "/=", "%=", "+=", "-=", "<<=", ">>=", "&=", "^=", "|=", ",",
+        "#", "##",
+    };
+    static_assert(lengthof(names) == u64(token_kind::count));
+
+    assert(kind < token_kind::count);
+    return names[u64(kind)];
+}
+
+bool token_is_keyword(token_kind kind) noexcept
+{
+    return kind >= token_kind::kw_auto && kind <= token_kind::kw__Thread_local;
+}
+
+bool token_is_identifier_like(token_kind kind) noexcept
+{
+    return kind == token_kind::identifier || token_is_keyword(kind);
+}
+
+void token_buffer::clear() noexcept
+{
+    count = 0;
+}
+
+void token_buffer::reserve(u64 capacity) noexcept
+{
+    if (capacity > kinds.size()) {
+        kinds.resize(capacity);
+        offsets.resize(capacity);
+        lengths.resize(capacity);
+        flags.resize(capacity);
+    }
+}
+
+void token_buffer::push(token_kind kind, u32 offset, u32 length, u8 token_flags) noexcept
+{
+    if (count == kinds.size()) {
+        reserve(std::max(u64(1024), count * 2));
+    }
+    kinds[count] = kind;
+    offsets[count] = offset;
+    lengths[count] = length;
+    flags[count] = token_flags;
+    ++count;
+}
+
+// CHARACTER CLASSIFICATION
+
+enum char_class : u8
+{
+    char_class_whitespace   = 1 << 0,
+    char_class_digit        = 1 << 1,
+    char_class_ident_start  = 1 << 2,
+    char_class_ident        = 1 << 3, // identifier continuation: [A-Za-z0-9_]
+};
+
+struct char_class_table
+{
+    u8 classes[256];
+
+    constexpr char_class_table() noexcept : classes()
+    {
+        for (u32 c = 0; c < 256; ++c) {
+            u8 cls = 0;
+            if (c == ' ' || (c >= '\t' && c <= '\r'))
+                cls |= char_class_whitespace;
+            if (c >= '0' && c <= '9')
+                cls |= char_class_digit | char_class_ident;
+            if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_')
+                cls |= char_class_ident_start | char_class_ident;
+            classes[c] = cls;
+        }
+    }
+};
+
+static constexpr char_class_table s_char_classes;
+
+static bool has_class(char c, u8 cls) noexcept
+{
+    return s_char_classes.classes[u8(c)] & cls;
+}
+
+#if SIMD_WIDTH == 32
+
+typedef __m256i simd_block;
+static simd_block simd_load(char const *p) noexcept { return _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)); }
+static simd_block simd_splat(char c) noexcept { return _mm256_set1_epi8(c); }
+static simd_block simd_eq(simd_block a, simd_block b) noexcept { return _mm256_cmpeq_epi8(a, b); }
+static simd_block simd_or(simd_block a, simd_block b) noexcept { return _mm256_or_si256(a, b); }
+static simd_block simd_add(simd_block a, simd_block b) noexcept { return _mm256_add_epi8(a, b); }
+static simd_block simd_lt(simd_block a, simd_block b) noexcept { return _mm256_cmpgt_epi8(b, a); }
+static u32 simd_movemask(simd_block a) noexcept { return u32(_mm256_movemask_epi8(a)); }
+
+#elif SIMD_WIDTH == 16
+
+typedef __m128i simd_block;
+static simd_block simd_load(char const *p) noexcept { return _mm_loadu_si128(reinterpret_cast<__m128i const *>(p)); }
+static simd_block simd_splat(char c) noexcept { return _mm_set1_epi8(c); }
+static simd_block simd_eq(simd_block a, simd_block b) noexcept { return _mm_cmpeq_epi8(a, b); }
+static simd_block simd_or(simd_block a, simd_block b) noexcept { return _mm_or_si128(a, b); }
+static simd_block simd_add(simd_block a, simd_block b) noexcept { return _mm_add_epi8(a, b); }
+static simd_block simd_lt(simd_block a, simd_block b) noexcept { return _mm_cmplt_epi8(a, b); }
+static u32 simd_movemask(simd_block a) noexcept { return u32(_mm_movemask_epi8(a)); }
+
+#endif
+
+#if SIMD_WIDTH != 0
+
+/// Lanes where `lo <= v <= hi` (unsigned). Biasing by 0x80-lo turns the unsigned range check into one signed compare.
+static simd_block simd_in_range(simd_block v, char lo, char hi) noexcept
+{
+    simd_block biased = simd_add(v, simd_splat(char(0x80 - u8(lo))));
+    return simd_lt(biased, simd_splat(char(-128 + (u8(hi) - u8(lo) + 1))));
+}
+
+#endif
+
+/// @brief Per-byte class bitmasks for a 64-byte window of the input, bit `i` describes `base[i]`.
+/// Classifying a whole window up front amortizes the work across every (typically short) token inside it;
+/// runs are then measured with a shift and a bit count instead of a loop per byte.
+struct classified_window
+{
+    char const *base = nullptr;
+    u64 ident = 0;      // [A-Za-z0-9_]
+    u64 whitespace = 0; // [ \t\n\v\f\r]
+};
+
+template <bool Simd>
+static void classify_window(classified_window &win, char const *p, char const *end) noexcept
+{
+    win.base = p;
+    win.ident = 0;
+    win.whitespace = 0;
+
+#if SIMD_WIDTH != 0
+    if constexpr (Simd) {
+        if (end - p >= 64) {
+            for (u64 i = 0; i < 64; i += SIMD_WIDTH) {
+                simd_block v = simd_load(p + i);
+
+                simd_block lower = simd_or(v, simd_splat(0x20)); // ASCII letters to lower case
+                simd_block ident = simd_in_range(lower, 'a', 'z');
+                ident = simd_or(ident, simd_in_range(v, '0', '9'));
+                ident = simd_or(ident, simd_eq(v, simd_splat('_')));
+
+                simd_block space = simd_or(simd_eq(v, simd_splat(' ')), simd_in_range(v, '\t', '\r'));
+
+                win.ident |= u64(simd_movemask(ident)) << i;
+                win.whitespace |= u64(simd_movemask(space)) << i;
+            }
+            return;
+        }
+    }
+#endif
+
+    // Bytes past `end` are left unclassified, which terminates any run at the end of input.
+    u64 n = std::min(u64(end - p), u64(64));
+    for (u64 i = 0; i < n; ++i) {
+        u8 cls = s_char_classes.classes[u8(p[i])];
+        win.ident |= u64((cls & char_class_ident) != 0) << i;
+        win.whitespace |= u64((cls & char_class_whitespace) != 0) << i;
+    }
+}
+
+/// Returns the length of the run of characters starting at `p` whose bits are set in `Mask` of the window,
+/// sliding the window forward as needed.
+template <bool Simd, u64 classified_window::*Mask>
+static u64 span(classified_window &win, char const *p, char const *end) noexcept
+{
+    char const *const start = p;
+
+    for (;;) {
+        u64 off = u64(p - win.base);
+        if (off >= 64) {
+            classify_window<Simd>(win, p, end);
+            off = 0;
+        }
+        u64 run = u64(std::countr_one(win.*Mask >> off));
+        if (run < 64 - off) {
+            return u64(p - start) + run;
+        }
+        p += 64 - off;
+        if (p >= end) {
+            return u64(end - start);
+        }
+    }
+}
+
+// KEYWORDS AND PUNCTUATORS
+
+static constexpr std::pair<std::string_view, token_kind> s_keyword_entries[] = {
+    { "auto", token_kind::kw_auto },
+    { "break", token_kind::kw_break },
+    { "case", token_kind::kw_case },
+    { "char", token_kind::kw_char },
+    { "const", token_kind::kw_const },
+    { "continue", token_kind::kw_continue },
+    { "default", token_kind::kw_default },
+    { "do", token_kind::kw_do },
+    { "double", token_kind::kw_double },
+    { "else", token_kind::kw_else },
+    { "enum", token_kind::kw_enum },
+    { "extern", token_kind::kw_extern },
+    { "float", token_kind::kw_float },
+    { "for", token_kind::kw_for },
+    { "goto", token_kind::kw_goto },
+    { "if", token_kind::kw_if },
+    { "inline", token_kind::kw_inline },
+    { "int", token_kind::kw_int },
+    { "long", token_kind::kw_long },
+    { "register", token_kind::kw_register },
+    { "restrict", token_kind::kw_restrict },
+    { "return", token_kind::kw_return },
+    { "short", token_kind::kw_short },
+    { "signed", token_kind::kw_signed },
+    { "sizeof", token_kind::kw_sizeof },
+    { "static", token_kind::kw_static },
+    { "struct", token_kind::kw_struct },
+    { "switch", token_kind::kw_switch },
+    { "typedef", token_kind::kw_typedef },
+    { "union", token_kind::kw_union },
+    { "unsigned", token_kind::kw_unsigned },
+    { "void", token_kind::kw_void },
+    { "volatile", token_kind::kw_volatile },
+    { "while", token_kind::kw_while },
+    { "_Alignas", token_kind::kw__Alignas },
+    { "_Alignof", token_kind::kw__Alignof },
+    { "_Atomic", token_kind::kw__Atomic },
+    { "_Bool", token_kind::kw__Bool },
+    { "_Complex", token_kind::kw__Complex },
+    { "_Generic", token_kind::kw__Generic },
+    { "_Imaginary", token_kind::kw__Imaginary },
+    { "_Noreturn", token_kind::kw__Noreturn },
+    { "_Static_assert", token_kind::kw__Static_assert },
+    { "_Thread_local", token_kind::kw__Thread_local },
+};
+
+static constexpr std::pair<std::string_view, token_kind> s_punctuator_entries[] = {
+    { "[", token_kind::l_bracket },
+    { "]", token_kind::r_bracket },
+    { "(", token_kind::l_paren },
+    { ")", token_kind::r_paren },
+    { "{", token_kind::l_brace },
+    { "}", token_kind::r_brace },
+    { ".", token_kind::period },
+    { "->", token_kind::arrow },
+    { "++", token_kind::plus_plus },
+    { "--", token_kind::minus_minus },
+    { "&", token_kind::ampersand },
+    { "*", token_kind::star },
+    { "+", token_kind::plus },
+    { "-", token_kind::minus },
+    { "~", token_kind::tilde },
+    { "!", token_kind::exclaim },
+    { "/", token_kind::slash },
+    { "%", token_kind::percent },
+    { "<<", token_kind::less_less },
+    { ">>", token_kind::greater_greater },
+    { "<", token_kind::less },
+    { ">", token_kind::greater },
+    { "<=", token_kind::less_equal },
+    { ">=", token_kind::greater_equal },
+    { "==", token_kind::equal_equal },
+    { "!=", token_kind::exclaim_equal },
+    { "^", token_kind::caret },
+    { "|", token_kind::pipe },
+    { "&&", token_kind::ampersand_ampersand },
+    { "||", token_kind::pipe_pipe },
+    { "?", token_kind::question },
+    { ":", token_kind::colon },
+    { ";", token_kind::semicolon },
+    { "...", token_kind::ellipsis },
+    { "=", token_kind::equal },
+    { "*=", token_kind::star_equal },
+    { "/=", token_kind::slash_equal },
+    { "%=", token_kind::percent_equal },
+    { "+=", token_kind::plus_equal },
+    { "-=", token_kind::minus_equal },
+    { "<<=", token_kind::less_less_equal },
+    { ">>=", token_kind::greater_greater_equal },
+    { "&=", token_kind::ampersand_equal },
+    { "^=", token_kind::caret_equal },
+    { "|=", token_kind::pipe_equal },
+    { ",", token_kind::comma },
+    { "#", token_kind::hash },
+    { "##", token_kind::hash_hash },
+};
+
+static constexpr auto s_keywords = make_static_perfect_hash<256>(s_keyword_entries);
+static constexpr auto s_punctuators = make_static_perfect_hash<256>(s_punctuator_entries);
+static_assert(s_keywords.seed != 0, "no perfect hash seed for the keyword set, grow the table");
+static_assert(s_punctuators.seed != 0, "no perfect hash seed for the punctuator set, grow the table");
+
+/// Length of the longest punctuator starting with each byte, 0 if none does.
+struct punctuator_length_table
+{
+    u8 max_len[256];
+
+    constexpr punctuator_length_table() noexcept : max_len()
+    {
+        for (auto const &[spelling, kind] : s_punctuator_entries) {
+            u8 &len = max_len[u8(spelling[0])];
+            len = std::max(len, u8(spelling.size()));
+        }
+    }
+};
+
+static constexpr punctuator_length_table s_punctuator_lengths;
+
+token_kind keyword_kind(std::string_view spelling) noexcept
+{
+    return s_keywords.find(spelling, token_kind::identifier);
+}
+
+/// Longest-match punctuator at `p`, writes its length to `len`. Returns `unknown` when none matches.
+/// Probes the perfect hash from the longest length possible for the first byte down to 1.
+static token_kind match_punctuator(char const *p, char const *end, u32 &len) noexcept
+{
+    u32 max_len = std::min(u32(s_punctuator_lengths.max_len[u8(*p)]), u32(end - p));
+
+    for (u32 n = max_len; n > 0; --n) {
+        token_kind kind = s_punctuators.find(std::string_view(p, n), token_kind::unknown);
+        if (kind != token_kind::unknown) {
+            len = n;
+            return kind;
+        }
+    }
+
+    len = 1;
+    return token_kind::unknown;
+}
+
+// LEXER
+
+/// Skips a quoted literal starting at `p` (which points at the opening quote). Returns one past the closing quote,
+/// or the end of the line/input if the literal is unterminated.
+static char const *skip_quoted(char const *p, char const *end) noexcept
+{
+    char const quote = *p++;
+    while (p < end) {
+        char c = *p;
+        if (c == quote) {
+            return p + 1;
+        }
+        if (c == '\\' && end - p > 1) {
+            p += 2;
+            continue;
+        }
+        if (c == '\n') {
+            break;
+        }
+        ++p;
+    }
+    return p;
+}
+
+template <bool Simd>
+static void lex_impl(std::string_view text, token_buffer &out) noexcept
+{
+    assert(text.size() <= u64(u32(-1)));
+
+    out.clear();
+    out.reserve(text.size() / 4 + 16); // typical C averages well above 4 bytes per token
+
+    char const *const begin = text.data();
+    char const *const end = begin + text.size();
+    char const *p = begin;
+
+    classified_window win;
+    classify_window<Simd>(win, p, end);
+
+    u8 pending_flags = token_flag_line_start;
+
+    while (p < end) {
+        char const c = *p;
+
+        if (has_class(c, char_class_whitespace)) {
+            u64 run = span<Simd, &classified_window::whitespace>(win, p, end);
+            pending_flags |= token_flag_space_before;
+            if (memchr(p, '\n', run)) {
+                pending_flags |= token_flag_line_start;
+            }
+            p += run;
+            continue;
+        }
+
+        char const *const start = p;
+        token_kind kind;
+
+        if (has_class(c, char_class_ident_start)) {
+            p += span<Simd, &classified_window::ident>(win, p, end);
+            kind = keyword_kind(std::string_view(start, u64(p - start)));
+        }
+        else if (has_class(c, char_class_digit) || (c == '.' && p + 1 < end && has_class(p[1], char_class_digit))) {
+            // pp-number: [.]digit followed by identifier chars, periods, and signs after an exponent
+            ++p;
+            for (;;) {
+                p += span<Simd, &classified_window::ident>(win, p, end);
+                if (p < end && *p == '.') {
+                    ++p;
+                    continue;
+                }
+                if (p < end && (*p == '+' || *p == '-') && one_of(p[-1], { 'e', 'E', 'p', 'P' })) {
+                    ++p;
+                    continue;
+                }
+                break;
+            }
+            kind = token_kind::number;
+        }
+        else if (c == '"') {
+            p = skip_quoted(p, end);
+            kind = token_kind::string_literal;
+        }
+        else if (c == '\'') {
+            p = skip_quoted(p, end);
+            kind = token_kind::char_literal;
+        }
+        else if (c == '/' && p + 1 < end && p[1] == '/') {
+            void const *newline = memchr(p, '\n', u64(end - p));
+            p = newline ? static_cast<char const *>(newline) : end;
+            pending_flags |= token_flag_space_before;
+            continue;
+        }
+        else if (c == '/' && p + 1 < end && p[1] == '*') {
+            std::string_view rest(p + 2, u64(end - p - 2));
+            u64 close = rest.find("*/");
+            p = close == std::string_view::npos ? end : p + 2 + close + 2;
+            pending_flags |= token_flag_space_before; // a comment is one space, even when it spans lines
+            continue;
+        }
+        else if (c == '\\' && (end - p > 1) && (p[1] == '\n' || (p[1] == '\r' && end - p > 2 && p[2] == '\n'))) {
+            // line splice between tokens, the logical line continues
+            p += p[1] == '\n' ? 2 : 3;
+            pending_flags |= token_flag_space_before;
+            continue;
+        }
+        else {
+            u32 len;
+            kind = match_punctuator(p, end, len);
+            p += len;
+        }
+
+        out.push(kind, u32(start - begin), u32(p - start), pending_flags);
+        pending_flags = 0;
+    }
+
+    out.push(token_kind::end_of_input, u32(text.size()), 0, pending_flags | token_flag_line_start);
+}
+
+void lex(std::string_view text, token_buffer &out, bool use_simd) noexcept
+{
+    if (use_simd) {
+        lex_impl<true>(text, out);
+    } else {
+        lex_impl<false>(text, out);
+    }
+}
+
+bool lex_file(char const *path, mapped_file &file, token_buffer &out) noexcept
+{
+    if (!file.open(path)) {
+        out.clear();
+        return false;
+    }
+    lex(file.view(), out);
+    return true;
+}
+
+// LITERAL DECODING
+
+bool parse_integer_literal(std::string_view spelling, u64 &out) noexcept
+{
+    while (!spelling.empty() && one_of(spelling.back(), { 'u', 'U', 'l', 'L' })) {
+        spelling.remove_suffix(1);
+    }
+    if (spelling.empty()) {
+        return false;
+    }
+
+    u64 base = 10;
+    if (spelling.size() > 2 && spelling[0] == '0' && (spelling[1] == 'x' || spelling[1] == 'X')) {
+        base = 16;
+        spelling.remove_prefix(2);
+    }
+    else if (spelling.size() > 1 && spelling[0] == '0') {
+        base = 8;
+        spelling.remove_prefix(1);
+    }
+
+    u64 value = 0;
+    for (char c : spelling) {
+        u64 digit;
+        if (c >= '0' && c <= '9')       digit = u64(c - '0');
+        else if (c >= 'a' && c <= 'f')  digit = u64(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F')  digit = u64(c - 'A' + 10);
+        else                            return false;
+
+        if (digit >= base) {
+            return false;
+        }
+        value = value * base + digit;
+    }
+
+    out = value;
+    return true;
+}
+
+/// Decodes one (possibly escaped) character at `p`, advancing it. Returns false on a malformed escape.
+static bool decode_char(char const *&p, char const *end, s64 &out) noexcept
+{
+    if (*p != '\\') {
+        out = u8(*p++);
+        return true;
+    }
+    if (++p == end) {
+        return false;
+    }
+
+    char c = *p++;
+    switch (c) {
+        case 'n':  out = '\n'; return true;
+        case 't':  out = '\t'; return true;
+        case 'r':  out = '\r'; return true;
+        case 'a':  out = '\a'; return true;
+        case 'b':  out = '\b'; return true;
+        case 'f':  out = '\f'; return true;
+        case 'v':  out = '\v'; return true;
+        case '\\': out = '\\'; return true;
+        case '\'': out = '\''; return true;
+        case '"':  out = '"';  return true;
+        case '?':  out = '?';  return true;
+        case 'x': {
+            s64 value = 0;
+            char const *digits_start = p;
+            while (p < end && isxdigit(u8(*p))) {
+                char d = *p++;
+                value = value * 16 + (d <= '9' ? d - '0' : (d | 0x20) - 'a' + 10);
+            }
+            out = u8(value);
+            return p != digits_start;
+        }
+        default:
+            if (c >= '0' && c <= '7') {
+                s64 value = c - '0';
+                for (u64 i = 0; i < 2 && p < end && *p >= '0' && *p <= '7'; ++i) {
+                    value = value * 8 + (*p++ - '0');
+                }
+                out = u8(value);
+                return true;
+            }
+            return false;
+    }
+}
+
+bool parse_char_literal(std::string_view spelling, s64 &out) noexcept
+{
+    if (spelling.size() < 3 || spelling.front() != '\'' || spelling.back() != '\'') {
+        return false;
+    }
+    char const *p = spelling.data() + 1;
+    char const *end = spelling.data() + spelling.size() - 1;
+
+    s64 value;
+    if (!decode_char(p, end, value) || p != end) {
+        return false;
+    }
+    out = s64(s8(value)); // plain char is signed on our targets
+    return true;
+}
+
+bool decode_string_literal(std::string_view spelling, std::string &out) noexcept
+{
+    out.clear();
+    if (spelling.size() < 2 || spelling.front() != '"' || spelling.back() != '"') {
+        return false;
+    }
+    char const *p = spelling.data() + 1;
+    char const *end = spelling.data() + spelling.size() - 1;
+
+    while (p < end) {
+        s64 c;
+        if (!decode_char(p, end, c)) {
+            return false;
+        }
+        out += char(c);
+    }
+    return true;
+}
+
+// BENCHMARK
+
+static void append_random_identifier(std::string &out) noexcept
+{
+    static char const *const stems[] = {
+        "item", "cJSON", "buffer", "length", "value", "child", "next", "prev", "string", "index",
+        "lua_State", "L", "top", "ci", "nresults", "p", "i", "print_value", "parse_number", "hooks",
+    };
+    out += stems[fast_rand(0, lengthof(stems) - 1)];
+    if (chance(0.5)) {
+        out += '_';
+        out += std::to_string(fast_rand(0, 999));
+    }
+}
+
+/// C-shaped filler: declarations, expressions with mixed punctuators, literals, comments and indentation.
+static std::string generate_benchmark_source(u64 size) noexcept
+{
+    static char const *const keywords[] = { "int", "char", "static", "const", "unsigned", "return", "if", "while" };
+    static char const *const operators[] = { " + ", " - ", " * ", " / ", " == ", " != ", " <= ", " && ", " || ", "->", ".", " << ", " & " };
+
+    std::string src;
+    src.reserve(size + 256);
+    seed_fast_rand(0x5EED);
+
+    while (src.size() < size) {
+        src.append(fast_rand(0, 3) * 4, ' ');
+        src += keywords[fast_rand(0, lengthof(keywords) - 1)];
+        src += ' ';
+        append_random_identifier(src);
+        src += " = ";
+
+        u64 terms = fast_rand(1, 6);
+        for (u64 t = 0; t < terms; ++t) {
+            switch (fast_rand(0, 4)) {
+                case 0: src += std::to_string(fast_rand(0, 100000)); break;
+                case 1: src += "\"some string literal\""; break;
+                case 2: src += "'x'"; break;
+                default: append_random_identifier(src); break;
+            }
+            if (t + 1 < terms) {
+                src += operators[fast_rand(0, lengthof(operators) - 1)];
+            }
+        }
+        src += ";";
+        if (chance(0.1)) {
+            src += " // trailing comment";
+        }
+        src += '\n';
+    }
+
+    return src;
+}
+
+lexer_benchmark_result lexer_benchmark(u64 input_bytes, u64 iterations) noexcept
+{
+    assert(iterations > 0);
+
+    std::string const src = generate_benchmark_source(input_bytes);
+    token_buffer tokens;
+
+    auto lex_best_us = [&](bool use_simd) { return best_time_us(iterations, [&] { lex(src, tokens, use_simd); }); };
+
+    lexer_benchmark_result result = {};
+    result.input_bytes = src.size();
+    result.iterations = iterations;
+    result.scalar_best_us = lex_best_us(false);
+    result.simd_best_us = lex_best_us(true);
+    result.token_count = tokens.count;
+    result.scalar_mb_per_sec = (f64(src.size()) / (1024.0 * 1024.0)) / (f64(result.scalar_best_us) / 1'000'000.0);
+    result.simd_mb_per_sec = (f64(src.size()) / (1024.0 * 1024.0)) / (f64(result.simd_best_us) / 1'000'000.0);
+    result.simd_isa = simd_isa_name();
+
+    return result;
+}
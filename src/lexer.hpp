@@ -0,0 +1,191 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+
+struct mapped_file;
+
+enum class token_kind : u8
+{
+    end_of_input,
+    unknown,
+    identifier,
+    number,
+    char_literal,
+    string_literal,
+
+    // KEYWORDS (C99 + C11), in the same order as `token_kind_name`
+
+    kw_auto,
+    kw_break,
+    kw_case,
+    kw_char,
+    kw_const,
+    kw_continue,
+    kw_default,
+    kw_do,
+    kw_double,
+    kw_else,
+    kw_enum,
+    kw_extern,
+    kw_float,
+    kw_for,
+    kw_goto,
+    kw_if,
+    kw_inline,
+    kw_int,
+    kw_long,
+    kw_register,
+    kw_restrict,
+    kw_return,
+    kw_short,
+    kw_signed,
+    kw_sizeof,
+    kw_static,
+    kw_struct,
+    kw_switch,
+    kw_typedef,
+    kw_union,
+    kw_unsigned,
+    kw_void,
+    kw_volatile,
+    kw_while,
+    kw__Alignas,
+    kw__Alignof,
+    kw__Atomic,
+    kw__Bool,
+    kw__Complex,
+    kw__Generic,
+    kw__Imaginary,
+    kw__Noreturn,
+    kw__Static_assert,
+    kw__Thread_local,
+
+    // PUNCTUATORS
+
+    l_bracket,              // [
+    r_bracket,              // ]
+    l_paren,                // (
+    r_paren,                // )
+    l_brace,                // {
+    r_brace,                // }
+    period,                 // .
+    arrow,                  // ->
+    plus_plus,              // ++
+    minus_minus,            // --
+    ampersand,              // &
+    star,                   // *
+    plus,                   // +
+    minus,                  // -
+    tilde,                  // ~
+    exclaim,                // !
+    slash,                  // /
+    percent,                // %
+    less_less,              // <<
+    greater_greater,        // >>
+    less,                   // <
+    greater,                // >
+    less_equal,             // <=
+    greater_equal,          // >=
+    equal_equal,            // ==
+    exclaim_equal,          // !=
+    caret,                  // ^
+    pipe,                   // |
+    ampersand_ampersand,    // &&
+    pipe_pipe,              // ||
+    question,               // ?
+    colon,                  // :
+    semicolon,              // ;
+    ellipsis,               // ...
+    equal,                  // =
+    star_equal,             // *=
+    slash_equal,            // /=
+    percent_equal,          // %=
+    plus_equal,             // +=
+    minus_equal,            // -=
+    less_less_equal,        // <<=
+    greater_greater_equal,  // >>=
+    ampersand_equal,        // &=
+    caret_equal,            // ^=
+    pipe_equal,             // |=
+    comma,                  // ,
+    hash,                   // #
+    hash_hash,              // ##
+
+    count
+};
+
+char const *token_kind_name(token_kind kind) noexcept;
+
+bool token_is_keyword(token_kind kind) noexcept;
+
+/// Identifiers and keywords: anything the preprocessor may treat as a name (e.g. `#if`, `#define inline`).
+bool token_is_identifier_like(token_kind kind) noexcept;
+
+/// Keyword kind for `spelling`, or `token_kind::identifier` if it is not a keyword. One hash probe.
+token_kind keyword_kind(std::string_view spelling) noexcept;
+
+enum token_flags : u8
+{
+    token_flag_line_start   = 1 << 0, // first token on its (logical) line, used to recognize directives
+    token_flag_space_before = 1 << 1, // preceded by whitespace or a comment
+};
+
+/// @brief Structure-of-arrays token storage. Token `i` is `kinds[i]`, `offsets[i]`, `lengths[i]`, `flags[i]`,
+/// where offset/length locate the token's spelling in the lexed text. The last token is always `end_of_input`.
+/// The arrays are sized by capacity, use `count` (not `kinds.size()`) for the number of tokens.
+struct token_buffer
+{
+    std::vector<token_kind> kinds;
+    std::vector<u32> offsets;
+    std::vector<u32> lengths;
+    std::vector<u8> flags;
+    u64 count = 0;
+
+    void clear() noexcept;
+    void reserve(u64 capacity) noexcept;
+    void push(token_kind kind, u32 offset, u32 length, u8 flags) noexcept;
+
+    std::string_view spelling(std::string_view text, u64 token_idx) const noexcept
+    {
+        return text.substr(offsets[token_idx], lengths[token_idx]);
+    }
+};
+
+/// Tokenizes `text` (at most 4 GiB) into `out`, replacing its contents. Comments and whitespace are skipped.
+/// Set `use_simd` to false to force the byte-at-a-time classifier (for benchmarking and verification).
+void lex(std::string_view text, token_buffer &out, bool use_simd = true) noexcept;
+
+/// Memory-maps `path` into `file` and tokenizes it into `out`. Token offsets refer to `file.data`,
+/// so `file` must outlive any use of the spellings. Returns false if the file could not be mapped.
+bool lex_file(char const *path, mapped_file &file, token_buffer &out) noexcept;
+
+// LITERAL DECODING
+
+/// Parses a C integer literal (decimal, octal or hex, optional u/l suffixes). Returns false if malformed.
+bool parse_integer_literal(std::string_view spelling, u64 &out) noexcept;
+
+/// Value of a character literal such as 'a' or '\n'. Returns false if malformed.
+bool parse_char_literal(std::string_view spelling, s64 &out) noexcept;
+
+/// Decodes a string literal (quotes included) into its bytes, without the terminating NUL. Returns false if malformed.
+bool decode_string_literal(std::string_view spelling, std::string &out) noexcept;
+
+struct lexer_benchmark_result
+{
+    u64 input_bytes;
+    u64 token_count;
+    u64 iterations;
+    s64 scalar_best_us;
+    s64 simd_best_us;
+    f64 scalar_mb_per_sec;
+    f64 simd_mb_per_sec;
+    char const *simd_isa;
+};
+
+/// Generates `input_bytes` of C-like source and reports the best-of-`iterations` lexing throughput
+/// for both the scalar and SIMD classifiers.
+lexer_benchmark_result lexer_benchmark(u64 input_bytes = 32 * 1024 * 1024, u64 iterations = 5) noexcept;
@@ -0,0 +1,138 @@
+#if defined(_WIN32)
+#   define WIN32_LEAN_AND_MEAN
+#   define NOMINMAX
+#   include <Windows.h>
+#else
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
+#include "mapped_file.hpp"
+
+mapped_file::~mapped_file() noexcept
+{
+    close();
+}
+
+bool mapped_file::is_open() const noexcept
+{
+#if defined(_WIN32)
+    return file_handle != nullptr;
+#else
+    return fd != -1;
+#endif
+}
+
+std::string_view mapped_file::view() const noexcept
+{
+    return std::string_view(data, size);
+}
+
+#if defined(_WIN32)
+
+bool mapped_file::open(char const *path) noexcept
+{
+    close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    LARGE_INTEGER file_size = {};
+    if (!GetFileSizeEx(file, &file_size)) {
+        CloseHandle(file);
+        return false;
+    }
+
+    this->file_handle = file;
+    this->size = u64(file_size.QuadPart);
+
+    if (this->size == 0) {
+        return true; // CreateFileMapping rejects empty files
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping == nullptr) {
+        close();
+        return false;
+    }
+    this->mapping_handle = mapping;
+
+    this->data = static_cast<char const *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    if (this->data == nullptr) {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void mapped_file::close() noexcept
+{
+    if (data) {
+        UnmapViewOfFile(data);
+    }
+    if (mapping_handle) {
+        CloseHandle(mapping_handle);
+    }
+    if (file_handle) {
+        CloseHandle(file_handle);
+    }
+    data = nullptr;
+    size = 0;
+    mapping_handle = nullptr;
+    file_handle = nullptr;
+}
+
+#else
+
+bool mapped_file::open(char const *path) noexcept
+{
+    close();
+
+    s32 file = ::open(path, O_RDONLY);
+    if (file == -1) {
+        return false;
+    }
+
+    struct stat st = {};
+    if (fstat(file, &st) != 0) {
+        ::close(file);
+        return false;
+    }
+
+    this->fd = file;
+    this->size = u64(st.st_size);
+
+    if (this->size == 0) {
+        return true; // mmap rejects zero-length mappings
+    }
+
+    void *addr = mmap(nullptr, this->size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (addr == MAP_FAILED) {
+        close();
+        return false;
+    }
+    madvise(addr, this->size, MADV_SEQUENTIAL);
+
+    this->data = static_cast<char const *>(addr);
+    return true;
+}
+
+void mapped_file::close() noexcept
+{
+    if (data) {
+        munmap(const_cast<char *>(data), size);
+    }
+    if (fd != -1) {
+        ::close(fd);
+    }
+    data = nullptr;
+    size = 0;
+    fd = -1;
+}
+
+#endif
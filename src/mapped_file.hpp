@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string_view>
+
+#include "primitives.hpp"
+
+/// @brief Read-only memory mapping of an entire file.
+/// The mapping lives until `close` is called or the object is destructed.
+/// Empty files are "mapped" successfully with `data == nullptr` and `size == 0`.
+struct mapped_file
+{
+    char const *data = nullptr;
+    u64 size = 0;
+
+#if defined(_WIN32)
+    void *file_handle = nullptr;
+    void *mapping_handle = nullptr;
+#else
+    s32 fd = -1;
+#endif
+
+    mapped_file() noexcept = default;
+    mapped_file(mapped_file const &) = delete;
+    mapped_file &operator=(mapped_file const &) = delete;
+    ~mapped_file() noexcept;
+
+    /// Maps the file at `path`, closing any previous mapping first. Returns false on failure.
+    bool open(char const *path) noexcept;
+    void close() noexcept;
+
+    bool is_open() const noexcept;
+    std::string_view view() const noexcept;
+};
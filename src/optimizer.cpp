@@ -0,0 +1,679 @@
+#include <algorithm>
+#include <limits>
+#include <unordered_map>
+
+#include "util.hpp"
+#include "ir.hpp"
+#include "ssa.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+
+#include "optimizer.hpp"
+
+char const *ir_pass_name(ir_pass pass) noexcept
+{
+    switch (pass) {
+        case ir_pass::ssa:        return "ssa";
+        case ir_pass::sccp:       return "sccp";
+        case ir_pass::gvn:        return "gvn";
+        case ir_pass::dce:        return "dce";
+        case ir_pass::out_of_ssa: return "out_of_ssa";
+        case ir_pass::count:      break;
+    }
+    return "";
+}
+
+// SPARSE CONDITIONAL CONSTANT PROPAGATION
+
+void ssa_sccp(ssa_function &fn, std::vector<s64> &constants) noexcept
+{
+    u32 const value_count = u32(fn.insts.size());
+    u32 const block_count = u32(fn.blocks.size());
+
+    // Users of each value, in compressed rows.
+    std::vector<u32> user_start(value_count + 1, 0);
+    for (u32 b : fn.rpo) {
+        for (u32 v : fn.blocks[b].insts) {
+            for (u32 i = 0; i < fn.insts[v].arg_count; ++i) {
+                ++user_start[fn.arg(v, i) + 1];
+            }
+        }
+    }
+    for (u32 v = 0; v < value_count; ++v) {
+        user_start[v + 1] += user_start[v];
+    }
+    std::vector<u32> users(user_start[value_count]);
+    {
+        std::vector<u32> fill(user_start.begin(), user_start.end() - 1);
+        for (u32 b : fn.rpo) {
+            for (u32 v : fn.blocks[b].insts) {
+                for (u32 i = 0; i < fn.insts[v].arg_count; ++i) {
+                    users[fill[fn.arg(v, i)]++] = v;
+                }
+            }
+        }
+    }
+
+    // Lattice: unknown (not yet shown reachable) > constant > overdefined, values only ever move down.
+    enum : u8 { unknown, constant, overdefined };
+    std::vector<u8> state(value_count, unknown);
+    std::vector<s64> value(value_count, 0);
+    std::vector<bool> block_executable(block_count, false);
+    std::vector<bool> edge_executable(block_count * 2, false); // edge (b, k) leads to succs[k]
+    std::vector<u32> flow_work;
+    std::vector<u32> ssa_work;
+
+    auto set = [&](u32 v, u8 s, s64 c) {
+        if (state[v] == overdefined || s == unknown || (s == constant && state[v] == constant && value[v] == c)) {
+            return;
+        }
+        if (s == constant && state[v] == constant) {
+            s = overdefined;
+        }
+        state[v] = s;
+        value[v] = c;
+        ssa_work.push_back(v);
+    };
+    auto mark_edge = [&](u32 b, u32 k) {
+        if (!edge_executable[b * 2 + k]) {
+            edge_executable[b * 2 + k] = true;
+            flow_work.push_back(b * 2 + k);
+        }
+    };
+    auto edge_into = [&](u32 p, u32 s) {
+        return edge_executable[p * 2 + (fn.blocks[p].succs[0] == s ? 0 : 1)];
+    };
+
+    auto evaluate = [&](u32 v) {
+        ssa_inst const &inst = fn.insts[v];
+        u32 b = inst.block;
+
+        if (inst.kind == ssa_kind::param) {
+            set(v, overdefined, 0);
+            return;
+        }
+        if (inst.kind == ssa_kind::phi) {
+            u8 s = unknown;
+            s64 c = 0;
+            for (u32 j = 0; j < inst.arg_count && s != overdefined; ++j) {
+                if (!edge_into(fn.blocks[b].preds[j], b)) {
+                    continue;
+                }
+                u32 a = fn.arg(v, j);
+                if (state[a] == overdefined || (state[a] == constant && s == constant && value[a] != c)) {
+                    s = overdefined;
+                } else if (state[a] == constant) {
+                    s = constant;
+                    c = value[a];
+                }
+            }
+            set(v, s, c);
+            return;
+        }
+
+        switch (inst.op) {
+            case ir_op::jump:
+                mark_edge(b, 0);
+                return;
+            case ir_op::jump_if: {
+                u32 cond = fn.arg(v, 0);
+                if (state[cond] == constant) {
+                    mark_edge(b, value[cond] != 0 ? 0 : 1);
+                } else if (state[cond] == overdefined) {
+                    mark_edge(b, 0);
+                    mark_edge(b, 1);
+                }
+                return;
+            }
+            case ir_op::ret:
+            case ir_op::store_global:
+                return;
+            case ir_op::mov_imm:
+                set(v, constant, inst.imm);
+                return;
+            case ir_op::mov_wide:
+                set(v, constant, constants[inst.imm]);
+                return;
+            default:
+                break;
+        }
+        if (!ir_op_is_pure(inst.op) || inst.op == ir_op::load_string) {
+            set(v, overdefined, 0);
+            return;
+        }
+
+        s64 operands[2] = {};
+        for (u32 i = 0; i < inst.arg_count; ++i) {
+            u32 a = fn.arg(v, i);
+            if (state[a] == unknown) {
+                return;
+            }
+            if (state[a] == overdefined) {
+                set(v, overdefined, 0);
+                return;
+            }
+            operands[i] = value[a];
+        }
+        s64 folded;
+        if (ir_fold(inst.op, operands[0], operands[1], inst.imm, folded)) {
+            set(v, constant, folded);
+        } else {
+            set(v, overdefined, 0); // traps at run time, leave it to do so
+        }
+    };
+
+    auto visit_block = [&](u32 b) {
+        for (u32 v : fn.blocks[b].insts) {
+            evaluate(v);
+        }
+    };
+
+    block_executable[0] = true;
+    visit_block(0);
+    while (!flow_work.empty() || !ssa_work.empty()) {
+        while (!flow_work.empty()) {
+            u32 edge = flow_work.back();
+            flow_work.pop_back();
+            u32 s = fn.blocks[edge / 2].succs[edge % 2];
+            if (!block_executable[s]) {
+                block_executable[s] = true;
+                visit_block(s);
+            } else {
+                for (u32 v : fn.blocks[s].insts) {
+                    if (fn.insts[v].kind == ssa_kind::phi) evaluate(v);
+                }
+            }
+        }
+        while (!ssa_work.empty()) {
+            u32 v = ssa_work.back();
+            ssa_work.pop_back();
+            for (u32 i = user_start[v]; i < user_start[v + 1]; ++i) {
+                if (block_executable[fn.insts[users[i]].block]) {
+                    evaluate(users[i]);
+                }
+            }
+        }
+    }
+
+    // Rewrite: constants, decided branches, then blocks never reached.
+    for (u32 b : fn.rpo) {
+        if (!block_executable[b]) {
+            continue;
+        }
+        ssa_block &block = fn.blocks[b];
+        for (u32 v : block.insts) {
+            ssa_inst &inst = fn.insts[v];
+            bool foldable = inst.kind == ssa_kind::phi || (inst.kind == ssa_kind::op && ir_op_is_pure(inst.op) && inst.op != ir_op::mov_imm && inst.op != ir_op::mov_wide);
+            if (!foldable || state[v] != constant) {
+                continue;
+            }
+            inst.kind = ssa_kind::op;
+            inst.arg_count = 0;
+            if (value[v] >= std::numeric_limits<s32>::min() && value[v] <= std::numeric_limits<s32>::max()) {
+                inst.op = ir_op::mov_imm;
+                inst.imm = s32(value[v]);
+            } else {
+                inst.op = ir_op::mov_wide;
+                inst.imm = s32(constants.size());
+                constants.push_back(value[v]);
+            }
+        }
+        std::stable_partition(block.insts.begin(), block.insts.end(), [&](u32 v) {
+            return fn.insts[v].kind == ssa_kind::phi || fn.insts[v].kind == ssa_kind::param;
+        });
+
+        ssa_inst &term = fn.insts[block.insts.back()];
+        if (term.op == ir_op::jump_if && edge_executable[b * 2] != edge_executable[b * 2 + 1]) {
+            u32 taken = edge_executable[b * 2] ? 0 : 1;
+            u32 dropped = block.succs[1 - taken];
+            std::vector<u32> const &preds = fn.blocks[dropped].preds;
+            ssa_remove_pred(fn, dropped, u32(std::find(preds.begin(), preds.end(), b) - preds.begin()));
+            block.succs[0] = block.succs[taken];
+            block.succs[1] = ssa_null;
+            term.op = ir_op::jump;
+            term.arg_count = 0;
+        }
+    }
+    for (u32 b : fn.rpo) {
+        if (block_executable[b]) {
+            continue;
+        }
+        for (u32 s : fn.blocks[b].succs) {
+            if (s != ssa_null && block_executable[s]) {
+                std::vector<u32> const &preds = fn.blocks[s].preds;
+                ssa_remove_pred(fn, s, u32(std::find(preds.begin(), preds.end(), b) - preds.begin()));
+            }
+        }
+        fn.blocks[b].removed = true;
+        fn.blocks[b].preds.clear();
+    }
+
+    ssa_cleanup(fn);
+    ssa_compute_dominators(fn);
+}
+
+// GLOBAL VALUE NUMBERING
+
+namespace {
+
+struct value_key
+{
+    ir_op op;
+    s32 imm;
+    u32 args[2];
+
+    bool operator==(value_key const &) const noexcept = default;
+};
+
+struct value_key_hash
+{
+    u64 operator()(value_key const &k) const noexcept
+    {
+        u64 h = (u64(k.op) << 32) ^ u64(u32(k.imm));
+        h = h * 0x9E3779B97F4A7C15ull ^ k.args[0];
+        h = h * 0x9E3779B97F4A7C15ull ^ k.args[1];
+        return h ^ (h >> 29);
+    }
+};
+
+} // namespace
+
+/// Whether `v` is already what sign-extending its low `bits` bits would produce.
+static bool fits_in_bits(ssa_function const &fn, u32 v, s32 bits, u32 depth = 0) noexcept
+{
+    ssa_inst const &inst = fn.insts[v];
+    if (inst.kind == ssa_kind::phi) {
+        if (depth >= 4) {
+            return false;
+        }
+        for (u32 i = 0; i < inst.arg_count; ++i) {
+            u32 a = ssa_resolve(fn, fn.arg(v, i));
+            if (a != v && !fits_in_bits(fn, a, bits, depth + 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (inst.kind != ssa_kind::op) {
+        return false;
+    }
+    switch (inst.op) {
+        case ir_op::mov_imm: {
+            s64 limit = s64(1) << (bits - 1);
+            return inst.imm >= -limit && inst.imm < limit;
+        }
+        case ir_op::sext:
+            return inst.imm <= bits;
+        case ir_op::log_not:
+        case ir_op::eq:
+        case ir_op::ne:
+        case ir_op::lt:
+        case ir_op::le:
+        case ir_op::gt:
+        case ir_op::ge:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/// The value `v` trivially equals, or `ssa_null`.
+static u32 simplify(ssa_function const &fn, u32 v) noexcept
+{
+    ssa_inst const &inst = fn.insts[v];
+    if (inst.kind == ssa_kind::phi) {
+        u32 same = ssa_null;
+        for (u32 i = 0; i < inst.arg_count; ++i) {
+            u32 a = ssa_resolve(fn, fn.arg(v, i));
+            if (a == v || a == same) {
+                continue;
+            }
+            if (same != ssa_null) {
+                return ssa_null;
+            }
+            same = a;
+        }
+        return same;
+    }
+    if (inst.kind != ssa_kind::op) {
+        return ssa_null;
+    }
+    if (inst.op == ir_op::add_imm && inst.imm == 0) {
+        return ssa_resolve(fn, fn.arg(v, 0));
+    }
+    if (inst.op == ir_op::sext && fits_in_bits(fn, ssa_resolve(fn, fn.arg(v, 0)), inst.imm)) {
+        return ssa_resolve(fn, fn.arg(v, 0));
+    }
+    return ssa_null;
+}
+
+static value_key make_key(ssa_function const &fn, u32 v) noexcept
+{
+    ssa_inst const &inst = fn.insts[v];
+    value_key k = { inst.op, inst.imm, { ssa_null, ssa_null } };
+    for (u32 i = 0; i < inst.arg_count; ++i) {
+        k.args[i] = ssa_resolve(fn, fn.arg(v, i));
+    }
+    switch (k.op) {
+        case ir_op::add:
+        case ir_op::mul:
+        case ir_op::bit_and:
+        case ir_op::bit_or:
+        case ir_op::bit_xor:
+        case ir_op::eq:
+        case ir_op::ne:
+            if (k.args[0] > k.args[1]) std::swap(k.args[0], k.args[1]);
+            break;
+        case ir_op::gt: // a > b is b < a
+            k.op = ir_op::lt;
+            std::swap(k.args[0], k.args[1]);
+            break;
+        case ir_op::ge:
+            k.op = ir_op::le;
+            std::swap(k.args[0], k.args[1]);
+            break;
+        default:
+            break;
+    }
+    return k;
+}
+
+static void gvn_block(ssa_function &fn, u32 b, std::vector<std::vector<u32>> const &children,
+                      std::unordered_map<value_key, u32, value_key_hash> &table, std::vector<value_key> &scope) noexcept
+{
+    u64 scope_start = scope.size();
+
+    for (u32 v : fn.blocks[b].insts) {
+        if (u32 same = simplify(fn, v); same != ssa_null) {
+            ssa_replace(fn, v, same);
+            continue;
+        }
+        ssa_inst const &inst = fn.insts[v];
+        if (inst.kind != ssa_kind::op || !ir_op_is_pure(inst.op)) {
+            continue;
+        }
+        value_key k = make_key(fn, v);
+        auto [it, inserted] = table.try_emplace(k, v);
+        if (inserted) {
+            scope.push_back(k);
+        } else {
+            ssa_replace(fn, v, it->second);
+        }
+    }
+
+    for (u32 child : children[b]) {
+        gvn_block(fn, child, children, table, scope);
+    }
+
+    while (scope.size() > scope_start) {
+        table.erase(scope.back());
+        scope.pop_back();
+    }
+}
+
+/// Blocks on some cycle: for every back edge p -> h (h dominates p), whatever reaches p without passing h.
+static std::vector<bool> blocks_in_loops(ssa_function const &fn) noexcept
+{
+    std::vector<bool> in_loop(fn.blocks.size(), false);
+    std::vector<u32> visited(fn.blocks.size(), ssa_null); // back edge source that last reached each block
+    std::vector<u32> work;
+    auto dominates = [&](u32 x, u32 y) {
+        for (; y != ssa_null; y = fn.blocks[y].idom) {
+            if (y == x) return true;
+        }
+        return false;
+    };
+    for (u32 p : fn.rpo) {
+        for (u32 h : fn.blocks[p].succs) {
+            if (h == ssa_null || !dominates(h, p)) {
+                continue;
+            }
+            in_loop[h] = true;
+            work.push_back(p);
+            while (!work.empty()) {
+                u32 b = work.back();
+                work.pop_back();
+                if (b == h || visited[b] == p) {
+                    continue;
+                }
+                visited[b] = p;
+                in_loop[b] = true;
+                for (u32 pred : fn.blocks[b].preds) {
+                    work.push_back(pred);
+                }
+            }
+        }
+    }
+    return in_loop;
+}
+
+void ssa_gvn(ssa_function &fn) noexcept
+{
+    // Constants have no operands, so those inside loops can move to the entry block, where numbering then
+    // shares them function-wide. Everything else stays put (no code motion beyond that).
+    std::vector<bool> in_loop = blocks_in_loops(fn);
+    std::vector<u32> hoisted;
+    for (u32 b : fn.rpo) {
+        if (b == 0 || !in_loop[b]) {
+            continue;
+        }
+        std::erase_if(fn.blocks[b].insts, [&](u32 v) {
+            ssa_inst &inst = fn.insts[v];
+            bool constant = inst.kind == ssa_kind::op && (inst.op == ir_op::mov_imm || inst.op == ir_op::mov_wide || inst.op == ir_op::load_string);
+            if (constant) {
+                inst.block = 0;
+                hoisted.push_back(v);
+            }
+            return constant;
+        });
+    }
+    std::vector<u32> &entry = fn.blocks[0].insts;
+    entry.insert(entry.end() - 1, hoisted.begin(), hoisted.end());
+
+    std::vector<std::vector<u32>> children = ssa_dominator_tree(fn);
+    std::unordered_map<value_key, u32, value_key_hash> table;
+    std::vector<value_key> scope;
+    gvn_block(fn, 0, children, table, scope);
+
+    // Loop phis were visited before their back edge arguments were numbered, retry them until nothing changes.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (u32 b : fn.rpo) {
+            for (u32 v : fn.blocks[b].insts) {
+                if (fn.insts[v].kind != ssa_kind::phi) {
+                    continue;
+                }
+                if (u32 same = simplify(fn, v); same != ssa_null) {
+                    ssa_replace(fn, v, same);
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    ssa_cleanup(fn);
+}
+
+// DEAD CODE ELIMINATION
+
+void ssa_dce(ssa_function &fn) noexcept
+{
+    std::vector<bool> live(fn.insts.size(), false);
+    std::vector<u32> work;
+
+    auto has_side_effect = [&](u32 v) {
+        ssa_inst const &inst = fn.insts[v];
+        if (inst.kind != ssa_kind::op) {
+            return inst.kind == ssa_kind::param;
+        }
+        switch (inst.op) {
+            case ir_op::store_global:
+            case ir_op::call:
+            case ir_op::call_builtin:
+            case ir_op::jump:
+            case ir_op::jump_if:
+            case ir_op::ret:
+                return true;
+            case ir_op::div:
+            case ir_op::mod: {
+                // Kept for its trap unless the divisor is a constant that cannot trap.
+                ssa_inst const &divisor = fn.insts[fn.arg(v, 1)];
+                bool safe = (divisor.op == ir_op::mov_imm && divisor.imm != 0 && divisor.imm != -1) || divisor.op == ir_op::mov_wide;
+                return divisor.kind != ssa_kind::op || !safe;
+            }
+            default:
+                return false;
+        }
+    };
+
+    for (u32 b : fn.rpo) {
+        for (u32 v : fn.blocks[b].insts) {
+            if (has_side_effect(v)) {
+                live[v] = true;
+                work.push_back(v);
+            }
+        }
+    }
+    while (!work.empty()) {
+        u32 v = work.back();
+        work.pop_back();
+        for (u32 i = 0; i < fn.insts[v].arg_count; ++i) {
+            u32 a = fn.arg(v, i);
+            if (!live[a]) {
+                live[a] = true;
+                work.push_back(a);
+            }
+        }
+    }
+
+    for (u32 b : fn.rpo) {
+        for (u32 v : fn.blocks[b].insts) {
+            if (!live[v]) {
+                fn.insts[v].kind = ssa_kind::dead;
+            }
+        }
+    }
+    ssa_cleanup(fn);
+}
+
+// PIPELINE
+
+void ir_optimize(ir_module &module, ir_optimization_stats *stats, cancel_token const *cancel) noexcept
+{
+    ir_optimization_stats total = {};
+
+    for (ir_function &fn : module.functions) {
+        if (cancelled(cancel)) {
+            break;
+        }
+        ir_pass_stats passes[u64(ir_pass::count)] = {};
+        time_point_precise_t t = get_time_precise();
+
+        auto record = [&](ir_pass pass, u64 before, u64 after) {
+            time_point_precise_t now = get_time_precise();
+            passes[u64(pass)] = { before, after, time_diff_ns(t, now) };
+            t = now;
+        };
+
+        ssa_function ssa;
+        if (!ssa_build(fn, ssa)) {
+            ++total.functions_skipped;
+            continue;
+        }
+        record(ir_pass::ssa, fn.code.size(), ssa_instruction_count(ssa));
+
+        u64 before = ssa_instruction_count(ssa);
+        ssa_sccp(ssa, module.constants);
+        record(ir_pass::sccp, before, ssa_instruction_count(ssa));
+
+        before = ssa_instruction_count(ssa);
+        ssa_gvn(ssa);
+        record(ir_pass::gvn, before, ssa_instruction_count(ssa));
+
+        before = ssa_instruction_count(ssa);
+        ssa_dce(ssa);
+        record(ir_pass::dce, before, ssa_instruction_count(ssa));
+
+        before = ssa_instruction_count(ssa);
+        if (!ssa_to_ir(ssa, fn)) {
+            ++total.functions_skipped;
+            continue;
+        }
+        record(ir_pass::out_of_ssa, before, fn.code.size());
+
+        ++total.functions;
+        for (u64 p = 0; p < u64(ir_pass::count); ++p) {
+            total.passes[p].instructions_before += passes[p].instructions_before;
+            total.passes[p].instructions_after += passes[p].instructions_after;
+            total.passes[p].elapsed_ns += passes[p].elapsed_ns;
+        }
+    }
+
+    if (stats != nullptr) {
+        *stats = total;
+    }
+}
+
+std::string ir_optimization_stats_to_string(ir_optimization_stats const &stats) noexcept
+{
+    std::string s;
+    for (u64 p = 0; p < u64(ir_pass::count); ++p) {
+        ir_pass_stats const &pass = stats.passes[p];
+        s += make_str("%-10s %7llu -> %7llu  %+8lld  %9.1f us\n", ir_pass_name(ir_pass(p)),
+                      (unsigned long long)pass.instructions_before, (unsigned long long)pass.instructions_after,
+                      (long long)pass.instructions_after - (long long)pass.instructions_before, f64(pass.elapsed_ns) / 1000.0);
+    }
+    if (stats.functions_skipped > 0) {
+        s += make_str("%llu functions left unoptimized\n", (unsigned long long)stats.functions_skipped);
+    }
+    return s;
+}
+
+// BENCHMARK
+
+optimizer_benchmark_result optimizer_benchmark(char const *path, u64 iterations) noexcept
+{
+    optimizer_benchmark_result result = {};
+
+    compilation comp;
+    comp.optimize = false;
+    if (path == nullptr) {
+        comp.source_text = interpreter_benchmark_source();
+    } else if (!compilation_load_file(comp, path)) {
+        result.errors.push_back(std::string("cannot read ") + path);
+        return result;
+    }
+    if (!compile_to_ir(comp)) {
+        result.errors.push_back(comp.errors.empty() ? "compilation failed" : comp.errors.front());
+        return result;
+    }
+
+    ir_module const &plain = comp.ir;
+    ir_module optimized = plain;
+    ir_optimize(optimized, &result.stats);
+
+    interpreter_options counting;
+    counting.count_instructions = true;
+    execution_result before, after;
+    execute_ir(plain, before, counting);
+    execute_ir(optimized, after, counting);
+    result.dispatches_before = before.instructions;
+    result.dispatches_after = after.instructions;
+    if (before.output != after.output || before.exit_code != after.exit_code || before.error != after.error) {
+        result.errors.push_back("optimized program behaves differently");
+    }
+
+    auto best_of = [&](ir_module const &module) {
+        s64 best = std::numeric_limits<s64>::max();
+        for (u64 i = 0; i < iterations; ++i) {
+            execution_result run;
+            execute_ir(module, run);
+            best = std::min(best, run.elapsed_us);
+        }
+        return best;
+    };
+    result.best_us_before = best_of(plain);
+    result.best_us_after = best_of(optimized);
+
+    return result;
+}
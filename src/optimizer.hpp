@@ -0,0 +1,73 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+
+struct ir_module;
+struct ssa_function;
+struct cancel_token;
+
+enum class ir_pass : u8
+{
+    ssa,            // construction: mem2reg and copy propagation happen while renaming
+    sccp,           // sparse conditional constant propagation, also removes unreachable blocks
+    gvn,            // dominator-scoped global value numbering, trivial phis and redundant sign extensions
+    dce,            // mark-sweep from side effects
+    out_of_ssa,     // phi copies, block layout, jump threading
+
+    count
+};
+
+char const *ir_pass_name(ir_pass pass) noexcept;
+
+/// Instruction counts in SSA form include phis and one terminator per block (fallthrough included),
+/// so `ssa` and `out_of_ssa` also show what that bookkeeping costs.
+struct ir_pass_stats
+{
+    u64 instructions_before;
+    u64 instructions_after;
+    s64 elapsed_ns;
+};
+
+struct ir_optimization_stats
+{
+    ir_pass_stats passes[u64(ir_pass::count)];
+    u64 functions;          // optimized, the only ones counted in `passes`
+    u64 functions_skipped;  // left as lowered (contain superinstructions or need too many registers)
+};
+
+/// Wegman & Zadeck SCCP: values and CFG edges are only considered once proven reachable, so constants
+/// flowing around branches that fold away are found too. Constants become mov_imm (or mov_wide into
+/// `constants`), decided branches become jumps and blocks never reached are removed.
+void ssa_sccp(ssa_function &fn, std::vector<s64> &constants) noexcept;
+
+/// Replaces every pure instruction computing the same operation on the same values as a dominating one,
+/// phis whose arguments are all one value, and sign extensions of values that already fit.
+void ssa_gvn(ssa_function &fn) noexcept;
+
+/// Removes every instruction whose value does not reach a side effect, branch or return.
+void ssa_dce(ssa_function &fn) noexcept;
+
+/// Runs ssa -> sccp -> gvn -> dce -> out_of_ssa on every function of `module`. Must run before
+/// `fuse_superinstructions`. If `stats` is given, it receives instruction counts and time per pass.
+/// `cancel` is polled before each function, the ones after a cancellation are left unoptimized.
+void ir_optimize(ir_module &module, ir_optimization_stats *stats = nullptr, cancel_token const *cancel = nullptr) noexcept;
+
+/// One line per pass: instructions before and after, the delta and the time taken.
+std::string ir_optimization_stats_to_string(ir_optimization_stats const &stats) noexcept;
+
+struct optimizer_benchmark_result
+{
+    ir_optimization_stats stats;
+    u64 dispatches_before;      // instructions the interpreter executes running `main`
+    u64 dispatches_after;
+    s64 best_us_before;         // best of `iterations` runs
+    s64 best_us_after;
+    std::vector<std::string> errors; // failed compiles, output that changed under optimization
+};
+
+/// Compiles the C file at `path` (or, if null, the interpreter benchmark program) with and without
+/// `ir_optimize`, reports the pass statistics and runs both versions to compare dispatches and time.
+optimizer_benchmark_result optimizer_benchmark(char const *path, u64 iterations = 5) noexcept;
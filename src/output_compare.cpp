@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+#include "util.hpp"
+#include "simd.hpp"
+#include "mapped_file.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+
+#include "output_compare.hpp"
+
+namespace fs = std::filesystem;
+
+u64 first_mismatch(char const *a, char const *b, u64 size, bool use_simd) noexcept
+{
+    u64 i = 0;
+
+#if SIMD_WIDTH == 32
+    if (use_simd) {
+        for (; i + 32 <= size; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i));
+            u32 equal = u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+            if (equal != u32(-1)) {
+                return i + u64(std::countr_one(equal));
+            }
+        }
+    }
+#elif SIMD_WIDTH == 16
+    if (use_simd) {
+        for (; i + 16 <= size; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<__m128i const *>(b + i));
+            u32 equal = u32(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)));
+            if (equal != 0xffff) {
+                return i + u64(std::countr_one(equal));
+            }
+        }
+    }
+#else
+    (void)use_simd;
+#endif
+
+    for (; i < size; ++i) {
+        if (a[i] != b[i]) {
+            return i;
+        }
+    }
+    return size;
+}
+
+void output_compare_begin(output_comparator &cmp, std::string_view expected, u64 context) noexcept
+{
+    cmp = {};
+    cmp.expected = expected;
+    cmp.context = context;
+}
+
+bool output_compare_feed(output_comparator &cmp, std::string_view chunk) noexcept
+{
+    if (cmp.differs) {
+        cmp.actual_after.append(chunk.substr(0, cmp.context - cmp.actual_after.size()));
+        return cmp.actual_after.size() < cmp.context;
+    }
+
+    u64 n = std::min<u64>(chunk.size(), cmp.expected.size() - cmp.compared);
+    u64 same = first_mismatch(cmp.expected.data() + cmp.compared, chunk.data(), n);
+    cmp.compared += same;
+    if (same == chunk.size()) {
+        return true;
+    }
+
+    // A different byte, or more output than expected.
+    cmp.differs = true;
+    cmp.actual_after.assign(chunk.substr(same, cmp.context));
+    return cmp.actual_after.size() < cmp.context;
+}
+
+bool output_compare_finish(output_comparator &cmp) noexcept
+{
+    cmp.finished = true;
+    cmp.differs |= cmp.compared < cmp.expected.size();
+    return !cmp.differs;
+}
+
+static void append_escaped(std::string &out, std::string_view s) noexcept
+{
+    for (char c : s) {
+        switch (c) {
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            default:
+                if (u8(c) < 0x20 || u8(c) == 0x7f) {
+                    out += make_str("\\x%02x", unsigned(u8(c)));
+                } else {
+                    out += c;
+                }
+        }
+    }
+}
+
+std::string output_compare_report(output_comparator const &cmp) noexcept
+{
+    // Only the bytes before the difference are counted, and only once.
+    std::string_view before = cmp.expected.substr(0, cmp.compared);
+    u64 line = 1;
+    u64 line_start = 0;
+    for (char const *p = before.data(), *end = p + before.size(); p < end;) {
+        char const *newline = static_cast<char const *>(memchr(p, '\n', u64(end - p)));
+        if (newline == nullptr) {
+            break;
+        }
+        ++line;
+        line_start = u64(newline - before.data()) + 1;
+        p = newline + 1;
+    }
+
+    u64 begin = cmp.compared - std::min(cmp.compared, cmp.context);
+    std::string_view agreed = cmp.expected.substr(begin, cmp.compared - begin);
+    std::string_view expected_after = cmp.expected.substr(cmp.compared, cmp.context);
+
+    std::string report = make_str("line %llu, column %llu (byte %llu): expected \"", (unsigned long long)line,
+                                  (unsigned long long)(cmp.compared - line_start + 1), (unsigned long long)cmp.compared);
+    append_escaped(report, agreed);
+    append_escaped(report, expected_after);
+    report += cmp.compared + expected_after.size() == cmp.expected.size() ? "\" (end), got \"" : "\", got \"";
+    append_escaped(report, agreed);
+    append_escaped(report, cmp.actual_after);
+    report += cmp.finished && cmp.actual_after.size() < cmp.context ? "\" (end)" : "\"";
+    return report;
+}
+
+// BENCHMARK
+
+output_compare_benchmark_result output_compare_benchmark(u64 lines, u64 iterations) noexcept
+{
+    output_compare_benchmark_result result = {};
+    iterations = std::max(iterations, u64(1));
+    result.simd_isa = simd_isa_name();
+
+    compilation comp;
+    comp.source_path = "output_compare_benchmark.c";
+    comp.source_text = make_str(
+        "int main()\n"
+        "{\n"
+        "    long i;\n"
+        "    for (i = 0; i < %llu; ++i)\n"
+        "        printf(\"line %%ld: the quick brown fox\\n\", i);\n"
+        "    return 0;\n"
+        "}\n",
+        (unsigned long long)lines);
+    if (!compile_to_ir(comp)) {
+        return result;
+    }
+
+    // The expected output goes through a file like a test's, mapped rather than read.
+    std::string expected;
+    for (u64 i = 0; i < lines; ++i) {
+        expected += make_str("line %llu: the quick brown fox\n", (unsigned long long)i);
+    }
+    result.bytes = expected.size();
+
+    std::error_code ec;
+    fs::path path = fs::temp_directory_path(ec) / make_str("output_compare_benchmark-%llx.txt", (unsigned long long)fnv1a_hash(comp.source_text));
+    FILE *file = fopen(path.string().c_str(), "wb");
+    if (file == nullptr) {
+        return result;
+    }
+    bool written = fwrite(expected.data(), 1, expected.size(), file) == expected.size();
+    written = fclose(file) == 0 && written;
+    mapped_file mapped;
+    if (!written || !mapped.open(path.string().c_str())) {
+        fs::remove(path, ec);
+        return result;
+    }
+
+    execution_result run;
+    volatile bool sink = false;
+    result.buffered_us = best_time_us(iterations, [&] {
+        execute_ir(comp.ir, run);
+        sink = sink + (run.output == mapped.view());
+        result.buffered_peak_bytes = run.output.size();
+    });
+
+    output_comparator cmp;
+    interpreter_options options;
+    options.output_sink = [&](std::string_view chunk) {
+        result.streamed_peak_bytes = std::max<u64>(result.streamed_peak_bytes, chunk.size());
+        return output_compare_feed(cmp, chunk);
+    };
+    result.streamed_us = best_time_us(iterations, [&] {
+        output_compare_begin(cmp, mapped.view());
+        execute_ir(comp.ir, run, options);
+        sink = sink + output_compare_finish(cmp);
+    });
+
+    // The same run against an expected output that differs on its second line stops right there.
+    std::string wrong = expected;
+    wrong[wrong.find('\n') + 1] = 'L';
+    result.early_stop_us = best_time_us(iterations, [&] {
+        output_compare_begin(cmp, wrong);
+        execute_ir(comp.ir, run, options);
+        sink = sink + output_compare_finish(cmp);
+    });
+    (void)sink;
+
+    mapped.close();
+    fs::remove(path, ec);
+
+    // The search alone, over identical buffers so it runs to the end.
+    std::string const copy = expected;
+    volatile u64 found = 0;
+    auto mb_per_sec = [&](bool use_simd) {
+        s64 us = best_time_us(iterations, [&] { found = found + first_mismatch(expected.data(), copy.data(), copy.size(), use_simd); });
+        return (f64(copy.size()) / (1024.0 * 1024.0)) / (f64(us) / 1'000'000.0);
+    };
+    result.scalar_mb_per_sec = mb_per_sec(false);
+    result.simd_mb_per_sec = mb_per_sec(true);
+    (void)found;
+    return result;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+#include "primitives.hpp"
+
+/// Offset of the first byte where `a` and `b` differ among their first `size`, or `size` if there is none.
+/// Set `use_simd` to false to force the byte-at-a-time search (for benchmarking and verification).
+u64 first_mismatch(char const *a, char const *b, u64 size, bool use_simd = true) noexcept;
+
+/// @brief Compares output as it is produced against the expected output, usually a memory-mapped file, so
+/// neither side is ever held whole: feed it chunks in order, then `output_compare_finish`. It stops taking
+/// input at the first difference, once it has `context` bytes of what came after it.
+struct output_comparator
+{
+    std::string_view expected;
+    u64 context = 40;               // bytes shown on each side of a difference
+    u64 compared = 0;               // bytes of output that matched
+    bool differs = false;
+    std::string actual_after;       // output from the first difference on, up to `context` bytes
+    bool finished = false;
+};
+
+/// Starts comparing against `expected`, which must outlive the comparator.
+void output_compare_begin(output_comparator &cmp, std::string_view expected, u64 context = 40) noexcept;
+
+/// Compares the next `chunk` of output. Returns false once the output differs and enough of it was seen to
+/// report the difference: the producer can stop there.
+bool output_compare_feed(output_comparator &cmp, std::string_view chunk) noexcept;
+
+/// Ends the output. Returns true if it was exactly `expected`, else a shorter output differs where it ended.
+bool output_compare_finish(output_comparator &cmp) noexcept;
+
+/// Where the output first differs, as "line L, column C (byte B): expected "…", got "…"": the expected and
+/// actual text around the difference, escaped, both starting `context` bytes before it (where they agree).
+std::string output_compare_report(output_comparator const &cmp) noexcept;
+
+struct output_compare_benchmark_result
+{
+    u64 bytes;                      // printed by the program, and compared
+    s64 buffered_us;                // run to completion into one string, then compared whole
+    s64 streamed_us;                // run with output compared as it is printed
+    u64 buffered_peak_bytes;        // output held at once
+    u64 streamed_peak_bytes;
+    s64 early_stop_us;              // streamed against an expected output that differs after its first line
+    f64 scalar_mb_per_sec;          // `first_mismatch` alone
+    f64 simd_mb_per_sec;
+    char const *simd_isa;
+};
+
+/// Runs a generated program printing `lines` lines (about 30 bytes each) the way the tests do, buffered then
+/// streamed, and measures the mismatch search over the same bytes `iterations` times, keeping the best.
+output_compare_benchmark_result output_compare_benchmark(u64 lines = 2'000'000, u64 iterations = 5) noexcept;
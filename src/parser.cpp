@@ -0,0 +1,717 @@
+#include <cassert>
+
+#include "util.hpp"
+#include "lexer.hpp"
+#include "ast.hpp"
+#include "intern.hpp"
+
+#include "parser.hpp"
+
+std::string source_location_str(std::string_view text, u64 offset) noexcept
+{
+    offset = std::min(offset, u64(text.size()));
+
+    u64 line = 1;
+    u64 line_start = 0;
+    for (u64 i = 0; i < offset; ++i) {
+        if (text[i] == '\n') {
+            ++line;
+            line_start = i + 1;
+        }
+    }
+    return make_str("%zu:%zu", line, offset - line_start + 1);
+}
+
+class parser
+{
+public:
+    parser(std::string_view text, token_buffer const &tokens, ast &tree, intern_table &names, std::vector<std::string> &errors) noexcept
+        : m_text(text), m_tokens(tokens), m_tree(tree), m_names(names), m_errors(errors)
+    {
+    }
+
+    void parse_translation_unit() noexcept;
+
+    /// Parses the external declaration at token `first`, returns where the next one starts.
+    u32 parse_top_level_declaration(u32 first, std::vector<u32> &decls) noexcept;
+
+private:
+    std::string_view m_text;
+    token_buffer const &m_tokens;
+    ast &m_tree;
+    intern_table &m_names;
+    std::vector<std::string> &m_errors;
+    u32 m_pos = 0;
+    bool m_failed = false; // set by `error`, cleared when recovering at the next external declaration
+
+    token_kind peek(u32 ahead = 0) const noexcept
+    {
+        u64 idx = std::min(u64(m_pos) + ahead, m_tokens.count - 1);
+        return m_tokens.kinds[idx];
+    }
+
+    std::string_view spelling(u32 idx) const noexcept
+    {
+        return m_tokens.spelling(m_text, idx);
+    }
+
+    bool accept(token_kind kind) noexcept
+    {
+        if (peek() == kind) {
+            ++m_pos;
+            return true;
+        }
+        return false;
+    }
+
+    u32 error(char const *what) noexcept
+    {
+        if (!m_failed) {
+            std::string found = peek() == token_kind::end_of_input ? "end of input" : "'" + std::string(spelling(m_pos)) + "'";
+            m_errors.push_back(source_location_str(m_text, m_tokens.offsets[m_pos]) + ": " + what + ", found " + found);
+            m_failed = true;
+        }
+        return ast_null;
+    }
+
+    bool expect(token_kind kind) noexcept
+    {
+        if (accept(kind)) {
+            return true;
+        }
+        error(make_str("expected '%s'", token_kind_name(kind)).c_str());
+        return false;
+    }
+
+    u32 make_node(ast_kind kind, u32 token, std::initializer_list<u32> children) noexcept
+    {
+        u32 node = m_tree.add_node(kind, token);
+        for (u32 child : children) {
+            if (child != ast_null) {
+                m_tree.add_child(node, child);
+            }
+        }
+        return node;
+    }
+
+    u32 make_node(ast_kind kind, u32 token, std::vector<u32> const &children) noexcept
+    {
+        u32 node = m_tree.add_node(kind, token);
+        for (u32 child : children) {
+            m_tree.add_child(node, child);
+        }
+        return node;
+    }
+
+    /// Interns the spelling of `node`'s token as its name, see `ast::values`.
+    u32 named(u32 node) noexcept
+    {
+        m_tree.values[node] = m_names.intern(spelling(m_tree.tokens[node]));
+        return node;
+    }
+
+    bool is_declaration_start() const noexcept;
+    ast_type parse_type_specifiers() noexcept;
+
+    u32 parse_external_declaration(std::vector<u32> &out_decls) noexcept;
+    u32 parse_function_rest(ast_type type, u32 name_tok) noexcept;
+    bool parse_var_declarators(ast_type type, u32 first_name_tok, std::vector<u32> &out_decls) noexcept;
+
+    u32 parse_statement() noexcept;
+    u32 parse_compound_statement() noexcept;
+
+    u32 parse_expression() noexcept;
+    u32 parse_assignment() noexcept;
+    u32 parse_ternary() noexcept;
+    u32 parse_binary(s32 min_prec) noexcept;
+    u32 parse_unary() noexcept;
+    u32 parse_postfix() noexcept;
+    u32 parse_primary() noexcept;
+
+    void recover(u32 decl_start) noexcept;
+};
+
+static bool is_qualifier_keyword(token_kind kind) noexcept
+{
+    return one_of(kind, { token_kind::kw_const, token_kind::kw_volatile, token_kind::kw_static, token_kind::kw_extern,
+                          token_kind::kw_register, token_kind::kw_inline });
+}
+
+static bool is_type_keyword(token_kind kind) noexcept
+{
+    return one_of(kind, { token_kind::kw_void, token_kind::kw_char, token_kind::kw_short, token_kind::kw_int,
+                          token_kind::kw_long, token_kind::kw_signed, token_kind::kw_unsigned });
+}
+
+bool parser::is_declaration_start() const noexcept
+{
+    return is_type_keyword(peek()) || is_qualifier_keyword(peek());
+}
+
+/// Consumes declaration specifiers, qualifiers and storage classes are accepted and ignored. Every type is
+/// signed: `unsigned` is an error (returning `ast_type::none`) rather than a signed type that silently wraps
+/// and compares the wrong way.
+ast_type parser::parse_type_specifiers() noexcept
+{
+    ast_type type = ast_type::none;
+    bool saw_sign = false;
+
+    for (;; ++m_pos) {
+        token_kind k = peek();
+        if (is_qualifier_keyword(k)) {
+            continue;
+        }
+
+        if (k == token_kind::kw_unsigned) {
+            error("unsigned types are not supported");
+            return ast_type::none;
+        } else if (k == token_kind::kw_signed) {
+            saw_sign = true;
+        } else if (k == token_kind::kw_void) {
+            type = ast_type::void_;
+        } else if (k == token_kind::kw_char) {
+            type = ast_type::char_;
+        } else if (k == token_kind::kw_short) {
+            type = ast_type::short_;
+        } else if (k == token_kind::kw_int) {
+            if (type == ast_type::none) type = ast_type::int_; // `long int`, `short int` keep their width
+        } else if (k == token_kind::kw_long) {
+            type = ast_type::long_;
+        } else {
+            break;
+        }
+    }
+
+    if (type == ast_type::none && saw_sign) {
+        type = ast_type::int_;
+    }
+    return type;
+}
+
+void parser::parse_translation_unit() noexcept
+{
+    std::vector<u32> decls;
+
+    while (peek() != token_kind::end_of_input) {
+        parse_top_level_declaration(m_pos, decls);
+    }
+
+    m_tree.root = make_node(ast_kind::translation_unit, 0, decls);
+}
+
+u32 parser::parse_top_level_declaration(u32 first, std::vector<u32> &decls) noexcept
+{
+    m_pos = first;
+    parse_external_declaration(decls);
+    if (m_failed) {
+        recover(first);
+    }
+    if (m_pos == first) {
+        ++m_pos; // guarantee progress
+    }
+    return m_pos;
+}
+
+/// Skips to the end of the external declaration that started at `decl_start`: just past the next `;` or
+/// closing `}` at nesting depth zero, accounting for the braces already consumed before the error.
+void parser::recover(u32 decl_start) noexcept
+{
+    s64 depth = 0;
+    for (u32 i = decl_start; i < m_pos; ++i) {
+        if (m_tokens.kinds[i] == token_kind::l_brace) ++depth;
+        if (m_tokens.kinds[i] == token_kind::r_brace) --depth;
+    }
+
+    while (peek() != token_kind::end_of_input) {
+        token_kind k = peek();
+        ++m_pos;
+        if (k == token_kind::l_brace) {
+            ++depth;
+        } else if (k == token_kind::r_brace) {
+            if (--depth <= 0) break;
+        } else if (k == token_kind::semicolon && depth == 0) {
+            break;
+        }
+    }
+    m_failed = false;
+}
+
+u32 parser::parse_external_declaration(std::vector<u32> &out_decls) noexcept
+{
+    ast_type type = parse_type_specifiers();
+    if (type == ast_type::none) {
+        return error("expected a declaration");
+    }
+    if (accept(token_kind::semicolon)) {
+        return ast_null; // e.g. `int;`
+    }
+
+    u32 name_tok = m_pos;
+    if (!expect(token_kind::identifier)) {
+        return ast_null;
+    }
+
+    if (peek() == token_kind::l_paren) {
+        u32 fn = parse_function_rest(type, name_tok);
+        if (fn != ast_null) {
+            out_decls.push_back(fn);
+        }
+        return fn;
+    }
+
+    parse_var_declarators(type, name_tok, out_decls);
+    return ast_null;
+}
+
+u32 parser::parse_function_rest(ast_type type, u32 name_tok) noexcept
+{
+    expect(token_kind::l_paren);
+
+    std::vector<u32> children;
+
+    bool void_params = peek() == token_kind::kw_void && peek(1) == token_kind::r_paren;
+    if (void_params) {
+        ++m_pos;
+    }
+    else if (peek() != token_kind::r_paren) {
+        do {
+            ast_type param_type = parse_type_specifiers();
+            if (param_type == ast_type::none) {
+                return error("expected a parameter type");
+            }
+            u32 param_tok = m_pos;
+            if (!expect(token_kind::identifier)) {
+                return ast_null;
+            }
+            u32 param = named(make_node(ast_kind::param_decl, param_tok, {}));
+            m_tree.types[param] = param_type;
+            children.push_back(param);
+        } while (accept(token_kind::comma));
+    }
+    if (!expect(token_kind::r_paren)) {
+        return ast_null;
+    }
+
+    if (!accept(token_kind::semicolon)) {
+        u32 body = parse_compound_statement();
+        if (body == ast_null) {
+            return ast_null;
+        }
+        children.push_back(body);
+    }
+
+    u32 fn = named(make_node(ast_kind::function_decl, name_tok, children));
+    m_tree.types[fn] = type;
+    return fn;
+}
+
+/// Parses `[= init] (, name [= init])* ;` after the first declarator's name.
+bool parser::parse_var_declarators(ast_type type, u32 first_name_tok, std::vector<u32> &out_decls) noexcept
+{
+    u32 name_tok = first_name_tok;
+    for (;;) {
+        u32 init = ast_null;
+        if (accept(token_kind::equal)) {
+            init = parse_assignment();
+            if (init == ast_null) {
+                return false;
+            }
+        }
+        u32 var = named(make_node(ast_kind::var_decl, name_tok, { init }));
+        m_tree.types[var] = type;
+        out_decls.push_back(var);
+
+        if (!accept(token_kind::comma)) {
+            break;
+        }
+        name_tok = m_pos;
+        if (!expect(token_kind::identifier)) {
+            return false;
+        }
+    }
+    return expect(token_kind::semicolon);
+}
+
+// STATEMENTS
+
+u32 parser::parse_compound_statement() noexcept
+{
+    u32 brace_tok = m_pos;
+    if (!expect(token_kind::l_brace)) {
+        return ast_null;
+    }
+
+    std::vector<u32> stmts;
+    while (peek() != token_kind::r_brace) {
+        if (peek() == token_kind::end_of_input) {
+            return error("expected '}'");
+        }
+        u32 stmt = parse_statement();
+        if (stmt == ast_null) {
+            return ast_null;
+        }
+        stmts.push_back(stmt);
+    }
+    ++m_pos; // }
+
+    return make_node(ast_kind::compound_stmt, brace_tok, stmts);
+}
+
+u32 parser::parse_statement() noexcept
+{
+    u32 tok = m_pos;
+
+    if (peek() == token_kind::l_brace) {
+        return parse_compound_statement();
+    }
+    if (accept(token_kind::semicolon)) {
+        return make_node(ast_kind::empty, tok, {});
+    }
+
+    if (is_declaration_start()) {
+        ast_type type = parse_type_specifiers();
+        if (type == ast_type::none) {
+            return error("expected a type");
+        }
+        u32 name_tok = m_pos;
+        if (!expect(token_kind::identifier)) {
+            return ast_null;
+        }
+        std::vector<u32> decls;
+        if (!parse_var_declarators(type, name_tok, decls)) {
+            return ast_null;
+        }
+        return make_node(ast_kind::decl_stmt, tok, decls);
+    }
+
+    if (accept(token_kind::kw_if)) {
+        if (!expect(token_kind::l_paren)) return ast_null;
+        u32 cond = parse_expression();
+        if (cond == ast_null || !expect(token_kind::r_paren)) return ast_null;
+        u32 then = parse_statement();
+        if (then == ast_null) return ast_null;
+        u32 otherwise = ast_null;
+        if (accept(token_kind::kw_else)) {
+            otherwise = parse_statement();
+            if (otherwise == ast_null) return ast_null;
+        }
+        return make_node(ast_kind::if_stmt, tok, { cond, then, otherwise });
+    }
+
+    if (accept(token_kind::kw_while)) {
+        if (!expect(token_kind::l_paren)) return ast_null;
+        u32 cond = parse_expression();
+        if (cond == ast_null || !expect(token_kind::r_paren)) return ast_null;
+        u32 body = parse_statement();
+        if (body == ast_null) return ast_null;
+        return make_node(ast_kind::while_stmt, tok, { cond, body });
+    }
+
+    if (accept(token_kind::kw_do)) {
+        u32 body = parse_statement();
+        if (body == ast_null) return ast_null;
+        if (!accept(token_kind::kw_while)) return error("expected 'while'");
+        if (!expect(token_kind::l_paren)) return ast_null;
+        u32 cond = parse_expression();
+        if (cond == ast_null || !expect(token_kind::r_paren) || !expect(token_kind::semicolon)) return ast_null;
+        return make_node(ast_kind::do_stmt, tok, { body, cond });
+    }
+
+    if (accept(token_kind::kw_for)) {
+        if (!expect(token_kind::l_paren)) return ast_null;
+
+        u32 init;
+        if (peek() == token_kind::semicolon || is_declaration_start()) {
+            init = parse_statement(); // `;` or a declaration, both consume the semicolon
+        } else {
+            u32 expr_tok = m_pos;
+            u32 expr = parse_expression();
+            if (expr == ast_null || !expect(token_kind::semicolon)) return ast_null;
+            init = make_node(ast_kind::expr_stmt, expr_tok, { expr });
+        }
+        if (init == ast_null) return ast_null;
+
+        u32 cond;
+        if (peek() == token_kind::semicolon) {
+            cond = make_node(ast_kind::empty, m_pos, {});
+        } else {
+            cond = parse_expression();
+        }
+        if (cond == ast_null || !expect(token_kind::semicolon)) return ast_null;
+
+        u32 step;
+        if (peek() == token_kind::r_paren) {
+            step = make_node(ast_kind::empty, m_pos, {});
+        } else {
+            step = parse_expression();
+        }
+        if (step == ast_null || !expect(token_kind::r_paren)) return ast_null;
+
+        u32 body = parse_statement();
+        if (body == ast_null) return ast_null;
+        return make_node(ast_kind::for_stmt, tok, { init, cond, step, body });
+    }
+
+    if (accept(token_kind::kw_return)) {
+        u32 value = ast_null;
+        if (peek() != token_kind::semicolon) {
+            value = parse_expression();
+            if (value == ast_null) return ast_null;
+        }
+        if (!expect(token_kind::semicolon)) return ast_null;
+        return make_node(ast_kind::return_stmt, tok, { value });
+    }
+
+    if (accept(token_kind::kw_break)) {
+        if (!expect(token_kind::semicolon)) return ast_null;
+        return make_node(ast_kind::break_stmt, tok, {});
+    }
+
+    if (accept(token_kind::kw_continue)) {
+        if (!expect(token_kind::semicolon)) return ast_null;
+        return make_node(ast_kind::continue_stmt, tok, {});
+    }
+
+    u32 expr = parse_expression();
+    if (expr == ast_null || !expect(token_kind::semicolon)) {
+        return ast_null;
+    }
+    return make_node(ast_kind::expr_stmt, tok, { expr });
+}
+
+// EXPRESSIONS
+
+u32 parser::parse_expression() noexcept
+{
+    return parse_assignment();
+}
+
+static bool is_assignment_op(token_kind kind) noexcept
+{
+    switch (kind) {
+        case token_kind::equal:
+        case token_kind::star_equal:
+        case token_kind::slash_equal:
+        case token_kind::percent_equal:
+        case token_kind::plus_equal:
+        case token_kind::minus_equal:
+        case token_kind::less_less_equal:
+        case token_kind::greater_greater_equal:
+        case token_kind::ampersand_equal:
+        case token_kind::caret_equal:
+        case token_kind::pipe_equal:
+            return true;
+        default:
+            return false;
+    }
+}
+
+u32 parser::parse_assignment() noexcept
+{
+    u32 lhs = parse_ternary();
+    if (lhs == ast_null) {
+        return ast_null;
+    }
+
+    if (!is_assignment_op(peek())) {
+        return lhs;
+    }
+    u32 op_tok = m_pos++;
+    if (m_tree.kinds[lhs] != ast_kind::identifier) {
+        m_pos = op_tok;
+        return error("expression is not assignable");
+    }
+
+    u32 rhs = parse_assignment(); // right associative
+    if (rhs == ast_null) {
+        return ast_null;
+    }
+    return make_node(ast_kind::assign, op_tok, { lhs, rhs });
+}
+
+u32 parser::parse_ternary() noexcept
+{
+    u32 cond = parse_binary(1);
+    if (cond == ast_null || peek() != token_kind::question) {
+        return cond;
+    }
+    u32 tok = m_pos++;
+
+    u32 if_true = parse_expression();
+    if (if_true == ast_null || !expect(token_kind::colon)) {
+        return ast_null;
+    }
+    u32 if_false = parse_ternary();
+    if (if_false == ast_null) {
+        return ast_null;
+    }
+    return make_node(ast_kind::ternary, tok, { cond, if_true, if_false });
+}
+
+static s32 binary_precedence(token_kind kind) noexcept
+{
+    switch (kind) {
+        case token_kind::star: case token_kind::slash: case token_kind::percent:        return 10;
+        case token_kind::plus: case token_kind::minus:                                   return 9;
+        case token_kind::less_less: case token_kind::greater_greater:                    return 8;
+        case token_kind::less: case token_kind::greater:
+        case token_kind::less_equal: case token_kind::greater_equal:                     return 7;
+        case token_kind::equal_equal: case token_kind::exclaim_equal:                    return 6;
+        case token_kind::ampersand:                                                      return 5;
+        case token_kind::caret:                                                          return 4;
+        case token_kind::pipe:                                                           return 3;
+        case token_kind::ampersand_ampersand:                                            return 2;
+        case token_kind::pipe_pipe:                                                      return 1;
+        default:                                                                         return 0;
+    }
+}
+
+/// Precedence climbing over the left-associative binary operators.
+u32 parser::parse_binary(s32 min_prec) noexcept
+{
+    u32 lhs = parse_unary();
+    if (lhs == ast_null) {
+        return ast_null;
+    }
+
+    for (;;) {
+        s32 prec = binary_precedence(peek());
+        if (prec == 0 || prec < min_prec) {
+            return lhs;
+        }
+        u32 op_tok = m_pos++;
+        u32 rhs = parse_binary(prec + 1);
+        if (rhs == ast_null) {
+            return ast_null;
+        }
+        lhs = make_node(ast_kind::binary, op_tok, { lhs, rhs });
+    }
+}
+
+u32 parser::parse_unary() noexcept
+{
+    token_kind k = peek();
+    if (one_of(k, { token_kind::minus, token_kind::plus, token_kind::exclaim, token_kind::tilde,
+                    token_kind::plus_plus, token_kind::minus_minus })) {
+        u32 op_tok = m_pos++;
+        u32 operand = parse_unary();
+        if (operand == ast_null) {
+            return ast_null;
+        }
+        if ((k == token_kind::plus_plus || k == token_kind::minus_minus) && m_tree.kinds[operand] != ast_kind::identifier) {
+            m_pos = op_tok + 1;
+            return error("operand of increment/decrement is not assignable");
+        }
+        return make_node(ast_kind::unary, op_tok, { operand });
+    }
+    return parse_postfix();
+}
+
+u32 parser::parse_postfix() noexcept
+{
+    u32 expr = parse_primary();
+
+    while (expr != ast_null) {
+        token_kind k = peek();
+        if (k == token_kind::plus_plus || k == token_kind::minus_minus) {
+            if (m_tree.kinds[expr] != ast_kind::identifier) {
+                return error("operand of increment/decrement is not assignable");
+            }
+            u32 op_tok = m_pos++;
+            expr = make_node(ast_kind::postfix, op_tok, { expr });
+        }
+        else if (k == token_kind::l_paren) {
+            return error("only named functions can be called");
+        }
+        else {
+            break;
+        }
+    }
+
+    return expr;
+}
+
+u32 parser::parse_primary() noexcept
+{
+    u32 tok = m_pos;
+
+    switch (peek()) {
+        case token_kind::number: {
+            u64 value;
+            if (!parse_integer_literal(spelling(tok), value)) {
+                return error("invalid integer literal");
+            }
+            ++m_pos;
+            return make_node(ast_kind::int_literal, tok, {});
+        }
+        case token_kind::char_literal: {
+            s64 value;
+            if (!parse_char_literal(spelling(tok), value)) {
+                return error("invalid character literal");
+            }
+            ++m_pos;
+            return make_node(ast_kind::char_literal, tok, {});
+        }
+        case token_kind::string_literal: {
+            u32 pieces = 0;
+            while (peek() == token_kind::string_literal) {
+                ++m_pos;
+                ++pieces;
+            }
+            u32 node = make_node(ast_kind::string_literal, tok, {});
+            m_tree.values[node] = pieces;
+            return node;
+        }
+        case token_kind::identifier: {
+            ++m_pos;
+            if (!accept(token_kind::l_paren)) {
+                return named(make_node(ast_kind::identifier, tok, {}));
+            }
+
+            std::vector<u32> args;
+            if (peek() != token_kind::r_paren) {
+                do {
+                    u32 arg = parse_assignment();
+                    if (arg == ast_null) {
+                        return ast_null;
+                    }
+                    args.push_back(arg);
+                } while (accept(token_kind::comma));
+            }
+            if (!expect(token_kind::r_paren)) {
+                return ast_null;
+            }
+            return named(make_node(ast_kind::call, tok, args));
+        }
+        case token_kind::l_paren: {
+            ++m_pos;
+            u32 inner = parse_expression();
+            if (inner == ast_null || !expect(token_kind::r_paren)) {
+                return ast_null;
+            }
+            return inner;
+        }
+        default:
+            return error("expected an expression");
+    }
+}
+
+bool parse_tokens(std::string_view text, token_buffer const &tokens, ast &out, intern_table &names, std::vector<std::string> &errors) noexcept
+{
+    assert(tokens.count > 0 && tokens.kinds[tokens.count - 1] == token_kind::end_of_input);
+
+    u64 errors_before = errors.size();
+    parser p(text, tokens, out, names, errors);
+    p.parse_translation_unit();
+    return errors.size() == errors_before;
+}
+
+u32 parse_top_level_declaration(std::string_view text, token_buffer const &tokens, u32 first, ast &out, intern_table &names,
+                                std::vector<u32> &decls, std::vector<std::string> &errors) noexcept
+{
+    assert(first < tokens.count && tokens.kinds[first] != token_kind::end_of_input);
+    assert(tokens.kinds[tokens.count - 1] == token_kind::end_of_input);
+
+    parser p(text, tokens, out, names, errors);
+    return p.parse_top_level_declaration(first, decls);
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+
+struct ast;
+struct intern_table;
+struct token_buffer;
+
+/// Converts a byte offset in `text` to a "line:column" string (both 1-based) for diagnostics.
+std::string source_location_str(std::string_view text, u64 offset) noexcept;
+
+/// Builds the AST for `tokens` (lexed from `text`) into `out`, which must already be `init`ed on an arena.
+/// Parses the C subset the compiler currently supports: functions, global and local integer variables, the
+/// usual statements, and expressions with C's unary, binary, conditional and (compound) assignment operators at
+/// C's precedence. Missing from the expression grammar: the comma operator, `sizeof`, casts, pointers (unary `&`
+/// and `*`), subscripts, member access (`.` and `->`) and calls of anything but a function name; assignment and
+/// `++`/`--` only apply to a variable name.
+/// Names of declarations, identifiers and callees are interned into `names` (see `ast::values`).
+/// Errors are appended to `errors` as "line:col: message", returns false if there were any.
+bool parse_tokens(std::string_view text, token_buffer const &tokens, ast &out, intern_table &names, std::vector<std::string> &errors) noexcept;
+
+/// Parses the one external declaration (a function, or a declaration of one or more globals) starting at token
+/// `first`, exactly as `parse_tokens` would: its nodes are appended to `out`, the declarations it declares to
+/// `decls` and an error, if any, to `errors`, after which it skips to the end of the declaration. Returns the token
+/// the next external declaration starts at. The result depends only on the tokens from `first` on, so an edit
+/// needs only the declarations it touched re-parsed. The translation_unit root is left to the caller.
+u32 parse_top_level_declaration(std::string_view text, token_buffer const &tokens, u32 first, ast &out, intern_table &names,
+                                std::vector<u32> &decls, std::vector<std::string> &errors) noexcept;
@@ -1,5 +1,31 @@
+#include <QDebug>
+#include <QDir>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QMessageBox>
+#include <QStringList>
+
+#include "lexer.hpp"
+#include "ast_layout.hpp"
+#include "source_index.hpp"
+#include "cfg_layout.hpp"
+#include "compiler.hpp"
+#include "differential.hpp"
+#include "driver.hpp"
+#include "elf.hpp"
+#include "output_compare.hpp"
+#include "incremental.hpp"
+#include "interpreter.hpp"
+#include "jit.hpp"
+#include "optimizer.hpp"
+#include "regalloc.hpp"
+#include "superinstructions.hpp"
+#include "test_suite.hpp"
+#include "text_document.hpp"
+
 #include "CompilerTestsWindow.hpp"
 #include "CompilationFlowWindow.hpp"
+#include "DocumentViewer.hpp"
 
 #include "populateCommonMenuBar.hpp"
 
@@ -19,6 +45,28 @@ void populateCommonMenuBar(QMenuBar *menu_bar)
             w->resize(1600, 900);
             w->show();
         });
+
+        QAction *open_document_action = new QAction("Open &Document...", menu_bar);
+
+        window_menu->addAction(open_document_action);
+
+        QObject::connect(open_document_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString path = QFileDialog::getOpenFileName(menu_bar, "Document to view");
+            if (path.isEmpty())
+                return;
+            auto document = std::make_shared<text_document>();
+            std::string error;
+            if (!text_document_open(*document, path.toUtf8().constData(), error)) {
+                QMessageBox::critical(menu_bar, "Open Document", QString::fromStdString(error));
+                return;
+            }
+            DocumentViewer *w = new DocumentViewer(nullptr);
+            w->setAttribute(Qt::WA_DeleteOnClose);
+            w->setWindowTitle(QString("%1 (%2 lines)").arg(path).arg(document->line_count()));
+            w->setDocument(std::move(document));
+            w->resize(1200, 900);
+            w->show();
+        });
     }
     {
         QMenu *debug_menu = menu_bar->addMenu("&Debug");
@@ -31,5 +79,319 @@ void populateCommonMenuBar(QMenuBar *menu_bar)
             int *p = new int[4];
             p[4] = 123; // intentional heap buffer overflow
         });
+
+        QAction *cached_tests_action = new QAction("Run Tests with &Cache...", menu_bar);
+
+        debug_menu->addAction(cached_tests_action);
+
+        QObject::connect(cached_tests_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString csvPath = QFileDialog::getOpenFileName(menu_bar, "Tests CSV to run", QString(), "CSV (*.csv)");
+            if (csvPath.isEmpty())
+                return;
+            QDir testsDir = QFileInfo(csvPath).dir();
+            QString dataDir = testsDir.filePath("data");
+            // Next to the tests, so every run of the same CSV shares it.
+            QString cacheDir = testsDir.filePath(".cache");
+
+            std::vector<compiler_test> tests;
+            std::string error;
+            if (!load_compiler_tests(csvPath.toUtf8().constData(), tests, error)) {
+                qDebug() << "Run tests:" << QString::fromStdString(error);
+                return;
+            }
+            compiler_test_run run = run_compiler_tests(tests, dataDir.toUtf8().constData(), cacheDir.toUtf8().constData());
+            qDebug().nospace()
+                << "Tests: " << run.passed << " passed, " << run.failed << " failed in " << run.elapsed_us << " us"
+                << " | cache: " << QString::fromStdString(compile_cache_stats_to_string(run.cache));
+            for (u64 i = 0; i < tests.size(); ++i) {
+                if (!run.results[i].passed) {
+                    qDebug().nospace() << "  " << QString::fromStdString(tests[i].name) << ": " << QString::fromStdString(run.results[i].detail);
+                }
+            }
+        });
+
+        QAction *lexer_benchmark_action = new QAction("Benchmark &Lexer", menu_bar);
+
+        debug_menu->addAction(lexer_benchmark_action);
+
+        QObject::connect(lexer_benchmark_action, &QAction::triggered, menu_bar, []() {
+            lexer_benchmark_result r = lexer_benchmark();
+            qDebug().nospace()
+                << "Lexer benchmark: " << r.input_bytes << " bytes, " << r.token_count << " tokens, best of " << r.iterations
+                << " | scalar " << r.scalar_mb_per_sec << " MB/s"
+                << " | " << r.simd_isa << ' ' << r.simd_mb_per_sec << " MB/s";
+        });
+
+        QAction *interpreter_benchmark_action = new QAction("Benchmark &Interpreter", menu_bar);
+
+        debug_menu->addAction(interpreter_benchmark_action);
+
+        QObject::connect(interpreter_benchmark_action, &QAction::triggered, menu_bar, []() {
+            interpreter_benchmark_result r = interpreter_benchmark();
+            qDebug().nospace()
+                << "Interpreter benchmark: " << r.instructions << " instructions"
+                << " | switch " << r.switch_ns_per_inst << " ns/inst (" << r.switch_vs_native << "x native)"
+                << " | threaded " << r.threaded_ns_per_inst << " ns/inst (" << r.threaded_vs_native << "x native)"
+                << " | native " << r.native_best_us << " us";
+        });
+
+        QAction *optimizer_benchmark_action = new QAction("Benchmark &Optimizer", menu_bar);
+
+        debug_menu->addAction(optimizer_benchmark_action);
+
+        QObject::connect(optimizer_benchmark_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString path = QFileDialog::getOpenFileName(menu_bar, "C file to optimize", QString(), "C (*.c *.h)");
+            if (path.isEmpty())
+                return;
+
+            optimizer_benchmark_result r = optimizer_benchmark(path.toUtf8().constData());
+            qDebug().nospace()
+                << "Optimizer benchmark: " << path
+                << " | dispatches " << r.dispatches_before << " -> " << r.dispatches_after
+                << " | time " << r.best_us_before << " -> " << r.best_us_after << " us";
+            qDebug().noquote() << QString::fromStdString(ir_optimization_stats_to_string(r.stats));
+            for (std::string const &e : r.errors) {
+                qDebug() << "  error:" << QString::fromStdString(e);
+            }
+        });
+
+        QAction *superinstruction_benchmark_action = new QAction("Benchmark &Superinstructions", menu_bar);
+
+        debug_menu->addAction(superinstruction_benchmark_action);
+
+        QObject::connect(superinstruction_benchmark_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString csvPath = QFileDialog::getOpenFileName(menu_bar, "Tests CSV to profile", QString(), "CSV (*.csv)");
+            if (csvPath.isEmpty())
+                return;
+            // Same layout as the repo: tests/compiler.csv next to tests/data
+            QString dataDir = QFileInfo(csvPath).dir().filePath("data");
+
+            superinstruction_benchmark_result r = superinstruction_benchmark(csvPath.toUtf8().constData(), dataDir.toUtf8().constData());
+            qDebug().nospace()
+                << "Superinstruction benchmark: " << r.programs << " programs"
+                << " | static " << r.static_before << " -> " << r.static_after << " instructions"
+                << " | dispatches " << r.dispatches_before << " -> " << r.dispatches_after
+                << " | time " << r.best_us_before << " -> " << r.best_us_after << " us";
+            for (auto const &pair : r.hottest_pairs) {
+                qDebug().nospace() << "  " << ir_op_name(pair.first) << " + " << ir_op_name(pair.second) << ": " << pair.count;
+            }
+            for (std::string const &e : r.errors) {
+                qDebug() << "  error:" << QString::fromStdString(e);
+            }
+        });
+
+        QAction *jit_benchmark_action = new QAction("Benchmark &JIT", menu_bar);
+
+        debug_menu->addAction(jit_benchmark_action);
+
+        QObject::connect(jit_benchmark_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString csvPath = QFileDialog::getOpenFileName(menu_bar, "Tests CSV to run", QString(), "CSV (*.csv)");
+            if (csvPath.isEmpty())
+                return;
+            QString dataDir = QFileInfo(csvPath).dir().filePath("data");
+
+            jit_benchmark_result r = jit_benchmark(csvPath.toUtf8().constData(), dataDir.toUtf8().constData());
+            qDebug().nospace()
+                << "JIT benchmark: " << r.programs << " programs"
+                << " | compile " << r.compile_us << " us, " << r.code_bytes << " bytes"
+                << " | interpreter " << r.interpreter_best_us << " us"
+                << " | JIT " << r.jit_best_us << " us"
+                << " | " << r.speedup << "x";
+            for (std::string const &e : r.errors) {
+                qDebug() << "  error:" << QString::fromStdString(e);
+            }
+        });
+
+        QAction *regalloc_benchmark_action = new QAction("Benchmark &Register Allocator", menu_bar);
+
+        debug_menu->addAction(regalloc_benchmark_action);
+
+        QObject::connect(regalloc_benchmark_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString csvPath = QFileDialog::getOpenFileName(menu_bar, "Tests CSV to run", QString(), "CSV (*.csv)");
+            if (csvPath.isEmpty())
+                return;
+            QString dataDir = QFileInfo(csvPath).dir().filePath("data");
+
+            regalloc_benchmark_result r = regalloc_benchmark(csvPath.toUtf8().constData(), dataDir.toUtf8().constData());
+            qDebug().nospace()
+                << "Register allocator benchmark: " << r.programs << " programs"
+                << " | stack slots: " << r.naive_code_bytes << " bytes, "
+                << r.naive.reloads << " reloads, " << r.naive.spill_stores << " stores, " << r.naive_best_us << " us"
+                << " | linear scan: " << r.linear_scan_code_bytes << " bytes, "
+                << r.linear_scan.spilled << "/" << r.linear_scan.intervals << " intervals spilled, "
+                << r.linear_scan.reloads << " reloads, " << r.linear_scan.spill_stores << " stores, "
+                << r.linear_scan.moves_eliminated << " moves eliminated, " << r.linear_scan_best_us << " us";
+            for (std::string const &e : r.errors) {
+                qDebug() << "  error:" << QString::fromStdString(e);
+            }
+        });
+
+        QAction *write_object_action = new QAction("Write &Object File...", menu_bar);
+
+        debug_menu->addAction(write_object_action);
+
+        QObject::connect(write_object_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString sourcePath = QFileDialog::getOpenFileName(menu_bar, "C file to compile", QString(), "C (*.c *.h)");
+            if (sourcePath.isEmpty())
+                return;
+            QFileInfo sourceInfo(sourcePath);
+            QString objectPath = QFileDialog::getSaveFileName(menu_bar, "Object file", sourceInfo.dir().filePath(sourceInfo.completeBaseName() + ".o"), "ELF object (*.o)");
+            if (objectPath.isEmpty())
+                return;
+
+            compilation comp;
+            std::string error;
+            if (!compilation_load_file(comp, sourcePath.toUtf8().constData())) {
+                error = "cannot read " + sourcePath.toStdString();
+            } else if (!compile_to_ir(comp)) {
+                error = comp.errors.empty() ? "compilation failed" : comp.errors.front();
+            } else if (elf_write_object_file(comp.ir, objectPath.toUtf8().constData(), error)) {
+                qDebug() << "Wrote" << objectPath;
+                return;
+            }
+            qDebug() << "Write object file:" << QString::fromStdString(error);
+        });
+
+        QAction *driver_benchmark_action = new QAction("Benchmark &Parallel Driver...", menu_bar);
+
+        debug_menu->addAction(driver_benchmark_action);
+
+        QObject::connect(driver_benchmark_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            // Cancelling the dialog benchmarks a generated set of translation units instead.
+            QStringList sourcePaths = QFileDialog::getOpenFileNames(menu_bar, "C files to compile together", QString(), "C (*.c)");
+            std::vector<std::string> paths;
+            for (QString const &path : sourcePaths) {
+                paths.push_back(path.toStdString());
+            }
+
+            driver_benchmark_result r = driver_benchmark(paths);
+            qDebug().nospace()
+                << "Parallel driver benchmark: " << r.units << " translation units, " << r.source_bytes << " bytes"
+                << " | " << r.ir_instructions << " IR instructions";
+            for (driver_scaling_point const &p : r.points) {
+                qDebug().nospace()
+                    << "  " << p.threads << " threads: " << p.best_us << " us, " << p.speedup << "x, "
+                    << p.steals << " steals" << (p.identical ? "" : " | OUTPUT DIFFERS from 1 thread");
+            }
+            for (std::string const &e : r.errors) {
+                qDebug() << "  error:" << QString::fromStdString(e);
+            }
+        });
+
+        QAction *elf_benchmark_action = new QAction("Benchmark &ELF Writer", menu_bar);
+
+        debug_menu->addAction(elf_benchmark_action);
+
+        QObject::connect(elf_benchmark_action, &QAction::triggered, menu_bar, []() {
+            // A generated translation unit, large enough for a stable bytes-per-second figure.
+            elf_benchmark_result r = elf_benchmark(nullptr);
+            qDebug().nospace()
+                << "ELF writer benchmark: " << r.functions << " functions from " << r.source_bytes << " bytes of C"
+                << " | " << r.code_bytes << " bytes of code, " << r.object_bytes << " byte object"
+                << " | codegen " << r.codegen_best_us << " us, write " << r.write_best_us << " us"
+                << " | " << r.code_mb_per_sec << " MB/s of machine code";
+            for (std::string const &e : r.errors) {
+                qDebug() << "  error:" << QString::fromStdString(e);
+            }
+        });
+
+        QAction *incremental_benchmark_action = new QAction("Benchmark &Incremental Front End", menu_bar);
+
+        debug_menu->addAction(incremental_benchmark_action);
+
+        QObject::connect(incremental_benchmark_action, &QAction::triggered, menu_bar, []() {
+            incremental_benchmark_result r = incremental_benchmark();
+            qDebug().nospace() << "Incremental front end benchmark: " << r.edits << " one-character edits per source";
+            for (incremental_benchmark_point const &p : r.points) {
+                qDebug().nospace()
+                    << "  " << p.source_bytes << " bytes: full " << p.full_us << " us, incremental " << p.incremental_us << " us"
+                    << (p.identical ? "" : " | RESULTS DIFFER from a full compile");
+            }
+            qDebug().nospace() << "  incremental grows by " << r.incremental_ns_per_kb << " ns per KB of source after the edit";
+        });
+
+        QAction *ast_layout_benchmark_action = new QAction("Benchmark &AST Renderer", menu_bar);
+
+        debug_menu->addAction(ast_layout_benchmark_action);
+
+        QObject::connect(ast_layout_benchmark_action, &QAction::triggered, menu_bar, []() {
+            ast_layout_benchmark_result r = ast_layout_benchmark();
+            qDebug().nospace()
+                << "AST renderer benchmark: " << r.nodes << " nodes, layout " << r.build_us << " us"
+                << (r.overlaps == 0 ? "" : " | BOXES OVERLAP")
+                << " | per frame over " << r.frames << " viewports: 1:1 " << r.zoomed_in_frame_us << " us ("
+                << r.zoomed_in_visible << " boxes), whole tree " << r.zoomed_out_frame_us << " us ("
+                << r.zoomed_out_visible << " boxes)";
+        });
+
+        QAction *source_index_benchmark_action = new QAction("Benchmark &Source Index", menu_bar);
+
+        debug_menu->addAction(source_index_benchmark_action);
+
+        QObject::connect(source_index_benchmark_action, &QAction::triggered, menu_bar, []() {
+            source_index_benchmark_result r = source_index_benchmark();
+            qDebug().nospace()
+                << "Source index benchmark: " << r.tokens << " tokens, " << r.nodes << " nodes, " << r.instructions
+                << " instructions, built in " << r.build_us << " us | " << r.lookups << " lookups: by offset "
+                << r.offset_lookup_ns << " ns, by instruction " << r.inst_lookup_ns << " ns";
+        });
+
+        QAction *cfg_layout_benchmark_action = new QAction("Benchmark &CFG Layout", menu_bar);
+
+        debug_menu->addAction(cfg_layout_benchmark_action);
+
+        QObject::connect(cfg_layout_benchmark_action, &QAction::triggered, menu_bar, []() {
+            cfg_layout_benchmark_result r = cfg_layout_benchmark();
+            qDebug().nospace()
+                << "CFG layout benchmark: " << r.instructions << " instructions, " << r.blocks << " blocks, " << r.edges
+                << " edges, " << r.dummies << " dummy nodes in " << r.layers << " layers, " << r.crossings
+                << " crossings, laid out in " << r.build_us << " us | " << r.frames << " frames: " << r.frame_us
+                << " us, " << r.frame_visible << " blocks and segments each";
+        });
+
+        QAction *text_document_benchmark_action = new QAction("Benchmark Document &Index", menu_bar);
+
+        debug_menu->addAction(text_document_benchmark_action);
+
+        QObject::connect(text_document_benchmark_action, &QAction::triggered, menu_bar, []() {
+            text_document_benchmark_result r = text_document_benchmark();
+            qDebug().nospace()
+                << "Document index benchmark: " << r.bytes << " bytes, " << r.lines << " lines, opened in "
+                << r.open_best_us << " us | indexing: scalar " << r.scalar_mb_per_sec << " MB/s, " << r.simd_isa << " "
+                << r.simd_mb_per_sec << " MB/s (best of " << r.iterations << ")";
+        });
+
+        QAction *output_compare_benchmark_action = new QAction("Benchmark O"Benchmark Output &Comparison"utput Comparison", menu_bar);
+
+        debug_menu->addAction(output_compare_benchmark_action);
+
+        QObject::connect(output_compare_benchmark_action, &QAction::triggered, menu_bar, []() {
+            output_compare_benchmark_result r = output_compare_benchmark();
+            qDebug().nospace()
+                << "Output comparison benchmark: " << r.bytes << " bytes | buffered " << r.buffered_us << " us, holding "
+                << r.buffered_peak_bytes << " bytes | streamed " << r.streamed_us << " us, holding " << r.streamed_peak_bytes
+                << " bytes | stopped at the first difference in " << r.early_stop_us << " us | mismatch search: scalar "
+                << r.scalar_mb_per_sec << " MB/s, " << r.simd_isa << " " << r.simd_mb_per_sec << " MB/s";
+        });
+
+        QAction *differential_benchmark_action = new QAction("Benchmark Against System C &Compilers...", menu_bar);
+
+        debug_menu->addAction(differential_benchmark_action);
+
+        QObject::connect(differential_benchmark_action, &QAction::triggered, menu_bar, [menu_bar]() {
+            QString csvPath = QFileDialog::getOpenFileName(menu_bar, "Tests CSV to benchmark", QString(), "CSV (*.csv)");
+            if (csvPath.isEmpty())
+                return;
+            QString dataDir = QFileInfo(csvPath).dir().filePath("data");
+
+            std::vector<compiler_test> tests;
+            std::string error;
+            if (!load_compiler_tests(csvPath.toUtf8().constData(), tests, error)) {
+                qDebug() << "Differential benchmark:" << QString::fromStdString(error);
+                return;
+            }
+            differential_benchmark_result r = differential_benchmark(tests, dataDir.toUtf8().constData());
+            qDebug().noquote() << "Differential benchmark:\n" + QString::fromStdString(differential_benchmark_to_string(r));
+        });
     }
 }
\ No newline at end of file
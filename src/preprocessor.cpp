@@ -0,0 +1,1288 @@
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "util.hpp"
+#include "mapped_file.hpp"
+#include "lexer.hpp"
+#include "text_document.hpp"
+
+#include "preprocessor.hpp"
+
+namespace fs = std::filesystem;
+
+// INCLUDE CACHE
+
+enum class include_guard_kind : u8
+{
+    none,
+    macro, // #ifndef X / #define X ... #endif wrapping the whole file
+};
+
+struct cached_file
+{
+    std::string path; // canonical
+    fs::file_time_type mtime;
+    std::string text;
+    token_buffer tokens;
+    std::vector<u32> line_starts;
+    include_guard_kind guard_kind = include_guard_kind::none;
+    std::string guard_macro;
+
+    /// Line and column (both from 0) of byte `offset`.
+    std::pair<u32, u32> position(u32 offset) const noexcept
+    {
+        u32 line = u32(std::upper_bound(line_starts.begin(), line_starts.end(), offset) - line_starts.begin()) - 1;
+        return { line, offset - line_starts[line] };
+    }
+};
+
+static std::mutex s_cache_mutex;
+static std::unordered_map<std::string, std::shared_ptr<cached_file const>> s_cache;
+static u64 s_cache_hits = 0;
+static u64 s_cache_misses = 0;
+
+/// Tokens of the directive line starting at `hash_idx` (the `#`), excluding the `#` itself.
+static std::pair<u64, u64> directive_line(token_buffer const &tokens, u64 hash_idx) noexcept
+{
+    u64 first = hash_idx + 1;
+    u64 last = first;
+    while (last < tokens.count && !(tokens.flags[last] & token_flag_line_start)) {
+        ++last;
+    }
+    return { first, last };
+}
+
+static bool is_directive_start(token_buffer const &tokens, u64 idx) noexcept
+{
+    return tokens.kinds[idx] == token_kind::hash && (tokens.flags[idx] & token_flag_line_start);
+}
+
+/// Recognizes the classic guard: the file's first directive is `#ifndef X` (or `#if !defined X`) followed by
+/// `#define X`, and its matching `#endif` is the last thing in the file. `#pragma once` is not looked for here,
+/// it only counts once the preprocessor reaches it (not inside `#if 0`), see `m_once_included`.
+static void detect_include_guard(cached_file &file) noexcept
+{
+    token_buffer const &tokens = file.tokens;
+    std::string_view text = file.text;
+
+    auto spelling = [&](u64 idx) { return tokens.spelling(text, idx); };
+    auto is_ident = [&](u64 idx, std::string_view s) {
+        return token_is_identifier_like(tokens.kinds[idx]) && spelling(idx) == s;
+    };
+
+    if (tokens.count < 2 || !is_directive_start(tokens, 0)) {
+        return;
+    }
+
+    std::string_view candidate;
+    {
+        auto [first, last] = directive_line(tokens, 0);
+        u64 n = last - first;
+        if (n == 2 && is_ident(first, "ifndef") && token_is_identifier_like(tokens.kinds[first + 1])) {
+            candidate = spelling(first + 1);
+        }
+        else if (n >= 4 && is_ident(first, "if") && tokens.kinds[first + 1] == token_kind::exclaim && is_ident(first + 2, "defined")) {
+            if (n == 4 && token_is_identifier_like(tokens.kinds[first + 3])) {
+                candidate = spelling(first + 3);
+            }
+            else if (n == 6 && tokens.kinds[first + 3] == token_kind::l_paren && tokens.kinds[first + 5] == token_kind::r_paren) {
+                candidate = spelling(first + 4);
+            }
+        }
+        if (candidate.empty()) {
+            return;
+        }
+
+        if (last >= tokens.count || !is_directive_start(tokens, last)) {
+            return;
+        }
+        auto [def_first, def_last] = directive_line(tokens, last);
+        if (def_last - def_first < 2 || !is_ident(def_first, "define") || spelling(def_first + 1) != candidate) {
+            return;
+        }
+    }
+
+    // Find the #endif that closes the opening conditional, nothing but end_of_input may follow it.
+    s64 depth = 0;
+    for (u64 i = 0; i < tokens.count; ++i) {
+        if (!is_directive_start(tokens, i)) {
+            continue;
+        }
+        auto [first, last] = directive_line(tokens, i);
+        if (first == last) {
+            continue;
+        }
+        std::string_view name = spelling(first);
+        if (one_of(name, { std::string_view("if"), std::string_view("ifdef"), std::string_view("ifndef") })) {
+            ++depth;
+        }
+        else if (depth == 1 && one_of(name, { std::string_view("else"), std::string_view("elif") })) {
+            return;
+        }
+        else if (name == "endif") {
+            if (--depth == 0) {
+                if (tokens.kinds[last] == token_kind::end_of_input) {
+                    file.guard_kind = include_guard_kind::macro;
+                    file.guard_macro = std::string(candidate);
+                }
+                return;
+            }
+        }
+        i = last - 1;
+    }
+}
+
+static std::shared_ptr<cached_file> make_cached_file(std::string path, std::string text) noexcept
+{
+    auto file = std::make_shared<cached_file>();
+    file->path = std::move(path);
+    file->text = std::move(text);
+    lex(file->text, file->tokens);
+    index_lines(file->text, file->line_starts);
+    detect_include_guard(*file);
+    return file;
+}
+
+/// Returns the cached contents of `canonical_path`, reading and lexing it if it is absent or stale.
+/// `was_hit` reports whether the cache served the request. Returns nullptr if the file cannot be read.
+static std::shared_ptr<cached_file const> include_cache_get(std::string const &canonical_path, bool &was_hit) noexcept
+{
+    std::error_code ec;
+    fs::file_time_type mtime = fs::last_write_time(canonical_path, ec);
+    if (ec) {
+        return nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(s_cache_mutex);
+        auto it = s_cache.find(canonical_path);
+        if (it != s_cache.end() && it->second->mtime == mtime) {
+            ++s_cache_hits;
+            was_hit = true;
+            return it->second;
+        }
+    }
+
+    // Read and lex outside the lock, another thread racing on the same file only costs duplicate work.
+    mapped_file mapping;
+    if (!mapping.open(canonical_path.c_str())) {
+        return nullptr;
+    }
+    auto file = make_cached_file(canonical_path, std::string(mapping.view()));
+    file->mtime = mtime;
+    mapping.close();
+
+    std::lock_guard<std::mutex> lock(s_cache_mutex);
+    ++s_cache_misses;
+    was_hit = false;
+    s_cache[canonical_path] = file;
+    return file;
+}
+
+include_cache_stats include_cache_get_stats() noexcept
+{
+    std::lock_guard<std::mutex> lock(s_cache_mutex);
+
+    include_cache_stats stats = {};
+    stats.entries = s_cache.size();
+    stats.hits = s_cache_hits;
+    stats.misses = s_cache_misses;
+    for (auto const &[path, file] : s_cache) {
+        stats.bytes += file->text.size();
+    }
+    return stats;
+}
+
+void include_cache_clear() noexcept
+{
+    std::lock_guard<std::mutex> lock(s_cache_mutex);
+    s_cache.clear();
+    s_cache_hits = 0;
+    s_cache_misses = 0;
+}
+
+// PREPROCESSOR
+
+struct macro_def;
+
+/// The chain of macros a token was produced by, used to stop recursive expansion.
+struct expansion_ctx
+{
+    macro_def const *macro;
+    expansion_ctx const *parent;
+};
+
+struct pp_token
+{
+    std::string_view spelling;
+    expansion_ctx const *ctx = nullptr;
+    cached_file const *file = nullptr; // where the token is, or the invocation of the macro it came from
+    u32 offset = 0;
+    token_kind kind = token_kind::unknown;
+    u8 flags = 0;
+    bool painted = false;     // names a macro that was disabled when seen, must never expand
+    bool paste_op = false;    // a ## from a macro body (as opposed to one passed in an argument)
+    bool placemarker = false; // stands in for an empty argument next to ##
+};
+
+struct macro_def
+{
+    std::string name;
+    bool function_like = false;
+    bool variadic = false;
+    std::vector<std::string> params; // __VA_ARGS__ is the last param of variadic macros
+    std::vector<pp_token> body;
+};
+
+struct conditional_frame
+{
+    bool parent_active;
+    bool active;
+    bool any_taken;
+    bool seen_else;
+};
+
+struct pp_cursor
+{
+    cached_file const *file = nullptr;
+    u64 idx = 0;
+};
+
+class preprocessor
+{
+public:
+    preprocessor(preprocessor_options const &options, preprocess_result &out) noexcept
+        : m_options(options), m_out(out)
+    {
+        std::string predefined = "#define __STDC__ 1\n#define __STDC_VERSION__ 199901L\n";
+        for (auto const &[name, value] : options.defines) {
+            predefined += "#define " + name + " " + value + "\n";
+        }
+        auto file = make_cached_file("<predefined>", std::move(predefined));
+        m_retained.push_back(file);
+        process(*file);
+    }
+
+    /// Preprocesses the main file, whose lines the output starts out matching.
+    void run(cached_file const &main_file) noexcept
+    {
+        m_out.files.push_back(main_file.path);
+        m_out.line_marks.push_back({ 1, 0, 1 });
+        m_file_indices[&main_file] = 0;
+        m_out_file = &main_file;
+        process(main_file);
+    }
+
+    void process(cached_file const &file) noexcept;
+
+private:
+    preprocessor_options const &m_options;
+    preprocess_result &m_out;
+
+    std::unordered_map<std::string, macro_def> m_macros;
+    std::unordered_set<std::string> m_once_included;
+    std::vector<std::shared_ptr<cached_file const>> m_retained; // keeps token spellings alive
+    std::deque<std::string> m_generated;                         // stable storage for synthesized spellings
+    std::deque<expansion_ctx> m_contexts;
+
+    std::deque<pp_token> m_pending; // expanded tokens to be read before the cursor
+    pp_cursor m_cursor;
+    std::vector<conditional_frame> m_conditionals;
+    u32 m_include_depth = 0;
+    bool m_last_emitted_from_macro = false;
+
+    std::unordered_map<cached_file const *, u32> m_file_indices; // into `m_out.files`
+    cached_file const *m_out_file = nullptr; // the file the current output line is a line of
+    u32 m_out_line = 0;                      // ... which line of it, from 0
+    u32 m_out_column = 0;
+    u32 m_output_line = 1;                   // the current output line, from 1
+
+    void error(std::string message) noexcept
+    {
+        std::string where = m_cursor.file ? m_cursor.file->path + ": " : std::string();
+        m_out.errors.push_back(where + message);
+    }
+
+    bool active() const noexcept
+    {
+        return m_conditionals.empty() || m_conditionals.back().active;
+    }
+
+    std::string_view intern_spelling(std::string s) noexcept
+    {
+        return m_generated.emplace_back(std::move(s));
+    }
+
+    pp_token file_token(u64 idx) const noexcept
+    {
+        pp_token t;
+        t.kind = m_cursor.file->tokens.kinds[idx];
+        t.flags = m_cursor.file->tokens.flags[idx];
+        t.spelling = m_cursor.file->tokens.spelling(m_cursor.file->text, idx);
+        t.file = m_cursor.file;
+        t.offset = m_cursor.file->tokens.offsets[idx];
+        return t;
+    }
+
+    bool cursor_at_end() const noexcept
+    {
+        return m_cursor.file == nullptr || m_cursor.file->tokens.kinds[m_cursor.idx] == token_kind::end_of_input;
+    }
+
+    bool next_token(pp_token &out) noexcept
+    {
+        if (!m_pending.empty()) {
+            out = m_pending.front();
+            m_pending.pop_front();
+            return true;
+        }
+        if (cursor_at_end()) {
+            return false;
+        }
+        out = file_token(m_cursor.idx++);
+        return true;
+    }
+
+    bool peek_token(pp_token &out) const noexcept
+    {
+        if (!m_pending.empty()) {
+            out = m_pending.front();
+            return true;
+        }
+        if (cursor_at_end()) {
+            return false;
+        }
+        out = file_token(m_cursor.idx);
+        return true;
+    }
+
+    u32 file_index(cached_file const *file) noexcept
+    {
+        auto [it, inserted] = m_file_indices.try_emplace(file, u32(m_out.files.size()));
+        if (inserted) {
+            m_out.files.push_back(file->path);
+        }
+        return it->second;
+    }
+
+    /// Appends `t` on its source line and column: the newlines of comments, directives and skipped code are
+    /// kept, so diagnostics against the output point at the source. Only entering or leaving a file starts a new
+    /// run of lines, recorded in a line mark.
+    void emit(pp_token const &t) noexcept
+    {
+        std::string &text = m_out.text;
+        bool from_macro = t.ctx != nullptr;
+        auto [line, column] = t.file->position(t.offset);
+
+        if (t.file != m_out_file || line < m_out_line) {
+            if (!text.empty()) {
+                text += '\n';
+                ++m_output_line;
+            }
+            preprocess_line_mark mark = { m_output_line, file_index(t.file), line + 1 };
+            if (m_out.line_marks.back().output_line == m_output_line) {
+                m_out.line_marks.back() = mark; // nothing was emitted under the previous one
+            } else {
+                m_out.line_marks.push_back(mark);
+            }
+            m_out_file = t.file;
+            m_out_line = line;
+            m_out_column = 0;
+        }
+        if (line > m_out_line) {
+            text.append(line - m_out_line, '\n');
+            m_output_line += line - m_out_line;
+            m_out_line = line;
+            m_out_column = 0;
+        }
+
+        if (m_out_column < column) {
+            text.append(column - m_out_column, ' ');
+            m_out_column = column;
+        }
+        else if (m_out_column > 0 && ((t.flags & token_flag_space_before) || from_macro || m_last_emitted_from_macro)) {
+            // tokens from expansions are separated so they cannot merge when the output is lexed again
+            text += ' ';
+            ++m_out_column;
+        }
+        text += t.spelling;
+        m_out_column += u32(t.spelling.size());
+        m_last_emitted_from_macro = from_macro;
+    }
+
+    static bool is_disabled(expansion_ctx const *ctx, macro_def const *macro) noexcept
+    {
+        for (; ctx; ctx = ctx->parent) {
+            if (ctx->macro == macro) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool try_expand(pp_token &name) noexcept;
+    bool expand_builtin(pp_token const &name) noexcept;
+    std::vector<pp_token> expand_list(std::vector<pp_token> const &in) noexcept;
+    std::vector<pp_token> substitute(macro_def const &macro, std::vector<std::vector<pp_token>> const &args) noexcept;
+    void paste_tokens(std::vector<pp_token> &tokens) noexcept;
+    pp_token stringize(std::vector<pp_token> const &arg) noexcept;
+
+    void handle_directive() noexcept;
+    void handle_define(std::vector<pp_token> const &line) noexcept;
+    void handle_include(std::vector<pp_token> const &line) noexcept;
+    bool evaluate_condition(std::vector<pp_token> const &line) noexcept;
+};
+
+/// Expands `name` if it names an enabled macro (reading arguments from the token stream for function-like macros),
+/// pushing the result to the front of the pending tokens. Returns false if `name` is not expanded.
+bool preprocessor::try_expand(pp_token &name) noexcept
+{
+    if (name.painted) {
+        return false;
+    }
+    auto it = m_macros.find(std::string(name.spelling));
+    if (it == m_macros.end()) {
+        return expand_builtin(name);
+    }
+    macro_def const &macro = it->second;
+    if (is_disabled(name.ctx, &macro)) {
+        name.painted = true;
+        return false;
+    }
+
+    std::vector<std::vector<pp_token>> args;
+
+    if (macro.function_like) {
+        pp_token lparen;
+        if (!peek_token(lparen) || lparen.kind != token_kind::l_paren) {
+            return false; // a function-like macro name not followed by ( is an ordinary identifier
+        }
+        next_token(lparen);
+
+        args.emplace_back();
+        s64 depth = 0;
+        for (;;) {
+            pp_token t;
+            if (!next_token(t)) {
+                error("unterminated invocation of macro '" + macro.name + "'");
+                return true;
+            }
+            if (t.kind == token_kind::r_paren && depth == 0) {
+                break;
+            }
+            if (t.kind == token_kind::l_paren) ++depth;
+            if (t.kind == token_kind::r_paren) --depth;
+
+            bool collecting_varargs = macro.variadic && args.size() == macro.params.size();
+            if (t.kind == token_kind::comma && depth == 0 && !collecting_varargs) {
+                args.emplace_back();
+                continue;
+            }
+            t.flags &= ~token_flag_line_start; // arguments spanning lines are joined
+            args.back().push_back(t);
+        }
+
+        if (macro.params.empty() && args.size() == 1 && args[0].empty()) {
+            args.clear();
+        }
+        if (macro.variadic && args.size() + 1 == macro.params.size()) {
+            args.emplace_back(); // empty __VA_ARGS__
+        }
+        if (args.size() != macro.params.size()) {
+            error(make_str("macro '%s' expects %zu arguments, got %zu", macro.name.c_str(), macro.params.size(), args.size()));
+            return true;
+        }
+    }
+
+    std::vector<pp_token> result = substitute(macro, args);
+
+    expansion_ctx const *ctx = &m_contexts.emplace_back(expansion_ctx{ &macro, name.ctx });
+    for (pp_token &t : result) {
+        t.ctx = ctx;
+        t.file = name.file;
+        t.offset = name.offset;
+        t.flags &= ~token_flag_line_start;
+    }
+    if (!result.empty()) {
+        result.front().flags = name.flags;
+    }
+
+    m_pending.insert(m_pending.begin(), result.begin(), result.end());
+    return true;
+}
+
+static bool is_builtin_macro(std::string_view name) noexcept
+{
+    return name == "__LINE__" || name == "__FILE__";
+}
+
+/// Expands `name` if it is __LINE__ or __FILE__, which give the line and path of the token (or of the macro
+/// invocation it came from). Returns false if `name` is neither.
+bool preprocessor::expand_builtin(pp_token const &name) noexcept
+{
+    if (!is_builtin_macro(name.spelling) || !name.file) {
+        return false;
+    }
+
+    pp_token t = name;
+    if (name.spelling == "__LINE__") {
+        t.kind = token_kind::number;
+        t.spelling = intern_spelling(std::to_string(name.file->position(name.offset).first + 1));
+    } else {
+        std::string s = "\"";
+        for (char c : name.file->path) {
+            if (c == '"' || c == '\\') {
+                s += '\\';
+            }
+            s += c;
+        }
+        s += '"';
+        t.kind = token_kind::string_literal;
+        t.spelling = intern_spelling(std::move(s));
+    }
+    m_pending.push_front(t);
+    return true;
+}
+
+/// Fully macro-expands an isolated token list (used for arguments and #if/#include lines).
+std::vector<pp_token> preprocessor::expand_list(std::vector<pp_token> const &in) noexcept
+{
+    std::deque<pp_token> saved_pending = std::move(m_pending);
+    pp_cursor saved_cursor = m_cursor;
+
+    m_pending.assign(in.begin(), in.end());
+    m_cursor = {};
+
+    std::vector<pp_token> out;
+    pp_token t;
+    while (next_token(t)) {
+        if (token_is_identifier_like(t.kind) && try_expand(t)) {
+            continue;
+        }
+        out.push_back(t);
+    }
+
+    m_pending = std::move(saved_pending);
+    m_cursor = saved_cursor;
+    return out;
+}
+
+pp_token preprocessor::stringize(std::vector<pp_token> const &arg) noexcept
+{
+    std::string s = "\"";
+    for (u64 i = 0; i < arg.size(); ++i) {
+        if (i > 0 && (arg[i].flags & (token_flag_space_before | token_flag_line_start))) {
+            s += ' ';
+        }
+        bool escape = arg[i].kind == token_kind::string_literal || arg[i].kind == token_kind::char_literal;
+        for (char c : arg[i].spelling) {
+            if (escape && (c == '"' || c == '\\')) {
+                s += '\\';
+            }
+            s += c;
+        }
+    }
+    s += '"';
+
+    pp_token t;
+    t.kind = token_kind::string_literal;
+    t.spelling = intern_spelling(std::move(s));
+    return t;
+}
+
+std::vector<pp_token> preprocessor::substitute(macro_def const &macro, std::vector<std::vector<pp_token>> const &args) noexcept
+{
+    std::vector<pp_token> const &body = macro.body;
+    std::vector<pp_token> result;
+    std::vector<std::vector<pp_token>> expanded_args(args.size());
+    std::vector<bool> expanded(args.size(), false);
+
+    auto param_index = [&](pp_token const &t) -> s64 {
+        if (!macro.function_like || !token_is_identifier_like(t.kind)) {
+            return -1;
+        }
+        for (u64 p = 0; p < macro.params.size(); ++p) {
+            if (macro.params[p] == t.spelling) {
+                return s64(p);
+            }
+        }
+        return -1;
+    };
+
+    for (u64 j = 0; j < body.size(); ++j) {
+        pp_token const &b = body[j];
+
+        if (macro.function_like && b.kind == token_kind::hash && j + 1 < body.size() && param_index(body[j + 1]) >= 0) {
+            pp_token s = stringize(args[u64(param_index(body[j + 1]))]);
+            s.flags = b.flags;
+            result.push_back(s);
+            ++j;
+            continue;
+        }
+
+        s64 p = param_index(b);
+        if (p < 0) {
+            result.push_back(b);
+            continue;
+        }
+
+        bool next_to_paste = (j > 0 && body[j - 1].paste_op) || (j + 1 < body.size() && body[j + 1].paste_op);
+        std::vector<pp_token> const *tokens;
+        if (next_to_paste) {
+            tokens = &args[u64(p)];
+        } else {
+            if (!expanded[u64(p)]) {
+                expanded_args[u64(p)] = expand_list(args[u64(p)]);
+                expanded[u64(p)] = true;
+            }
+            tokens = &expanded_args[u64(p)];
+        }
+
+        if (tokens->empty() && next_to_paste) {
+            pp_token placemarker;
+            placemarker.placemarker = true;
+            result.push_back(placemarker);
+            continue;
+        }
+        for (u64 k = 0; k < tokens->size(); ++k) {
+            pp_token t = (*tokens)[k];
+            if (k == 0) {
+                t.flags = b.flags;
+            }
+            result.push_back(t);
+        }
+    }
+
+    paste_tokens(result);
+    return result;
+}
+
+void preprocessor::paste_tokens(std::vector<pp_token> &tokens) noexcept
+{
+    std::vector<pp_token> out;
+    out.reserve(tokens.size());
+
+    for (u64 i = 0; i < tokens.size(); ++i) {
+        if (!tokens[i].paste_op || out.empty() || i + 1 == tokens.size()) {
+            out.push_back(tokens[i]);
+            continue;
+        }
+
+        pp_token lhs = out.back();
+        pp_token const &rhs = tokens[++i];
+
+        if (lhs.placemarker) {
+            pp_token t = rhs;
+            t.flags = lhs.flags;
+            out.back() = t;
+            continue;
+        }
+        if (rhs.placemarker) {
+            continue;
+        }
+
+        std::string joined = std::string(lhs.spelling) + std::string(rhs.spelling);
+        token_buffer relexed;
+        lex(joined, relexed);
+        if (relexed.count != 2) {
+            error("pasting '" + std::string(lhs.spelling) + "' and '" + std::string(rhs.spelling) + "' does not give a valid token");
+            out.push_back(rhs);
+            continue;
+        }
+        out.back().kind = relexed.kinds[0];
+        out.back().spelling = intern_spelling(std::move(joined));
+        out.back().painted = false;
+    }
+
+    std::erase_if(out, [](pp_token const &t) { return t.placemarker; });
+    tokens = std::move(out);
+}
+
+void preprocessor::handle_define(std::vector<pp_token> const &line) noexcept
+{
+    if (line.size() < 2 || !token_is_identifier_like(line[1].kind)) {
+        error("#define requires a macro name");
+        return;
+    }
+
+    macro_def macro;
+    macro.name = std::string(line[1].spelling);
+    u64 i = 2;
+
+    // A function-like macro's ( must immediately follow the name.
+    if (i < line.size() && line[i].kind == token_kind::l_paren && !(line[i].flags & token_flag_space_before)) {
+        macro.function_like = true;
+        ++i;
+        bool closed = false;
+        while (i < line.size()) {
+            pp_token const &t = line[i++];
+            if (t.kind == token_kind::r_paren) {
+                closed = true;
+                break;
+            }
+            if (t.kind == token_kind::comma) {
+                continue;
+            }
+            if (t.kind == token_kind::ellipsis) {
+                macro.variadic = true;
+                macro.params.push_back("__VA_ARGS__");
+            }
+            else if (token_is_identifier_like(t.kind) && !macro.variadic) {
+                macro.params.push_back(std::string(t.spelling));
+            }
+            else {
+                error("malformed parameter list for macro '" + macro.name + "'");
+                return;
+            }
+        }
+        if (!closed) {
+            error("missing ) in parameter list of macro '" + macro.name + "'");
+            return;
+        }
+    }
+
+    for (; i < line.size(); ++i) {
+        pp_token t = line[i];
+        t.paste_op = t.kind == token_kind::hash_hash;
+        macro.body.push_back(t);
+    }
+    if (!macro.body.empty()) {
+        macro.body.front().flags &= ~token_flag_space_before;
+    }
+
+    m_macros[macro.name] = std::move(macro);
+}
+
+void preprocessor::handle_include(std::vector<pp_token> const &line) noexcept
+{
+    ++m_out.stats.include_directives;
+
+    std::vector<pp_token> operand(line.begin() + 1, line.end());
+    if (!operand.empty() && operand[0].kind != token_kind::string_literal && operand[0].kind != token_kind::less) {
+        operand = expand_list(operand); // #include MACRO
+    }
+    if (operand.empty()) {
+        error("#include expects \"FILENAME\" or <FILENAME>");
+        return;
+    }
+
+    std::string name;
+    bool quoted = operand[0].kind == token_kind::string_literal;
+    if (quoted) {
+        name = std::string(operand[0].spelling.substr(1, operand[0].spelling.size() - 2));
+    } else if (operand[0].kind == token_kind::less) {
+        u64 i = 1;
+        for (; i < operand.size() && operand[i].kind != token_kind::greater; ++i) {
+            if (i > 1 && (operand[i].flags & token_flag_space_before)) {
+                name += ' ';
+            }
+            name += operand[i].spelling;
+        }
+        if (i == operand.size()) {
+            error("missing > in #include");
+            return;
+        }
+    } else {
+        error("#include expects \"FILENAME\" or <FILENAME>");
+        return;
+    }
+
+    std::vector<fs::path> candidates;
+    if (quoted) {
+        candidates.push_back(fs::path(m_cursor.file->path).parent_path() / name);
+    }
+    for (std::string const &dir : m_options.include_dirs) {
+        candidates.push_back(fs::path(dir) / name);
+    }
+
+    std::string canonical;
+    for (fs::path const &candidate : candidates) {
+        std::error_code ec;
+        if (fs::is_regular_file(candidate, ec)) {
+            canonical = fs::weakly_canonical(candidate, ec).string();
+            break;
+        }
+    }
+    if (canonical.empty()) {
+        error("cannot find include file '" + name + "'");
+        return;
+    }
+
+    if (m_once_included.contains(canonical)) {
+        ++m_out.stats.includes_skipped;
+        return;
+    }
+
+    bool was_hit = false;
+    std::shared_ptr<cached_file const> file = include_cache_get(canonical, was_hit);
+    if (!file) {
+        error("cannot read include file '" + canonical + "'");
+        return;
+    }
+    if (was_hit) {
+        ++m_out.stats.cache_hits;
+    } else {
+        ++m_out.stats.cache_misses;
+        m_out.stats.lexed_bytes += file->text.size();
+    }
+
+    if (file->guard_kind == include_guard_kind::macro && m_macros.contains(file->guard_macro)) {
+        ++m_out.stats.includes_skipped;
+        return;
+    }
+
+    if (m_include_depth >= 200) {
+        error("#include nested too deeply");
+        return;
+    }
+
+    m_retained.push_back(file);
+
+    ++m_include_depth;
+    process(*file);
+    --m_include_depth;
+}
+
+// #IF EXPRESSIONS
+
+struct condition_parser
+{
+    std::vector<pp_token> const &tokens;
+    u64 pos = 0;
+    std::string error;
+    u32 unevaluated = 0; // inside the untaken side of &&, || or ?:, where dividing by zero is no error
+
+    token_kind peek() const noexcept
+    {
+        return pos < tokens.size() ? tokens[pos].kind : token_kind::end_of_input;
+    }
+
+    bool accept(token_kind kind) noexcept
+    {
+        if (peek() == kind) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    s64 primary() noexcept
+    {
+        if (pos >= tokens.size()) {
+            error = "unexpected end of #if expression";
+            return 0;
+        }
+        pp_token const &t = tokens[pos++];
+        switch (t.kind) {
+            case token_kind::number: {
+                u64 value = 0;
+                if (!parse_integer_literal(t.spelling, value)) {
+                    error = "invalid integer '" + std::string(t.spelling) + "' in #if";
+                }
+                return s64(value);
+            }
+            case token_kind::char_literal: {
+                s64 value = 0;
+                if (!parse_char_literal(t.spelling, value)) {
+                    error = "invalid character literal in #if";
+                }
+                return value;
+            }
+            case token_kind::identifier:
+                return 0; // identifiers left after expansion evaluate to 0
+            case token_kind::l_paren: {
+                s64 value = ternary();
+                if (!accept(token_kind::r_paren)) {
+                    error = "missing ) in #if";
+                }
+                return value;
+            }
+            case token_kind::minus:   return -unary_after();
+            case token_kind::plus:    return unary_after();
+            case token_kind::tilde:   return ~unary_after();
+            case token_kind::exclaim: return !unary_after();
+            default:
+                if (token_is_keyword(t.kind)) {
+                    return 0; // so are keywords, they are just identifiers to the preprocessor
+                }
+                error = "unexpected '" + std::string(t.spelling) + "' in #if";
+                return 0;
+        }
+    }
+
+    s64 unary_after() noexcept
+    {
+        return primary();
+    }
+
+    static s32 precedence(token_kind kind) noexcept
+    {
+        switch (kind) {
+            case token_kind::star: case token_kind::slash: case token_kind::percent:        return 10;
+            case token_kind::plus: case token_kind::minus:                                   return 9;
+            case token_kind::less_less: case token_kind::greater_greater:                    return 8;
+            case token_kind::less: case token_kind::greater:
+            case token_kind::less_equal: case token_kind::greater_equal:                     return 7;
+            case token_kind::equal_equal: case token_kind::exclaim_equal:                    return 6;
+            case token_kind::ampersand:                                                      return 5;
+            case token_kind::caret:                                                          return 4;
+            case token_kind::pipe:                                                           return 3;
+            case token_kind::ampersand_ampersand:                                            return 2;
+            case token_kind::pipe_pipe:                                                      return 1;
+            default:                                                                         return 0;
+        }
+    }
+
+    s64 binary(s32 min_prec) noexcept
+    {
+        s64 lhs = primary();
+        for (;;) {
+            token_kind op = peek();
+            s32 prec = precedence(op);
+            if (prec == 0 || prec < min_prec || !error.empty()) {
+                return lhs;
+            }
+            ++pos;
+            bool short_circuit = (op == token_kind::ampersand_ampersand && !lhs) || (op == token_kind::pipe_pipe && lhs);
+            unevaluated += short_circuit;
+            s64 rhs = binary(prec + 1);
+            unevaluated -= short_circuit;
+            switch (op) {
+                case token_kind::star:                  lhs = lhs * rhs; break;
+                case token_kind::slash:
+                case token_kind::percent:
+                    if (rhs == 0) {
+                        if (unevaluated > 0) {
+                            lhs = 0;
+                            break;
+                        }
+                        error = "division by zero in #if";
+                        return 0;
+                    }
+                    lhs = op == token_kind::slash ? lhs / rhs : lhs % rhs;
+                    break;
+                case token_kind::plus:                  lhs = lhs + rhs; break;
+                case token_kind::minus:                 lhs = lhs - rhs; break;
+                case token_kind::less_less:             lhs = lhs << rhs; break;
+                case token_kind::greater_greater:       lhs = lhs >> rhs; break;
+                case token_kind::less:                  lhs = lhs < rhs; break;
+                case token_kind::greater:               lhs = lhs > rhs; break;
+                case token_kind::less_equal:            lhs = lhs <= rhs; break;
+                case token_kind::greater_equal:         lhs = lhs >= rhs; break;
+                case token_kind::equal_equal:           lhs = lhs == rhs; break;
+                case token_kind::exclaim_equal:         lhs = lhs != rhs; break;
+                case token_kind::ampersand:             lhs = lhs & rhs; break;
+                case token_kind::caret:                 lhs = lhs ^ rhs; break;
+                case token_kind::pipe:                  lhs = lhs | rhs; break;
+                case token_kind::ampersand_ampersand:   lhs = lhs && rhs; break;
+                case token_kind::pipe_pipe:             lhs = lhs || rhs; break;
+                default:                                assert(false); break;
+            }
+        }
+    }
+
+    s64 ternary() noexcept
+    {
+        s64 cond = binary(1);
+        if (!accept(token_kind::question)) {
+            return cond;
+        }
+        unevaluated += !cond;
+        s64 if_true = ternary();
+        unevaluated -= !cond;
+        if (!accept(token_kind::colon)) {
+            error = "missing : in #if";
+            return 0;
+        }
+        unevaluated += cond != 0;
+        s64 if_false = ternary();
+        unevaluated -= cond != 0;
+        return cond ? if_true : if_false;
+    }
+};
+
+bool preprocessor::evaluate_condition(std::vector<pp_token> const &line) noexcept
+{
+    static std::string_view const one = "1";
+    static std::string_view const zero = "0";
+
+    // `defined` must be resolved before macro expansion.
+    std::vector<pp_token> resolved;
+    for (u64 i = 1; i < line.size(); ++i) {
+        if (token_is_identifier_like(line[i].kind) && line[i].spelling == "defined") {
+            bool parens = i + 1 < line.size() && line[i + 1].kind == token_kind::l_paren;
+            u64 name_idx = i + (parens ? 2 : 1);
+            if (name_idx >= line.size() || !token_is_identifier_like(line[name_idx].kind)) {
+                error("'defined' requires an identifier");
+                return false;
+            }
+            if (parens && (name_idx + 1 >= line.size() || line[name_idx + 1].kind != token_kind::r_paren)) {
+                error("missing ) after 'defined'");
+                return false;
+            }
+            std::string_view name = line[name_idx].spelling;
+            pp_token t;
+            t.kind = token_kind::number;
+            t.spelling = m_macros.contains(std::string(name)) || is_builtin_macro(name) ? one : zero;
+            resolved.push_back(t);
+            i = name_idx + (parens ? 1 : 0);
+            continue;
+        }
+        resolved.push_back(line[i]);
+    }
+
+    std::vector<pp_token> expanded = expand_list(resolved);
+    condition_parser parser{ expanded, 0, {}, 0 };
+    s64 value = parser.ternary();
+    if (parser.error.empty() && parser.pos != expanded.size()) {
+        parser.error = "unexpected '" + std::string(expanded[parser.pos].spelling) + "' in #if";
+    }
+    if (!parser.error.empty()) {
+        error(parser.error);
+        return false;
+    }
+    return value != 0;
+}
+
+// DIRECTIVES
+
+void preprocessor::handle_directive() noexcept
+{
+    token_buffer const &tokens = m_cursor.file->tokens;
+    auto [first, last] = directive_line(tokens, m_cursor.idx);
+    m_cursor.idx = last;
+
+    std::vector<pp_token> line;
+    for (u64 i = first; i < last; ++i) {
+        line.push_back(file_token(i));
+    }
+    if (line.empty()) {
+        return; // null directive
+    }
+
+    std::string_view name = line[0].spelling;
+
+    if (name == "if" || name == "ifdef" || name == "ifndef") {
+        bool parent_active = active();
+        bool taken = false;
+        if (parent_active) {
+            if (name == "if") {
+                taken = evaluate_condition(line);
+            } else if (line.size() < 2 || !token_is_identifier_like(line[1].kind)) {
+                error("#" + std::string(name) + " requires a macro name");
+            } else {
+                bool defined = m_macros.contains(std::string(line[1].spelling)) || is_builtin_macro(line[1].spelling);
+                taken = (name == "ifdef") == defined;
+            }
+        }
+        m_conditionals.push_back({ parent_active, taken, taken, false });
+        return;
+    }
+    if (name == "elif" || name == "else") {
+        if (m_conditionals.empty() || m_conditionals.back().seen_else) {
+            error("#" + std::string(name) + " without matching #if");
+            return;
+        }
+        conditional_frame &frame = m_conditionals.back();
+        if (!frame.parent_active || frame.any_taken) {
+            frame.active = false;
+        } else {
+            frame.active = name == "else" ? true : evaluate_condition(line);
+        }
+        frame.any_taken |= frame.active;
+        frame.seen_else = name == "else";
+        return;
+    }
+    if (name == "endif") {
+        if (m_conditionals.empty()) {
+            error("#endif without matching #if");
+            return;
+        }
+        m_conditionals.pop_back();
+        return;
+    }
+
+    if (!active()) {
+        return;
+    }
+
+    if (name == "define") {
+        handle_define(line);
+    }
+    else if (name == "undef") {
+        if (line.size() < 2 || !token_is_identifier_like(line[1].kind)) {
+            error("#undef requires a macro name");
+        } else {
+            m_macros.erase(std::string(line[1].spelling));
+        }
+    }
+    else if (name == "include") {
+        handle_include(line);
+    }
+    else if (name == "pragma") {
+        if (line.size() == 2 && line[1].spelling == "once") {
+            m_once_included.insert(m_cursor.file->path);
+        }
+        // other pragmas are ignored
+    }
+    else if (name == "error") {
+        std::string message = "#error";
+        for (u64 i = 1; i < line.size(); ++i) {
+            message += ' ';
+            message += line[i].spelling;
+        }
+        error(message);
+    }
+    else if (name == "line" || name == "warning") {
+        // not needed by any consumer of the output yet
+    }
+    else {
+        error("unknown directive #" + std::string(name));
+    }
+}
+
+void preprocessor::process(cached_file const &file) noexcept
+{
+    pp_cursor saved_cursor = m_cursor;
+    std::vector<conditional_frame> saved_conditionals = std::move(m_conditionals);
+    m_cursor = { &file, 0 };
+    m_conditionals.clear();
+
+    token_buffer const &tokens = file.tokens;
+
+    for (;;) {
+        if (m_pending.empty()) {
+            if (cursor_at_end()) {
+                break;
+            }
+            if (is_directive_start(tokens, m_cursor.idx)) {
+                handle_directive();
+                continue;
+            }
+            if (!active()) {
+                ++m_cursor.idx;
+                continue;
+            }
+        }
+
+        pp_token t;
+        if (!next_token(t)) {
+            break;
+        }
+        if (token_is_identifier_like(t.kind) && try_expand(t)) {
+            continue;
+        }
+        emit(t);
+    }
+
+    if (!m_conditionals.empty()) {
+        error("unterminated conditional directive");
+    }
+
+    m_cursor = saved_cursor;
+    m_conditionals = std::move(saved_conditionals);
+}
+
+static bool preprocess_impl(std::shared_ptr<cached_file const> main_file, preprocessor_options const &options, preprocess_result &out) noexcept
+{
+    time_point_precise_t start = get_time_precise();
+
+    out.text.clear();
+    out.files.clear();
+    out.line_marks.clear();
+    out.errors.clear();
+    out.stats = {};
+
+    {
+        preprocessor pp(options, out);
+        pp.run(*main_file);
+    }
+
+    out.stats.elapsed_us = time_diff_us(start, get_time_precise());
+    return out.errors.empty();
+}
+
+bool preprocess_file(char const *path, preprocessor_options const &options, preprocess_result &out) noexcept
+{
+    std::error_code ec;
+    std::string canonical = fs::weakly_canonical(path, ec).string();
+
+    bool was_hit = false;
+    std::shared_ptr<cached_file const> file = ec ? nullptr : include_cache_get(canonical, was_hit);
+    if (!file) {
+        out = {};
+        out.errors.push_back(std::string("cannot read '") + path + "'");
+        return false;
+    }
+
+    bool ok = preprocess_impl(file, options, out);
+    if (was_hit) {
+        ++out.stats.cache_hits;
+    } else {
+        ++out.stats.cache_misses;
+        out.stats.lexed_bytes += file->text.size();
+    }
+    return ok;
+}
+
+bool preprocess_text(std::string_view text, char const *path, preprocessor_options const &options, preprocess_result &out) noexcept
+{
+    std::error_code ec;
+    std::string canonical = fs::weakly_canonical(path, ec).string();
+    if (ec) {
+        canonical = path;
+    }
+
+    // Editor buffers change on every keystroke, so they bypass the cache; only what they include is cached.
+    std::shared_ptr<cached_file const> file = make_cached_file(canonical, std::string(text));
+    bool ok = preprocess_impl(file, options, out);
+    out.stats.lexed_bytes += text.size();
+    return ok;
+}
+
+static bool parse_decimal(std::string_view s, u32 &out) noexcept
+{
+    out = 0;
+    for (char c : s) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        out = out * 10 + u32(c - '0');
+    }
+    return !s.empty();
+}
+
+void preprocess_map_error_locations(preprocess_result const &pp, std::vector<std::string> &errors, u64 first) noexcept
+{
+    if (pp.line_marks.empty()) {
+        return; // not preprocessed, the text is the source
+    }
+
+    for (u64 i = first; i < errors.size(); ++i) {
+        std::string &e = errors[i];
+        u64 line_end = e.find(':');
+        u64 column_end = line_end == std::string::npos ? line_end : e.find(':', line_end + 1);
+        u32 output_line, column;
+        if (column_end == std::string::npos || !parse_decimal(std::string_view(e).substr(0, line_end), output_line) ||
+            !parse_decimal(std::string_view(e).substr(line_end + 1, column_end - line_end - 1), column)) {
+            continue;
+        }
+
+        auto mark = std::upper_bound(pp.line_marks.begin(), pp.line_marks.end(), output_line,
+            [](u32 line, preprocess_line_mark const &m) { return line < m.output_line; });
+        if (mark == pp.line_marks.begin()) {
+            continue;
+        }
+        --mark;
+        u32 line = mark->line + (output_line - mark->output_line);
+        std::string where = mark->file == 0 ? make_str("%u:%u", line, column)
+                                            : make_str("%s:%u:%u", pp.files[mark->file].c_str(), line, column);
+        e.replace(0, column_end, where);
+    }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "primitives.hpp"
+
+struct preprocessor_options
+{
+    std::vector<std::string> include_dirs;                     // searched in order for <> includes, and after the includer's directory for "" includes
+    std::vector<std::pair<std::string, std::string>> defines;  // name (or "name(params)"), replacement text
+};
+
+struct preprocess_stats
+{
+    u64 include_directives; // #include lines reached in active code
+    u64 includes_skipped;   // includes resolved but never entered thanks to #pragma once or an include guard
+    u64 cache_hits;         // files served from the process-wide include cache
+    u64 cache_misses;       // files read and lexed by this run
+    u64 lexed_bytes;        // bytes lexed by this run, i.e. the unique bytes not already in the cache
+    s64 elapsed_us;
+};
+
+/// Output lines from `output_line` on are lines `line`, `line + 1`, ... of `files[file]` (lines from 1).
+struct preprocess_line_mark
+{
+    u32 output_line;
+    u32 file;
+    u32 line;
+};
+
+struct preprocess_result
+{
+    std::string text;
+    std::vector<std::string> files;                // files[0] is the main file
+    std::vector<preprocess_line_mark> line_marks;  // by output_line, a new one wherever an #include enters or leaves a file
+    std::vector<std::string> errors;
+    preprocess_stats stats;
+};
+
+/// Runs the C preprocessor on `path`, writing the expanded text to `out.text`.
+/// Supports object and function-like macros (including #, ## and __VA_ARGS__, __LINE__ and __FILE__), conditionals,
+/// #include, #pragma once and #error. Every token stays on its source line and column, so until the first #include
+/// the text lines up with the main file; `out.line_marks` map the rest. Returns false if any errors were recorded in
+/// `out.errors`.
+bool preprocess_file(char const *path, preprocessor_options const &options, preprocess_result &out) noexcept;
+
+/// Same as `preprocess_file` but the main file's contents are `text` (e.g. an unsaved editor buffer),
+/// `path` is only used to resolve relative includes and for diagnostics.
+bool preprocess_text(std::string_view text, char const *path, preprocessor_options const &options, preprocess_result &out) noexcept;
+
+/// Rewrites the "line:col" each of `errors[first..]` starts with, a position in `pp.text`, to where that text came
+/// from: "line:col" in the main file, "path:line:col" in an included one. Errors without a position are left alone.
+void preprocess_map_error_locations(preprocess_result const &pp, std::vector<std::string> &errors, u64 first = 0) noexcept;
+
+struct include_cache_stats
+{
+    u64 entries;
+    u64 bytes;  // total text bytes held
+    u64 hits;
+    u64 misses;
+};
+
+/// The include cache maps canonical path (+ mtime) to a file's text, tokens and detected include guard.
+/// It is shared by every preprocessor run in the process and is thread-safe.
+include_cache_stats include_cache_get_stats() noexcept;
+void include_cache_clear() noexcept;
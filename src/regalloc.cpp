@@ -0,0 +1,500 @@
+#include <algorithm>
+#include <bit>
+#include <limits>
+
+#include "util.hpp"
+#include "ir.hpp"
+#include "x64.hpp"
+#include "jit.hpp"
+#include "interpreter.hpp"
+#include "compiler.hpp"
+#include "test_suite.hpp"
+
+#include "regalloc.hpp"
+
+// OPERANDS
+
+/// Calls `use(reg)` for every register `in` reads.
+template <typename Fn>
+static void for_each_use(ir_inst const &in, Fn &&use) noexcept
+{
+    switch (in.op) {
+        case ir_op::mov:
+        case ir_op::add_imm:
+        case ir_op::neg:
+        case ir_op::bit_not:
+        case ir_op::log_not:
+        case ir_op::sext:
+            use(in.b);
+            break;
+        case ir_op::add:
+        case ir_op::sub:
+        case ir_op::mul:
+        case ir_op::div:
+        case ir_op::mod:
+        case ir_op::bit_and:
+        case ir_op::bit_or:
+        case ir_op::bit_xor:
+        case ir_op::shl:
+        case ir_op::shr:
+        case ir_op::eq:
+        case ir_op::ne:
+        case ir_op::lt:
+        case ir_op::le:
+        case ir_op::gt:
+        case ir_op::ge:
+            use(in.b);
+            use(in.c);
+            break;
+        case ir_op::store_local:
+        case ir_op::store_global:
+        case ir_op::jump_if:
+        case ir_op::jump_if_not:
+        case ir_op::ret:
+            use(in.a);
+            break;
+        case ir_op::call:
+        case ir_op::call_builtin:
+            for (u32 i = 0; i < in.c; ++i) {
+                use(u32(in.b) + i);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static bool defines(ir_op op) noexcept
+{
+    switch (op) {
+        case ir_op::nop:
+        case ir_op::store_local:
+        case ir_op::store_global:
+        case ir_op::jump:
+        case ir_op::jump_if:
+        case ir_op::jump_if_not:
+        case ir_op::ret:
+            return false;
+        default:
+            return true;
+    }
+}
+
+// LIVENESS
+
+struct bitset
+{
+    std::vector<u64> words;
+
+    void resize(u32 bits) noexcept { words.assign((bits + 63) / 64, 0); }
+    void set(u32 i) noexcept { words[i / 64] |= u64(1) << (i % 64); }
+    void reset(u32 i) noexcept { words[i / 64] &= ~(u64(1) << (i % 64)); }
+    bool test(u32 i) const noexcept { return (words[i / 64] >> (i % 64)) & 1; }
+
+    template <typename Fn>
+    void for_each(Fn &&fn) const noexcept
+    {
+        for (u64 w = 0; w < words.size(); ++w) {
+            for (u64 bits = words[w]; bits != 0; bits &= bits - 1) {
+                fn(u32(w * 64 + u64(std::countr_zero(bits))));
+            }
+        }
+    }
+};
+
+struct liveness_block
+{
+    u32 first;
+    u32 last;
+    u32 succs[2] = { u32(-1), u32(-1) };
+    bitset use;     // read before any write in the block
+    bitset def;
+    bitset in;
+    bitset out;
+};
+
+static std::vector<liveness_block> solve_liveness(ir_function const &fn) noexcept
+{
+    u32 n = u32(fn.code.size());
+    std::vector<bool> leader(n + 1, false);
+    leader[0] = true;
+    for (u32 i = 0; i < n; ++i) {
+        ir_inst const &in = fn.code[i];
+        if (ir_op_is_jump(in.op)) {
+            leader[in.imm] = true;
+        }
+        if (ir_op_is_jump(in.op) || in.op == ir_op::ret) {
+            leader[i + 1] = true;
+        }
+    }
+
+    std::vector<liveness_block> blocks;
+    std::vector<u32> block_of(n);
+    for (u32 i = 0; i < n; ++i) {
+        if (leader[i]) {
+            blocks.push_back({});
+            blocks.back().first = i;
+        }
+        blocks.back().last = i;
+        block_of[i] = u32(blocks.size() - 1);
+    }
+
+    for (u32 b = 0; b < blocks.size(); ++b) {
+        liveness_block &block = blocks[b];
+        ir_inst const &end = fn.code[block.last];
+        u32 k = 0;
+        if (ir_op_is_jump(end.op)) {
+            block.succs[k++] = block_of[end.imm];
+        }
+        if (end.op != ir_op::jump && end.op != ir_op::ret && block.last + 1 < n) {
+            block.succs[k++] = block_of[block.last + 1];
+        }
+
+        block.use.resize(fn.register_count);
+        block.def.resize(fn.register_count);
+        block.in.resize(fn.register_count);
+        block.out.resize(fn.register_count);
+        for (u32 i = block.first; i <= block.last; ++i) {
+            ir_inst const &in = fn.code[i];
+            for_each_use(in, [&](u32 r) {
+                if (!block.def.test(r)) block.use.set(r);
+            });
+            if (defines(in.op)) {
+                block.def.set(in.a);
+            }
+        }
+    }
+
+    // Backwards problem, so visiting blocks in reverse converges in a few rounds.
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (u32 b = u32(blocks.size()); b-- > 0;) {
+            liveness_block &block = blocks[b];
+            for (u32 s : block.succs) {
+                if (s == u32(-1)) continue;
+                for (u64 w = 0; w < block.out.words.size(); ++w) {
+                    block.out.words[w] |= blocks[s].in.words[w];
+                }
+            }
+            for (u64 w = 0; w < block.in.words.size(); ++w) {
+                u64 in = block.use.words[w] | (block.out.words[w] & ~block.def.words[w]);
+                changed |= in != block.in.words[w];
+                block.in.words[w] = in;
+            }
+        }
+    }
+    return blocks;
+}
+
+// LINEAR SCAN
+
+static f64 spill_weight(regalloc_interval const &interval, f64 cost) noexcept
+{
+    return cost / f64(interval.end - interval.start + 1);
+}
+
+bool regalloc_linear_scan(ir_function const &fn, regalloc_options const &options, regalloc_result &out) noexcept
+{
+    out = {};
+    out.stats.function = fn.name;
+    for (ir_inst const &in : fn.code) {
+        if (ir_op_is_superinstruction(in.op)) {
+            return false;
+        }
+    }
+
+    u32 const register_count = fn.register_count;
+    u32 const n = u32(fn.code.size());
+    out.physical.assign(register_count, regalloc_unused);
+    out.spill_slot.assign(register_count, u32(-1));
+    out.intervals.assign(register_count, { std::numeric_limits<u32>::max(), 0 });
+
+    // Intervals: the hull of every definition, use and block the register is live into or out of.
+    std::vector<liveness_block> blocks = solve_liveness(fn);
+    auto extend = [&](u32 r, u32 from, u32 to) {
+        out.intervals[r].start = std::min(out.intervals[r].start, from);
+        out.intervals[r].end = std::max(out.intervals[r].end, to);
+    };
+    for (liveness_block const &block : blocks) {
+        block.in.for_each([&](u32 r) { extend(r, 2 * block.first, 2 * block.first); });
+        block.out.for_each([&](u32 r) { extend(r, 2 * block.last + 2, 2 * block.last + 2); });
+    }
+
+    // Loop depth from back edges: code between a jump and an earlier target is a loop body.
+    std::vector<s32> depth_delta(n + 1, 0);
+    for (u32 i = 0; i < n; ++i) {
+        ir_inst const &in = fn.code[i];
+        if (ir_op_is_jump(in.op) && u32(in.imm) <= i) {
+            ++depth_delta[in.imm];
+            --depth_delta[i + 1];
+        }
+    }
+
+    std::vector<f64> cost(register_count, 0.0);
+    std::vector<bool> read(register_count, false);
+    std::vector<u32> hint(register_count, u32(-1));
+    std::vector<u32> builtin_calls; // positions of calls, ascending: a callee may reach a builtin
+    s32 depth = 0;
+    for (u32 i = 0; i < n; ++i) {
+        ir_inst const &in = fn.code[i];
+        depth += depth_delta[i];
+        f64 weight = 1.0;
+        for (s32 d = 0; d < std::min(depth, 5); ++d) {
+            weight *= 10.0;
+        }
+        for_each_use(in, [&](u32 r) {
+            extend(r, 2 * i, 2 * i);
+            cost[r] += weight;
+            read[r] = true;
+        });
+        if (defines(in.op)) {
+            extend(in.a, 2 * i + 1, 2 * i + 1);
+            cost[in.a] += weight;
+        }
+        if (in.op == ir_op::call || in.op == ir_op::call_builtin) {
+            builtin_calls.push_back(i);
+        }
+    }
+    // Dead definitions need no register, the code generator writes them to a scratch register.
+    for (u32 r = 0; r < register_count; ++r) {
+        if (!read[r]) {
+            out.intervals[r] = { std::numeric_limits<u32>::max(), 0 };
+        }
+    }
+    // Whichever side of a `mov` starts later would like the other's register, and gets it if that is free then.
+    for (ir_inst const &in : fn.code) {
+        if (in.op != ir_op::mov || in.a == in.b) {
+            continue;
+        }
+        u32 later = out.intervals[in.a].start > out.intervals[in.b].start ? in.a : in.b;
+        u32 earlier = later == in.a ? in.b : in.a;
+        if (hint[later] == u32(-1)) {
+            hint[later] = earlier;
+        }
+    }
+
+    auto crosses_builtin_call = [&](u32 r) {
+        auto it = std::upper_bound(builtin_calls.begin(), builtin_calls.end(), out.intervals[r].start / 2);
+        return it != builtin_calls.end() && out.live_across(r, *it);
+    };
+
+    std::vector<u32> order;
+    for (u32 r = 0; r < register_count; ++r) {
+        if (out.intervals[r].start <= out.intervals[r].end) {
+            order.push_back(r);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](u32 x, u32 y) {
+        return out.intervals[x].start != out.intervals[y].start ? out.intervals[x].start < out.intervals[y].start : x < y;
+    });
+    out.stats.intervals = u32(order.size());
+
+    auto spill = [&](u32 r) {
+        out.physical[r] = regalloc_spilled;
+        out.spill_slot[r] = out.spill_slot_count++;
+        ++out.stats.spilled;
+    };
+
+    u32 const all = options.register_count >= 32 ? ~u32(0) : (u32(1) << options.register_count) - 1;
+    u32 free = all;
+    std::vector<u32> active;
+    for (u32 r : order) {
+        regalloc_interval const current = out.intervals[r];
+        std::erase_if(active, [&](u32 a) {
+            if (out.intervals[a].end < current.start) {
+                free |= u32(1) << out.physical[a];
+                return true;
+            }
+            return false;
+        });
+
+        u32 choice = u32(-1);
+        if (hint[r] != u32(-1) && out.physical[hint[r]] < 32 && (free >> out.physical[hint[r]]) & 1) {
+            choice = out.physical[hint[r]];
+        } else if (free != 0) {
+            // Keep registers that survive builtin calls for the values that need them.
+            u32 preserved = free & options.call_preserved;
+            u32 clobbered = free & ~options.call_preserved;
+            u32 preferred = crosses_builtin_call(r) ? (preserved != 0 ? preserved : clobbered) : (clobbered != 0 ? clobbered : preserved);
+            choice = u32(std::countr_zero(preferred));
+        }
+
+        if (choice != u32(-1)) {
+            out.physical[r] = u16(choice);
+            free &= ~(u32(1) << choice);
+            active.push_back(r);
+            continue;
+        }
+
+        auto victim = std::min_element(active.begin(), active.end(), [&](u32 x, u32 y) {
+            return spill_weight(out.intervals[x], cost[x]) < spill_weight(out.intervals[y], cost[y]);
+        });
+        if (victim == active.end() || spill_weight(current, cost[r]) <= spill_weight(out.intervals[*victim], cost[*victim])) {
+            spill(r);
+        } else {
+            out.physical[r] = out.physical[*victim];
+            spill(*victim);
+            *victim = r;
+        }
+    }
+
+    for (u32 r = 0; r < register_count; ++r) {
+        if (out.physical[r] < 32) {
+            out.used_mask |= u32(1) << out.physical[r];
+        }
+    }
+    out.stats.registers_used = u32(std::popcount(out.used_mask));
+    for (ir_inst const &in : fn.code) {
+        if (in.op == ir_op::mov && out.physical[in.a] < 32 && out.physical[in.a] == out.physical[in.b]) {
+            ++out.stats.moves_eliminated;
+        }
+    }
+    return true;
+}
+
+void regalloc_stack_slots(ir_function const &fn, regalloc_result &out) noexcept
+{
+    out = {};
+    out.stats.function = fn.name;
+    out.physical.assign(fn.register_count, regalloc_spilled);
+    out.spill_slot.resize(fn.register_count);
+    for (u32 r = 0; r < fn.register_count; ++r) {
+        out.spill_slot[r] = r;
+    }
+    out.intervals.assign(fn.register_count, { 0, std::numeric_limits<u32>::max() });
+    out.spill_slot_count = fn.register_count;
+    out.stats.intervals = fn.register_count;
+    out.stats.spilled = fn.register_count;
+}
+
+static void accumulate(regalloc_stats &total, regalloc_stats const &s) noexcept
+{
+    total.intervals += s.intervals;
+    total.registers_used = std::max(total.registers_used, s.registers_used);
+    total.spilled += s.spilled;
+    total.reloads += s.reloads;
+    total.spill_stores += s.spill_stores;
+    total.moves_eliminated += s.moves_eliminated;
+}
+
+std::string regalloc_stats_to_string(std::vector<regalloc_stats> const &stats) noexcept
+{
+    std::string text = make_str("%-20s %9s %5s %7s %7s %7s %7s\n", "function", "intervals", "regs", "spilled", "reloads", "stores", "moves-");
+    regalloc_stats total = {};
+    for (regalloc_stats const &s : stats) {
+        text += make_str("%-20s %9u %5u %7u %7u %7u %7u\n", s.function.c_str(), s.intervals, s.registers_used,
+                         s.spilled, s.reloads, s.spill_stores, s.moves_eliminated);
+        accumulate(total, s);
+    }
+    text += make_str("%-20s %9u %5u %7u %7u %7u %7u\n", "total", total.intervals, total.registers_used,
+                     total.spilled, total.reloads, total.spill_stores, total.moves_eliminated);
+    return text;
+}
+
+// BENCHMARK
+
+regalloc_benchmark_result regalloc_benchmark(char const *csv_path, char const *data_dir, u64 iterations) noexcept
+{
+    regalloc_benchmark_result result = {};
+
+    std::vector<compiler_test> tests;
+    std::string error;
+    if (!load_compiler_tests(csv_path, tests, error)) {
+        result.errors.push_back(error);
+    }
+
+    struct program
+    {
+        std::string name;
+        ir_module ir;
+        jit_module naive;
+        jit_module linear_scan;
+        execution_result expected; // the interpreter's run
+    };
+    std::vector<program> programs;
+
+    auto add_program = [&](std::string name, compilation &comp) {
+        if (!compile_to_ir(comp)) {
+            result.errors.push_back(name + ": " + (comp.errors.empty() ? "compilation failed" : comp.errors.front()));
+            return;
+        }
+        programs.push_back({ std::move(name), std::move(comp.ir), {}, {}, {} });
+    };
+
+    for (compiler_test const &test : tests) {
+        compilation comp;
+        std::string path = std::string(data_dir) + "/" + test.source_file;
+        if (!compilation_load_file(comp, path.c_str())) {
+            result.errors.push_back(test.name + ": cannot read " + path);
+            continue;
+        }
+        add_program(test.name, comp);
+    }
+    {
+        compilation comp;
+        comp.source_text = interpreter_benchmark_source();
+        add_program("interpreter_benchmark", comp);
+    }
+
+    // Modules are compiled in place, their machine code points into their strings.
+    for (program &p : programs) {
+        execute_ir(p.ir, p.expected);
+
+        for (bool allocate : { false, true }) {
+            x64_options options;
+            options.allocate_registers = allocate;
+            x64_module_code code;
+            jit_module &jit = allocate ? p.linear_scan : p.naive;
+            if (!x64_compile(p.ir, code, error, options) || !jit_compile(p.ir, jit, error, options)) {
+                result.errors.push_back(p.name + ": " + error);
+                continue;
+            }
+            (allocate ? result.linear_scan_code_bytes : result.naive_code_bytes) += code.code.size();
+            for (regalloc_stats const &s : code.regalloc) {
+                accumulate(allocate ? result.linear_scan : result.naive, s);
+            }
+        }
+        if (p.naive.code != nullptr && p.linear_scan.code != nullptr) {
+            ++result.programs;
+        }
+    }
+
+    auto run = [](program const &p, jit_module const &jit, execution_result &out) {
+        out = {};
+        ir_runtime rt;
+        ir_runtime_init(rt, p.ir);
+        if (p.ir.main_index != u32(-1)) {
+            jit_call(jit, p.ir.main_index, nullptr, 0, rt, out.exit_code);
+        }
+        out.output = std::move(rt.output);
+        out.error = std::move(rt.error);
+    };
+
+    for (program const &p : programs) {
+        if (p.naive.code == nullptr || p.linear_scan.code == nullptr) {
+            continue;
+        }
+        for (bool allocate : { false, true }) {
+            execution_result r;
+            run(p, allocate ? p.linear_scan : p.naive, r);
+            if (r.output != p.expected.output || r.exit_code != p.expected.exit_code || r.error != p.expected.error) {
+                result.errors.push_back(p.name + (allocate ? ": linear scan" : ": stack slots") + " output differs from the interpreter");
+            }
+        }
+    }
+
+    auto best_of = [&](bool allocate) {
+        return best_time_us(iterations, [&] {
+            for (program const &p : programs) {
+                if (p.naive.code != nullptr && p.linear_scan.code != nullptr) {
+                    execution_result r;
+                    run(p, allocate ? p.linear_scan : p.naive, r);
+                }
+            }
+        });
+    };
+    result.naive_best_us = best_of(false);
+    result.linear_scan_best_us = best_of(true);
+
+    return result;
+}
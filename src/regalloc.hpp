@@ -0,0 +1,86 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+
+struct ir_function;
+
+u16 constexpr regalloc_spilled = u16(-1);  // lives in a stack slot
+u16 constexpr regalloc_unused = u16(-2);   // never live: defined but never read, or not used at all
+
+/// Instruction i reads its operands at position 2i and writes its result at 2i + 1, so a value whose last
+/// use is an instruction's operand never conflicts with that instruction's result.
+struct regalloc_interval
+{
+    u32 start;
+    u32 end;    // inclusive, `start > end` for an unused register
+};
+
+struct regalloc_stats
+{
+    std::string function;
+    u32 intervals;          // IR registers that are live somewhere
+    u32 registers_used;     // distinct physical registers assigned
+    u32 spilled;            // intervals that live in stack slots
+    u32 reloads;            // loads from spill slots, counted by the code generator
+    u32 spill_stores;       // stores to spill slots, likewise
+    u32 moves_eliminated;   // `mov`s whose source and destination ended up in the same register
+};
+
+/// Where every IR register of one function lives.
+struct regalloc_result
+{
+    std::vector<u16> physical;              // index into the target's allocatable registers, or the constants above
+    std::vector<u32> spill_slot;            // of spilled registers
+    std::vector<regalloc_interval> intervals;
+    u32 spill_slot_count = 0;
+    u32 used_mask = 0;                      // physical registers assigned to anything
+    regalloc_stats stats = {};
+
+    /// Whether `reg` holds a value that is still needed after instruction `inst` and was defined before it.
+    bool live_across(u32 reg, u32 inst) const noexcept
+    {
+        return intervals[reg].start < 2 * inst && intervals[reg].end > 2 * inst + 1;
+    }
+};
+
+struct regalloc_options
+{
+    u32 register_count;     // allocatable physical registers, at most 32
+    u32 call_preserved;     // mask of those a `call` or `call_builtin` leaves intact, tried first for values live across one
+};
+
+/// Poletto & Sarkar linear scan over one live interval per IR register: liveness is solved per basic block,
+/// each interval is the hull of the register's definitions, uses and the blocks it is live through, and
+/// intervals are assigned in order of their start. When none of the registers is free, the interval with the
+/// lowest spill weight (uses and definitions weighted by 10 per enclosing loop, over its length) among the
+/// active ones and the new one is spilled for its whole lifetime. Of the two sides of a `mov`, the one starting
+/// later is given the other's register if that is free by then, which removes the move (coalescing).
+/// Returns false if `fn` contains superinstructions.
+bool regalloc_linear_scan(ir_function const &fn, regalloc_options const &options, regalloc_result &out) noexcept;
+
+/// The naive strategy, for comparison: every IR register spilled to the slot of its own number.
+void regalloc_stack_slots(ir_function const &fn, regalloc_result &out) noexcept;
+
+/// One line per function and a total line: intervals, registers used, spills, reloads, spill stores and
+/// moves eliminated.
+std::string regalloc_stats_to_string(std::vector<regalloc_stats> const &stats) noexcept;
+
+struct regalloc_benchmark_result
+{
+    u64 programs;                       // corpus programs that compiled, plus the interpreter benchmark program
+    regalloc_stats naive;               // summed over every function (`function` is empty)
+    regalloc_stats linear_scan;
+    u64 naive_code_bytes;
+    u64 linear_scan_code_bytes;
+    s64 naive_best_us;                  // best-of-iterations time to run every program once under the JIT
+    s64 linear_scan_best_us;
+    std::vector<std::string> errors;    // unreadable corpus, failed compiles, output differing from the interpreter
+};
+
+/// JIT-compiles the programs of the tests CSV at `csv_path` (sources in `data_dir`) and the interpreter
+/// benchmark program with stack slots and with linear scan, checks both against the interpreter and compares
+/// code size, spill traffic and run time.
+regalloc_benchmark_result regalloc_benchmark(char const *csv_path, char const *data_dir, u64 iterations = 5) noexcept;
@@ -0,0 +1,25 @@
+#pragma once
+
+// SIMD_WIDTH is the vector width in bytes the byte scanners (lexer, line index, output comparison) are compiled
+// for: 32 with AVX2, 16 with SSE2 (always there on x64), 0 where only their scalar loops exist.
+#if defined(__AVX2__)
+#   define SIMD_WIDTH 32
+#   include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define SIMD_WIDTH 16
+#   include <emmintrin.h>
+#else
+#   define SIMD_WIDTH 0
+#endif
+
+/// Returns "AVX2", "SSE2" or "scalar" depending on SIMD_WIDTH, for benchmark reports.
+constexpr char const *simd_isa_name() noexcept
+{
+#if SIMD_WIDTH == 32
+    return "AVX2";
+#elif SIMD_WIDTH == 16
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
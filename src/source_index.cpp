@@ -0,0 +1,207 @@
+#include <algorithm>
+
+#include "util.hpp"
+#include "compiler.hpp"
+#include "text_document.hpp"
+
+#include "source_index.hpp"
+
+static bool closes_declaration(token_kind kind) noexcept
+{
+    return kind == token_kind::r_paren || kind == token_kind::r_bracket || kind == token_kind::r_brace
+        || kind == token_kind::semicolon;
+}
+
+void source_index_build(std::string_view text, token_buffer const &tokens, ast const &tree, ir_module const &ir,
+    source_index &out) noexcept
+{
+    u32 const n = tree.count;
+    u32 const token_count = u32(tokens.count);
+
+    index_lines(text, out.line_starts);
+
+    // The nodes in the tree, every parent before its children.
+    std::vector<u32> order;
+    out.node_parent.assign(n, ast_null);
+    if (tree.root != ast_null) {
+        order.push_back(tree.root);
+    }
+    for (u64 i = 0; i < order.size(); ++i) {
+        for (u32 c = tree.first_child[order[i]]; c != ast_null; c = tree.next_sibling[c]) {
+            out.node_parent[c] = order[i];
+            order.push_back(c);
+        }
+    }
+
+    // Spans, bottom-up.
+    out.node_first.assign(n, ast_null);
+    out.node_first_token.assign(n, 0);
+    out.node_last_token.assign(n, 0);
+    for (u64 i = order.size(); i-- > 0; ) {
+        u32 node = order[i];
+        u32 first = tree.tokens[node], last = first;
+        out.node_first[node] = node;
+        for (u32 c = tree.first_child[node]; c != ast_null; c = tree.next_sibling[c]) {
+            first = std::min(first, out.node_first_token[c]);
+            last = std::max(last, out.node_last_token[c]);
+            out.node_first[node] = std::min(out.node_first[node], out.node_first[c]);
+        }
+        out.node_first_token[node] = first;
+        out.node_last_token[node] = last;
+    }
+    if (tree.root != ast_null && token_count > 0) {
+        u32 previous_last = u32(-1);
+        for (u32 c = tree.first_child[tree.root]; c != ast_null; c = tree.next_sibling[c]) {
+            u32 &last = out.node_last_token[c];
+            while (last + 1 < token_count && closes_declaration(tokens.kinds[last + 1])) {
+                ++last;
+            }
+            out.node_first_token[c] = std::min(out.node_first_token[c], previous_last + 1);
+            previous_last = last;
+        }
+        out.node_first_token[tree.root] = 0;
+        out.node_last_token[tree.root] = token_count - 1;
+    }
+
+    // Each node takes the tokens of its span that none of its children span, top-down.
+    out.token_node.assign(token_count, ast_null);
+    for (u32 node : order) {
+        u32 cursor = out.node_first_token[node];
+        for (u32 c = tree.first_child[node]; c != ast_null; c = tree.next_sibling[c]) {
+            for (; cursor < out.node_first_token[c]; ++cursor) {
+                out.token_node[cursor] = node;
+            }
+            cursor = std::max(cursor, out.node_last_token[c] + 1);
+        }
+        for (; cursor <= out.node_last_token[node]; ++cursor) {
+            out.token_node[cursor] = node;
+        }
+    }
+
+    // Instructions, and the same grouped by node (a counting sort, so a subtree's are one range).
+    out.function_first_inst.clear();
+    u32 inst_count = 0;
+    for (ir_function const &fn : ir.functions) {
+        out.function_first_inst.push_back(inst_count);
+        inst_count += u32(fn.code.size());
+    }
+    out.function_first_inst.push_back(inst_count);
+
+    out.inst_node.assign(inst_count, ast_null);
+    out.node_inst_begin.assign(n + 1, 0);
+    for (u64 f = 0; f < ir.functions.size(); ++f) {
+        ir_function const &fn = ir.functions[f];
+        if (fn.nodes.size() != fn.code.size()) {
+            continue;
+        }
+        for (u64 i = 0; i < fn.nodes.size(); ++i) {
+            u32 node = fn.nodes[i];
+            if (node < n && out.node_first[node] != ast_null) {
+                out.inst_node[out.function_first_inst[f] + i] = node;
+                ++out.node_inst_begin[node + 1];
+            }
+        }
+    }
+    for (u32 node = 0; node < n; ++node) {
+        out.node_inst_begin[node + 1] += out.node_inst_begin[node];
+    }
+    out.node_insts.resize(out.node_inst_begin[n]);
+    std::vector<u32> cursor(out.node_inst_begin.begin(), out.node_inst_begin.end() - 1);
+    for (u32 inst = 0; inst < inst_count; ++inst) {
+        if (out.inst_node[inst] != ast_null) {
+            out.node_insts[cursor[out.inst_node[inst]]++] = inst;
+        }
+    }
+}
+
+u32 source_index_token_at(token_buffer const &tokens, u32 offset) noexcept
+{
+    u32 const *begin = tokens.offsets.data(), *end = begin + tokens.count;
+    u32 const *after = std::upper_bound(begin, end, offset);
+    return after == begin ? 0 : u32(after - begin - 1);
+}
+
+u32 source_index_line_of(source_index const &index, u32 offset) noexcept
+{
+    auto after = std::upper_bound(index.line_starts.begin(), index.line_starts.end(), offset);
+    return after == index.line_starts.begin() ? 0 : u32(after - index.line_starts.begin() - 1);
+}
+
+u32 source_index_node_spanning(source_index const &index, u32 first_token, u32 last_token) noexcept
+{
+    if (first_token >= index.token_node.size()) {
+        return ast_null;
+    }
+    u32 node = index.token_node[first_token];
+    while (node != ast_null && (index.node_first_token[node] > first_token || index.node_last_token[node] < last_token)) {
+        node = index.node_parent[node];
+    }
+    return node;
+}
+
+void source_index_select(source_index const &index, token_buffer const &tokens, u32 node, source_selection &out) noexcept
+{
+    out = {};
+    if (node == ast_null || index.node_first[node] == ast_null) {
+        return;
+    }
+    out.node = node;
+    out.first_token = index.node_first_token[node];
+    out.end_token = index.node_last_token[node] + 1;
+    out.begin = tokens.offsets[out.first_token];
+    out.end = tokens.offsets[out.end_token - 1] + tokens.lengths[out.end_token - 1];
+    out.first_inst = index.node_inst_begin[index.node_first[node]];
+    out.end_inst = index.node_inst_begin[node + 1];
+}
+
+u32 source_index_function_of(source_index const &index, u32 inst) noexcept
+{
+    auto after = std::upper_bound(index.function_first_inst.begin(), index.function_first_inst.end(), inst);
+    return u32(after - index.function_first_inst.begin() - 1);
+}
+
+// BENCHMARK
+
+source_index_benchmark_result source_index_benchmark(u64 tokens, u64 lookups) noexcept
+{
+    source_index_benchmark_result result = {};
+    result.lookups = lookups;
+
+    compilation comp;
+    comp.source_text = generate_benchmark_program(std::max(tokens / 92, u64(1)), false); // each function is 92 tokens
+    compile_to_ir(comp);
+    result.tokens = comp.tokens.count;
+    result.nodes = comp.tree.count;
+    result.instructions = comp.ir.instruction_count();
+
+    source_index index;
+    time_point_precise_t t0 = get_time_precise();
+    source_index_build(comp.preprocessed.text, comp.tokens, comp.tree, comp.ir, index);
+    result.build_us = time_diff_us(t0, get_time_precise());
+
+    u64 seed = 0x9e3779b97f4a7c15ull;
+    auto next = [&seed](u64 bound) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        return bound == 0 ? 0 : (seed >> 33) % bound;
+    };
+    source_selection selection;
+    volatile u64 sink = 0; // keeps the lookups from being optimized away
+
+    time_point_precise_t t1 = get_time_precise();
+    for (u64 i = 0; i < lookups; ++i) {
+        u32 token = source_index_token_at(comp.tokens, u32(next(comp.preprocessed.text.size())));
+        source_index_select(index, comp.tokens, source_index_node_spanning(index, token, token), selection);
+        sink = sink + selection.end_inst - selection.first_inst;
+    }
+    result.offset_lookup_ns = time_diff_ns(t1, get_time_precise()) / s64(std::max(lookups, u64(1)));
+
+    time_point_precise_t t2 = get_time_precise();
+    for (u64 i = 0; i < lookups && !index.inst_node.empty(); ++i) {
+        u32 inst = u32(next(index.inst_node.size()));
+        source_index_select(index, comp.tokens, index.inst_node[inst], selection);
+        sink = sink + selection.end_token - selection.first_token + source_index_function_of(index, inst);
+    }
+    result.inst_lookup_ns = time_diff_ns(t2, get_time_precise()) / s64(std::max(lookups, u64(1)));
+    (void)sink;
+    return result;
+}
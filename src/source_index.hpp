@@ -0,0 +1,75 @@
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+#include "ast.hpp"
+#include "ir.hpp"
+#include "lexer.hpp"
+
+/// @brief Where the tokens, AST nodes and IR instructions of one compilation are in the text that was lexed,
+/// and which of them belong together, so that whatever is selected in one view can be shown in the others.
+/// Built in linear time; every lookup is a binary search or an array access.
+struct source_index
+{
+    std::vector<u32> line_starts;           // offset of every line of the text
+    std::vector<u32> token_node;            // per token: the innermost node spanning it, `ast_null` if none
+    std::vector<u32> node_parent;           // per node, `ast_null` for the root and nodes not in the tree
+    std::vector<u32> node_first;            // per node: lowest id in its subtree, node ids are post-order
+    std::vector<u32> node_first_token;      // per node: the tokens its subtree spans, first to last
+    std::vector<u32> node_last_token;
+    std::vector<u32> function_first_inst;   // per IR function, and one past the last: its first instruction
+    std::vector<u32> inst_node;             // per instruction, numbered through all functions: its node
+    std::vector<u32> node_inst_begin;       // per node, and one past the last: its range of `node_insts`
+    std::vector<u32> node_insts;            // instructions lowered from each node, grouped by node in id order
+};
+
+/// Indexes `text`, the `tokens` lexed from it, `tree` parsed from them and `ir` lowered from `tree` (its
+/// `ir_function::nodes`, instructions without them are not linked to the source). Top-level declarations
+/// also span the closing `)`, `]`, `}` and `;` after their last node, and the root spans every token.
+void source_index_build(std::string_view text, token_buffer const &tokens, ast const &tree, ir_module const &ir,
+    source_index &out) noexcept;
+
+/// The token `offset` falls in, or the last one before it. 0 if there are none before it.
+u32 source_index_token_at(token_buffer const &tokens, u32 offset) noexcept;
+
+/// Line (from 0) `offset` is on.
+u32 source_index_line_of(source_index const &index, u32 offset) noexcept;
+
+/// The innermost node whose tokens include `first_token` through `last_token`, or `ast_null`. Climbs from the
+/// node of `first_token`, so it takes as many steps as the selection is deeper than that node.
+u32 source_index_node_spanning(source_index const &index, u32 first_token, u32 last_token) noexcept;
+
+/// @brief One node and everything that corresponds to it.
+struct source_selection
+{
+    u32 node = ast_null;
+    u32 first_token = 0;    // the tokens its subtree spans, [first_token, end_token)
+    u32 end_token = 0;
+    u32 begin = 0;          // the text those tokens span, [begin, end)
+    u32 end = 0;
+    u32 first_inst = 0;     // the instructions lowered from its subtree, range of `source_index::node_insts`
+    u32 end_inst = 0;
+};
+
+/// Selects `node`, or nothing if it is `ast_null`.
+void source_index_select(source_index const &index, token_buffer const &tokens, u32 node, source_selection &out) noexcept;
+
+/// The function (index into `ir_module::functions`) instruction `inst` is in.
+u32 source_index_function_of(source_index const &index, u32 inst) noexcept;
+
+struct source_index_benchmark_result
+{
+    u64 tokens;
+    u64 nodes;
+    u64 instructions;
+    s64 build_us;
+    u64 lookups;
+    s64 offset_lookup_ns;   // average offset to token to node to selection
+    s64 inst_lookup_ns;     // average instruction to node to selection
+};
+
+/// Compiles a generated source of about `tokens` tokens, indexes it and times `lookups` random selections by
+/// offset (as a click in the source does) and by instruction (a click in the IR).
+source_index_benchmark_result source_index_benchmark(u64 tokens = 2000000, u64 lookups = 100000) noexcept;
@@ -0,0 +1,944 @@
+#include <algorithm>
+#include <cassert>
+
+#include "util.hpp"
+
+#include "ssa.hpp"
+
+/// Registers `inst` reads, in SSA operand order. Calls read `c` registers from `b` and are handled by the caller.
+static u32 read_registers(ir_inst const &inst, u32 out[2]) noexcept
+{
+    switch (inst.op) {
+        case ir_op::mov:
+        case ir_op::add_imm:
+        case ir_op::neg:
+        case ir_op::bit_not:
+        case ir_op::log_not:
+        case ir_op::sext:
+            out[0] = inst.b;
+            return 1;
+
+        case ir_op::store_local:
+        case ir_op::store_global:
+        case ir_op::jump_if:
+        case ir_op::jump_if_not:
+        case ir_op::ret:
+            out[0] = inst.a;
+            return 1;
+
+        default:
+            if ((inst.op >= ir_op::add && inst.op <= ir_op::shr) || (inst.op >= ir_op::eq && inst.op <= ir_op::ge)) {
+                out[0] = inst.b;
+                out[1] = inst.c;
+                return 2;
+            }
+            return 0;
+    }
+}
+
+static bool writes_register(ir_op op) noexcept
+{
+    switch (op) {
+        case ir_op::nop:
+        case ir_op::store_local:
+        case ir_op::store_global:
+        case ir_op::jump:
+        case ir_op::jump_if:
+        case ir_op::jump_if_not:
+        case ir_op::ret:
+            return false;
+        default:
+            return true;
+    }
+}
+
+/// Whether an SSA instruction defines a value that needs a register.
+static bool defines_value(ssa_inst const &inst) noexcept
+{
+    return inst.kind == ssa_kind::phi || inst.kind == ssa_kind::param
+        || (inst.kind == ssa_kind::op && writes_register(inst.op));
+}
+
+// SHARED UTILITIES
+
+u32 ssa_add_inst(ssa_function &fn, u32 block, ssa_kind kind, ir_op op, u32 arg_count, s32 imm) noexcept
+{
+    u32 v = u32(fn.insts.size());
+    fn.insts.push_back({ kind, op, block, u32(fn.args.size()), arg_count, imm, ssa_null });
+    fn.args.resize(fn.args.size() + arg_count, ssa_null);
+    fn.forward.push_back(ssa_null);
+    if (block != ssa_null) {
+        fn.blocks[block].insts.push_back(v);
+    }
+    return v;
+}
+
+u32 ssa_resolve(ssa_function const &fn, u32 value) noexcept
+{
+    while (value != ssa_null && fn.forward[value] != ssa_null) {
+        value = fn.forward[value];
+    }
+    return value;
+}
+
+void ssa_replace(ssa_function &fn, u32 value, u32 replacement) noexcept
+{
+    assert(ssa_resolve(fn, replacement) != value);
+    fn.insts[value].kind = ssa_kind::dead;
+    fn.forward[value] = replacement;
+}
+
+void ssa_remove_pred(ssa_function &fn, u32 block, u32 pred_index) noexcept
+{
+    ssa_block &b = fn.blocks[block];
+    for (u32 v : b.insts) {
+        ssa_inst &phi = fn.insts[v];
+        if (phi.kind != ssa_kind::phi) {
+            continue;
+        }
+        u32 *args = fn.args.data() + phi.first_arg;
+        std::copy(args + pred_index + 1, args + phi.arg_count, args + pred_index);
+        --phi.arg_count;
+    }
+    b.preds.erase(b.preds.begin() + pred_index);
+}
+
+void ssa_cleanup(ssa_function &fn) noexcept
+{
+    for (ssa_block &b : fn.blocks) {
+        if (b.removed) {
+            b.insts.clear();
+            continue;
+        }
+        std::erase_if(b.insts, [&](u32 v) { return fn.insts[v].kind == ssa_kind::dead; });
+        for (u32 v : b.insts) {
+            ssa_inst const &inst = fn.insts[v];
+            for (u32 i = 0; i < inst.arg_count; ++i) {
+                fn.args[inst.first_arg + i] = ssa_resolve(fn, fn.args[inst.first_arg + i]);
+            }
+        }
+    }
+}
+
+u64 ssa_instruction_count(ssa_function const &fn) noexcept
+{
+    u64 n = 0;
+    for (ssa_block const &b : fn.blocks) {
+        if (!b.removed) {
+            n += b.insts.size();
+        }
+    }
+    return n - fn.param_count;
+}
+
+// DOMINATORS
+
+void ssa_compute_dominators(ssa_function &fn) noexcept
+{
+    u32 const block_count = u32(fn.blocks.size());
+
+    // Postorder by iterative DFS, then reversed.
+    fn.rpo.clear();
+    std::vector<u8> state(block_count, 0); // 0 unvisited, 1 on the stack, 2 done
+    std::vector<std::pair<u32, u32>> stack; // block, next successor to visit
+    stack.push_back({ 0, 0 });
+    state[0] = 1;
+    while (!stack.empty()) {
+        auto &[b, next] = stack.back();
+        if (next < 2) {
+            u32 s = fn.blocks[b].succs[next++];
+            if (s != ssa_null && state[s] == 0 && !fn.blocks[s].removed) {
+                state[s] = 1;
+                stack.push_back({ s, 0 });
+            }
+            continue;
+        }
+        state[b] = 2;
+        fn.rpo.push_back(b);
+        stack.pop_back();
+    }
+    std::reverse(fn.rpo.begin(), fn.rpo.end());
+
+    std::vector<u32> rpo_index(block_count, ssa_null);
+    for (u32 i = 0; i < fn.rpo.size(); ++i) {
+        rpo_index[fn.rpo[i]] = i;
+    }
+    for (ssa_block &b : fn.blocks) {
+        b.idom = ssa_null;
+    }
+
+    // "A Simple, Fast Dominance Algorithm" (Cooper, Harvey & Kennedy): iterate to a fixed point in reverse
+    // postorder, intersecting the dominator chains of already processed predecessors.
+    auto intersect = [&](u32 x, u32 y) {
+        while (x != y) {
+            while (rpo_index[x] > rpo_index[y]) x = fn.blocks[x].idom;
+            while (rpo_index[y] > rpo_index[x]) y = fn.blocks[y].idom;
+        }
+        return x;
+    };
+
+    fn.blocks[0].idom = 0;
+    for (bool changed = true; changed;) {
+        changed = false;
+        for (u32 i = 1; i < fn.rpo.size(); ++i) {
+            u32 b = fn.rpo[i];
+            u32 new_idom = ssa_null;
+            for (u32 p : fn.blocks[b].preds) {
+                if (rpo_index[p] == ssa_null || fn.blocks[p].idom == ssa_null) {
+                    continue;
+                }
+                new_idom = new_idom == ssa_null ? p : intersect(p, new_idom);
+            }
+            if (fn.blocks[b].idom != new_idom) {
+                fn.blocks[b].idom = new_idom;
+                changed = true;
+            }
+        }
+    }
+    fn.blocks[0].idom = ssa_null;
+}
+
+std::vector<std::vector<u32>> ssa_dominator_tree(ssa_function const &fn) noexcept
+{
+    std::vector<std::vector<u32>> children(fn.blocks.size());
+    for (u32 b : fn.rpo) {
+        if (fn.blocks[b].idom != ssa_null) {
+            children[fn.blocks[b].idom].push_back(b);
+        }
+    }
+    return children;
+}
+
+// CONSTRUCTION
+
+class ssa_builder
+{
+public:
+    ssa_builder(ir_function const &fn, ssa_function &out) noexcept : m_fn(fn), m_out(out)
+    {
+    }
+
+    void build() noexcept;
+
+private:
+    ir_function const &m_fn;
+    ssa_function &m_out;
+
+    std::vector<u32> m_block_start;          // code range of each block, `ssa_null` for the synthetic entry
+    std::vector<u32> m_block_end;
+    std::vector<u32> m_phi_var;              // variable of each phi value
+    std::vector<std::vector<u32>> m_stacks;  // reaching definitions per variable, innermost last
+    std::vector<u32> m_pushed;               // variables pushed, for popping when leaving a block
+    std::vector<std::vector<u32>> m_dom_children;
+    u32 m_undef = ssa_null;
+
+    // Registers are variables 0..register_count-1, slots follow.
+    u32 slot_var(s32 slot) const noexcept
+    {
+        return m_fn.register_count + u32(slot);
+    }
+
+    u32 current(u32 var) noexcept
+    {
+        if (!m_stacks[var].empty()) {
+            return m_stacks[var].back();
+        }
+        // Read before any write, which ast_to_ir only allows for code it zero-initializes anyway.
+        if (m_undef == ssa_null) {
+            m_undef = ssa_add_inst(m_out, ssa_null, ssa_kind::op, ir_op::mov_imm, 0, 0);
+            m_out.insts[m_undef].block = 0;
+            std::vector<u32> &entry = m_out.blocks[0].insts;
+            entry.insert(entry.begin() + m_out.param_count, m_undef);
+        }
+        return m_undef;
+    }
+
+    void define(u32 var, u32 value) noexcept
+    {
+        m_stacks[var].push_back(value);
+        m_pushed.push_back(var);
+    }
+
+    void split_blocks() noexcept;
+    void place_phis() noexcept;
+    void rename(u32 block) noexcept;
+};
+
+void ssa_builder::split_blocks() noexcept
+{
+    std::vector<ir_inst> const &code = m_fn.code;
+    u32 const n = u32(code.size());
+
+    std::vector<bool> leader(n + 1, false);
+    bool entry_is_target = false;
+    leader[0] = true;
+    for (u32 i = 0; i < n; ++i) {
+        if (ir_op_is_jump(code[i].op)) {
+            leader[code[i].imm] = true;
+            leader[i + 1] = true;
+            entry_is_target |= code[i].imm == 0;
+        } else if (code[i].op == ir_op::ret) {
+            leader[i + 1] = true;
+        }
+    }
+
+    // The entry block must have no predecessors, loops starting at the first instruction get an empty one in front.
+    if (entry_is_target) {
+        m_block_start.push_back(ssa_null);
+        m_block_end.push_back(ssa_null);
+    }
+    std::vector<u32> block_of(n, ssa_null);
+    for (u32 i = 0; i < n; ++i) {
+        if (leader[i]) {
+            if (!m_block_start.empty() && m_block_start.back() != ssa_null) {
+                m_block_end.back() = i;
+            }
+            block_of[i] = u32(m_block_start.size());
+            m_block_start.push_back(i);
+            m_block_end.push_back(n);
+        }
+    }
+
+    u32 const block_count = u32(m_block_start.size());
+    m_out.blocks.resize(block_count);
+    for (u32 b = 0; b < block_count; ++b) {
+        ssa_block &block = m_out.blocks[b];
+        u32 next = b + 1 < block_count ? b + 1 : ssa_null;
+        if (m_block_start[b] == ssa_null) {
+            block.succs[0] = next;
+            continue;
+        }
+        block.layout = m_block_start[b];
+
+        ir_inst const &last = code[m_block_end[b] - 1];
+        switch (last.op) {
+            case ir_op::jump:           block.succs[0] = block_of[last.imm]; break;
+            case ir_op::jump_if:        block.succs[0] = block_of[last.imm]; block.succs[1] = next; break;
+            case ir_op::jump_if_not:    block.succs[0] = next; block.succs[1] = block_of[last.imm]; break;
+            case ir_op::ret:            break;
+            default:                    block.succs[0] = next; break;
+        }
+        assert(last.op == ir_op::ret || (block.succs[0] != ssa_null && (!ir_op_is_jump(last.op) || last.op == ir_op::jump || block.succs[1] != ssa_null)));
+        if (block.succs[1] == block.succs[0]) {
+            block.succs[1] = ssa_null; // a branch to where it falls through anyway
+        }
+    }
+
+    ssa_compute_dominators(m_out);
+
+    std::vector<bool> reachable(block_count, false);
+    for (u32 b : m_out.rpo) {
+        reachable[b] = true;
+    }
+    for (u32 b = 0; b < block_count; ++b) {
+        m_out.blocks[b].removed = !reachable[b];
+    }
+    for (u32 b = 0; b < block_count; ++b) {
+        if (!reachable[b]) {
+            continue;
+        }
+        for (u32 s : m_out.blocks[b].succs) {
+            if (s != ssa_null) {
+                m_out.blocks[s].preds.push_back(b);
+            }
+        }
+    }
+    ssa_compute_dominators(m_out);
+}
+
+void ssa_builder::place_phis() noexcept
+{
+    std::vector<ir_inst> const &code = m_fn.code;
+    u32 const block_count = u32(m_out.blocks.size());
+    u32 const var_count = m_fn.register_count + m_fn.slot_count;
+
+    // Dominance frontiers, again following Cooper, Harvey & Kennedy.
+    std::vector<std::vector<u32>> frontier(block_count);
+    for (u32 b : m_out.rpo) {
+        std::vector<u32> const &preds = m_out.blocks[b].preds;
+        if (preds.size() < 2) {
+            continue;
+        }
+        for (u32 p : preds) {
+            for (u32 runner = p; runner != m_out.blocks[b].idom; runner = m_out.blocks[runner].idom) {
+                if (frontier[runner].empty() || frontier[runner].back() != b) {
+                    frontier[runner].push_back(b);
+                }
+            }
+        }
+    }
+
+    // Variables read in a block before being written there are live across blocks ("global names" of
+    // semi-pruned SSA), the rest are statement temporaries and never need a phi.
+    std::vector<bool> global(var_count, false);
+    std::vector<std::vector<u32>> def_blocks(var_count);
+    std::vector<u32> defined_in(var_count, ssa_null);
+
+    auto def = [&](u32 var, u32 b) {
+        if (defined_in[var] != b) {
+            defined_in[var] = b;
+            def_blocks[var].push_back(b);
+        }
+    };
+    auto use = [&](u32 var, u32 b) {
+        if (defined_in[var] != b) {
+            global[var] = true;
+        }
+    };
+
+    for (u32 b : m_out.rpo) {
+        if (b == 0) {
+            for (u32 p = 0; p < m_fn.param_count; ++p) {
+                def(p, 0);
+            }
+        }
+        if (m_block_start[b] == ssa_null) {
+            continue;
+        }
+        for (u32 i = m_block_start[b]; i < m_block_end[b]; ++i) {
+            ir_inst const &inst = code[i];
+            if (inst.op == ir_op::call || inst.op == ir_op::call_builtin) {
+                for (u32 r = inst.b; r < u32(inst.b) + inst.c; ++r) {
+                    use(r, b);
+                }
+            } else {
+                u32 reads[2];
+                for (u32 k = 0, count = read_registers(inst, reads); k < count; ++k) {
+                    use(reads[k], b);
+                }
+            }
+            if (inst.op == ir_op::load_local) {
+                use(slot_var(inst.imm), b);
+            }
+
+            if (inst.op == ir_op::store_local) {
+                def(slot_var(inst.imm), b);
+            } else if (writes_register(inst.op)) {
+                def(inst.a, b);
+            }
+        }
+    }
+
+    std::vector<u32> has_phi(block_count, ssa_null);
+    std::vector<u32> queued(block_count, ssa_null);
+    std::vector<u32> work;
+    for (u32 var = 0; var < var_count; ++var) {
+        if (!global[var]) {
+            continue;
+        }
+        work = def_blocks[var];
+        for (u32 b : work) {
+            queued[b] = var;
+        }
+        while (!work.empty()) {
+            u32 x = work.back();
+            work.pop_back();
+            for (u32 y : frontier[x]) {
+                if (has_phi[y] == var) {
+                    continue;
+                }
+                has_phi[y] = var;
+                u32 phi = ssa_add_inst(m_out, y, ssa_kind::phi, ir_op::nop, u32(m_out.blocks[y].preds.size()));
+                m_phi_var.resize(phi + 1, ssa_null);
+                m_phi_var[phi] = var;
+                if (queued[y] != var) {
+                    queued[y] = var;
+                    work.push_back(y);
+                }
+            }
+        }
+    }
+}
+
+void ssa_builder::rename(u32 block) noexcept
+{
+    u64 pushed_before = m_pushed.size();
+    ssa_block &b = m_out.blocks[block];
+
+    for (u32 v : std::vector<u32>(b.insts)) {
+        if (m_out.insts[v].kind == ssa_kind::phi) {
+            define(m_phi_var[v], v);
+        }
+    }
+
+    bool terminated = false;
+    if (m_block_start[block] != ssa_null) {
+        for (u32 i = m_block_start[block]; i < m_block_end[block]; ++i) {
+            ir_inst const &inst = m_fn.code[i];
+            u32 first_new = u32(m_out.insts.size());
+            switch (inst.op) {
+                case ir_op::nop:
+                    break;
+                // Copies and slot accesses only rename, which is what mem2reg and copy propagation amount to.
+                case ir_op::mov:
+                    define(inst.a, current(inst.b));
+                    break;
+                case ir_op::load_local:
+                    define(inst.a, current(slot_var(inst.imm)));
+                    break;
+                case ir_op::store_local:
+                    define(slot_var(inst.imm), current(inst.a));
+                    break;
+
+                case ir_op::jump:
+                    ssa_add_inst(m_out, block, ssa_kind::op, ir_op::jump, 0);
+                    terminated = true;
+                    break;
+                case ir_op::jump_if:
+                case ir_op::jump_if_not:
+                    if (b.succs[1] == ssa_null) {
+                        ssa_add_inst(m_out, block, ssa_kind::op, ir_op::jump, 0);
+                    } else {
+                        u32 cond = current(inst.a);
+                        u32 v = ssa_add_inst(m_out, block, ssa_kind::op, ir_op::jump_if, 1);
+                        m_out.arg(v, 0) = cond;
+                    }
+                    terminated = true;
+                    break;
+
+                case ir_op::call:
+                case ir_op::call_builtin: {
+                    u32 v = ssa_add_inst(m_out, block, ssa_kind::op, inst.op, inst.c, inst.imm);
+                    for (u32 k = 0; k < inst.c; ++k) {
+                        m_out.arg(v, k) = current(inst.b + k);
+                    }
+                    define(inst.a, v);
+                    break;
+                }
+
+                default: {
+                    u32 reads[2];
+                    u32 count = read_registers(inst, reads);
+                    u32 operands[2];
+                    for (u32 k = 0; k < count; ++k) {
+                        operands[k] = current(reads[k]);
+                    }
+                    u32 v = ssa_add_inst(m_out, block, ssa_kind::op, inst.op, count, inst.imm);
+                    for (u32 k = 0; k < count; ++k) {
+                        m_out.arg(v, k) = operands[k];
+                    }
+                    if (writes_register(inst.op)) {
+                        define(inst.a, v);
+                    }
+                    terminated = inst.op == ir_op::ret;
+                    break;
+                }
+            }
+            for (u32 v = first_new; v < m_out.insts.size(); ++v) {
+                m_out.insts[v].node = i < m_fn.nodes.size() ? m_fn.nodes[i] : ssa_null;
+            }
+        }
+    }
+    if (!terminated) {
+        ssa_add_inst(m_out, block, ssa_kind::op, ir_op::jump, 0);
+    }
+
+    for (u32 s : m_out.blocks[block].succs) {
+        if (s == ssa_null) {
+            continue;
+        }
+        std::vector<u32> const &preds = m_out.blocks[s].preds;
+        u32 j = u32(std::find(preds.begin(), preds.end(), block) - preds.begin());
+        for (u32 v : m_out.blocks[s].insts) {
+            if (m_out.insts[v].kind == ssa_kind::phi) {
+                u32 value = current(m_phi_var[v]);
+                m_out.arg(v, j) = value;
+            }
+        }
+    }
+
+    for (u32 child : m_dom_children[block]) {
+        rename(child);
+    }
+
+    while (m_pushed.size() > pushed_before) {
+        m_stacks[m_pushed.back()].pop_back();
+        m_pushed.pop_back();
+    }
+}
+
+void ssa_builder::build() noexcept
+{
+    split_blocks();
+    place_phis();
+
+    m_stacks.resize(m_fn.register_count + m_fn.slot_count);
+    m_dom_children = ssa_dominator_tree(m_out);
+
+    // Parameters come first in the entry block, which has no predecessors and so no phis.
+    assert(m_out.blocks[0].insts.empty());
+    for (u32 p = 0; p < m_fn.param_count; ++p) {
+        m_stacks[p].push_back(ssa_add_inst(m_out, 0, ssa_kind::param, ir_op::nop, 0, s32(p)));
+    }
+
+    rename(0);
+}
+
+bool ssa_build(ir_function const &fn, ssa_function &out) noexcept
+{
+    out = {};
+    out.param_count = fn.param_count;
+    if (fn.code.empty() || fn.code.back().op != ir_op::ret) {
+        return false;
+    }
+    for (ir_inst const &inst : fn.code) {
+        if (ir_op_is_superinstruction(inst.op)) {
+            return false;
+        }
+    }
+
+    ssa_builder builder(fn, out);
+    builder.build();
+    return true;
+}
+
+// OUT OF SSA
+
+/// Appends `copies` (dst, src register pairs with distinct destinations, all reading the values from
+/// before any of them) as a sequence of movs, breaking cycles with `temp`.
+static void emit_parallel_copy(std::vector<std::pair<u32, u32>> copies, std::vector<ir_inst> &code, u32 &temp, u32 &register_count) noexcept
+{
+    while (!copies.empty()) {
+        bool emitted = false;
+        for (u64 i = 0; i < copies.size(); ++i) {
+            u32 dst = copies[i].first;
+            bool read_later = std::any_of(copies.begin(), copies.end(), [&](auto const &c) { return c.second == dst; });
+            if (!read_later) {
+                code.push_back({ ir_op::mov, 0, u16(dst), u16(copies[i].second), 0, 0 });
+                copies.erase(copies.begin() + s64(i));
+                emitted = true;
+                break;
+            }
+        }
+        if (emitted) {
+            continue;
+        }
+        // Only cycles remain: save one destination so it stops being read, which unblocks its cycle.
+        if (temp == ssa_null) {
+            temp = register_count++;
+        }
+        u32 saved = copies.front().first;
+        code.push_back({ ir_op::mov, 0, u16(temp), u16(saved), 0, 0 });
+        for (auto &c : copies) {
+            if (c.second == saved) {
+                c.second = temp;
+            }
+        }
+    }
+}
+
+bool ssa_to_ir(ssa_function const &fn, ir_function &out) noexcept
+{
+    u32 const value_count = u32(fn.insts.size());
+    u32 const block_count = u32(fn.blocks.size());
+
+    std::vector<u32> layout = fn.rpo;
+    std::sort(layout.begin(), layout.end(), [&](u32 x, u32 y) {
+        return fn.blocks[x].layout != fn.blocks[y].layout ? fn.blocks[x].layout < fn.blocks[y].layout : x < y;
+    });
+    assert(layout.empty() || layout.front() == 0);
+
+    // REGISTERS
+
+    std::vector<u32> use_count(value_count, 0);
+    for (u32 b : layout) {
+        for (u32 v : fn.blocks[b].insts) {
+            for (u32 i = 0; i < fn.insts[v].arg_count; ++i) {
+                ++use_count[fn.arg(v, i)];
+            }
+        }
+    }
+
+    std::vector<u32> reg(value_count, ssa_null);
+    std::vector<u32> call_base(value_count, 0);
+    u32 register_count = fn.param_count;
+
+    // Argument blocks first, so values computed only to be passed can be computed in place.
+    for (u32 b : layout) {
+        for (u32 v : fn.blocks[b].insts) {
+            ssa_inst const &inst = fn.insts[v];
+            if ((inst.op != ir_op::call && inst.op != ir_op::call_builtin) || inst.arg_count == 0) {
+                continue;
+            }
+            call_base[v] = register_count;
+            register_count += inst.arg_count;
+            for (u32 i = 0; i < inst.arg_count; ++i) {
+                u32 a = fn.arg(v, i);
+                if (fn.insts[a].kind == ssa_kind::op && fn.insts[a].block == b && use_count[a] == 1) {
+                    reg[a] = call_base[v] + i;
+                }
+            }
+        }
+    }
+    for (u32 b : layout) {
+        for (u32 v : fn.blocks[b].insts) {
+            if (fn.insts[v].kind == ssa_kind::phi) {
+                reg[v] = register_count++;
+            }
+        }
+    }
+
+    // Likewise values computed only to flow into a phi over a plain jump are computed into the phi's register,
+    // provided the phi's current value is not read after that point.
+    for (u32 s : layout) {
+        ssa_block const &block = fn.blocks[s];
+        for (u32 j = 0; j < block.preds.size(); ++j) {
+            ssa_block const &pred = fn.blocks[block.preds[j]];
+            if (pred.succs[1] != ssa_null) {
+                continue;
+            }
+            for (u32 phi : block.insts) {
+                if (fn.insts[phi].kind != ssa_kind::phi) {
+                    continue;
+                }
+                u32 a = fn.arg(phi, j);
+                if (reg[a] != ssa_null || fn.insts[a].kind != ssa_kind::op || fn.insts[a].block != block.preds[j] || use_count[a] != 1) {
+                    continue;
+                }
+                auto reads_phi = [&](u32 v) {
+                    for (u32 i = 0; i < fn.insts[v].arg_count; ++i) {
+                        if (fn.arg(v, i) == phi) return true;
+                    }
+                    return false;
+                };
+                auto def = std::find(pred.insts.begin(), pred.insts.end(), a);
+                bool read_later = std::any_of(def + 1, pred.insts.end(), reads_phi);
+                for (u32 other : block.insts) {
+                    read_later |= fn.insts[other].kind == ssa_kind::phi && fn.arg(other, j) == phi;
+                }
+                if (!read_later) {
+                    reg[a] = reg[phi];
+                }
+            }
+        }
+    }
+
+    for (u32 b : layout) {
+        for (u32 v : fn.blocks[b].insts) {
+            ssa_inst const &inst = fn.insts[v];
+            if (reg[v] != ssa_null || !defines_value(inst)) {
+                continue;
+            }
+            reg[v] = inst.kind == ssa_kind::param ? u32(inst.imm) : register_count++;
+        }
+    }
+
+    // PHI COPIES
+
+    // Copies of edge (b, k) into successor succs[k], each a parallel copy.
+    std::vector<std::vector<std::pair<u32, u32>>> copies(block_count * 2);
+    for (u32 s : layout) {
+        ssa_block const &block = fn.blocks[s];
+        for (u32 j = 0; j < block.preds.size(); ++j) {
+            u32 p = block.preds[j];
+            u32 k = fn.blocks[p].succs[0] == s ? 0 : 1;
+            for (u32 v : block.insts) {
+                if (fn.insts[v].kind != ssa_kind::phi) {
+                    continue;
+                }
+                u32 src = reg[fn.arg(v, j)];
+                if (src != reg[v]) {
+                    copies[p * 2 + k].push_back({ reg[v], src });
+                }
+            }
+        }
+    }
+
+    // LAYOUT
+
+    // Emission units: blocks, each followed by the blocks splitting its critical edges that carry copies.
+    struct unit
+    {
+        u32 block;  // for a split edge, the block it leaves
+        u32 edge;   // `ssa_null` for the block itself, otherwise the successor index
+    };
+    std::vector<unit> units;
+    std::vector<u32> unit_of_block(block_count, ssa_null);
+    std::vector<u32> unit_of_edge(block_count * 2, ssa_null);
+    for (u32 b : layout) {
+        unit_of_block[b] = u32(units.size());
+        units.push_back({ b, ssa_null });
+        bool branches = fn.blocks[b].succs[1] != ssa_null;
+        for (u32 k : { 1u, 0u }) {
+            if (branches && !copies[b * 2 + k].empty()) {
+                unit_of_edge[b * 2 + k] = u32(units.size());
+                units.push_back({ b, k });
+            }
+        }
+    }
+
+    // Blocks with nothing but a jump are skipped, their predecessors jump straight to where they lead.
+    u32 const unit_count = u32(units.size());
+    std::vector<bool> forwarding(unit_count, false);
+    for (u32 u = 1; u < unit_count; ++u) {
+        u32 b = units[u].block;
+        forwarding[u] = units[u].edge == ssa_null && fn.blocks[b].insts.size() == 1
+                     && fn.insts[fn.terminator(b)].op == ir_op::jump && copies[b * 2].empty();
+    }
+    std::vector<u8> state(unit_count, 0); // 0 unresolved, 1 resolving, 2 resolved
+    std::vector<u32> final_unit(unit_count);
+    auto resolve = [&](auto &self, u32 u) -> u32 {
+        if (!forwarding[u]) return u;
+        if (state[u] == 2) return final_unit[u];
+        if (state[u] == 1) {
+            forwarding[u] = false; // an empty infinite loop, keep one block of it
+            return u;
+        }
+        state[u] = 1;
+        u32 target = self(self, unit_of_block[fn.blocks[units[u].block].succs[0]]);
+        state[u] = 2;
+        final_unit[u] = forwarding[u] ? target : u;
+        return final_unit[u];
+    };
+    for (u32 u = 0; u < unit_count; ++u) {
+        resolve(resolve, u);
+    }
+    auto target_of = [&](u32 b, u32 k) {
+        u32 split = unit_of_edge[b * 2 + k];
+        return split != ssa_null ? split : resolve(resolve, unit_of_block[fn.blocks[b].succs[k]]);
+    };
+
+    // EMISSION
+
+    std::vector<ir_inst> code;
+    std::vector<u32> nodes;     // of `code`, filled in after each instruction's emission
+    std::vector<u32> unit_start(unit_count, 0);
+    std::vector<std::pair<u32, u32>> fixups; // jump instruction, target unit
+    u32 temp = ssa_null;
+
+    auto emit = [&](ir_op op, u32 a = 0, u32 b = 0, u32 c = 0, s32 imm = 0) {
+        code.push_back({ op, 0, u16(a), u16(b), u16(c), imm });
+    };
+    auto emit_jump = [&](ir_op op, u32 cond, u32 target) {
+        fixups.push_back({ u32(code.size()), target });
+        emit(op, cond);
+    };
+
+    for (u32 u = 0; u < unit_count; ++u) {
+        if (forwarding[u]) {
+            continue;
+        }
+        unit_start[u] = u32(code.size());
+        u32 next = u + 1;
+        while (next < unit_count && forwarding[next]) {
+            ++next;
+        }
+
+        u32 b = units[u].block;
+        if (units[u].edge != ssa_null) {
+            u32 k = units[u].edge;
+            emit_parallel_copy(copies[b * 2 + k], code, temp, register_count);
+            u32 target = resolve(resolve, unit_of_block[fn.blocks[b].succs[k]]);
+            if (target != next) {
+                emit_jump(ir_op::jump, 0, target);
+            }
+            nodes.resize(code.size(), fn.insts[fn.terminator(b)].node); // the split edge belongs to the branch
+            continue;
+        }
+
+        for (u32 v : fn.blocks[b].insts) {
+            ssa_inst const &inst = fn.insts[v];
+            if (inst.kind != ssa_kind::op) {
+                continue;
+            }
+            switch (inst.op) {
+                case ir_op::jump: {
+                    emit_parallel_copy(copies[b * 2], code, temp, register_count);
+                    u32 target = target_of(b, 0);
+                    if (target != next) {
+                        emit_jump(ir_op::jump, 0, target);
+                    }
+                    break;
+                }
+                case ir_op::jump_if: {
+                    u32 cond = reg[fn.arg(v, 0)];
+                    u32 on_true = target_of(b, 0);
+                    u32 on_false = target_of(b, 1);
+                    if (on_true == on_false) {
+                        if (on_true != next) emit_jump(ir_op::jump, 0, on_true);
+                    } else if (on_false == next) {
+                        emit_jump(ir_op::jump_if, cond, on_true);
+                    } else if (on_true == next) {
+                        emit_jump(ir_op::jump_if_not, cond, on_false);
+                    } else {
+                        emit_jump(ir_op::jump_if, cond, on_true);
+                        emit_jump(ir_op::jump, 0, on_false);
+                    }
+                    break;
+                }
+                case ir_op::ret:
+                case ir_op::store_global:
+                    emit(inst.op, reg[fn.arg(v, 0)], 0, 0, inst.imm);
+                    break;
+                case ir_op::call:
+                case ir_op::call_builtin: {
+                    u32 base = call_base[v];
+                    for (u32 i = 0; i < inst.arg_count; ++i) {
+                        if (reg[fn.arg(v, i)] != base + i) {
+                            emit(ir_op::mov, base + i, reg[fn.arg(v, i)]);
+                        }
+                    }
+                    emit(inst.op, reg[v], base, inst.arg_count, inst.imm);
+                    break;
+                }
+                default:
+                    emit(inst.op, reg[v], inst.arg_count > 0 ? reg[fn.arg(v, 0)] : 0, inst.arg_count > 1 ? reg[fn.arg(v, 1)] : 0, inst.imm);
+                    break;
+            }
+            nodes.resize(code.size(), inst.node);
+        }
+    }
+    for (auto [at, target] : fixups) {
+        code[at].imm = s32(unit_start[target]);
+    }
+
+    if (register_count > ir_max_registers) {
+        return false;
+    }
+    out.code = std::move(code);
+    out.nodes = std::move(nodes);
+    out.register_count = register_count;
+    out.slot_count = 0;
+    return true;
+}
+
+// DEBUGGING
+
+std::string ssa_function_to_string(ssa_function const &fn) noexcept
+{
+    std::string s;
+    for (u32 b : fn.rpo) {
+        ssa_block const &block = fn.blocks[b];
+        s += make_str("b%u:", b);
+        if (!block.preds.empty()) {
+            s += "  ; preds";
+            for (u32 p : block.preds) s += make_str(" b%u", p);
+        }
+        if (block.idom != ssa_null) {
+            s += make_str(", idom b%u", block.idom);
+        }
+        s += '\n';
+
+        for (u32 v : block.insts) {
+            ssa_inst const &inst = fn.insts[v];
+            s += "    ";
+            if (defines_value(inst)) {
+                s += make_str("v%u = ", v);
+            }
+            s += inst.kind == ssa_kind::phi ? "phi" : inst.kind == ssa_kind::param ? "param" : ir_op_name(inst.op);
+            for (u32 i = 0; i < inst.arg_count; ++i) {
+                s += make_str(i == 0 ? " v%u" : ", v%u", fn.arg(v, i));
+            }
+            if (inst.kind == ssa_kind::param || (inst.kind == ssa_kind::op && inst.op != ir_op::jump && inst.op != ir_op::jump_if && inst.op != ir_op::ret && inst.arg_count < 2)) {
+                s += make_str(inst.arg_count == 0 ? " %d" : ", %d", inst.imm);
+            }
+            if (inst.op == ir_op::jump) {
+                s += make_str(" b%u", block.succs[0]);
+            } else if (inst.op == ir_op::jump_if) {
+                s += make_str(", b%u, b%u", block.succs[0], block.succs[1]);
+            }
+            s += '\n';
+        }
+    }
+    return s;
+}
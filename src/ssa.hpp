@@ -0,0 +1,102 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "ir.hpp"
+
+u32 constexpr ssa_null = u32(-1);
+
+enum class ssa_kind : u8
+{
+    op,     // an `ir_op` over SSA values
+    phi,    // one argument per predecessor, in `ssa_block::preds` order
+    param,  // parameter number `imm`, defined on entry
+    dead,   // removed by a pass, uses are redirected through `ssa_function::forward`
+};
+
+/// One instruction, which is also the value it defines: values are indices into `ssa_function::insts`.
+/// Its operands are `arg_count` values starting at `ssa_function::args[first_arg]` and replace the register
+/// fields of `ir_inst`: two for binary ops, one for unary ops, stores, conditions and returns, one per
+/// argument for calls. `imm` keeps its `ir_op` meaning.
+struct ssa_inst
+{
+    ssa_kind kind;
+    ir_op op;
+    u32 block;
+    u32 first_arg;
+    u32 arg_count;
+    s32 imm;
+    u32 node;       // of the IR instruction it was built from, see `ir_function::nodes`, `ssa_null` if none
+};
+
+/// A basic block ends in exactly one terminator: `jump` (to succs[0]), `jump_if` (to succs[0] when its
+/// argument is non-zero, succs[1] otherwise) or `ret`. Both successors of a `jump_if` are distinct.
+struct ssa_block
+{
+    std::vector<u32> insts;     // phis, then the body, then the terminator
+    std::vector<u32> preds;
+    u32 succs[2] = { ssa_null, ssa_null };
+    u32 idom = ssa_null;        // immediate dominator, `ssa_null` for the entry and removed blocks
+    u32 layout = 0;             // where the block started in the linear IR, out-of-SSA keeps this order
+    bool removed = false;
+};
+
+/// @brief SSA form of one `ir_function`: registers and frame slots are both renamed into values, so no
+/// load_local, store_local or mov survives construction.
+struct ssa_function
+{
+    std::vector<ssa_inst> insts;
+    std::vector<u32> args;
+    std::vector<u32> forward;       // replacement of each dead value, `ssa_null` if none
+    std::vector<ssa_block> blocks;  // blocks[0] is the entry
+    std::vector<u32> rpo;           // reachable blocks in reverse postorder, kept by `ssa_compute_dominators`
+    u32 param_count = 0;
+
+    u32 arg(u32 value, u32 i) const noexcept { return args[insts[value].first_arg + i]; }
+    u32 &arg(u32 value, u32 i) noexcept { return args[insts[value].first_arg + i]; }
+    u32 terminator(u32 block) const noexcept { return blocks[block].insts.back(); }
+};
+
+/// Converts `fn` (unfused IR) to SSA: basic blocks from jump targets, dominators (Cooper, Harvey & Kennedy),
+/// phis at iterated dominance frontiers for every register and slot that is live across blocks
+/// (semi-pruned form) and renaming along the dominator tree. Every slot is promoted, which is mem2reg:
+/// no instruction can take a slot's address. Unreachable code is dropped and a read of a variable that
+/// was never written reads 0. Returns false if `fn` contains superinstructions.
+bool ssa_build(ir_function const &fn, ssa_function &out) noexcept;
+
+/// Recomputes `rpo` and every block's `idom` after edges or blocks were removed.
+void ssa_compute_dominators(ssa_function &fn) noexcept;
+
+/// Children of each block in the dominator tree.
+std::vector<std::vector<u32>> ssa_dominator_tree(ssa_function const &fn) noexcept;
+
+/// Appends a new instruction with `arg_count` operands (initially `ssa_null`) to `block`'s list
+/// and returns its value.
+u32 ssa_add_inst(ssa_function &fn, u32 block, ssa_kind kind, ir_op op, u32 arg_count, s32 imm = 0) noexcept;
+
+/// What `value` currently stands for, following replacements of dead values.
+u32 ssa_resolve(ssa_function const &fn, u32 value) noexcept;
+
+/// Kills `value`, redirecting its uses to `replacement` (applied by `ssa_cleanup`).
+void ssa_replace(ssa_function &fn, u32 value, u32 replacement) noexcept;
+
+/// Removes the edge from `block`'s pred number `pred_index`, dropping the matching phi arguments.
+void ssa_remove_pred(ssa_function &fn, u32 block, u32 pred_index) noexcept;
+
+/// Rewrites operands through replacements and drops dead instructions from their blocks.
+void ssa_cleanup(ssa_function &fn) noexcept;
+
+/// Instructions in live blocks, phis and terminators included, the unit of per-pass statistics.
+u64 ssa_instruction_count(ssa_function const &fn) noexcept;
+
+/// Leaves SSA into `out`, keeping its name and parameter count: phis become copies at the end of
+/// predecessors (on split critical edges where needed, sequentialized as parallel copies), blocks are laid
+/// out in their original order and jumps to the next block or through empty blocks are dropped.
+/// Every value gets its own register, except that values computed only to be passed to a call or to flow
+/// into a phi are computed straight into the argument block or the phi's register.
+/// Returns false, leaving `out` untouched, if that needs more than `ir_max_registers`.
+bool ssa_to_ir(ssa_function const &fn, ir_function &out) noexcept;
+
+std::string ssa_function_to_string(ssa_function const &fn) noexcept;
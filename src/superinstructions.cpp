@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <memory>
+
+#include "util.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+#include "test_suite.hpp"
+
+#include "superinstructions.hpp"
+
+/// Fused form of `x` followed by `y`, or an instruction with op `count` when the pair has no superinstruction.
+static ir_inst fuse_pair(ir_inst const &x, ir_inst const &y) noexcept
+{
+    auto fits_u16 = [](s32 v) { return v >= 0 && v <= 0xFFFF; };
+    auto fused = [](ir_op op, u16 a, u16 b, u16 c, s32 imm) { return ir_inst{ op, 0, a, b, c, imm }; };
+
+    switch (x.op) {
+        case ir_op::load_local:
+            if (y.op == ir_op::load_local && fits_u16(y.imm)) {
+                return fused(ir_op::load_local_pair, x.a, y.a, u16(y.imm), x.imm);
+            }
+            if (y.op == ir_op::mov_imm && fits_u16(x.imm)) {
+                return fused(ir_op::load_local_mov_imm, x.a, y.a, u16(x.imm), y.imm);
+            }
+            if (y.op == ir_op::add_imm && y.b == x.a && fits_u16(x.imm)) {
+                return fused(ir_op::load_local_add_imm, y.a, x.a, u16(x.imm), y.imm);
+            }
+            break;
+
+        case ir_op::load_local_add_imm:
+            if (y.op == ir_op::store_local && y.a == x.a && y.imm == s32(x.c)) {
+                return fused(ir_op::local_add_imm, x.a, x.b, x.c, x.imm);
+            }
+            if (y.op == ir_op::sext_store_local && y.a == x.a && y.b == x.a && y.c == 32 && y.imm == s32(x.c)) {
+                return fused(ir_op::local_add_imm_sext32, x.a, x.b, x.c, x.imm);
+            }
+            break;
+
+        case ir_op::mov_imm:
+            if (y.op == ir_op::store_local && y.a == x.a && fits_u16(y.imm)) {
+                return fused(ir_op::mov_imm_store_local, x.a, 0, u16(y.imm), x.imm);
+            }
+            break;
+
+        case ir_op::sext:
+            if (y.op == ir_op::store_local && y.a == x.a) {
+                return fused(ir_op::sext_store_local, x.a, x.b, u16(x.imm), y.imm);
+            }
+            break;
+
+        case ir_op::eq:
+        case ir_op::ne:
+        case ir_op::lt:
+        case ir_op::le:
+        case ir_op::gt:
+        case ir_op::ge:
+            if (y.op == ir_op::jump_if_not && y.a == x.a) {
+                ir_op op = ir_op(u8(ir_op::eq_jump_if_not) + (u8(x.op) - u8(ir_op::eq)));
+                return fused(op, x.a, x.b, x.c, y.imm);
+            }
+            break;
+
+        default:
+            break;
+    }
+    return fused(ir_op::count, 0, 0, 0, 0);
+}
+
+/// One round of fusion over `fn`, returns whether anything fused.
+static bool fuse_round(ir_function &fn, ir_pair_profile const *profile, fusion_stats *stats) noexcept
+{
+    std::vector<ir_inst> &code = fn.code;
+    u64 n = code.size();
+
+    std::vector<bool> is_target(n + 1, false);
+    for (ir_inst const &inst : code) {
+        if (ir_op_is_jump(inst.op)) {
+            is_target[u64(inst.imm)] = true;
+        }
+    }
+
+    struct candidate
+    {
+        u64 index;  // of the first instruction
+        u64 weight;
+        ir_inst fused;
+    };
+    std::vector<candidate> candidates;
+    for (u64 i = 0; i + 1 < n; ++i) {
+        if (is_target[i + 1]) {
+            continue;
+        }
+        ir_inst f = fuse_pair(code[i], code[i + 1]);
+        if (f.op != ir_op::count) {
+            u64 weight = profile ? profile->pairs[u8(code[i].op)][u8(code[i + 1].op)] : 0;
+            candidates.push_back({ i, weight, f });
+        }
+    }
+    if (candidates.empty()) {
+        return false;
+    }
+
+    // Hottest first, ties left to right; an instruction joins at most one pair per round.
+    std::stable_sort(candidates.begin(), candidates.end(), [](candidate const &l, candidate const &r) {
+        return l.weight > r.weight;
+    });
+    std::vector<bool> taken(n, false);
+    std::vector<bool> removed(n, false);
+    for (candidate const &c : candidates) {
+        if (taken[c.index] || taken[c.index + 1]) {
+            continue;
+        }
+        taken[c.index] = taken[c.index + 1] = true;
+        removed[c.index + 1] = true;
+        code[c.index] = c.fused;
+        if (stats != nullptr) {
+            ++stats->fused[u8(c.fused.op)];
+        }
+    }
+
+    // Compact and retarget jumps. A removed instruction was never a target, so it needs no mapping of its own.
+    // A fused instruction keeps the AST node of its first half.
+    bool has_nodes = fn.nodes.size() == n;
+    std::vector<u32> new_index(n + 1);
+    u64 out = 0;
+    for (u64 i = 0; i < n; ++i) {
+        new_index[i] = u32(out);
+        if (!removed[i]) {
+            if (has_nodes) {
+                fn.nodes[out] = fn.nodes[i];
+            }
+            code[out++] = code[i];
+        }
+    }
+    new_index[n] = u32(out);
+    code.resize(out);
+    if (has_nodes) {
+        fn.nodes.resize(out);
+    }
+
+    for (ir_inst &inst : code) {
+        if (ir_op_is_jump(inst.op)) {
+            inst.imm = s32(new_index[u64(inst.imm)]);
+        }
+    }
+    return true;
+}
+
+void fuse_superinstructions(ir_module &module, ir_pair_profile const *profile, fusion_stats *stats) noexcept
+{
+    if (stats != nullptr) {
+        *stats = {};
+        stats->instructions_before = module.instruction_count();
+    }
+
+    for (ir_function &fn : module.functions) {
+        while (fuse_round(fn, profile, stats)) {
+        }
+    }
+
+    if (stats != nullptr) {
+        stats->instructions_after = module.instruction_count();
+    }
+}
+
+// BENCHMARK
+
+superinstruction_benchmark_result superinstruction_benchmark(char const *csv_path, char const *data_dir, u64 iterations) noexcept
+{
+    superinstruction_benchmark_result result = {};
+
+    std::vector<compiler_test> tests;
+    std::string error;
+    if (!load_compiler_tests(csv_path, tests, error)) {
+        result.errors.push_back(error);
+    }
+
+    struct program
+    {
+        std::string name;
+        ir_module plain;
+        ir_module fused;
+        std::string expected_output; // of the unfused run
+    };
+    std::vector<program> programs;
+
+    auto add_program = [&](std::string name, compilation &comp) {
+        if (!compile_to_ir(comp)) {
+            result.errors.push_back(name + ": " + (comp.errors.empty() ? "compilation failed" : comp.errors.front()));
+            return;
+        }
+        programs.push_back({ std::move(name), std::move(comp.ir), {}, {} });
+    };
+
+    for (compiler_test const &test : tests) {
+        compilation comp;
+        std::string path = std::string(data_dir) + "/" + test.source_file;
+        if (!compilation_load_file(comp, path.c_str())) {
+            result.errors.push_back(test.name + ": cannot read " + path);
+            continue;
+        }
+        add_program(test.name, comp);
+    }
+    {
+        // The corpus is small and mostly declarations, a program with real loops keeps the numbers meaningful.
+        compilation comp;
+        comp.source_text = interpreter_benchmark_source();
+        add_program("interpreter_benchmark", comp);
+    }
+    result.programs = programs.size();
+
+    // Profile the unfused programs, then fuse them with that profile.
+    auto profile = std::make_unique<ir_pair_profile>();
+    interpreter_options counting;
+    counting.count_instructions = true;
+    for (program &p : programs) {
+        counting.profile = profile.get();
+        execution_result run;
+        execute_ir(p.plain, run, counting);
+        result.dispatches_before += run.instructions;
+        p.expected_output = run.output;
+
+        p.fused = p.plain;
+        fuse_superinstructions(p.fused, profile.get());
+        result.static_before += p.plain.instruction_count();
+        result.static_after += p.fused.instruction_count();
+    }
+
+    for (program &p : programs) {
+        counting.profile = nullptr;
+        execution_result run;
+        execute_ir(p.fused, run, counting);
+        result.dispatches_after += run.instructions;
+        if (run.output != p.expected_output) {
+            result.errors.push_back(p.name + ": output differs after fusion");
+        }
+    }
+
+    std::vector<superinstruction_benchmark_result::pair_count> pairs;
+    for (u64 x = 0; x < u64(ir_op::count); ++x) {
+        for (u64 y = 0; y < u64(ir_op::count); ++y) {
+            if (profile->pairs[x][y] != 0) {
+                pairs.push_back({ ir_op(x), ir_op(y), profile->pairs[x][y] });
+            }
+        }
+    }
+    std::sort(pairs.begin(), pairs.end(), [](auto const &l, auto const &r) { return l.count > r.count; });
+    pairs.resize(std::min(pairs.size(), size_t(10)));
+    result.hottest_pairs = std::move(pairs);
+
+    auto best_of = [&](bool fused) {
+        return best_time_us(iterations, [&] {
+            for (program const &p : programs) {
+                execution_result run;
+                execute_ir(fused ? p.fused : p.plain, run);
+            }
+        });
+    };
+    result.best_us_before = best_of(false);
+    result.best_us_after = best_of(true);
+
+    return result;
+}
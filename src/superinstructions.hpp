@@ -0,0 +1,48 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "ir.hpp"
+
+struct ir_pair_profile;
+
+struct fusion_stats
+{
+    u64 instructions_before;
+    u64 instructions_after;
+    u64 fused[u64(ir_op::count)]; // how many of each superinstruction were formed
+};
+
+/// Replaces adjacent instruction pairs with the superinstructions listed at the end of `ir_op`, for the
+/// interpreter only (other backends must run on unfused IR). A pair fuses only when its second instruction
+/// is not a jump target, and the fused form writes every register the pair wrote, so the pass needs no
+/// liveness information. Where candidate pairs overlap, the one `profile` saw dispatched more often wins
+/// (without a profile, the leftmost). Runs to a fixed point so fused pairs can absorb a neighbour, e.g.
+/// load_local + add_imm + sext + store_local becomes a single local_add_imm_sext32.
+void fuse_superinstructions(ir_module &module, ir_pair_profile const *profile, fusion_stats *stats = nullptr) noexcept;
+
+struct superinstruction_benchmark_result
+{
+    struct pair_count
+    {
+        ir_op first;
+        ir_op second;
+        u64 count;
+    };
+
+    u64 programs;                           // corpus programs that compiled, plus the interpreter benchmark program
+    std::vector<pair_count> hottest_pairs;  // top 10 of the profile, most frequent first
+    u64 static_before;                      // instructions in the modules
+    u64 static_after;
+    u64 dispatches_before;                  // instructions executed running every program once
+    u64 dispatches_after;
+    s64 best_us_before;                     // best-of-iterations time to run every program once
+    s64 best_us_after;
+    std::vector<std::string> errors;        // unreadable corpus, failed compiles, fused output that differs
+};
+
+/// Profiles opcode pairs running the programs of the tests CSV at `csv_path` (sources in `data_dir`),
+/// fuses with that profile and measures dispatch counts and wall time before and after on the same programs.
+superinstruction_benchmark_result superinstruction_benchmark(char const *csv_path, char const *data_dir, u64 iterations = 5) noexcept;
@@ -0,0 +1,354 @@
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string_view>
+
+#include "util.hpp"
+#include "mapped_file.hpp"
+#include "thread_pool.hpp"
+#include "compiler.hpp"
+#include "interpreter.hpp"
+#include "output_compare.hpp"
+
+#include "test_suite.hpp"
+
+namespace fs = std::filesystem;
+
+static std::string_view trim(std::string_view s) noexcept
+{
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t' || s.back() == '\r')) s.remove_suffix(1);
+    return s;
+}
+
+static std::vector<std::string_view> split_fields(std::string_view line) noexcept
+{
+    std::vector<std::string_view> fields;
+    for (;;) {
+        u64 comma = line.find(',');
+        fields.push_back(trim(line.substr(0, comma)));
+        if (comma == std::string_view::npos) {
+            return fields;
+        }
+        line.remove_prefix(comma + 1);
+    }
+}
+
+bool load_compiler_tests(char const *csv_path, std::vector<compiler_test> &out, std::string &error) noexcept
+{
+    out.clear();
+
+    mapped_file file;
+    if (!file.open(csv_path)) {
+        error = make_str("cannot read \"%s\"", csv_path);
+        return false;
+    }
+
+    std::string_view text = file.view();
+    bool header_seen = false;
+    u64 line_number = 0;
+
+    while (!text.empty()) {
+        u64 newline = text.find('\n');
+        std::string_view line = trim(text.substr(0, newline));
+        text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+        ++line_number;
+
+        if (line.empty()) {
+            continue;
+        }
+
+        std::vector<std::string_view> fields = split_fields(line);
+
+        if (!header_seen) {
+            if (fields.size() != 3 || fields[0] != "Test Name" || fields[1] != "Source File" || fields[2] != "Expected Output File") {
+                error = "the CSV columns must be: Test Name, Source File, Expected Output File";
+                return false;
+            }
+            header_seen = true;
+            continue;
+        }
+
+        if (fields.size() != 3) {
+            error = make_str("line %zu: expected 3 columns, found %zu", line_number, fields.size());
+            return false;
+        }
+        out.push_back({ std::string(fields[0]), std::string(fields[1]), std::string(fields[2]) });
+    }
+
+    return true;
+}
+
+bool load_compiler_test_results_db(char const *path, compiler_test_results_db &db, std::string &error) noexcept
+{
+    db.passed.clear();
+
+    std::error_code ec;
+    if (!fs::exists(path, ec)) {
+        return true;
+    }
+    mapped_file file;
+    if (!file.open(path)) {
+        error = make_str("cannot read \"%s\"", path);
+        return false;
+    }
+
+    std::string_view text = file.view();
+    while (!text.empty()) {
+        u64 newline = text.find('\n');
+        std::string_view line = text.substr(0, newline);
+        text.remove_prefix(newline == std::string_view::npos ? text.size() : newline + 1);
+
+        u64 tab = line.rfind('\t');
+        if (tab == std::string_view::npos) {
+            continue;
+        }
+        std::string hash(line.substr(tab + 1));
+        db.passed[std::string(line.substr(0, tab))] = strtoull(hash.c_str(), nullptr, 16);
+    }
+    return true;
+}
+
+bool save_compiler_test_results_db(char const *path, compiler_test_results_db const &db, std::string &error) noexcept
+{
+    std::string text;
+    for (auto const &[name, hash] : db.passed) {
+        text += name;
+        text += make_str("\t%016llx\n", (unsigned long long)hash);
+    }
+
+    std::error_code ec;
+    fs::path parent = fs::path(path).parent_path();
+    if (!parent.empty()) {
+        fs::create_directories(parent, ec);
+    }
+    // A temporary then a rename, so a run that is interrupted leaves the previous database whole.
+    std::string temp = std::string(path) + ".tmp";
+    FILE *file = fopen(temp.c_str(), "wb");
+    bool written = file != nullptr && fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = file != nullptr && fclose(file) == 0 && written;
+    if (written) {
+        fs::rename(temp, path, ec);
+        written = !ec;
+    }
+    if (!written) {
+        fs::remove(temp, ec);
+        error = make_str("cannot write \"%s\"", path);
+    }
+    return written;
+}
+
+u64 compiler_test_hash(compiler_test const &test, char const *data_dir, execution_engine engine) noexcept
+{
+    std::string source_path = std::string(data_dir) + "/" + test.source_file;
+    std::string expected_path = std::string(data_dir) + "/" + test.expected_output_file;
+    mapped_file source, expected;
+    if (!source.open(source_path.c_str()) || !expected.open(expected_path.c_str())) {
+        return 0;
+    }
+    // Sizes first, so bytes cannot move from one file to the other without changing the hash.
+    u64 const sizes[] = { source.size, expected.size };
+    u64 hash = fnv1a_hash(compiler_build_id());
+    hash = fnv1a_hash(execution_engine_name(engine), hash);
+    hash = fnv1a_hash(std::string_view(reinterpret_cast<char const *>(sizes), sizeof(sizes)), hash);
+    hash = fnv1a_hash(source.view(), hash);
+    return fnv1a_hash(expected.view(), hash);
+}
+
+bool compiler_test_unchanged(compiler_test_results_db const &db, compiler_test const &test, u64 hash) noexcept
+{
+    auto it = db.passed.find(test.name);
+    return hash != 0 && it != db.passed.end() && it->second == hash;
+}
+
+void compiler_test_results_db_record(compiler_test_results_db &db, compiler_test const &test, u64 hash, bool passed) noexcept
+{
+    if (passed && hash != 0) {
+        db.passed[test.name] = hash;
+    } else {
+        db.passed.erase(test.name);
+    }
+}
+
+compiler_test_result run_compiler_test(compiler_test const &test, char const *data_dir, char const *cache_dir,
+                                       compile_cache_stats &cache_stats, cancel_token const *cancel,
+                                       execution_engine engine) noexcept
+{
+    compiler_test_result result = {};
+
+    time_point_precise_t t0 = get_time_precise();
+    compilation comp;
+    comp.cancel = cancel;
+    std::string source_path = std::string(data_dir) + "/" + test.source_file;
+    if (!compilation_load_file(comp, source_path.c_str())) {
+        result.detail = "cannot read " + source_path;
+        return result;
+    }
+    bool compiled = cache_dir != nullptr ? compile_to_ir_cached(comp, cache_dir, cache_stats) : compile_to_ir(comp);
+    result.compile_us = time_diff_us(t0, get_time_precise());
+    result.preprocess_us = comp.preprocess_us;
+    result.lex_us = comp.lex_us;
+    result.parse_us = comp.parse_us;
+    result.ir_us = comp.ir_us;
+    if (!compiled) {
+        result.detail = cancelled(cancel) ? "cancelled" : comp.errors.empty() ? "compilation failed" : comp.errors.front();
+        return result;
+    }
+
+    std::string expected_path = std::string(data_dir) + "/" + test.expected_output_file;
+    mapped_file expected;
+    if (!expected.open(expected_path.c_str())) {
+        result.detail = "cannot read " + expected_path;
+        return result;
+    }
+
+    // The output is compared as the program prints it, so neither side is ever held whole, and a program
+    // stops at its first wrong byte.
+    output_comparator cmp;
+    output_compare_begin(cmp, expected.view());
+    execution_result run;
+    interpreter_options options;
+    options.cancel = cancel;
+    options.output_sink = [&](std::string_view chunk) {
+        time_point_precise_t t1 = get_time_precise();
+        bool more = output_compare_feed(cmp, chunk);
+        result.compare_us += time_diff_us(t1, get_time_precise());
+        return more;
+    };
+    execute_program(comp.ir, engine, run, options);
+    result.run_us = run.elapsed_us - result.compare_us;
+    if (cancelled(cancel)) {
+        result.detail = "cancelled";
+        return result;
+    }
+    if (!cmp.differs && !run.error.empty()) {
+        result.detail = "runtime error: " + run.error;
+        return result;
+    }
+    if (!output_compare_finish(cmp)) {
+        result.detail = "output differs from " + test.expected_output_file + " at " + output_compare_report(cmp);
+        return result;
+    }
+    result.passed = true;
+    return result;
+}
+
+compiler_test_run run_compiler_tests(std::vector<compiler_test> const &tests, char const *data_dir, char const *cache_dir,
+                                     thread_pool *pool, compiler_test_results_db *results_db,
+                                     execution_engine engine) noexcept
+{
+    compiler_test_run run = {};
+    run.engine = engine;
+    run.results.resize(tests.size());
+    run.threads = pool != nullptr ? pool->thread_count() : 1;
+    time_point_precise_t t0 = get_time_precise();
+
+    std::vector<u64> hashes(results_db != nullptr ? tests.size() : 0);
+    auto run_test = [&](u64 i, compile_cache_stats &cache_stats) {
+        if (results_db != nullptr) {
+            hashes[i] = compiler_test_hash(tests[i], data_dir, engine);
+            if (compiler_test_unchanged(*results_db, tests[i], hashes[i])) {
+                run.results[i].passed = true;
+                run.results[i].skipped = true;
+                return;
+            }
+        }
+        run.results[i] = run_compiler_test(tests[i], data_dir, cache_dir, cache_stats, nullptr, engine);
+    };
+
+    if (pool != nullptr) {
+        // Cache statistics per worker, so workers write nothing shared but their own results.
+        std::vector<compile_cache_stats> cache(pool->thread_count(), compile_cache_stats{});
+        pool->parallel_for(tests.size(), [&](u64 i, u32 worker) { run_test(i, cache[worker]); });
+        for (compile_cache_stats const &stats : cache) {
+            compile_cache_stats_add(run.cache, stats);
+        }
+    } else {
+        for (u64 i = 0; i < tests.size(); ++i) {
+            run_test(i, run.cache);
+        }
+    }
+
+    for (u64 i = 0; i < tests.size(); ++i) {
+        compiler_test_result const &result = run.results[i];
+        ++(result.passed ? run.passed : run.failed);
+        run.skipped += result.skipped;
+        if (results_db != nullptr && !result.skipped) {
+            compiler_test_results_db_record(*results_db, tests[i], hashes[i], result.passed);
+        }
+    }
+    run.elapsed_us = time_diff_us(t0, get_time_precise());
+    return run;
+}
+
+static void append_json_string(std::string &out, std::string_view s) noexcept
+{
+    out += '"';
+    for (char c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (u8(c) < 0x20) {
+                    out += make_str("\\u%04x", unsigned(u8(c)));
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+bool write_compiler_test_results(char const *path, std::vector<compiler_test> const &tests, compiler_test_run const &run,
+                                 std::string &error) noexcept
+{
+    std::string json = make_str(
+        "{\n"
+        "  \"passed\": %llu,\n"
+        "  \"failed\": %llu,\n"
+        "  \"skipped\": %llu,\n"
+        "  \"build\": \"%s\",\n"
+        "  \"engine\": \"%s\",\n"
+        "  \"threads\": %u,\n"
+        "  \"elapsed_us\": %lld,\n"
+        "  \"cache\": ",
+        (unsigned long long)run.passed, (unsigned long long)run.failed, (unsigned long long)run.skipped, compiler_build_id(),
+        execution_engine_name(run.engine), run.threads, (long long)run.elapsed_us);
+    append_json_string(json, compile_cache_stats_to_string(run.cache));
+    json += ",\n  \"tests\": [";
+
+    for (u64 i = 0; i < tests.size(); ++i) {
+        compiler_test_result const &result = run.results[i];
+        json += i == 0 ? "\n    {\"name\": " : ",\n    {\"name\": ";
+        append_json_string(json, tests[i].name);
+        json += make_str(", \"passed\": %s, \"skipped\": %s, \"detail\": ", result.passed ? "true" : "false",
+                         result.skipped ? "true" : "false");
+        append_json_string(json, result.detail);
+        json += make_str(
+            ", \"compile_us\": %lld, \"preprocess_us\": %lld, \"lex_us\": %lld, \"parse_us\": %lld, \"ir_us\": %lld, "
+            "\"run_us\": %lld, \"compare_us\": %lld}",
+            (long long)result.compile_us, (long long)result.preprocess_us, (long long)result.lex_us,
+            (long long)result.parse_us, (long long)result.ir_us, (long long)result.run_us, (long long)result.compare_us);
+    }
+    json += tests.empty() ? "]\n}\n" : "\n  ]\n}\n";
+
+    std::error_code ec;
+    fs::path parent = fs::path(path).parent_path();
+    if (!parent.empty()) {
+        fs::create_directories(parent, ec);
+    }
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr) {
+        error = make_str("cannot write \"%s\"", path);
+        return false;
+    }
+    bool written = fwrite(json.data(), 1, json.size(), file) == json.size();
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        error = make_str("cannot write \"%s\"", path);
+    }
+    return written;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "primitives.hpp"
+#include "compile_cache.hpp"
+#include "jit.hpp"
+
+struct thread_pool;
+struct cancel_token;
+
+/// One row of a tests CSV. The file names are relative to the tests data directory.
+struct compiler_test
+{
+    std::string name;
+    std::string source_file;
+    std::string expected_output_file;
+};
+
+/// Reads a tests CSV: the header "Test Name,Source File,Expected Output File" then one test per line,
+/// blank lines ignored (the same format CompilerTestsWindow loads). Returns false with `error` set if the file
+/// cannot be read or is malformed.
+bool load_compiler_tests(char const *csv_path, std::vector<compiler_test> &out, std::string &error) noexcept;
+
+/// @brief What passed last time, for skipping tests that cannot have changed: by test name, the hash of what
+/// the test's outcome depends on (see `compiler_test_hash`) when it last passed. Stored as a text file, one
+/// "name<TAB>hash" per line.
+struct compiler_test_results_db
+{
+    std::unordered_map<std::string, u64> passed;
+};
+
+/// A missing file is an empty database. Returns false with `error` set if it exists but cannot be read.
+bool load_compiler_test_results_db(char const *path, compiler_test_results_db &db, std::string &error) noexcept;
+
+/// Writes to a temporary file next to `path` then renames it over, creating the directory if needed.
+bool save_compiler_test_results_db(char const *path, compiler_test_results_db const &db, std::string &error) noexcept;
+
+/// Hash of the test's source file, its expected output file, `compiler_build_id` and the engine that runs it,
+/// 0 if either file cannot be read. Files the source includes are not part of it.
+u64 compiler_test_hash(compiler_test const &test, char const *data_dir,
+                       execution_engine engine = execution_engine::interpreter) noexcept;
+
+/// Whether `test` last passed with the same `hash`.
+bool compiler_test_unchanged(compiler_test_results_db const &db, compiler_test const &test, u64 hash) noexcept;
+
+/// Remembers that `test` passed with `hash`, or forgets it if it did not.
+void compiler_test_results_db_record(compiler_test_results_db &db, compiler_test const &test, u64 hash, bool passed) noexcept;
+
+struct compiler_test_result
+{
+    bool passed;
+    bool skipped;           // unchanged since it last passed, so not run: `passed` with no timings
+    std::string detail;     // why it failed: diagnostics, a runtime error or an output mismatch
+    s64 compile_us;         // loading the source and every phase, cached or not
+    s64 preprocess_us;      // the phases, as `compilation` times them (a cache hit costs its loading)
+    s64 lex_us;
+    s64 parse_us;
+    s64 ir_us;
+    s64 run_us;             // without `compare_us`
+    s64 compare_us;         // comparing the output with the expected output, as it was printed
+};
+
+struct compiler_test_run
+{
+    std::vector<compiler_test_result> results;  // by test
+    execution_engine engine;
+    u64 passed;             // skipped tests included
+    u64 failed;
+    u64 skipped;
+    compile_cache_stats cache;                  // this run only, all zero without a cache
+    u32 threads;
+    s64 elapsed_us;
+};
+
+/// Compiles the test's source from `data_dir` (through the cache in `cache_dir`, or from scratch if it is null),
+/// runs it with `engine` and compares what it prints with the memory-mapped expected output file byte
+/// for byte, as it prints it: a wrong byte stops the program and fails the test with where the outputs differ
+/// and the text around it (see `output_compare_report`). A runtime error before then fails the test too.
+/// Cache hits and misses are added to `cache_stats`. If `cancel` gets cancelled the compilation or the program
+/// stops at its next check and the test fails as "cancelled" (JIT-compiled code runs to the end first).
+compiler_test_result run_compiler_test(compiler_test const &test, char const *data_dir, char const *cache_dir,
+                                       compile_cache_stats &cache_stats, cancel_token const *cancel = nullptr,
+                                       execution_engine engine = execution_engine::interpreter) noexcept;
+
+/// `run_compiler_test` for every test: in order on the calling thread, or concurrently on `pool` if there is one.
+/// Tests share nothing but the cache, which is safe to use concurrently, so results are the same either way.
+/// With a `results_db`, tests `compiler_test_unchanged` in it are skipped, and it is updated with every
+/// outcome.
+compiler_test_run run_compiler_tests(std::vector<compiler_test> const &tests, char const *data_dir, char const *cache_dir,
+                                     thread_pool *pool = nullptr, compiler_test_results_db *results_db = nullptr,
+                                     execution_engine engine = execution_engine::interpreter) noexcept;
+
+/// Writes `run` as JSON to `path`: the totals, then per test its name, whether it passed, why not, and the time
+/// each phase took, creating its directory if needed. Returns false with `error` set if the file cannot be written.
+bool write_compiler_test_results(char const *path, std::vector<compiler_test> const &tests, compiler_test_run const &run,
+                                 std::string &error) noexcept;
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <filesystem>
+
+#include "util.hpp"
+#include "simd.hpp"
+
+#include "text_document.hpp"
+
+namespace fs = std::filesystem;
+
+#if SIMD_WIDTH == 32
+
+/// Bit `i` set where `p[i]` is '\n', for 64 bytes.
+static u64 newline_mask(char const *p) noexcept
+{
+    __m256i newline = _mm256_set1_epi8('\n');
+    u64 lo = u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p)), newline)));
+    u64 hi = u32(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(p + 32)), newline)));
+    return lo | (hi << 32);
+}
+
+#elif SIMD_WIDTH == 16
+
+/// Bit `i` set where `p[i]` is '\n', for 64 bytes.
+static u64 newline_mask(char const *p) noexcept
+{
+    __m128i newline = _mm_set1_epi8('\n');
+    u64 mask = 0;
+    for (u64 i = 0; i < 64; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p + i));
+        mask |= u64(u32(_mm_movemask_epi8(_mm_cmpeq_epi8(v, newline)))) << i;
+    }
+    return mask;
+}
+
+#endif
+
+void index_lines(std::string_view text, std::vector<u32> &line_starts, bool use_simd) noexcept
+{
+    line_starts.assign(1, 0);
+    char const *base = text.data();
+    u64 i = 0, n = text.size();
+
+#if SIMD_WIDTH != 0
+    // A 64 byte window at a time, then one step per newline found: lines are rarely shorter than a few bytes.
+    if (use_simd) {
+        for (; i + 64 <= n; i += 64) {
+            for (u64 mask = newline_mask(base + i); mask != 0; mask &= mask - 1) {
+                line_starts.push_back(u32(i + u64(std::countr_zero(mask)) + 1));
+            }
+        }
+    }
+#else
+    (void)use_simd;
+#endif
+
+    for (; i < n; ++i) {
+        if (base[i] == '\n') {
+            line_starts.push_back(u32(i + 1));
+        }
+    }
+}
+
+std::string_view text_document::line(u32 line) const noexcept
+{
+    u64 begin = line_starts[line];
+    u64 end = line + 1 < line_starts.size() ? line_starts[line + 1] - 1 : file.size; // before the '\n'
+    if (end > begin && file.data[end - 1] == '\r') {
+        --end;
+    }
+    return std::string_view(file.data + begin, end - begin);
+}
+
+u32 text_document_columns(std::string_view line) noexcept
+{
+    u32 columns = 0;
+    for (char c : line) {
+        columns += c == '\t' ? text_document_tab_width - columns % text_document_tab_width : 1;
+    }
+    return columns;
+}
+
+bool text_document_open(text_document &doc, char const *path, std::string &error) noexcept
+{
+    doc.line_starts.clear();
+    doc.longest_line = 0;
+    if (!doc.file.open(path)) {
+        error = make_str("cannot map %s", path);
+        return false;
+    }
+    if (doc.file.size > u64(u32(-1))) {
+        doc.file.close();
+        error = make_str("%s is 4 GiB or larger", path);
+        return false;
+    }
+
+    index_lines(doc.text(), doc.line_starts);
+    for (u32 line = 0; line < doc.line_count(); ++line) {
+        // A tab is at most `text_document_tab_width` columns, so most lines are too short to need counting.
+        std::string_view text = doc.line(line);
+        if (u64(text.size()) * text_document_tab_width > doc.longest_line) {
+            doc.longest_line = std::max(doc.longest_line, text_document_columns(text));
+        }
+    }
+    return true;
+}
+
+// BENCHMARK
+
+/// Lines like a preprocessor writes for a program including system headers: line markers, declarations,
+/// blank lines.
+static std::string generate_benchmark_text(u64 bytes) noexcept
+{
+    static char const *const lines[] = {
+        "# 28 \"/usr/include/stdio.h\" 3 4\n",
+        "extern int fprintf (FILE *__restrict __stream, const char *__restrict __format, ...);\n",
+        "\n",
+        "typedef unsigned long int size_t;\n",
+        "extern void *memcpy (void *__restrict __dest, const void *__restrict __src, size_t __n) __attribute__ ((__nothrow__ , __leaf__)) __attribute__ ((__nonnull__ (1, 2)));\n",
+        "  return __builtin___memcpy_chk (__dest, __src, __len, __builtin_object_size (__dest, 0));\n",
+        "}\n",
+    };
+    std::string text;
+    text.reserve(bytes + 256);
+    for (u64 i = 0; text.size() < bytes; ++i) {
+        text += lines[(i * 7 + i / 3) % std::size(lines)];
+    }
+    return text;
+}
+
+text_document_benchmark_result text_document_benchmark(u64 bytes, u64 iterations) noexcept
+{
+    text_document_benchmark_result result = {};
+    result.iterations = std::max(iterations, u64(1));
+    result.simd_isa = simd_isa_name();
+
+    std::string const text = generate_benchmark_text(bytes);
+    result.bytes = text.size();
+
+    std::error_code ec;
+    fs::path path = fs::temp_directory_path(ec) / make_str("text_document_benchmark-%llx.txt", (unsigned long long)fnv1a_hash(text.substr(0, 64)));
+    FILE *file = fopen(path.string().c_str(), "wb");
+    if (file == nullptr) {
+        return result;
+    }
+    bool written = fwrite(text.data(), 1, text.size(), file) == text.size();
+    written = fclose(file) == 0 && written;
+
+    if (written) {
+        text_document doc;
+        std::string error;
+        bool ok = false;
+        result.open_best_us = best_time_us(result.iterations, [&] { ok = text_document_open(doc, path.string().c_str(), error); });
+        result.lines = ok ? doc.line_count() : 0;
+    }
+    fs::remove(path, ec);
+
+    std::vector<u32> line_starts;
+    auto index_best_us = [&](bool use_simd) { return best_time_us(result.iterations, [&] { index_lines(text, line_starts, use_simd); }); };
+    result.scalar_mb_per_sec = (f64(text.size()) / (1024.0 * 1024.0)) / (f64(index_best_us(false)) / 1'000'000.0);
+    result.simd_mb_per_sec = (f64(text.size()) / (1024.0 * 1024.0)) / (f64(index_best_us(true)) / 1'000'000.0);
+    return result;
+}
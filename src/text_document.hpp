@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "primitives.hpp"
+#include "mapped_file.hpp"
+
+/// Fills `line_starts` with the offset of every line of `text` (at most 4 GiB): 0, then one past every '\n'. A
+/// text ending in '\n' ends with an empty line, as editors show it. Set `use_simd` to false to force the
+/// byte-at-a-time scan (for benchmarking and verification).
+void index_lines(std::string_view text, std::vector<u32> &line_starts, bool use_simd = true) noexcept;
+
+/// Tabs advance to the next multiple of this column.
+static u32 constexpr text_document_tab_width = 4;
+
+/// Columns `line` takes on screen: one per byte, tabs expanded to the next stop.
+u32 text_document_columns(std::string_view line) noexcept;
+
+/// @brief A read-only text memory-mapped from a file, and where its lines start. Nothing is copied: opening
+/// costs a pass over the file to find its newlines, and the index takes 4 bytes a line, so a viewer can show
+/// any part of a file of tens of megabytes right away and keep only what is on screen.
+struct text_document
+{
+    mapped_file file;
+    std::vector<u32> line_starts;
+    u32 longest_line = 0;           // in `text_document_columns`, without its line break
+
+    std::string_view text() const noexcept { return file.view(); }
+    u32 line_count() const noexcept { return u32(line_starts.size()); }
+
+    /// Line `line` (from 0) without its line break, "\n" or "\r\n".
+    std::string_view line(u32 line) const noexcept;
+};
+
+/// Maps `path` into `doc` and indexes its lines. Returns false with `error` set if it cannot be mapped or is
+/// 4 GiB or more.
+bool text_document_open(text_document &doc, char const *path, std::string &error) noexcept;
+
+struct text_document_benchmark_result
+{
+    u64 bytes;
+    u64 lines;
+    u64 iterations;
+    s64 open_best_us;               // map and index, the file system cache warm
+    f64 scalar_mb_per_sec;          // line indexing alone
+    f64 simd_mb_per_sec;
+    char const *simd_isa;
+};
+
+/// Writes about `bytes` of preprocessor-like output to a temporary file, then reports the best-of-`iterations`
+/// time to open it as a `text_document` and the line indexing throughput of the scalar and SIMD scanners.
+text_document_benchmark_result text_document_benchmark(u64 bytes = 50 * 1024 * 1024, u64 iterations = 5) noexcept;
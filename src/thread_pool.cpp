@@ -0,0 +1,125 @@
+#include <algorithm>
+
+#include "util.hpp"
+
+#include "thread_pool.hpp"
+
+thread_pool::thread_pool(u32 thread_count) noexcept
+{
+    if (thread_count == 0) {
+        thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+    }
+    for (u32 i = 0; i < thread_count; ++i) {
+        m_queues.push_back(std::make_unique<queue>());
+    }
+    for (u32 i = 1; i < thread_count; ++i) {
+        m_threads.emplace_back(&thread_pool::worker_main, this, i);
+    }
+}
+
+thread_pool::~thread_pool() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_start.notify_all();
+    for (std::thread &t : m_threads) {
+        t.join();
+    }
+}
+
+void thread_pool::parallel_for(u64 count, std::function<void(u64, u32)> const &task) noexcept
+{
+    if (count == 0) {
+        m_steals = 0;
+        return;
+    }
+
+    u64 workers = m_queues.size();
+    for (u64 w = 0; w < workers; ++w) {
+        std::lock_guard<std::mutex> lock(m_queues[w]->mutex);
+        for (u64 i = count * w / workers; i < count * (w + 1) / workers; ++i) {
+            m_queues[w]->indices.push_back(i);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_task = &task;
+        m_running = u32(workers);
+        m_steals = 0;
+        ++m_generation;
+    }
+    m_start.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this] { return m_running == 0; });
+    m_task = nullptr;
+}
+
+void thread_pool::worker_main(u32 worker) noexcept
+{
+    u64 seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop) {
+                return;
+            }
+            seen = m_generation;
+        }
+        work(worker);
+    }
+}
+
+void thread_pool::work(u32 worker) noexcept
+{
+    std::function<void(u64, u32)> const &task = *m_task;
+    u64 stolen = 0;
+    u64 index = 0;
+    for (;;) {
+        if (take(worker, index)) {
+            task(index, worker);
+            continue;
+        }
+
+        // Own deque is empty: steal from the back of the others', starting after this worker so thieves spread out.
+        bool found = false;
+        for (u64 k = 1; k < m_queues.size() && !found; ++k) {
+            queue &victim = *m_queues[(worker + k) % m_queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.indices.empty()) {
+                index = victim.indices.back();
+                victim.indices.pop_back();
+                found = true;
+            }
+        }
+        if (!found) {
+            break;
+        }
+        ++stolen;
+        task(index, worker);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_steals += stolen;
+    if (--m_running == 0) {
+        m_done.notify_one();
+    }
+}
+
+bool thread_pool::take(u32 worker, u64 &index) noexcept
+{
+    queue &own = *m_queues[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (own.indices.empty()) {
+        return false;
+    }
+    index = own.indices.front();
+    own.indices.pop_front();
+    return true;
+}
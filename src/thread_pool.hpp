@@ -0,0 +1,55 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "primitives.hpp"
+
+/// @brief Fixed set of worker threads running index ranges with work stealing. Each worker owns a deque of
+/// task indices, takes from its front and, once empty, steals from the back of the others', so a few large
+/// tasks do not leave the remaining workers idle. The thread calling `parallel_for` works as worker 0.
+struct thread_pool
+{
+    /// `thread_count` workers including the caller, 0 for one per hardware thread.
+    explicit thread_pool(u32 thread_count = 0) noexcept;
+    thread_pool(thread_pool const &) = delete;
+    thread_pool &operator=(thread_pool const &) = delete;
+    ~thread_pool() noexcept;
+
+    u32 thread_count() const noexcept { return u32(m_queues.size()); }
+
+    /// Calls `task(index, worker)` for every index in [0, count) and returns when all calls have. Tasks are dealt
+    /// out in contiguous runs, so neighbouring indices tend to run on the same worker. Not reentrant.
+    void parallel_for(u64 count, std::function<void(u64 index, u32 worker)> const &task) noexcept;
+
+    /// Tasks taken from another worker's deque during the last `parallel_for`.
+    u64 steals() const noexcept { return m_steals; }
+
+private:
+    struct queue
+    {
+        std::mutex mutex;
+        std::deque<u64> indices;
+    };
+
+    std::vector<std::unique_ptr<queue>> m_queues; // by worker
+    std::vector<std::thread> m_threads;           // workers 1..n-1
+
+    std::mutex m_mutex;
+    std::condition_variable m_start;
+    std::condition_variable m_done;
+    std::function<void(u64, u32)> const *m_task = nullptr;
+    u64 m_generation = 0;   // bumped per `parallel_for`, wakes the workers
+    u32 m_running = 0;      // workers still inside the current `parallel_for`
+    u64 m_steals = 0;
+    bool m_stop = false;
+
+    void worker_main(u32 worker) noexcept;
+    void work(u32 worker) noexcept;
+    bool take(u32 worker, u64 &index) noexcept;
+};
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <cstdarg>
+#include <cstring>
 #include <optional>
 #include <utility>
 
@@ -99,7 +100,7 @@ s64 time_diff_us(time_point_precise_t start, time_point_precise_t end) noexcept
 
 time_point_precise_t get_time_precise() noexcept
 {
-    return std::chrono::high_resolution_clock::now();
+    return std::chrono::steady_clock::now();
 }
 
 time_point_system_t get_time_system() noexcept
@@ -123,6 +124,11 @@ s64 time_diff_us(time_point_system_t start, time_point_system_t end) noexcept
     return diff_us.count();
 }
 
+s64 time_diff_ns(time_point_precise_t start, time_point_precise_t end) noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
 void time_diff_str_impl(std::array<char, 64> &out, s64 ms_diff) noexcept
 {
     s64 const one_second = 1'000;
@@ -509,7 +515,8 @@ bool cstr_last_non_whitespace_is_one_of(char const *str, u64 len, char const *te
 std::string make_str(char const *fmt, ...) noexcept
 {
     s32 const buf_len = 1024;
-    static char s_buffer[buf_len];
+    // Per thread: translation units are compiled concurrently and every phase formats diagnostics.
+    thread_local char s_buffer[buf_len];
 
     va_list args;
     va_start(args, fmt);
@@ -1,8 +1,18 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <initializer_list>
+#include <limits>
 #include <source_location>
+#include <string>
+#include <string_view>
+#include <utility>
 
 #include "primitives.hpp"
 
@@ -22,7 +32,9 @@
 
 // TIME RELATED TYPES AND FUNCTIONS
 
-    typedef std::chrono::high_resolution_clock::time_point time_point_precise_t;
+    // steady_clock rather than high_resolution_clock: libstdc++ aliases the latter to system_clock,
+    // which would make the precise/system overloads below collide.
+    typedef std::chrono::steady_clock::time_point time_point_precise_t;
     typedef std::chrono::system_clock::time_point time_point_system_t;
 
     time_point_precise_t get_time_precise() noexcept;
@@ -32,9 +44,23 @@
     s64 time_diff_ms(time_point_system_t start, time_point_system_t end) noexcept;
     s64 time_diff_us(time_point_precise_t start, time_point_precise_t end) noexcept;
     s64 time_diff_us(time_point_system_t start, time_point_system_t end) noexcept;
+    s64 time_diff_ns(time_point_precise_t start, time_point_precise_t end) noexcept;
     std::array<char, 64> time_diff_str(time_point_precise_t start, time_point_precise_t end) noexcept;
     std::array<char, 64> time_diff_str(time_point_system_t start, time_point_system_t end) noexcept;
 
+    /// Fastest of `iterations` timed calls of `fn` in microseconds, at least 1 so rates can be divided by it.
+    template <typename Fn>
+    s64 best_time_us(u64 iterations, Fn &&fn) noexcept
+    {
+        s64 best = std::numeric_limits<s64>::max();
+        for (u64 i = 0; i < iterations; ++i) {
+            time_point_precise_t start = get_time_precise();
+            fn();
+            best = std::min(best, time_diff_us(start, get_time_precise()));
+        }
+        return std::max(best, s64(1));
+    }
+
 /// MISCELLANEOUS FUNCTIONS AND TYPES
 
     /// Toggle bool state.
@@ -66,6 +92,23 @@
 
     std::string make_str(char const *fmt, ...) noexcept;
 
+    /// @brief Asks work running on another thread to stop early. The owner calls `cancel`, the work polls
+    /// between units of work (phases, functions, loop iterations) and returns as soon as it sees it.
+    struct cancel_token
+    {
+        std::atomic<bool> flag = false;
+
+        void cancel() noexcept { flag.store(true, std::memory_order_relaxed); }
+        void reset() noexcept { flag.store(false, std::memory_order_relaxed); }
+        bool cancelled() const noexcept { return flag.load(std::memory_order_relaxed); }
+    };
+
+    /// For the APIs that take an optional token: false when there is none.
+    inline bool cancelled(cancel_token const *token) noexcept
+    {
+        return token != nullptr && token->cancelled();
+    }
+
 // FILESYSTEM RELATED FUNCTIONS
 
     std::array<char, 32> format_file_size(u64 file_size, u64 unit_multiplier) noexcept;
@@ -159,6 +202,81 @@
         return false;
     }
 
+    /// FNV-1a hash of `s` starting from `seed`. Usable in constant expressions.
+    constexpr u64 fnv1a_hash(std::string_view s, u64 seed = 0xcbf29ce484222325ull) noexcept
+    {
+        u64 h = seed;
+        for (char c : s) {
+            h ^= u8(c);
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    /// @brief Perfect hash table over a fixed set of non-empty strings, built at compile time.
+    /// Construction searches for a seed under which every key lands in its own slot, so `find` is one hash
+    /// and one comparison however many keys there are (where `one_of` compares against each of them).
+    /// `TableSize` must be a power of 2, a sparser table makes a perfect seed quicker to find.
+    /// Construct with `make_static_perfect_hash` and `static_assert(table.seed != 0)` to verify a seed was found.
+    template <typename ValueTy, u64 TableSize>
+    struct static_perfect_hash
+    {
+        static_assert((TableSize & (TableSize - 1)) == 0, "TableSize must be a power of 2");
+
+        std::string_view keys[TableSize] = {};
+        ValueTy values[TableSize] = {};
+        u64 seed = 0; // 0 when no perfect seed was found
+
+        /// Like gperf, only the length and the first, second and last bytes are hashed so a lookup costs the
+        /// same for long identifiers as for short ones. Key sets those cannot tell apart get no seed.
+        static constexpr u64 slot_of(std::string_view key, u64 seed) noexcept
+        {
+            u64 n = key.size();
+            u64 bits = n == 0 ? 0 : (n | (u64(u8(key[0])) << 8) | (u64(u8(key[n > 1])) << 16) | (u64(u8(key[n - 1])) << 24));
+            u64 h = bits * ((seed * 0x9E3779B97F4A7C15ull) | 1);
+            return (h >> 32) & (TableSize - 1);
+        }
+
+        /// Value for `key`, or `not_found` if `key` is not in the set.
+        constexpr ValueTy find(std::string_view key, ValueTy not_found) const noexcept
+        {
+            u64 slot = slot_of(key, seed);
+            return (!key.empty() && keys[slot] == key) ? values[slot] : not_found;
+        }
+    };
+
+    template <u64 TableSize, typename ValueTy, u64 KeyCount>
+    consteval static_perfect_hash<ValueTy, TableSize> make_static_perfect_hash(std::pair<std::string_view, ValueTy> const (&entries)[KeyCount]) noexcept
+    {
+        static_assert(KeyCount <= TableSize);
+
+        static_perfect_hash<ValueTy, TableSize> table;
+
+        for (u64 candidate = 1; candidate <= 100'000; ++candidate) {
+            bool used[TableSize] = {};
+            bool collision = false;
+            for (auto const &[key, value] : entries) {
+                u64 slot = table.slot_of(key, candidate);
+                collision |= used[slot];
+                used[slot] = true;
+            }
+            if (!collision) {
+                table.seed = candidate;
+                break;
+            }
+        }
+
+        if (table.seed != 0) {
+            for (auto const &[key, value] : entries) {
+                u64 slot = table.slot_of(key, table.seed);
+                table.keys[slot] = key;
+                table.values[slot] = value;
+            }
+        }
+
+        return table;
+    }
+
     /// Increments `val`, or wraps it back to `min` if increment would exceed `max`.
     template <typename Ty>
     Ty &inc_or_wrap(Ty &val, Ty const &min, Ty const &max) noexcept
@@ -0,0 +1,1209 @@
+#include <algorithm>
+#include <cstddef>
+#include <bit>
+#include <cstring>
+#include <limits>
+
+#include "util.hpp"
+#include "ir.hpp"
+
+#include "x64.hpp"
+
+// ASSEMBLER
+
+static bool fits_s8(s64 v) noexcept
+{
+    return v >= -128 && v <= 127;
+}
+
+static bool fits_s32(s64 v) noexcept
+{
+    return v >= std::numeric_limits<s32>::min() && v <= std::numeric_limits<s32>::max();
+}
+
+static u32 num(x64_reg r) noexcept
+{
+    return u32(r);
+}
+
+u32 x64_assembler::new_label() noexcept
+{
+    m_label_offsets.push_back(u32(-1));
+    return u32(m_label_offsets.size() - 1);
+}
+
+void x64_assembler::bind(u32 label) noexcept
+{
+    m_label_offsets[label] = u32(code.size());
+}
+
+bool x64_assembler::finish() noexcept
+{
+    for (auto [pos, label] : m_fixups) {
+        u32 target = m_label_offsets[label];
+        if (target == u32(-1)) {
+            return false;
+        }
+        s32 rel = s32(s64(target) - s64(pos + 4));
+        std::memcpy(code.data() + pos, &rel, 4);
+    }
+    m_fixups.clear();
+    return true;
+}
+
+void x64_assembler::emit32(u32 v) noexcept
+{
+    u8 bytes[4];
+    std::memcpy(bytes, &v, 4);
+    code.insert(code.end(), bytes, bytes + 4);
+}
+
+void x64_assembler::rex(bool w, u32 reg, u32 base) noexcept
+{
+    u8 prefix = u8(0x40 | (w << 3) | ((reg >> 3) << 2) | (base >> 3));
+    if (prefix != 0x40) {
+        emit8(prefix);
+    }
+}
+
+// [base + disp] with the shortest displacement. rsp and r12 need a SIB byte, rbp and r13 cannot use mod 00.
+void x64_assembler::modrm_mem(u32 reg, x64_reg base, s32 disp) noexcept
+{
+    u32 b = num(base) & 7;
+    u32 mod = (disp == 0 && b != 5) ? 0 : fits_s8(disp) ? 1 : 2;
+    emit8(u8((mod << 6) | ((reg & 7) << 3) | b));
+    if (b == 4) {
+        emit8(0x24);
+    }
+    if (mod == 1) {
+        emit8(u8(s8(disp)));
+    } else if (mod == 2) {
+        emit32(u32(disp));
+    }
+}
+
+void x64_assembler::modrm_reg(u32 reg, x64_reg rm) noexcept
+{
+    emit8(u8(0xC0 | ((reg & 7) << 3) | (num(rm) & 7)));
+}
+
+void x64_assembler::rel32_to(u32 label) noexcept
+{
+    m_fixups.push_back({ u32(code.size()), label });
+    emit32(0);
+}
+
+void x64_assembler::mov(x64_reg dst, x64_reg src) noexcept
+{
+    rex(true, num(src), num(dst));
+    emit8(0x89);
+    modrm_reg(num(src), dst);
+}
+
+void x64_assembler::mov(x64_reg dst, x64_reg base, s32 disp) noexcept
+{
+    rex(true, num(dst), num(base));
+    emit8(0x8B);
+    modrm_mem(num(dst), base, disp);
+}
+
+void x64_assembler::mov(x64_reg base, s32 disp, x64_reg src) noexcept
+{
+    rex(true, num(src), num(base));
+    emit8(0x89);
+    modrm_mem(num(src), base, disp);
+}
+
+void x64_assembler::mov32(x64_reg base, s32 disp, x64_reg src) noexcept
+{
+    rex(false, num(src), num(base));
+    emit8(0x89);
+    modrm_mem(num(src), base, disp);
+}
+
+void x64_assembler::mov_imm(x64_reg base, s32 disp, s32 imm) noexcept
+{
+    rex(true, 0, num(base));
+    emit8(0xC7);
+    modrm_mem(0, base, disp);
+    emit32(u32(imm));
+}
+
+void x64_assembler::mov_imm(x64_reg dst, s64 imm) noexcept
+{
+    if (imm >= 0 && imm <= s64(std::numeric_limits<u32>::max())) {
+        // Writing the 32-bit register zero-extends.
+        rex(false, 0, num(dst));
+        emit8(u8(0xB8 + (num(dst) & 7)));
+        emit32(u32(imm));
+    } else if (fits_s32(imm)) {
+        rex(true, 0, num(dst));
+        emit8(0xC7);
+        modrm_reg(0, dst);
+        emit32(u32(imm));
+    } else {
+        mov_imm64(dst, imm);
+    }
+}
+
+u32 x64_assembler::mov_imm64(x64_reg dst, s64 imm) noexcept
+{
+    rex(true, 0, num(dst));
+    emit8(u8(0xB8 + (num(dst) & 7)));
+    u32 offset = u32(code.size());
+    emit32(u32(u64(imm)));
+    emit32(u32(u64(imm) >> 32));
+    return offset;
+}
+
+void x64_assembler::lea(x64_reg dst, x64_reg base, s32 disp) noexcept
+{
+    rex(true, num(dst), num(base));
+    emit8(0x8D);
+    modrm_mem(num(dst), base, disp);
+}
+
+void x64_assembler::movsx(x64_reg dst, x64_reg base, s32 disp, u32 bits) noexcept
+{
+    rex(true, num(dst), num(base));
+    if (bits == 32) {
+        emit8(0x63);
+    } else {
+        emit8(0x0F);
+        emit8(bits == 8 ? 0xBE : 0xBF);
+    }
+    modrm_mem(num(dst), base, disp);
+}
+
+void x64_assembler::movsx(x64_reg dst, x64_reg src, u32 bits) noexcept
+{
+    // REX.W is always present, so byte register 4..7 are spl..dil rather than ah..bh.
+    rex(true, num(dst), num(src));
+    if (bits == 32) {
+        emit8(0x63);
+    } else {
+        emit8(0x0F);
+        emit8(bits == 8 ? 0xBE : 0xBF);
+    }
+    modrm_reg(num(dst), src);
+}
+
+void x64_assembler::movsxd(x64_reg dst, x64_reg src) noexcept
+{
+    rex(true, num(dst), num(src));
+    emit8(0x63);
+    modrm_reg(num(dst), src);
+}
+
+u32 x64_assembler::lea_rip(x64_reg dst) noexcept
+{
+    rex(true, num(dst), 0);
+    emit8(0x8D);
+    emit8(u8(((num(dst) & 7) << 3) | 5));
+    u32 offset = u32(code.size());
+    emit32(0);
+    return offset;
+}
+
+void x64_assembler::alu(u8 opcode, x64_reg dst, x64_reg base, s32 disp) noexcept
+{
+    rex(true, num(dst), num(base));
+    emit8(opcode);
+    modrm_mem(num(dst), base, disp);
+}
+
+void x64_assembler::alu(u8 opcode, x64_reg dst, x64_reg src) noexcept
+{
+    rex(true, num(dst), num(src));
+    emit8(opcode);
+    modrm_reg(num(dst), src);
+}
+
+void x64_assembler::alu_imm(u8 digit, x64_reg r, s32 imm) noexcept
+{
+    rex(true, 0, num(r));
+    if (fits_s8(imm)) {
+        emit8(0x83);
+        modrm_reg(digit, r);
+        emit8(u8(s8(imm)));
+    } else {
+        emit8(0x81);
+        modrm_reg(digit, r);
+        emit32(u32(imm));
+    }
+}
+
+void x64_assembler::cmp_imm(x64_reg base, s32 disp, s32 imm) noexcept
+{
+    rex(true, 0, num(base));
+    if (fits_s8(imm)) {
+        emit8(0x83);
+        modrm_mem(7, base, disp);
+        emit8(u8(s8(imm)));
+    } else {
+        emit8(0x81);
+        modrm_mem(7, base, disp);
+        emit32(u32(imm));
+    }
+}
+
+void x64_assembler::cmp_byte_imm(x64_reg base, s32 disp, u8 imm) noexcept
+{
+    rex(false, 0, num(base));
+    emit8(0x80);
+    modrm_mem(7, base, disp);
+    emit8(imm);
+}
+
+void x64_assembler::test(x64_reg x, x64_reg y) noexcept
+{
+    rex(true, num(y), num(x));
+    emit8(0x85);
+    modrm_reg(num(y), x);
+}
+
+void x64_assembler::imul(x64_reg dst, x64_reg base, s32 disp) noexcept
+{
+    rex(true, num(dst), num(base));
+    emit8(0x0F);
+    emit8(0xAF);
+    modrm_mem(num(dst), base, disp);
+}
+
+void x64_assembler::imul(x64_reg dst, x64_reg src) noexcept
+{
+    rex(true, num(dst), num(src));
+    emit8(0x0F);
+    emit8(0xAF);
+    modrm_reg(num(dst), src);
+}
+
+void x64_assembler::cqo() noexcept
+{
+    emit8(0x48);
+    emit8(0x99);
+}
+
+void x64_assembler::idiv(x64_reg divisor) noexcept
+{
+    rex(true, 0, num(divisor));
+    emit8(0xF7);
+    modrm_reg(7, divisor);
+}
+
+void x64_assembler::neg(x64_reg r) noexcept
+{
+    rex(true, 0, num(r));
+    emit8(0xF7);
+    modrm_reg(3, r);
+}
+
+void x64_assembler::not_(x64_reg r) noexcept
+{
+    rex(true, 0, num(r));
+    emit8(0xF7);
+    modrm_reg(2, r);
+}
+
+void x64_assembler::shl_cl(x64_reg r) noexcept
+{
+    rex(true, 0, num(r));
+    emit8(0xD3);
+    modrm_reg(4, r);
+}
+
+void x64_assembler::sar_cl(x64_reg r) noexcept
+{
+    rex(true, 0, num(r));
+    emit8(0xD3);
+    modrm_reg(7, r);
+}
+
+void x64_assembler::shl_imm(x64_reg r, u8 count) noexcept
+{
+    rex(true, 0, num(r));
+    emit8(0xC1);
+    modrm_reg(4, r);
+    emit8(count);
+}
+
+void x64_assembler::sar_imm(x64_reg r, u8 count) noexcept
+{
+    rex(true, 0, num(r));
+    emit8(0xC1);
+    modrm_reg(7, r);
+    emit8(count);
+}
+
+void x64_assembler::setcc_movzx(x64_cond cond, x64_reg r) noexcept
+{
+    // Without a REX prefix, byte registers 4..7 would be ah, ch, dh and bh.
+    u32 n = num(r);
+    if (n >= 4) {
+        emit8(u8(0x40 | (n >> 3)));
+    }
+    emit8(0x0F);
+    emit8(u8(0x90 + u8(cond)));
+    modrm_reg(0, r);
+
+    if (n >= 4) {
+        emit8(u8(0x40 | ((n >> 3) << 2) | (n >> 3)));
+    }
+    emit8(0x0F);
+    emit8(0xB6);
+    modrm_reg(n, r);
+}
+
+void x64_assembler::push(x64_reg r) noexcept
+{
+    rex(false, 0, num(r));
+    emit8(u8(0x50 + (num(r) & 7)));
+}
+
+void x64_assembler::push(x64_reg base, s32 disp) noexcept
+{
+    rex(false, 0, num(base));
+    emit8(0xFF);
+    modrm_mem(6, base, disp);
+}
+
+void x64_assembler::pop(x64_reg r) noexcept
+{
+    rex(false, 0, num(r));
+    emit8(u8(0x58 + (num(r) & 7)));
+}
+
+void x64_assembler::jmp(u32 label) noexcept
+{
+    emit8(0xE9);
+    rel32_to(label);
+}
+
+void x64_assembler::jcc(x64_cond cond, u32 label) noexcept
+{
+    emit8(0x0F);
+    emit8(u8(0x80 + u8(cond)));
+    rel32_to(label);
+}
+
+void x64_assembler::call(u32 label) noexcept
+{
+    emit8(0xE8);
+    rel32_to(label);
+}
+
+void x64_assembler::call(x64_reg target) noexcept
+{
+    rex(false, 0, num(target));
+    emit8(0xFF);
+    modrm_reg(2, target);
+}
+
+u32 x64_assembler::call_rel32() noexcept
+{
+    emit8(0xE8);
+    u32 offset = u32(code.size());
+    emit32(0);
+    return offset;
+}
+
+void x64_assembler::ret() noexcept
+{
+    emit8(0xC3);
+}
+
+// CODE GENERATION
+
+char const *x64_trap_message(x64_trap trap) noexcept
+{
+    switch (trap) {
+        case x64_trap::none:                return "";
+        case x64_trap::division_by_zero:    return "division by zero";
+        case x64_trap::division_overflow:   return "division overflow";
+        case x64_trap::stack_overflow:      return "stack overflow";
+        case x64_trap::cancelled:           return "cancelled";
+        case x64_trap::builtin:             return "builtin failed";
+    }
+    return "";
+}
+
+char const *x64_extern_name(x64_extern ext) noexcept
+{
+    static char const *const names[] = {
+        "putchar",
+        "printf",
+        "write",
+        "exit",
+    };
+    static_assert(lengthof(names) == u64(x64_extern::count));
+    return u64(ext) < lengthof(names) ? names[u64(ext)] : "";
+}
+
+using enum x64_reg;
+
+static x64_reg constexpr s_argument_registers[] = { rdi, rsi, rdx, rcx, r8, r9 };
+
+static s32 constexpr ctx_globals = s32(offsetof(x64_context, globals));
+static s32 constexpr ctx_stack_words = s32(offsetof(x64_context, stack_words));
+static s32 constexpr ctx_stack_top = s32(offsetof(x64_context, stack_top));
+static s32 constexpr ctx_saved_rsp = s32(offsetof(x64_context, saved_rsp));
+static s32 constexpr ctx_trap = s32(offsetof(x64_context, trap));
+static s32 constexpr ctx_trapped = s32(offsetof(x64_context, trapped));
+static s32 constexpr ctx_cancel = s32(offsetof(x64_context, cancel));
+static_assert(sizeof(cancel_token::flag) == 1 && offsetof(cancel_token, flag) == 0, "polled as the byte at the token's address");
+
+// Opcodes of the "reg op= r/m" forms.
+static u8 constexpr op_add = 0x03;
+static u8 constexpr op_or = 0x0B;
+static u8 constexpr op_and = 0x23;
+static u8 constexpr op_sub = 0x2B;
+static u8 constexpr op_xor = 0x33;
+static u8 constexpr op_cmp = 0x3B;
+static u8 constexpr op_imul = 0xAF; // 0x0F 0xAF, same operand order
+
+// IR registers live in the allocatable registers or in spill slots. rax, rcx and rdx stay free as scratch
+// (idiv and variable shifts need them), rdi carries argument pointers, r13-r15 hold the frame-word count,
+// globals and the context.
+// Every function saves the allocatable registers it uses, but a builtin call clobbers whatever the System V ABI
+// lets C clobber, and so does a call to an IR function that calls a builtin: values live across either kind of
+// call are saved around it unless they are in rbx, rbp or r12.
+static x64_reg constexpr s_allocatable[] = { rbx, rbp, r12, rsi, r8, r9, r10, r11 };
+static u32 constexpr s_call_preserved = 0b111; // rbx, rbp, r12
+
+/// Stack frame of one function, in words from rsp.
+struct x64_frame
+{
+    regalloc_result allocation;
+    u32 outgoing_words;     // argument blocks for calls whose arguments are not already adjacent in memory
+    u32 spill_base;
+    u32 slot_base;          // the IR function's own slots
+    u32 builtin_save_base;  // registers a call would clobber
+    u32 callee_save_base;   // allocatable registers this function uses
+    s32 bytes;              // rsp adjustment, keeps rsp 16-byte aligned inside the body for calls into C
+};
+
+struct x64_location
+{
+    bool in_register;
+    x64_reg reg;
+    s32 disp;               // from rsp, when not in a register
+};
+
+struct x64_codegen
+{
+    x64_codegen(ir_module const &module, x64_module_code &out, x64_options const &options) noexcept
+        : m_module(module), m_out(out), m_options(options), m_object(options.target == x64_target::object)
+    {}
+
+    bool run(std::string &error) noexcept
+    {
+        for (u32 i = 0; i < m_module.functions.size(); ++i) {
+            m_function_labels.push_back(m_as.new_label());
+        }
+        for (u32 i = 0; i < trap_count; ++i) {
+            m_trap_labels[i] = m_as.new_label();
+        }
+
+        // Frames first: object code needs the largest bytes-per-word ratio before emitting any prologue.
+        std::vector<x64_frame> frames(m_module.functions.size());
+        m_out.stack_bytes_per_word = 0;
+        for (u32 i = 0; i < m_module.functions.size(); ++i) {
+            if (!plan_frame(m_module.functions[i], frames[i], error)) {
+                return false;
+            }
+            u32 words = std::max(m_module.functions[i].register_count + m_module.functions[i].slot_count, u32(1));
+            m_out.stack_bytes_per_word = std::max(m_out.stack_bytes_per_word, (u32(frames[i].bytes) + 8 + words - 1) / words);
+        }
+        m_stack_words = u32(std::min(m_options.stack_bytes / std::max(m_out.stack_bytes_per_word, u32(1)),
+                                     u64(std::numeric_limits<s32>::max())));
+
+        if (m_object) {
+            for (std::string const &str : m_module.strings) {
+                m_string_offsets.push_back(u32(m_out.rodata.size()));
+                m_out.rodata.insert(m_out.rodata.end(), str.begin(), str.end());
+                m_out.rodata.push_back(0);
+            }
+            emit_object_traps();
+        } else {
+            emit_entry();
+        }
+        for (u32 i = 0; i < m_module.functions.size(); ++i) {
+            if (cancelled(m_options.cancel)) {
+                error = "cancelled";
+                return false;
+            }
+            u32 start = u32(m_as.code.size());
+            if (!emit_function(m_module.functions[i], frames[i], m_function_labels[i], error)) {
+                return false;
+            }
+            m_out.function_sizes.push_back(u32(m_as.code.size()) - start);
+            m_out.regalloc.push_back(std::move(frames[i].allocation.stats));
+        }
+        if (m_object) {
+            for (u32 i = 0; i < m_module.functions.size(); ++i) {
+                u32 start = u32(m_as.code.size());
+                bool callable = emit_entry_point(m_module.functions[i], m_function_labels[i]);
+                m_out.entry_points.push_back(callable ? start : u32(-1));
+                m_out.entry_sizes.push_back(u32(m_as.code.size()) - start);
+            }
+        }
+        if (!m_as.finish()) {
+            error = "unbound label";
+            return false;
+        }
+
+        m_out.code = std::move(m_as.code);
+        for (u32 label : m_function_labels) {
+            m_out.function_offsets.push_back(m_as.label_offset(label));
+        }
+        return true;
+    }
+
+private:
+    ir_module const &m_module;
+    x64_module_code &m_out;
+    x64_options const &m_options;
+    bool m_object;
+    u32 m_stack_words = 0;  // object code's frame-word limit
+    x64_assembler m_as;
+    std::vector<u32> m_string_offsets; // into `rodata`, object code only
+    std::vector<u32> m_function_labels;
+    static u32 constexpr trap_count = u32(x64_trap::builtin) + 1;
+    u32 m_trap_labels[trap_count] = {}; // by `x64_trap`, [none] is the common unwinding path
+
+    // The function being emitted.
+    x64_frame const *m_frame = nullptr;
+    regalloc_stats *m_stats = nullptr;
+    u32 m_frame_words = 0;  // what the interpreter would push for it
+
+    u32 trap(x64_trap t) const noexcept { return m_trap_labels[u32(t)]; }
+
+    // Loops and recursion are the only ways to run long, so a cancellable run checks on calls and backward jumps.
+    void poll_cancel() noexcept
+    {
+        if (m_options.poll_cancel && !m_object) {
+            m_as.mov(rax, r15, ctx_cancel);
+            m_as.cmp_byte_imm(rax, 0, 0);
+            m_as.jcc(x64_cond::ne, trap(x64_trap::cancelled));
+        }
+    }
+
+    bool plan_frame(ir_function const &fn, x64_frame &frame, std::string &error) noexcept
+    {
+        if (m_options.allocate_registers) {
+            regalloc_options options = { u32(lengthof(s_allocatable)), s_call_preserved };
+            if (!regalloc_linear_scan(fn, options, frame.allocation)) {
+                error = fn.name + ": superinstructions cannot be compiled, they are interpreter-only";
+                return false;
+            }
+        } else {
+            regalloc_stack_slots(fn, frame.allocation);
+        }
+
+        // With every register in its own slot, argument blocks are already in place.
+        u32 outgoing = 0;
+        bool has_builtin_call = false;
+        for (ir_inst const &in : fn.code) {
+            if (in.op == ir_op::call || in.op == ir_op::call_builtin) {
+                outgoing = std::max(outgoing, u32(in.c));
+            }
+            has_builtin_call |= in.op == ir_op::call || in.op == ir_op::call_builtin;
+        }
+        u32 used = frame.allocation.used_mask;
+        frame.outgoing_words = m_options.allocate_registers ? outgoing : 0;
+        frame.spill_base = frame.outgoing_words;
+        frame.slot_base = frame.spill_base + frame.allocation.spill_slot_count;
+        frame.builtin_save_base = frame.slot_base + fn.slot_count;
+        frame.callee_save_base = frame.builtin_save_base + (has_builtin_call ? u32(std::popcount(used & ~s_call_preserved)) : 0);
+        u32 words = frame.callee_save_base + u32(std::popcount(used));
+        frame.bytes = s32(8 * words);
+        if (frame.bytes % 16 == 0) {
+            frame.bytes += 8;
+        }
+        return true;
+    }
+
+    // OPERANDS
+
+    x64_location where(u32 r) const noexcept
+    {
+        u16 p = m_frame->allocation.physical[r];
+        if (p == regalloc_spilled) {
+            return { false, rax, s32(8 * (m_frame->spill_base + m_frame->allocation.spill_slot[r])) };
+        }
+        // Never live, so never read: writes go to a scratch register.
+        return { true, p == regalloc_unused ? rax : s_allocatable[p], 0 };
+    }
+
+    s32 slot(u32 s) const noexcept { return s32(8 * (m_frame->slot_base + s)); }
+
+    void move_into(x64_reg dst, x64_location const &src) noexcept
+    {
+        if (src.in_register) {
+            if (src.reg != dst) {
+                m_as.mov(dst, src.reg);
+            }
+        } else {
+            m_as.mov(dst, rsp, src.disp);
+            ++m_stats->reloads;
+        }
+    }
+
+    /// The register holding `r`, reloaded into `scratch` if spilled.
+    x64_reg read(u32 r, x64_reg scratch) noexcept
+    {
+        x64_location loc = where(r);
+        move_into(scratch, loc);
+        return loc.in_register ? loc.reg : scratch;
+    }
+
+    /// Where to compute a value for `r`: its register, or `scratch` to be stored afterwards by `write`.
+    x64_reg target(u32 r, x64_reg scratch) const noexcept
+    {
+        x64_location loc = where(r);
+        return loc.in_register ? loc.reg : scratch;
+    }
+
+    void write(u32 r, x64_reg value) noexcept
+    {
+        x64_location loc = where(r);
+        if (loc.in_register) {
+            if (loc.reg != value) {
+                m_as.mov(loc.reg, value);
+            }
+        } else {
+            m_as.mov(rsp, loc.disp, value);
+            ++m_stats->spill_stores;
+        }
+    }
+
+    /// dst op= src for the "reg op= r/m" opcodes, imul (0x0F 0xAF) included.
+    void alu_with(u8 opcode, x64_reg dst, x64_location const &src) noexcept
+    {
+        bool is_imul = opcode == 0xAF;
+        if (src.in_register) {
+            if (is_imul) {
+                m_as.imul(dst, src.reg);
+            } else {
+                m_as.alu(opcode, dst, src.reg);
+            }
+        } else {
+            if (is_imul) {
+                m_as.imul(dst, rsp, src.disp);
+            } else {
+                m_as.alu(opcode, dst, rsp, src.disp);
+            }
+            ++m_stats->reloads;
+        }
+    }
+
+    // INSTRUCTIONS
+
+    void reloc(u32 offset, x64_reloc::kind what, u32 index) noexcept
+    {
+        m_out.relocs.push_back({ offset, what, index });
+    }
+
+    // u64 entry(x64_context *ctx (rdi), s64 const *args (rsi), s64 *result (rdx), void const *function (rcx))
+    void emit_entry() noexcept
+    {
+        m_out.entry_offset = u32(m_as.code.size());
+        m_as.push(rbx);
+        m_as.push(rbp);
+        m_as.push(r12);
+        m_as.push(r13);
+        m_as.push(r14);
+        m_as.push(r15);
+        m_as.mov(r15, rdi);
+        m_as.mov(r14, r15, ctx_globals);
+        m_as.mov(r15, ctx_saved_rsp, rsp);
+        m_as.mov(rbx, rdx);
+        m_as.mov_imm(r13, 0);
+        m_as.mov(rsp, r15, ctx_stack_top);
+        m_as.mov(rdi, rsi);
+        m_as.call(rcx);
+        m_as.mov(rbx, 0, rax);
+        m_as.mov_imm(rax, 1);
+
+        u32 unwind = m_as.new_label();
+        m_as.bind(unwind);
+        m_as.mov(rsp, r15, ctx_saved_rsp);
+        m_as.pop(r15);
+        m_as.pop(r14);
+        m_as.pop(r13);
+        m_as.pop(r12);
+        m_as.pop(rbp);
+        m_as.pop(rbx);
+        m_as.ret();
+
+        // Traps land here from any depth, the saved rsp discards every JIT frame at once.
+        m_as.bind(m_trap_labels[0]);
+        m_as.mov32(r15, ctx_trap, rdi);
+        m_as.mov_imm(rax, 0);
+        m_as.jmp(unwind);
+        for (u32 t = 1; t < trap_count; ++t) {
+            m_as.bind(m_trap_labels[t]);
+            m_as.mov_imm(rdi, s64(t));
+            m_as.jmp(m_trap_labels[0]);
+        }
+    }
+
+    // Object code has no caller to unwind to: report on stderr and exit, which flushes what was printed.
+    void emit_object_traps() noexcept
+    {
+        for (u32 t = 1; t < trap_count; ++t) {
+            std::string message = std::string("runtime error: ") + x64_trap_message(x64_trap(t)) + '\n';
+            u32 message_offset = u32(m_out.rodata.size());
+            m_out.rodata.insert(m_out.rodata.end(), message.begin(), message.end());
+
+            m_as.bind(m_trap_labels[t]);
+            m_as.alu_imm(4, rsp, -16);
+            m_as.mov_imm(rdi, 2);
+            reloc(m_as.lea_rip(rsi), x64_reloc::kind::rodata, message_offset);
+            m_as.mov_imm(rdx, s64(message.size()));
+            reloc(m_as.call_rel32(), x64_reloc::kind::call_extern, u32(x64_extern::write_));
+            m_as.mov_imm(rdi, 70); // EX_SOFTWARE
+            reloc(m_as.call_rel32(), x64_reloc::kind::call_extern, u32(x64_extern::exit_));
+        }
+    }
+
+    // System V wrapper: spills the argument registers into the array the IR function expects and sets up the
+    // registers JIT code would get from the trampoline. Returns false for functions with stack-passed parameters.
+    bool emit_entry_point(ir_function const &fn, u32 body) noexcept
+    {
+        if (fn.param_count > lengthof(s_argument_registers)) {
+            return false;
+        }
+        // Entered with rsp = 8 (mod 16), two pushes keep that, so the array takes 8 (mod 16) bytes.
+        s32 array_bytes = s32(8 * fn.param_count);
+        if (array_bytes % 16 == 0) {
+            array_bytes += 8;
+        }
+        m_as.push(r13);
+        m_as.push(r14);
+        m_as.alu_imm(5, rsp, array_bytes);
+        for (u32 i = 0; i < fn.param_count; ++i) {
+            m_as.mov(rsp, s32(8 * i), s_argument_registers[i]);
+        }
+        m_as.mov_imm(r13, 0);
+        reloc(m_as.lea_rip(r14), x64_reloc::kind::data, 0);
+        m_as.mov(rdi, rsp);
+        m_as.call(body);
+        m_as.alu_imm(0, rsp, array_bytes);
+        m_as.pop(r14);
+        m_as.pop(r13);
+        m_as.ret();
+        return true;
+    }
+
+    void binary(ir_inst const &in, u8 opcode, bool commutative) noexcept
+    {
+        x64_location lb = where(in.b);
+        x64_location lc = where(in.c);
+        x64_reg dst = target(in.a, rax);
+        // Loading b into dst would overwrite c.
+        if (lc.in_register && lc.reg == dst && !(lb.in_register && lb.reg == dst)) {
+            if (commutative) {
+                std::swap(lb, lc);
+            } else {
+                dst = rax;
+            }
+        }
+        move_into(dst, lb);
+        alu_with(opcode, dst, lc);
+        write(in.a, dst);
+    }
+
+    void compare(ir_inst const &in, x64_cond cond) noexcept
+    {
+        x64_reg lhs = read(in.b, rax);
+        alu_with(op_cmp, lhs, where(in.c));
+        x64_reg dst = target(in.a, rax);
+        m_as.setcc_movzx(cond, dst);
+        write(in.a, dst);
+    }
+
+    void divide(ir_inst const &in) noexcept
+    {
+        u32 ok = m_as.new_label();
+        move_into(rcx, where(in.c));
+        m_as.test(rcx, rcx);
+        m_as.jcc(x64_cond::e, trap(x64_trap::division_by_zero));
+        move_into(rax, where(in.b));
+        m_as.alu_imm(7, rcx, -1);
+        m_as.jcc(x64_cond::ne, ok);
+        m_as.mov_imm(rdx, std::numeric_limits<s64>::min());
+        m_as.alu(op_cmp, rax, rdx);
+        m_as.jcc(x64_cond::e, trap(x64_trap::division_overflow));
+        m_as.bind(ok);
+        m_as.cqo();
+        m_as.idiv(rcx);
+        write(in.a, in.op == ir_op::div ? rax : rdx);
+    }
+
+    /// Offset from rsp of a block holding the `in.c` arguments starting at `in.b`, copying them to the outgoing
+    /// area unless they already sit next to each other in memory.
+    s32 argument_block(ir_inst const &in) noexcept
+    {
+        if (in.c == 0) {
+            return 0;
+        }
+        x64_location first = where(in.b);
+        bool adjacent = !first.in_register;
+        for (u32 i = 1; adjacent && i < in.c; ++i) {
+            x64_location loc = where(in.b + i);
+            adjacent = !loc.in_register && loc.disp == first.disp + s32(8 * i);
+        }
+        if (adjacent) {
+            return first.disp;
+        }
+        for (u32 i = 0; i < in.c; ++i) {
+            m_as.mov(rsp, s32(8 * i), read(in.b + i, rax));
+        }
+        return 0;
+    }
+
+    /// Registers C may clobber that hold values needed after instruction `index`, with their save offsets.
+    std::vector<std::pair<x64_reg, s32>> builtin_saves(ir_function const &fn, u32 index) const noexcept
+    {
+        std::vector<std::pair<x64_reg, s32>> saves;
+        regalloc_result const &allocation = m_frame->allocation;
+        u32 clobbered = allocation.used_mask & ~s_call_preserved;
+        u32 live = 0;
+        for (u32 r = 0; r < fn.register_count; ++r) {
+            u16 p = allocation.physical[r];
+            if (p < 32 && ((clobbered >> p) & 1) && allocation.live_across(r, index)) {
+                live |= u32(1) << p;
+            }
+        }
+        u32 k = 0;
+        for (u32 p = 0; p < lengthof(s_allocatable); ++p) {
+            if ((clobbered >> p) & 1) {
+                if ((live >> p) & 1) {
+                    saves.push_back({ s_allocatable[p], s32(8 * (m_frame->builtin_save_base + k)) });
+                }
+                ++k;
+            }
+        }
+        return saves;
+    }
+
+    // A direct call to the C library function, which is what the builtin emulates.
+    void object_builtin_call(ir_inst const &in, s32 args) noexcept
+    {
+        u32 register_args = std::min(u32(in.c), u32(lengthof(s_argument_registers)));
+        u32 stack_args = u32(in.c) - register_args;
+        s32 pushed = 0;
+        if (stack_args % 2 != 0) {
+            m_as.alu_imm(5, rsp, 8);
+            pushed += 8;
+        }
+        for (u32 i = in.c; i-- > register_args;) {
+            m_as.push(rsp, args + s32(8 * i) + pushed);
+            pushed += 8;
+        }
+        for (u32 i = 0; i < register_args; ++i) {
+            m_as.mov(s_argument_registers[i], rsp, args + s32(8 * i) + pushed);
+        }
+        m_as.mov_imm(rax, 0); // no vector registers used by the variadic call
+        x64_extern ext = ir_builtin(in.imm) == ir_builtin::putchar_ ? x64_extern::putchar_ : x64_extern::printf_;
+        reloc(m_as.call_rel32(), x64_reloc::kind::call_extern, u32(ext));
+        if (pushed != 0) {
+            m_as.alu_imm(0, rsp, pushed);
+        }
+        m_as.movsxd(rax, rax); // both return int
+    }
+
+    void callee_saves(bool restore) noexcept
+    {
+        u32 k = 0;
+        for (u32 p = 0; p < lengthof(s_allocatable); ++p) {
+            if ((m_frame->allocation.used_mask >> p) & 1) {
+                s32 disp = s32(8 * (m_frame->callee_save_base + k++));
+                if (restore) {
+                    m_as.mov(s_allocatable[p], rsp, disp);
+                } else {
+                    m_as.mov(rsp, disp, s_allocatable[p]);
+                }
+            }
+        }
+    }
+
+    bool emit_function(ir_function const &fn, x64_frame const &frame, u32 label, std::string &error) noexcept
+    {
+        m_frame = &frame;
+        m_stats = &const_cast<x64_frame &>(frame).allocation.stats;
+        m_frame_words = fn.register_count + fn.slot_count;
+
+        std::vector<u32> targets(fn.code.size());
+        for (u32 &t : targets) {
+            t = m_as.new_label();
+        }
+
+        // Frames count against the word limit exactly as the interpreter's stack, however large they really are.
+        m_as.bind(label);
+        m_as.alu_imm(0, r13, s32(m_frame_words));
+        if (m_object) {
+            m_as.alu_imm(7, r13, s32(m_stack_words));
+        } else {
+            m_as.alu(op_cmp, r13, r15, ctx_stack_words);
+        }
+        m_as.jcc(x64_cond::a, trap(x64_trap::stack_overflow));
+        poll_cancel();
+        m_as.alu_imm(5, rsp, frame.bytes);
+        callee_saves(false);
+        m_as.mov(rax, rdi);
+        for (u32 i = 0; i < fn.param_count; ++i) {
+            // A parameter overwritten before it is read may share its register with one still being loaded.
+            if (frame.allocation.intervals[i].start != 0) {
+                continue;
+            }
+            x64_location loc = where(i);
+            if (loc.in_register) {
+                m_as.mov(loc.reg, rax, s32(8 * i));
+            } else {
+                m_as.mov(rcx, rax, s32(8 * i));
+                m_as.mov(rsp, loc.disp, rcx);
+                ++m_stats->spill_stores;
+            }
+        }
+
+        for (u32 i = 0; i < fn.code.size(); ++i) {
+            ir_inst const &in = fn.code[i];
+            m_as.bind(targets[i]);
+
+            switch (in.op) {
+                case ir_op::nop:
+                    break;
+
+                // DATA MOVEMENT
+
+                case ir_op::mov_imm: {
+                    x64_location loc = where(in.a);
+                    if (loc.in_register) {
+                        m_as.mov_imm(loc.reg, s64(in.imm));
+                    } else {
+                        m_as.mov_imm(rsp, loc.disp, in.imm);
+                        ++m_stats->spill_stores;
+                    }
+                    break;
+                }
+                case ir_op::mov_wide: {
+                    x64_reg dst = target(in.a, rax);
+                    m_as.mov_imm(dst, m_module.constants[in.imm]);
+                    write(in.a, dst);
+                    break;
+                }
+                case ir_op::mov: {
+                    x64_location la = where(in.a);
+                    if (la.in_register) {
+                        move_into(la.reg, where(in.b));
+                    } else {
+                        write(in.a, read(in.b, rax));
+                    }
+                    break;
+                }
+                case ir_op::load_local: {
+                    x64_reg dst = target(in.a, rax);
+                    m_as.mov(dst, rsp, slot(in.imm));
+                    write(in.a, dst);
+                    break;
+                }
+                case ir_op::store_local:
+                    m_as.mov(rsp, slot(in.imm), read(in.a, rax));
+                    break;
+                case ir_op::load_global: {
+                    x64_reg dst = target(in.a, rax);
+                    m_as.mov(dst, r14, s32(8 * in.imm));
+                    write(in.a, dst);
+                    break;
+                }
+                case ir_op::store_global:
+                    m_as.mov(r14, s32(8 * in.imm), read(in.a, rax));
+                    break;
+                case ir_op::load_string: {
+                    x64_reg dst = target(in.a, rax);
+                    if (m_object) {
+                        reloc(m_as.lea_rip(dst), x64_reloc::kind::rodata, m_string_offsets[in.imm]);
+                    } else {
+                        reloc(m_as.mov_imm64(dst, 0), x64_reloc::kind::string, u32(in.imm));
+                    }
+                    write(in.a, dst);
+                    break;
+                }
+
+                // ARITHMETIC
+
+                case ir_op::add:        binary(in, op_add, true); break;
+                case ir_op::sub:        binary(in, op_sub, false); break;
+                case ir_op::mul:        binary(in, op_imul, true); break;
+                case ir_op::bit_and:    binary(in, op_and, true); break;
+                case ir_op::bit_or:     binary(in, op_or, true); break;
+                case ir_op::bit_xor:    binary(in, op_xor, true); break;
+                case ir_op::div:
+                case ir_op::mod:
+                    divide(in);
+                    break;
+                case ir_op::shl:
+                case ir_op::shr: {
+                    // The hardware masks 64-bit shift counts to 0..63, as the IR defines.
+                    move_into(rcx, where(in.c));
+                    x64_reg dst = target(in.a, rax);
+                    move_into(dst, where(in.b));
+                    if (in.op == ir_op::shl) {
+                        m_as.shl_cl(dst);
+                    } else {
+                        m_as.sar_cl(dst);
+                    }
+                    write(in.a, dst);
+                    break;
+                }
+                case ir_op::add_imm:
+                case ir_op::neg:
+                case ir_op::bit_not: {
+                    x64_reg dst = target(in.a, rax);
+                    move_into(dst, where(in.b));
+                    if (in.op == ir_op::add_imm) {
+                        m_as.alu_imm(0, dst, in.imm);
+                    } else if (in.op == ir_op::neg) {
+                        m_as.neg(dst);
+                    } else {
+                        m_as.not_(dst);
+                    }
+                    write(in.a, dst);
+                    break;
+                }
+                case ir_op::log_not: {
+                    x64_reg value = read(in.b, rax);
+                    m_as.test(value, value);
+                    x64_reg dst = target(in.a, rax);
+                    m_as.setcc_movzx(x64_cond::e, dst);
+                    write(in.a, dst);
+                    break;
+                }
+                case ir_op::sext: {
+                    x64_reg dst = target(in.a, rax);
+                    x64_location lb = where(in.b);
+                    if (in.imm == 8 || in.imm == 16 || in.imm == 32) {
+                        if (lb.in_register) {
+                            m_as.movsx(dst, lb.reg, u32(in.imm));
+                        } else {
+                            m_as.movsx(dst, rsp, lb.disp, u32(in.imm));
+                            ++m_stats->reloads;
+                        }
+                    } else {
+                        move_into(dst, lb);
+                        m_as.shl_imm(dst, u8(64 - in.imm));
+                        m_as.sar_imm(dst, u8(64 - in.imm));
+                    }
+                    write(in.a, dst);
+                    break;
+                }
+
+                // COMPARISONS
+
+                case ir_op::eq: compare(in, x64_cond::e); break;
+                case ir_op::ne: compare(in, x64_cond::ne); break;
+                case ir_op::lt: compare(in, x64_cond::l); break;
+                case ir_op::le: compare(in, x64_cond::le); break;
+                case ir_op::gt: compare(in, x64_cond::g); break;
+                case ir_op::ge: compare(in, x64_cond::ge); break;
+
+                // CONTROL FLOW
+
+                case ir_op::jump:
+                    if (in.imm <= s64(i)) {
+                        poll_cancel();
+                    }
+                    m_as.jmp(targets[in.imm]);
+                    break;
+                case ir_op::jump_if:
+                case ir_op::jump_if_not: {
+                    if (in.imm <= s64(i)) {
+                        poll_cancel();
+                    }
+                    x64_location la = where(in.a);
+                    if (la.in_register) {
+                        m_as.test(la.reg, la.reg);
+                    } else {
+                        m_as.cmp_imm(rsp, la.disp, 0);
+                        ++m_stats->reloads;
+                    }
+                    m_as.jcc(in.op == ir_op::jump_if ? x64_cond::ne : x64_cond::e, targets[in.imm]);
+                    break;
+                }
+                case ir_op::call: {
+                    s32 args = argument_block(in);
+                    auto saves = builtin_saves(fn, i);
+                    for (auto [reg, disp] : saves) {
+                        m_as.mov(rsp, disp, reg);
+                    }
+                    m_as.lea(rdi, rsp, args);
+                    m_as.call(m_function_labels[in.imm]);
+                    for (auto [reg, disp] : saves) {
+                        m_as.mov(reg, rsp, disp);
+                    }
+                    write(in.a, rax);
+                    break;
+                }
+                case ir_op::call_builtin: {
+                    s32 args = argument_block(in);
+                    auto saves = builtin_saves(fn, i);
+                    for (auto [reg, disp] : saves) {
+                        m_as.mov(rsp, disp, reg);
+                    }
+                    if (m_object) {
+                        object_builtin_call(in, args);
+                    } else {
+                        m_as.mov(rdi, r15);
+                        m_as.mov_imm(rsi, s64(in.imm));
+                        m_as.lea(rdx, rsp, args);
+                        m_as.mov_imm(rcx, s64(in.c));
+                        reloc(m_as.mov_imm64(rax, 0), x64_reloc::kind::builtin_helper, 0);
+                        m_as.call(rax);
+                        m_as.cmp_byte_imm(r15, ctx_trapped, 0);
+                        m_as.jcc(x64_cond::ne, trap(x64_trap::builtin));
+                    }
+                    for (auto [reg, disp] : saves) {
+                        m_as.mov(reg, rsp, disp);
+                    }
+                    write(in.a, rax);
+                    break;
+                }
+                case ir_op::ret: {
+                    x64_reg value = read(in.a, rax);
+                    if (value != rax) {
+                        m_as.mov(rax, value);
+                    }
+                    callee_saves(true);
+                    m_as.alu_imm(0, rsp, frame.bytes);
+                    m_as.alu_imm(5, r13, s32(m_frame_words));
+                    m_as.ret();
+                    break;
+                }
+
+                default:
+                    error = fn.name + ": " + ir_op_name(in.op) + " cannot be compiled, superinstructions are interpreter-only";
+                    return false;
+            }
+        }
+
+        // Execution must not fall off the end into the next function.
+        if (fn.code.empty() || (fn.code.back().op != ir_op::ret && fn.code.back().op != ir_op::jump)) {
+            error = fn.name + ": does not end in ret or jump";
+            return false;
+        }
+        return true;
+    }
+};
+
+bool x64_compile(ir_module const &module, x64_module_code &out, std::string &error, x64_options const &options) noexcept
+{
+    out = {};
+    x64_codegen codegen(module, out, options);
+    if (!codegen.run(error)) {
+        out = {};
+        return false;
+    }
+    return true;
+}
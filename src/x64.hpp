@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "primitives.hpp"
+#include "regalloc.hpp"
+
+struct ir_module;
+struct ir_runtime;
+struct cancel_token;
+
+enum class x64_reg : u8
+{
+    rax, rcx, rdx, rbx, rsp, rbp, rsi, rdi,
+    r8, r9, r10, r11, r12, r13, r14, r15,
+};
+
+/// Condition codes, the low nibble of Jcc/SETcc opcodes.
+enum class x64_cond : u8
+{
+    o, no, b, ae, e, ne, be, a, s, ns, p, np, l, ge, le, g,
+};
+
+/// @brief Appends x86-64 machine code to `code`. Only the forms the code generator needs are provided,
+/// memory operands are always [base + disp]. Branch targets are labels, resolved by `finish`.
+struct x64_assembler
+{
+    std::vector<u8> code;
+
+    u32 new_label() noexcept;
+    void bind(u32 label) noexcept;
+    u32 label_offset(u32 label) const noexcept { return m_label_offsets[label]; }
+
+    /// Patches every branch to its label. Returns false if some label was never bound.
+    bool finish() noexcept;
+
+    void mov(x64_reg dst, x64_reg src) noexcept;
+    void mov(x64_reg dst, x64_reg base, s32 disp) noexcept;         // dst = [base + disp]
+    void mov(x64_reg base, s32 disp, x64_reg src) noexcept;         // [base + disp] = src
+    void mov32(x64_reg base, s32 disp, x64_reg src) noexcept;       // [base + disp] = src (low 32 bits)
+    void mov_imm(x64_reg base, s32 disp, s32 imm) noexcept;         // [base + disp] = sign-extended imm
+    void mov_imm(x64_reg dst, s64 imm) noexcept;                    // shortest encoding
+    u32 mov_imm64(x64_reg dst, s64 imm) noexcept;                   // always 10 bytes, returns the immediate's offset
+    void lea(x64_reg dst, x64_reg base, s32 disp) noexcept;
+    void movsx(x64_reg dst, x64_reg base, s32 disp, u32 bits) noexcept; // bits 8, 16 or 32
+    void movsx(x64_reg dst, x64_reg src, u32 bits) noexcept;        // from the low `bits` of src
+    void movsxd(x64_reg dst, x64_reg src) noexcept;
+    u32 lea_rip(x64_reg dst) noexcept;                              // dst = [rip + disp32], returns the disp's offset
+
+    /// dst op= [base + disp], for add/or/and/sub/xor/cmp (opcode bytes 03 0B 23 2B 33 3B).
+    void alu(u8 opcode, x64_reg dst, x64_reg base, s32 disp) noexcept;
+    /// dst op= src, register form of `alu`.
+    void alu(u8 opcode, x64_reg dst, x64_reg src) noexcept;
+    /// r op= imm, `digit` selects add(0) or(1) and(4) sub(5) xor(6) cmp(7).
+    void alu_imm(u8 digit, x64_reg r, s32 imm) noexcept;
+    void cmp_imm(x64_reg base, s32 disp, s32 imm) noexcept;        // cmp qword [base + disp], imm
+    void cmp_byte_imm(x64_reg base, s32 disp, u8 imm) noexcept;    // cmp byte [base + disp], imm
+    void test(x64_reg x, x64_reg y) noexcept;
+    void imul(x64_reg dst, x64_reg base, s32 disp) noexcept;
+    void imul(x64_reg dst, x64_reg src) noexcept;
+    void cqo() noexcept;
+    void idiv(x64_reg divisor) noexcept;
+    void neg(x64_reg r) noexcept;
+    void not_(x64_reg r) noexcept;
+    void shl_cl(x64_reg r) noexcept;
+    void sar_cl(x64_reg r) noexcept;
+    void shl_imm(x64_reg r, u8 count) noexcept;
+    void sar_imm(x64_reg r, u8 count) noexcept;
+    void setcc_movzx(x64_cond cond, x64_reg r) noexcept;        // r = cond ? 1 : 0
+
+    void push(x64_reg r) noexcept;
+    void push(x64_reg base, s32 disp) noexcept;                     // push qword [base + disp]
+    void pop(x64_reg r) noexcept;
+    void jmp(u32 label) noexcept;
+    void jcc(x64_cond cond, u32 label) noexcept;
+    void call(u32 label) noexcept;
+    void call(x64_reg target) noexcept;
+    u32 call_rel32() noexcept;                                      // to an address outside `code`, returns the rel32's offset
+    void ret() noexcept;
+
+private:
+    std::vector<u32> m_label_offsets;
+    std::vector<std::pair<u32, u32>> m_fixups; // rel32 position, label
+
+    void emit8(u8 b) noexcept { code.push_back(b); }
+    void emit32(u32 v) noexcept;
+    void rex(bool w, u32 reg, u32 base) noexcept;
+    void modrm_mem(u32 reg, x64_reg base, s32 disp) noexcept;
+    void modrm_reg(u32 reg, x64_reg rm) noexcept;
+    void rel32_to(u32 label) noexcept;
+};
+
+/// Why JIT code stopped early, the message is `x64_trap_message`.
+enum class x64_trap : u32
+{
+    none,
+    division_by_zero,
+    division_overflow,
+    stack_overflow,
+    cancelled,          // `x64_context::cancel` was cancelled, see `x64_options::poll_cancel`
+    builtin,            // the builtin put its own message in `ir_runtime::error`
+};
+
+char const *x64_trap_message(x64_trap trap) noexcept;
+
+/// @brief State generated code reaches through r15 while it runs. Globals are addressed through r14 and
+/// r13 counts the words (registers + slots) of active frames, exactly what the interpreter's stack holds,
+/// so both engines overflow at the same call depth.
+struct x64_context
+{
+    ir_runtime *rt;
+    s64 *globals;
+    u64 stack_words;        // function prologues trap with `stack_overflow` when r13 would exceed this
+    u8 *stack_top;          // the entry trampoline switches to this 16-byte aligned stack
+    u64 saved_rsp;          // the caller's, to unwind to on a trap
+    cancel_token const *cancel; // never null, polled as `x64_options::poll_cancel` asks
+    x64_trap trap;
+    u8 trapped;             // set by the builtin helper when the builtin failed
+};
+
+enum class x64_target : u8
+{
+    jit,        // runs in this process: context in r15, absolute addresses patched after mapping
+    object,     // linked into a native executable: System V entry points, libc for builtins, RIP-relative data
+};
+
+/// C library functions object code calls.
+enum class x64_extern : u8
+{
+    putchar_,
+    printf_,
+    write_,     // trap messages, to stderr
+    exit_,      // after a trap, flushing what the program printed
+
+    count
+};
+
+char const *x64_extern_name(x64_extern ext) noexcept;
+
+struct x64_options
+{
+    x64_target target = x64_target::jit;
+    /// Linear scan register allocation, or every IR register in a stack slot of its own.
+    bool allocate_registers = true;
+    /// Object code counts frame words against a constant derived from this instead of
+    /// `x64_context::stack_words`, so the deepest allowed recursion stays inside a default 8 MiB thread stack.
+    u64 stack_bytes = 6 << 20;
+    /// Polled before each function, a cancelled compilation fails with "cancelled".
+    cancel_token const *cancel = nullptr;
+    /// x64_target::jit: function prologues and backward jumps check `x64_context::cancel`, as the interpreter
+    /// does on calls and backward branches, and trap with `cancelled`. Costs a load and a branch per iteration.
+    bool poll_cancel = false;
+};
+
+/// Addresses the generated code needs but cannot know.
+struct x64_reloc
+{
+    enum class kind : u8
+    {
+        // x64_target::jit, a 64-bit absolute `mov_imm64` immediate
+        string,             // address of module.strings[index]
+        builtin_helper,     // s64 helper(x64_context *, u32 builtin, s64 const *args, u32 argc)
+
+        // x64_target::object, a 32-bit displacement relative to the end of its 4 bytes
+        rodata,             // `x64_module_code::rodata` + index
+        data,               // the module's globals (8 bytes each, in order) + index
+        call_extern,        // the `x64_extern` numbered index
+    };
+
+    u32 offset;
+    kind what;
+    u32 index;
+};
+
+/// @brief Machine code for a whole module, position independent except for `relocs`.
+struct x64_module_code
+{
+    std::vector<u8> code;
+    std::vector<u32> function_offsets;
+    std::vector<u32> function_sizes;
+    std::vector<x64_reloc> relocs;
+
+    /// x64_target::jit: u64 entry(x64_context *ctx, s64 const *args, s64 *result, void const *function) switches
+    /// to the context's stack, calls `function` with `args` and returns 1, or 0 if the code trapped (`ctx->trap`).
+    u32 entry_offset = 0;
+
+    /// x64_target::object: System V callable wrapper of each function, `u32(-1)` for functions with more than
+    /// 6 parameters (only reachable from other IR functions). String literals then trap messages in `rodata`.
+    std::vector<u32> entry_points;
+    std::vector<u32> entry_sizes;
+    std::vector<u8> rodata;
+
+    /// Upper bound on machine stack bytes per interpreter frame word over all functions, return address included.
+    u32 stack_bytes_per_word = 0;
+    std::vector<regalloc_stats> regalloc; // by function
+};
+
+/// Translates every function of `module` (unfused IR) to x86-64. Functions take a pointer to their
+/// arguments in rdi and return in rax; IR registers live in machine registers or stack slots as
+/// `options.allocate_registers` decides. Returns false with `error` set if the module cannot be compiled.
+bool x64_compile(ir_module const &module, x64_module_code &out, std::string &error, x64_options const &options = {}) noexcept;
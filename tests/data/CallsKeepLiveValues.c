@@ -0,0 +1,29 @@
+long g = 88;
+
+long show(long x)
+{
+    printf("%ld ", g + x);
+    return g + x;
+}
+
+int main()
+{
+    long a = 1;
+    long b = 2;
+    long c = 3;
+    long d = 4;
+    long e = 5;
+    long f = 6;
+    long i = 0;
+    while (i < 3) {
+        a = a + show(b);
+        b = b + show(c);
+        c = c + show(d);
+        d = d + show(e);
+        e = e + show(f);
+        f = f + show(a);
+        i = i + 1;
+    }
+    printf("\n%ld %ld %ld %ld %ld %ld\n", a, b, c, d, e, f);
+    return 0;
+}
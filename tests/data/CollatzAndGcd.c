@@ -0,0 +1,46 @@
+long collatz_steps(long n)
+{
+    long steps = 0;
+    while (n != 1) {
+        if (n % 2 == 0)
+            n = n / 2;
+        else
+            n = 3 * n + 1;
+        steps++;
+    }
+    return steps;
+}
+
+long gcd(long a, long b)
+{
+    while (b != 0) {
+        long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+long gcd_recursive(long a, long b)
+{
+    return b == 0 ? a : gcd_recursive(b, a % b);
+}
+
+int main()
+{
+    long best = 0;
+    long best_n = 0;
+    for (long n = 1; n < 1000; n++) {
+        long s = collatz_steps(n);
+        if (s > best) {
+            best = s;
+            best_n = n;
+        }
+    }
+    printf("longest collatz below 1000: %ld (%ld steps)\n", best_n, best);
+    printf("gcd %ld %ld %ld\n", gcd(1071, 462), gcd(17, 5), gcd_recursive(1071, 462));
+    long a = 12;
+    long b = 18;
+    printf("lcm %ld\n", a / gcd(a, b) * b);
+    return 0;
+}
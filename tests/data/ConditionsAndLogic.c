@@ -0,0 +1,48 @@
+int evaluations = 0;
+
+int touch(int v)
+{
+    evaluations++;
+    return v;
+}
+
+int sign(int n)
+{
+    if (n < 0)
+        return -1;
+    else if (n == 0)
+        return 0;
+    else
+        return 1;
+}
+
+int main()
+{
+    for (int n = -2; n <= 2; n++) {
+        printf("sign(%d) = %d\n", n, sign(n));
+    }
+
+    int r = touch(0) && touch(1);
+    printf("0 && 1 = %d after %d evaluations\n", r, evaluations);
+    r = touch(1) || touch(0);
+    printf("1 || 0 = %d after %d evaluations\n", r, evaluations);
+    r = touch(1) && touch(2) && touch(0) && touch(3);
+    printf("chain = %d after %d evaluations\n", r, evaluations);
+
+    for (int n = 1; n <= 15; n++) {
+        if (n % 15 == 0)
+            printf("FizzBuzz\n");
+        else if (n % 5 == 0)
+            printf("Buzz\n");
+        else if (n % 3 == 0)
+            printf("Fizz\n");
+        else
+            printf("%d\n", n);
+    }
+
+    int a = 5, b = 9;
+    int lo = a < b ? a : b;
+    int hi = a > b ? a : b;
+    printf("min %d max %d nested %d\n", lo, hi, a > 3 ? (b > 10 ? 1 : 2) : 3);
+    return 0;
+}
@@ -0,0 +1,38 @@
+int square(int x)
+{
+    return x * x;
+}
+
+int always_seven()
+{
+    int a = 3;
+    int b = 4;
+    if (a + b != 7)
+        return 0;
+    return a + b;
+}
+
+int main()
+{
+    int folded = (2 + 3) * (10 - 4) / 3 - (1 << 4);
+    int dead = 0;
+    if (0) {
+        dead = 99;
+        printf("never printed\n");
+    }
+    while (0) {
+        dead = 98;
+    }
+    int unused = square(12);
+    int same = 6;
+    int sum = same + same + same;
+    printf("folded %d dead %d seven %d sum %d\n", folded, dead, always_seven(), sum);
+
+    int acc = 0;
+    for (int i = 0; i < 10; i++) {
+        int k = 2 * 3;
+        acc = acc + k * i + square(i);
+    }
+    printf("acc %d\n", acc);
+    return 0;
+}
@@ -0,0 +1,38 @@
+int counter;
+long accumulated = 100;
+static int calls = 0;
+
+void bump(int by)
+{
+    counter = counter + by;
+    calls++;
+}
+
+long add_to(long x)
+{
+    accumulated += x;
+    calls++;
+    return accumulated;
+}
+
+int max3(int a, int b, int c)
+{
+    int m = a;
+    if (b > m) m = b;
+    if (c > m) m = c;
+    return m;
+}
+
+int main()
+{
+    for (int i = 1; i <= 10; i++) {
+        bump(i);
+    }
+    printf("counter %d\n", counter);
+    long first = add_to(5);
+    long second = add_to(-50);
+    printf("add_to %ld %ld\n", first, second);
+    printf("max3 %d %d %d\n", max3(1, 2, 3), max3(9, -2, 4), max3(-5, -7, -6));
+    printf("calls %d\n", calls);
+    return 0;
+}
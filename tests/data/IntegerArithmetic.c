@@ -0,0 +1,43 @@
+int main()
+{
+    int a = 17;
+    int b = -5;
+    printf("%d %d %d %d %d\n", a + b, a - b, a * b, a / b, a % b);
+    printf("%d %d\n", -a / 5, -a % 5);
+    printf("%d %d %d\n", a & 12, a | 12, a ^ 12);
+    printf("%d %d %d\n", 1 << 10, 1024 >> 3, -64 >> 2);
+    printf("%d %d %d %d %d %d\n", a < b, a <= 17, a > b, a >= 18, a == 17, a != 17);
+    printf("%d %d\n", ~a, !a);
+
+    int x = 10;
+    x += 5;
+    x -= 3;
+    x *= 4;
+    x /= 6;
+    x %= 5;
+    x <<= 3;
+    x >>= 1;
+    x |= 1;
+    x &= 13;
+    x ^= 6;
+    printf("compound %d\n", x);
+
+    int i = 5;
+    int pre = ++i;
+    int post = i++;
+    printf("%d %d %d\n", pre, post, i);
+    --i;
+    i--;
+    printf("%d\n", i);
+
+    long l = 1;
+    for (int k = 0; k < 40; k++) {
+        l = l * 2;
+    }
+    printf("2^40 = %ld\n", l);
+
+    char c = 100;
+    short s = 30000;
+    printf("%d %d %d\n", c + c, s + s, (c * 3) % 7);
+    return 0;
+}
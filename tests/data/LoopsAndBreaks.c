@@ -0,0 +1,52 @@
+int is_prime(int n)
+{
+    if (n < 2)
+        return 0;
+    for (int d = 2; d * d <= n; ++d) {
+        if (n % d == 0)
+            return 0;
+    }
+    return 1;
+}
+
+int main()
+{
+    int count = 0;
+    int sum = 0;
+    for (int n = 0; n < 100; n++) {
+        if (!is_prime(n))
+            continue;
+        count++;
+        sum += n;
+        printf("%d ", n);
+    }
+    printf("\n%d primes, sum %d\n", count, sum);
+
+    int i = 0;
+    while (1) {
+        i += 7;
+        if (i > 60)
+            break;
+    }
+    printf("while stopped at %d\n", i);
+
+    int j = 10;
+    do {
+        printf("%d ", j);
+        j -= 3;
+    } while (j > 0);
+    printf("\n");
+
+    int total = 0;
+    for (int a = 1; a <= 5; a++) {
+        for (int b = 1; b <= 5; b++) {
+            if (b > a)
+                break;
+            if ((a + b) % 2)
+                continue;
+            total += a * b;
+        }
+    }
+    printf("nested total %d\n", total);
+    return 0;
+}
@@ -0,0 +1,30 @@
+#define N 5
+#define SQUARE(x) ((x) * (x))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define STR(x) #x
+#define CAT(a, b) a##b
+
+#if N > 3 && defined(SQUARE)
+#define BIG 1
+#else
+#define BIG 0
+#endif
+
+/* A comment
+   spanning
+   lines. */
+int CAT(val, ue) = 7;
+
+int main()
+{
+    printf("%d %d %d\n", SQUARE(N + 1), MAX(3, N), BIG);
+    printf("%s\n", STR(a + b));
+    printf("value %d\n", value);
+#if 0 ? 1 / 0 : 1
+    printf("line %d\n", __LINE__);
+#endif
+#ifdef UNDEFINED
+    printf("not here\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,16 @@
+int main()
+{
+    int i = 42;
+    long big = 1234567890123;
+    char c = 'Z';
+
+    printf("hello, world\n");
+    printf("%d %i %ld\n", i, -i, big);
+    printf("[%5d] [%-5d] [%05d] [%+d]\n", i, i, i, i);
+    printf("%x %X %o %#x\n", 255, 255, 8, 255);
+    printf("%c%c%c\n", c, 'a', 48 + 7);
+    printf("%s and %s\n", "strings", "more strings");
+    printf("100%%\n");
+    printf("%ld\n", -big * 3);
+    return 0;
+}
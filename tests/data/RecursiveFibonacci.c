@@ -0,0 +1,25 @@
+long fib(long n)
+{
+    if (n < 2)
+        return n;
+    return fib(n - 1) + fib(n - 2);
+}
+
+long ackermann(long m, long n)
+{
+    if (m == 0)
+        return n + 1;
+    if (n == 0)
+        return ackermann(m - 1, 1);
+    return ackermann(m - 1, ackermann(m, n - 1));
+}
+
+int main()
+{
+    for (long i = 0; i <= 20; i = i + 1) {
+        printf("fib(%ld) = %ld\n", i, fib(i));
+    }
+    printf("ackermann(2, 3) = %ld\n", ackermann(2, 3));
+    printf("ackermann(3, 3) = %ld\n", ackermann(3, 3));
+    return 0;
+}
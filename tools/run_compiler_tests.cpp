@@ -0,0 +1,138 @@
+// Headless test runner: runs a tests CSV (the format CompilerTestsWindow loads) on every core, without Qt.
+//
+//   run_compiler_tests [--threads N] [--data DIR] [--cache DIR] [--results FILE] [--engine interpreter|jit]
+//                      [--skip-unchanged] [--results-db FILE] [--differential] TESTS_CSV
+//
+// The data directory defaults to "data" next to the CSV, the results file to .cache/compiler_test_results.json
+// next to the CSV, and the cache is off unless given. With --skip-unchanged, tests whose source,
+// expected output and compiler build are the same as when they last passed are not run; what passed is kept
+// in the results database, .cache/test_results.db next to the CSV by default. Exits with 0 if every test
+// passed, 1 if any failed and 2 if the tests could not be run. Programs run on the interpreter unless --engine
+// says otherwise; the JIT also runs the register-allocating x86-64 backend the object files are written with.
+//
+// --differential runs no tests: it times every test program built by our compiler against gcc and clang at
+// -O0 and -O2 instead (see `differential_benchmark`) and prints the table.
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "util.hpp"
+#include "thread_pool.hpp"
+#include "test_suite.hpp"
+#include "differential.hpp"
+
+namespace fs = std::filesystem;
+
+static int usage() noexcept
+{
+    fprintf(stderr, "usage: run_compiler_tests [--threads N] [--data DIR] [--cache DIR] [--results FILE] [--engine interpreter|jit]\n"
+                    "                          [--skip-unchanged] [--results-db FILE] [--differential] TESTS_CSV\n");
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    u32 threads = 0;
+    std::string data_dir;
+    std::string cache_dir;
+    std::string results_path;
+    execution_engine engine = execution_engine::interpreter;
+    bool skip_unchanged = false;
+    bool differential = false;
+    std::string results_db_path;
+    std::string csv_path;
+
+    for (int i = 1; i < argc; ++i) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--threads") == 0 && has_value) {
+            threads = u32(strtoul(argv[++i], nullptr, 10));
+        } else if (strcmp(argv[i], "--data") == 0 && has_value) {
+            data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--cache") == 0 && has_value) {
+            cache_dir = argv[++i];
+        } else if (strcmp(argv[i], "--results") == 0 && has_value) {
+            results_path = argv[++i];
+        } else if (strcmp(argv[i], "--engine") == 0 && has_value) {
+            ++i;
+            if (strcmp(argv[i], execution_engine_name(execution_engine::interpreter)) == 0) {
+                engine = execution_engine::interpreter;
+            } else if (strcmp(argv[i], execution_engine_name(execution_engine::jit)) == 0) {
+                engine = execution_engine::jit;
+            } else {
+                return usage();
+            }
+        } else if (strcmp(argv[i], "--skip-unchanged") == 0) {
+            skip_unchanged = true;
+        } else if (strcmp(argv[i], "--differential") == 0) {
+            differential = true;
+        } else if (strcmp(argv[i], "--results-db") == 0 && has_value) {
+            results_db_path = argv[++i];
+        } else if (argv[i][0] != '-' && csv_path.empty()) {
+            csv_path = argv[i];
+        } else {
+            return usage();
+        }
+    }
+    if (csv_path.empty()) {
+        return usage();
+    }
+    if (data_dir.empty()) {
+        data_dir = (fs::path(csv_path).parent_path() / "data").string();
+    }
+    if (results_path.empty()) {
+        results_path = (fs::path(csv_path).parent_path() / ".cache" / "compiler_test_results.json").string();
+    }
+    if (results_db_path.empty()) {
+        results_db_path = (fs::path(csv_path).parent_path() / ".cache" / "test_results.db").string();
+    }
+
+    std::vector<compiler_test> tests;
+    std::string error;
+    if (!load_compiler_tests(csv_path.c_str(), tests, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+
+    if (differential) {
+        differential_benchmark_result result = differential_benchmark(tests, data_dir.c_str());
+        fputs(differential_benchmark_to_string(result).c_str(), stdout);
+        return result.configs.empty() ? 2 : 0;
+    }
+
+    compiler_test_results_db results_db;
+    if (skip_unchanged && !load_compiler_test_results_db(results_db_path.c_str(), results_db, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+
+    thread_pool pool(threads);
+    compiler_test_run run = run_compiler_tests(tests, data_dir.c_str(), cache_dir.empty() ? nullptr : cache_dir.c_str(), &pool,
+                                               skip_unchanged ? &results_db : nullptr, engine);
+
+    // The run is still valid without it, the next one just skips less.
+    if (skip_unchanged && !save_compiler_test_results_db(results_db_path.c_str(), results_db, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+    }
+
+    for (u64 i = 0; i < tests.size(); ++i) {
+        if (!run.results[i].passed) {
+            printf("FAIL %s: %s\n", tests[i].name.c_str(), run.results[i].detail.c_str());
+        }
+    }
+    printf("%llu passed (%llu unchanged, skipped), %llu failed in %lld us on %u threads, %s\n", (unsigned long long)run.passed,
+           (unsigned long long)run.skipped, (unsigned long long)run.failed, (long long)run.elapsed_us, run.threads,
+           execution_engine_name(run.engine));
+    if (!cache_dir.empty()) {
+        printf("cache: %s\n", compile_cache_stats_to_string(run.cache).c_str());
+    }
+
+    if (!write_compiler_test_results(results_path.c_str(), tests, run, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 2;
+    }
+    return run.failed == 0 ? 0 : 1;
+}